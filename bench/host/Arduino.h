@@ -0,0 +1,34 @@
+/**
+ * @file Arduino.h
+ * @brief The little of the Arduino core that the sample log uses, for host builds.
+ *
+ * Lets the benches build Journal.cpp, SampleLog.cpp and SampleCodec.cpp on a
+ * host with `-Ibench/host`, see FS.h. Critical sections are no-ops: the
+ * benches using them run the log from one thread.
+ */
+
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef int BaseType_t;
+#define tskNO_AFFINITY 0x7FFFFFFF
+
+typedef int portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED 0
+#define portENTER_CRITICAL(mux) (void)(mux)
+#define portEXIT_CRITICAL(mux) (void)(mux)
+
+class Print
+{
+public:
+  virtual ~Print() {}
+  virtual size_t write(const uint8_t *buffer, size_t size) = 0;
+};
+
+#endif /* HOST_ARDUINO_H */
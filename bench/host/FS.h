@@ -0,0 +1,133 @@
+/**
+ * @file FS.h
+ * @brief fs::FS and fs::File over a host directory, for host builds.
+ *
+ * Paths are taken relative to `FS::root`, which is then also the mount point
+ * to give Journal and SampleLog so their truncate() calls reach the same
+ * files. A write can be made to fail, see File::failWriteAfter(), to check
+ * what a torn write to the card leaves behind, and the bytes read are counted
+ * to see how much of a file a reader walks.
+ */
+
+#ifndef HOST_FS_H
+#define HOST_FS_H
+
+#include "Arduino.h"
+
+#include <memory>
+#include <string>
+#include <sys/stat.h>
+
+#define FILE_READ "r"
+#define FILE_WRITE "w"
+#define FILE_APPEND "a"
+
+enum SeekMode
+{
+  SeekSet,
+  SeekCur,
+  SeekEnd
+};
+
+namespace fs
+{
+
+class File
+{
+public:
+  File() {}
+  explicit File(FILE *file)
+  {
+    if (file)
+    {
+      _file = std::shared_ptr<FILE>(file, fclose);
+    }
+  }
+
+  /**
+   * @brief Make a later write fail after writing half its bytes.
+   *
+   * @param writes Writes that still succeed before it, -1 for none to fail.
+   */
+  static void failWriteAfter(long writes) { writesLeft() = writes; }
+
+  operator bool() const { return (bool)_file; }
+
+  size_t write(const uint8_t *buffer, size_t size)
+  {
+    long &left = writesLeft();
+    if (left >= 0 && left-- == 0)
+    {
+      size /= 2;
+      fwrite(buffer, 1, size, _file.get());
+      fflush(_file.get());
+      return size;
+    }
+    return fwrite(buffer, 1, size, _file.get());
+  }
+
+  /** @brief Bytes read through any File so far. */
+  static size_t &bytesRead()
+  {
+    static size_t bytes = 0;
+    return bytes;
+  }
+
+  size_t read(uint8_t *buffer, size_t size)
+  {
+    size_t read = fread(buffer, 1, size, _file.get());
+    bytesRead() += read;
+    return read;
+  }
+
+  bool seek(uint32_t pos, SeekMode mode = SeekSet)
+  {
+    return fseek(_file.get(), pos, mode == SeekSet ? SEEK_SET : mode == SeekCur ? SEEK_CUR : SEEK_END) == 0;
+  }
+
+  size_t size() const
+  {
+    long pos = ftell(_file.get());
+    fseek(_file.get(), 0, SEEK_END);
+    long end = ftell(_file.get());
+    fseek(_file.get(), pos, SEEK_SET);
+    return end;
+  }
+
+  void flush() { fflush(_file.get()); }
+  void close() { _file.reset(); }
+
+private:
+  std::shared_ptr<FILE> _file;
+
+  static long &writesLeft()
+  {
+    static long left = -1;
+    return left;
+  }
+};
+
+class FS
+{
+public:
+  std::string root;
+
+  File open(const char *path, const char *mode = FILE_READ)
+  {
+    return File(fopen((root + path).c_str(), (std::string(mode) + "b").c_str()));
+  }
+  bool exists(const char *path)
+  {
+    struct stat st;
+    return stat((root + path).c_str(), &st) == 0;
+  }
+  bool mkdir(const char *path) { return ::mkdir((root + path).c_str(), 0777) == 0; }
+  bool remove(const char *path) { return ::remove((root + path).c_str()) == 0; }
+  bool rename(const char *from, const char *to) { return ::rename((root + from).c_str(), (root + to).c_str()) == 0; }
+};
+
+} // namespace fs
+
+using fs::File;
+
+#endif /* HOST_FS_H */
@@ -0,0 +1,312 @@
+/**
+ * @file multipart_bench.cpp
+ * @brief Host check and benchmark of the multipart upload parsing.
+ *
+ * Feeds the data of a file part, as the firmware upload sends it, through the
+ * byte at a time state machine the request parser runs for it, and through
+ * the same machine with AsyncWebMultipartDelimiter handing over every stretch
+ * of data that cannot hold the delimiter in one go. Both must pass the same
+ * bytes to the upload handler for random data full of near delimiters, cut
+ * into random segments. Then reports the throughput of each on a 1.2 MB
+ * firmware arriving in 1436 byte segments. Build and run from the project
+ * root:
+ *
+ *     g++ -O2 -std=gnu++11 -Ilib/ESPAsyncWebServer-master/src bench/multipart_bench.cpp \
+ *         lib/ESPAsyncWebServer-master/src/AsyncWebMultipart.cpp -o multipart_bench
+ *     ./multipart_bench [rounds]
+ */
+
+#include <chrono>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+#include "AsyncWebMultipart.h"
+
+#define ITEM_BUFFER_LENGTH 1460
+
+/**
+ * @brief What the upload handler gets: the bytes, the calls and whether every index followed on.
+ */
+struct Upload
+{
+  std::string data;
+  size_t calls;
+  bool inOrder;
+
+  Upload() : calls(0), inOrder(true) {}
+
+  void handle(size_t index, const uint8_t *buf, size_t len)
+  {
+    inOrder &= index == data.size();
+    data.append((const char *)buf, len);
+    calls++;
+  }
+};
+
+/**
+ * @brief The file data states of AsyncWebServerRequest::_parseMultipartPostByte(), from the end of the part headers to the delimiter.
+ */
+class PartParser
+{
+  enum
+  {
+    WAIT_FOR_RETURN1,
+    EXPECT_FEED1,
+    EXPECT_DASH1,
+    EXPECT_DASH2,
+    BOUNDARY_OR_DATA,
+    FINISHED
+  };
+
+  std::string _boundary;
+  AsyncWebMultipartDelimiter _delimiter;
+  bool _search;
+  int _state;
+  size_t _boundaryPosition;
+  uint8_t _itemBuffer[ITEM_BUFFER_LENGTH];
+  size_t _itemBufferIndex;
+  size_t _itemSize;
+
+  void handleUploadByte(uint8_t data, bool last)
+  {
+    _itemBuffer[_itemBufferIndex++] = data;
+    if (last || _itemBufferIndex == ITEM_BUFFER_LENGTH)
+    {
+      upload.handle(_itemSize - _itemBufferIndex, _itemBuffer, _itemBufferIndex);
+      _itemBufferIndex = 0;
+    }
+  }
+
+  void itemWriteByte(uint8_t b, bool last)
+  {
+    _itemSize++;
+    handleUploadByte(b, last);
+  }
+
+  void handleUploadData(const uint8_t *data, size_t len)
+  {
+    if (_itemBufferIndex)
+    {
+      upload.handle(_itemSize - _itemBufferIndex, _itemBuffer, _itemBufferIndex);
+      _itemBufferIndex = 0;
+    }
+    upload.handle(_itemSize, data, len);
+    _itemSize += len;
+  }
+
+  void parseByte(uint8_t data, bool last)
+  {
+    if (_state == WAIT_FOR_RETURN1)
+    {
+      if (data != '\r')
+      {
+        itemWriteByte(data, last);
+      }
+      else
+      {
+        _state = EXPECT_FEED1;
+      }
+    }
+    else if (_state == EXPECT_FEED1)
+    {
+      if (data != '\n')
+      {
+        _state = WAIT_FOR_RETURN1;
+        itemWriteByte('\r', last);
+        parseByte(data, last);
+      }
+      else
+      {
+        _state = EXPECT_DASH1;
+      }
+    }
+    else if (_state == EXPECT_DASH1)
+    {
+      if (data != '-')
+      {
+        _state = WAIT_FOR_RETURN1;
+        itemWriteByte('\r', last);
+        itemWriteByte('\n', last);
+        parseByte(data, last);
+      }
+      else
+      {
+        _state = EXPECT_DASH2;
+      }
+    }
+    else if (_state == EXPECT_DASH2)
+    {
+      if (data != '-')
+      {
+        _state = WAIT_FOR_RETURN1;
+        itemWriteByte('\r', last);
+        itemWriteByte('\n', last);
+        itemWriteByte('-', last);
+        parseByte(data, last);
+      }
+      else
+      {
+        _state = BOUNDARY_OR_DATA;
+        _boundaryPosition = 0;
+      }
+    }
+    else if (_state == BOUNDARY_OR_DATA)
+    {
+      if (_boundaryPosition < _boundary.length() && _boundary[_boundaryPosition] != data)
+      {
+        _state = WAIT_FOR_RETURN1;
+        itemWriteByte('\r', last);
+        itemWriteByte('\n', last);
+        itemWriteByte('-', last);
+        itemWriteByte('-', last);
+        for (size_t i = 0; i < _boundaryPosition; i++)
+        {
+          itemWriteByte(_boundary[i], last);
+        }
+        parseByte(data, last);
+      }
+      else if (_boundaryPosition == _boundary.length() - 1)
+      {
+        _state = FINISHED;
+        upload.handle(_itemSize - _itemBufferIndex, _itemBuffer, _itemBufferIndex);
+        _itemBufferIndex = 0;
+      }
+      else
+      {
+        _boundaryPosition++;
+      }
+    }
+  }
+
+public:
+  Upload upload;
+
+  PartParser(const std::string &boundary, bool search)
+      : _boundary(boundary), _search(search), _state(WAIT_FOR_RETURN1), _boundaryPosition(0), _itemBufferIndex(0),
+        _itemSize(0)
+  {
+    _delimiter.begin(boundary.c_str(), boundary.length());
+  }
+
+  bool finished() const { return _state == FINISHED; }
+
+  /** @brief One segment, as AsyncWebServerRequest::_parseMultipartPost() takes it. */
+  void parse(const uint8_t *data, size_t len)
+  {
+    size_t i = 0;
+    while (i < len && _state != FINISHED)
+    {
+      if (_search && _state == WAIT_FOR_RETURN1)
+      {
+        size_t n = _delimiter.dataLength(data + i, len - i);
+        if (n)
+        {
+          handleUploadData(data + i, n);
+          i += n;
+          continue;
+        }
+      }
+      parseByte(data[i], i == len - 1);
+      i++;
+    }
+  }
+};
+
+/**
+ * @brief Random file data, with plenty of line ends, dashes and cut off delimiters, but not the whole one.
+ */
+static std::string makeFile(std::mt19937 &rng, const std::string &boundary, size_t length)
+{
+  static const char *pieces[] = {"\r", "\n", "-", "\r\n", "\r\n-", "\r\n--"};
+  std::string file;
+  while (file.size() < length)
+  {
+    if (rng() % 4)
+    {
+      file += (char)(rng() % 256);
+      continue;
+    }
+    file += pieces[rng() % 6];
+    if (rng() % 3 == 0)
+    {
+      file += "\r\n--" + boundary.substr(0, rng() % (boundary.size() + 1));
+    }
+  }
+  for (size_t p; (p = file.find("\r\n--" + boundary)) != std::string::npos;)
+  {
+    file[p + 1] = 'x';
+  }
+  return file;
+}
+
+static Upload parse(const std::string &boundary, const std::string &part, bool search, size_t segment,
+                    std::mt19937 *rng)
+{
+  PartParser parser(boundary, search);
+  const uint8_t *data = (const uint8_t *)part.data();
+  for (size_t i = 0; i < part.size();)
+  {
+    size_t n = rng ? 1 + (*rng)() % segment : segment;
+    n = n < part.size() - i ? n : part.size() - i;
+    parser.parse(data + i, n);
+    i += n;
+  }
+  if (!parser.finished())
+  {
+    parser.upload.inOrder = false;
+  }
+  return parser.upload;
+}
+
+int main(int argc, char **argv)
+{
+  size_t rounds = argc > 1 ? strtoul(argv[1], NULL, 10) : 20;
+  std::mt19937 rng(49);
+  const std::string boundaries[] = {"b", "----WebKitFormBoundary7MA4YWxkTrZu0gW",
+                                    "---------------------------41184676334"};
+
+  bool ok = true;
+  size_t checked = 0;
+  for (int n = 0; n < 3000; n++)
+  {
+    const std::string &boundary = boundaries[n % 3];
+    std::string file = makeFile(rng, boundary, rng() % 6000);
+    std::string part = file + "\r\n--" + boundary + "--\r\n";
+    size_t segment = n % 2 ? 1500 : 40;
+    std::mt19937 split(n);
+    Upload bytes = parse(boundary, part, false, segment, &split);
+    split.seed(n);
+    Upload search = parse(boundary, part, true, segment, &split);
+    ok &= bytes.inOrder && search.inOrder && bytes.data == file && search.data == file;
+    checked++;
+  }
+  printf("random parts       %zu, %s\n", checked, ok ? "same upload" : "DIFFERENT");
+
+  std::string firmware(1200 * 1024, 0);
+  for (char &c : firmware)
+  {
+    c = (char)(rng() % 256);
+  }
+  const std::string &boundary = boundaries[1];
+  std::string part = firmware + "\r\n--" + boundary + "--\r\n";
+  for (int search = 0; search < 2; search++)
+  {
+    size_t calls = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t r = 0; r < rounds; r++)
+    {
+      Upload upload = parse(boundary, part, search, 1436, NULL);
+      ok &= upload.data == firmware;
+      calls = upload.calls;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("%-18s %7.1f MB/s, %zu upload calls\n", search ? "delimiter search" : "byte at a time",
+           firmware.size() * rounds / seconds / 1e6, calls);
+  }
+
+  printf("result             %s\n", ok ? "ok" : "FAILED");
+  return ok ? 0 : 1;
+}
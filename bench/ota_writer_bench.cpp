@@ -0,0 +1,251 @@
+/**
+ * @file ota_writer_bench.cpp
+ * @brief Host check and benchmark of the OTA write stage.
+ *
+ * Checks that AsyncElegantOtaWriter hands the flash exactly the bytes it was
+ * given, in whole sectors but for the last block, for uploads cut into random
+ * chunks; that a failing flash write is reported and stops the writes after
+ * it; that an aborted update writes nothing more and frees the writer; and
+ * that an update left without end() is finished by the next begin().
+ *
+ * Then replays a firmware upload with simulated timing: TCP segments arriving
+ * at a fixed pace, but no more than a receive window ahead of the handler
+ * acking them, the ack taking a round trip to reach the sender, and a flash that takes a fixed time per sector, as Update does, buffering
+ * to a sector and erasing and writing it when full. Writing each segment
+ * straight to it, as the upload handler did, receiving stops for every
+ * sector; through the writer the next sector is received while the last one
+ * is written. Build and run from the project root:
+ *
+ *     g++ -O2 -std=gnu++11 -pthread -Ilib/AsyncElegantOTA-master/src bench/ota_writer_bench.cpp \
+ *         lib/AsyncElegantOTA-master/src/AsyncElegantOtaWriter.cpp -o ota_writer_bench
+ *     ./ota_writer_bench [firmware KiB] [us per segment] [us per sector] [us round trip]
+ */
+
+#include <chrono>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <thread>
+
+#include "AsyncElegantOtaWriter.h"
+
+#define SEGMENT_SIZE 1436
+/* Segments the sender may have in flight, the receive window of AsyncTCP */
+#define WINDOW_SEGMENTS 4
+
+/**
+ * @brief Stand-in for Update: a sector buffer, written to "flash" when full, taking sectorMicros.
+ */
+struct Flash
+{
+  std::string data;
+  uint8_t sector[OTA_SECTOR_SIZE];
+  size_t fill;
+  size_t calls;
+  size_t unaligned;
+  size_t failAt;
+  uint32_t sectorMicros;
+
+  Flash(uint32_t micros = 0) : fill(0), calls(0), unaligned(0), failAt((size_t)-1), sectorMicros(micros) {}
+
+  size_t write(uint8_t *buf, size_t len)
+  {
+    if (len != OTA_SECTOR_SIZE)
+    {
+      unaligned++;
+    }
+    if (calls++ == failAt)
+    {
+      return 0;
+    }
+    for (size_t i = 0; i < len;)
+    {
+      size_t n = OTA_SECTOR_SIZE - fill < len - i ? OTA_SECTOR_SIZE - fill : len - i;
+      memcpy(sector + fill, buf + i, n);
+      fill += n;
+      i += n;
+      if (fill == OTA_SECTOR_SIZE)
+      {
+        flush();
+      }
+    }
+    return len;
+  }
+
+  void flush()
+  {
+    std::this_thread::sleep_for(std::chrono::microseconds(sectorMicros));
+    data.append((const char *)sector, fill);
+    fill = 0;
+  }
+
+  AsyncElegantOtaSink sink()
+  {
+    return [this](uint8_t *buf, size_t len) { return write(buf, len); };
+  }
+};
+
+static bool checkChunks(AsyncElegantOtaWriter &writer, std::mt19937 &rng, const std::string &firmware)
+{
+  Flash flash;
+  writer.begin(flash.sink(), firmware.size());
+  const uint8_t *data = (const uint8_t *)firmware.data();
+  bool ok = true;
+  for (size_t i = 0; i < firmware.size();)
+  {
+    size_t n = 1 + rng() % 3000;
+    n = n < firmware.size() - i ? n : firmware.size() - i;
+    ok &= writer.write(data + i, n);
+    i += n;
+  }
+  ok &= writer.end();
+  flash.flush();
+  AsyncElegantOtaProgress progress = writer.progress();
+  return ok && flash.data == firmware && flash.unaligned <= 1 && !progress.active &&
+         progress.received == firmware.size() && progress.written == firmware.size();
+}
+
+static bool checkFailure(AsyncElegantOtaWriter &writer, const std::string &firmware)
+{
+  Flash flash;
+  flash.failAt = 3;
+  writer.begin(flash.sink(), firmware.size());
+  bool refused = false;
+  for (size_t i = 0; i < firmware.size(); i += SEGMENT_SIZE)
+  {
+    size_t n = SEGMENT_SIZE < firmware.size() - i ? SEGMENT_SIZE : firmware.size() - i;
+    refused |= !writer.write((const uint8_t *)firmware.data() + i, n);
+  }
+  bool ended = writer.end();
+  AsyncElegantOtaProgress progress = writer.progress();
+  return refused && !ended && progress.failed && progress.written == 3 * OTA_SECTOR_SIZE && flash.calls == 4;
+}
+
+static bool checkAborted(AsyncElegantOtaWriter &writer, const std::string &firmware)
+{
+  /* Slow enough for blocks to be queued when it is aborted */
+  Flash flash(2000);
+  writer.begin(flash.sink(), firmware.size());
+  bool ok = writer.write((const uint8_t *)firmware.data(), 3 * OTA_SECTOR_SIZE + 100);
+  writer.abort();
+  AsyncElegantOtaProgress progress = writer.progress();
+  size_t written = flash.data.size() + flash.fill;
+  ok &= !progress.active && progress.failed && progress.written == written && written <= 3 * OTA_SECTOR_SIZE &&
+        written % OTA_SECTOR_SIZE == 0 && !writer.write((const uint8_t *)firmware.data(), 10);
+  /* Nothing is written after it returns, and the next update goes through */
+  size_t calls = flash.calls;
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  Flash next;
+  writer.begin(next.sink(), 10000);
+  ok &= writer.write((const uint8_t *)firmware.data(), 10000) && writer.end();
+  next.flush();
+  return ok && flash.calls == calls && next.data == firmware.substr(0, 10000);
+}
+
+static bool checkAbandoned(AsyncElegantOtaWriter &writer, const std::string &firmware)
+{
+  Flash first;
+  writer.begin(first.sink(), 0);
+  writer.write((const uint8_t *)firmware.data(), 10000);
+  /* The client went away, the next upload starts over */
+  Flash second;
+  writer.begin(second.sink(), firmware.size());
+  bool ok = writer.write((const uint8_t *)firmware.data(), firmware.size()) && writer.end();
+  second.flush();
+  return ok && second.data == firmware && first.data.size() + first.fill == 10000;
+}
+
+/**
+ * @brief One upload at the given pace, through the writer or straight to the flash.
+ *
+ * @return Seconds taken from the first segment to the end of the last write.
+ */
+static double upload(const std::string &firmware, uint32_t segmentMicros, uint32_t sectorMicros, uint32_t rttMicros,
+                     bool buffered, AsyncElegantOtaProgress *progress)
+{
+  Flash flash(sectorMicros);
+  AsyncElegantOtaWriter writer;
+  const uint8_t *data = (const uint8_t *)firmware.data();
+  auto start = std::chrono::steady_clock::now();
+  auto next = start;
+  std::chrono::steady_clock::time_point handled[WINDOW_SEGMENTS];
+  if (buffered)
+  {
+    writer.begin(flash.sink(), firmware.size());
+  }
+  for (size_t i = 0, segment = 0; i < firmware.size(); i += SEGMENT_SIZE, segment++)
+  {
+    /* The sender only gets this one out once the one a window before it was acked */
+    next += std::chrono::microseconds(segmentMicros);
+    auto acked = handled[segment % WINDOW_SEGMENTS] + std::chrono::microseconds(rttMicros);
+    if (segment >= WINDOW_SEGMENTS && next < acked)
+    {
+      next = acked;
+    }
+    std::this_thread::sleep_until(next);
+    size_t n = SEGMENT_SIZE < firmware.size() - i ? SEGMENT_SIZE : firmware.size() - i;
+    if (buffered)
+    {
+      writer.write(data + i, n);
+    }
+    else
+    {
+      flash.write((uint8_t *)data + i, n);
+    }
+    handled[segment % WINDOW_SEGMENTS] = std::chrono::steady_clock::now();
+  }
+  if (buffered)
+  {
+    writer.end();
+    *progress = writer.progress();
+  }
+  flash.flush();
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  return flash.data == firmware ? seconds : -1;
+}
+
+int main(int argc, char **argv)
+{
+  size_t kib = argc > 1 ? strtoul(argv[1], NULL, 10) : 1200;
+  uint32_t segmentMicros = argc > 2 ? strtoul(argv[2], NULL, 10) : 500;
+  uint32_t sectorMicros = argc > 3 ? strtoul(argv[3], NULL, 10) : 1400;
+  uint32_t rttMicros = argc > 4 ? strtoul(argv[4], NULL, 10) : 3000;
+
+  std::mt19937 rng(50);
+  std::string firmware(kib * 1024 + 123, 0);
+  for (char &c : firmware)
+  {
+    c = (char)(rng() % 256);
+  }
+
+  bool ok = true;
+  AsyncElegantOtaWriter writer;
+  for (int i = 0; i < 20; i++)
+  {
+    std::string part = firmware.substr(0, rng() % 100000);
+    ok &= checkChunks(writer, rng, part);
+  }
+  printf("random chunks      %s\n", ok ? "same bytes, whole sectors" : "DIFFERENT");
+  bool failed = checkFailure(writer, firmware);
+  printf("failed write       %s\n", failed ? "reported, rest dropped" : "NOT HANDLED");
+  bool aborted = checkAborted(writer, firmware);
+  printf("aborted update     %s\n", aborted ? "rest dropped, writer freed" : "NOT HANDLED");
+  bool abandoned = checkAbandoned(writer, firmware);
+  printf("abandoned update   %s\n", abandoned ? "finished by the next" : "NOT HANDLED");
+  ok &= failed && aborted && abandoned;
+
+  printf("%zu KiB, a segment per %u us, a sector per %u us, %u us round trip\n", kib, segmentMicros, sectorMicros,
+         rttMicros);
+  AsyncElegantOtaProgress progress;
+  double direct = upload(firmware, segmentMicros, sectorMicros, rttMicros, false, NULL);
+  double buffered = upload(firmware, segmentMicros, sectorMicros, rttMicros, true, &progress);
+  ok &= direct > 0 && buffered > 0 && progress.written == firmware.size();
+  printf("direct             %6.3f s, %7.1f KiB/s\n", direct, firmware.size() / direct / 1024);
+  printf("double buffered    %6.3f s, %7.1f KiB/s, waited %u ms\n", buffered, firmware.size() / buffered / 1024,
+         progress.waitMillis);
+
+  printf("result             %s\n", ok ? "ok" : "FAILED");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,121 @@
+/**
+ * @file sample_codec_bench.cpp
+ * @brief Host benchmark of the sample block codec.
+ *
+ * Encodes a synthetic series of 10 s samples into blocks the way SampleLog
+ * does, decodes it again and checks the round trip, then reports bytes per
+ * sample and encode/decode throughput. Build and run from the project root:
+ *
+ *     g++ -O2 -std=gnu++11 -Iinclude bench/sample_codec_bench.cpp src/SampleCodec.cpp -o codec_bench
+ *     ./codec_bench [samples]
+ */
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "SampleCodec.h"
+
+/** Framing added by Journal to every block record */
+#define RECORD_OVERHEAD 8
+
+/** Size of one sample as a CSV line of the old data.txt */
+#define CSV_BYTES_PER_SAMPLE 29
+
+struct Block
+{
+  uint8_t data[SAMPLE_BLOCK_MAX_BYTES];
+  uint8_t length;
+};
+
+/**
+ * @brief Samples of a DS18B20 in a room: a slow daily swing plus sensor noise,
+ * 10 s apart with the odd second of timestamp jitter and a reboot every day.
+ */
+static std::vector<Sample> makeSeries(size_t count)
+{
+  std::vector<Sample> series(count);
+  srand(42);
+  uint32_t readingID = 1;
+  uint32_t epoch = 1715000000;
+  int32_t raw = 22 * 16;
+  for (size_t i = 0; i < count; i++)
+  {
+    if (i && i % 8640 == 0)
+    {
+      readingID++;
+    }
+    epoch += 10 + (rand() % 50 == 0 ? (rand() % 3) - 1 : 0);
+    int32_t target = 22 * 16 + (int32_t)(40 * ((i % 8640) < 4320 ? (i % 4320) : 4320 - (i % 4320)) / 4320);
+    raw += (raw < target) - (raw > target) + (rand() % 8 == 0 ? (rand() % 3) - 1 : 0);
+    series[i].readingID = readingID;
+    series[i].epoch = epoch;
+    series[i].raw = raw;
+  }
+  return series;
+}
+
+int main(int argc, char **argv)
+{
+  size_t count = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+  std::vector<Sample> series = makeSeries(count);
+  std::vector<Block> blocks;
+  blocks.reserve(count / 32 + 1);
+
+  auto start = std::chrono::steady_clock::now();
+  SampleBlockEncoder encoder;
+  for (size_t i = 0; i < count; i++)
+  {
+    if (!encoder.add(series[i]))
+    {
+      Block block;
+      memcpy(block.data, encoder.data(), encoder.length());
+      block.length = encoder.length();
+      blocks.push_back(block);
+      encoder.begin(i);
+      encoder.add(series[i]);
+    }
+  }
+  Block last;
+  memcpy(last.data, encoder.data(), encoder.length());
+  last.length = encoder.length();
+  blocks.push_back(last);
+  double encodeSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  start = std::chrono::steady_clock::now();
+  size_t decoded = 0;
+  size_t mismatches = 0;
+  SampleBlockDecoder decoder;
+  Sample sample;
+  for (size_t b = 0; b < blocks.size(); b++)
+  {
+    decoder.begin(blocks[b].data, blocks[b].length);
+    while (decoder.next(sample))
+    {
+      const Sample &expected = series[decoded++];
+      mismatches += sample.readingID != expected.readingID || sample.epoch != expected.epoch ||
+                    sample.raw != expected.raw;
+    }
+  }
+  double decodeSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  size_t payload = 0;
+  for (size_t b = 0; b < blocks.size(); b++)
+  {
+    payload += blocks[b].length;
+  }
+  size_t stored = payload + blocks.size() * RECORD_OVERHEAD;
+
+  printf("samples            %zu\n", count);
+  printf("blocks             %zu (%.1f samples each)\n", blocks.size(), (double)count / blocks.size());
+  printf("payload bytes      %.3f per sample\n", (double)payload / count);
+  printf("stored bytes       %.3f per sample, with record framing\n", (double)stored / count);
+  printf("vs 20 B records    %.1fx smaller\n", 20.0 * count / stored);
+  printf("vs CSV             %.1fx smaller\n", (double)CSV_BYTES_PER_SAMPLE * count / stored);
+  printf("encode             %.1f Msamples/s\n", count / encodeSeconds / 1e6);
+  printf("decode             %.1f Msamples/s\n", count / decodeSeconds / 1e6);
+  printf("round trip         %s\n", decoded == count && mismatches == 0 ? "ok" : "FAILED");
+  return decoded == count && mismatches == 0 ? 0 : 1;
+}
@@ -0,0 +1,307 @@
+/**
+ * @file sample_log_check.cpp
+ * @brief Host check of the sample log against failed writes and retention.
+ *
+ * Appends samples to a SampleLog in a temporary directory and makes one
+ * write fail halfway, as a card that is pulled or full does: once where the
+ * sample would grow the open block, rewritten in place, and once where it
+ * would start a new block. The failed sample must be reported and dropped.
+ * The block written before it must still decode intact, and the samples
+ * appended after it must be kept and counted, in the log and after the
+ * segment is recovered at the next begin().
+ *
+ * Then lets retention delete the oldest segment while an export is reading
+ * it: the file must stay until the export is done with it, the export must
+ * read it to the end, and the file must go once it is.
+ *
+ * Last, exports ranges starting at each sample of a segment: each must give
+ * the samples from there on, and one starting late in the segment must read
+ * only a small part of it. Build and run from the project root:
+ *
+ *     g++ -O2 -std=gnu++11 -Ibench/host -Iinclude bench/sample_log_check.cpp src/Journal.cpp \
+ *         src/SampleLog.cpp src/SampleCodec.cpp -o sample_log_check
+ *     ./sample_log_check [samples]
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+#include "FS.h"
+#include "SampleLog.h"
+
+/** Log lines go to stdout */
+void logWrite(const char *format, ...)
+{
+  va_list args;
+  va_start(args, format);
+  vprintf(format, args);
+  va_end(args);
+}
+
+static Sample makeSample(uint32_t i)
+{
+  Sample sample;
+  sample.readingID = i;
+  sample.epoch = 1700006400 + i * 10;
+  sample.raw = (int16_t)(320 + i % 7);
+  return sample;
+}
+
+/**
+ * @brief A log in a fresh directory under /tmp.
+ */
+struct TempLog
+{
+  fs::FS fs;
+  SampleLog log;
+
+  explicit TempLog(const char *name)
+  {
+    fs.root = std::string("/tmp/") + name;
+    std::string command = "rm -rf " + fs.root + " && mkdir -p " + fs.root;
+    if (system(command.c_str()) != 0)
+    {
+      fs.root.clear();
+    }
+  }
+
+  bool begin() { return !fs.root.empty() && log.begin(fs, fs.root.c_str(), "/log"); }
+};
+
+/**
+ * @brief Reading IDs of the exported samples, and whether the segment counts add up to them.
+ */
+static std::vector<uint32_t> exported(SampleLog &log, bool &counted)
+{
+  std::vector<uint32_t> ids;
+  SampleCsvExport range(log, 0, UINT32_MAX);
+  Sample sample;
+  while (range.nextSample(sample))
+  {
+    ids.push_back(sample.readingID);
+  }
+  SegmentInfo info;
+  size_t count = 0;
+  for (size_t i = 0; log.segmentAt(i, info); i++)
+  {
+    count += info.count;
+  }
+  counted = count == ids.size();
+  return ids;
+}
+
+/**
+ * @brief Samples of the last block on the card, as recovery reads it.
+ */
+static std::vector<uint32_t> lastBlock(const SampleLog &log)
+{
+  std::vector<uint32_t> ids;
+  const JournalRecord *last = log.journal().last();
+  SampleBlockDecoder decoder;
+  Sample sample;
+  if (last && decoder.begin(last->payload, last->length))
+  {
+    while (decoder.next(sample))
+    {
+      ids.push_back(sample.readingID);
+    }
+  }
+  return ids;
+}
+
+/**
+ * @brief Append `samples`, the write of sample `fail` failing, and check what is kept.
+ */
+static bool check(const char *name, uint32_t samples, uint32_t fail)
+{
+  TempLog temp(name);
+  if (!temp.begin())
+  {
+    printf("%-18s cannot create /tmp/%s\n", name, name);
+    return false;
+  }
+  std::vector<uint32_t> expected;
+  std::vector<uint32_t> before;
+  bool ok = true;
+  for (uint32_t i = 0; i < samples; i++)
+  {
+    if (i == fail)
+    {
+      before = lastBlock(temp.log);
+      fs::File::failWriteAfter(0);
+      ok &= temp.log.append(makeSample(i)) == 0;
+      fs::File::failWriteAfter(-1);
+      continue;
+    }
+    ok &= temp.log.append(makeSample(i)) > 0;
+    expected.push_back(i);
+    if (i == fail + 1)
+    {
+      /* The block before the failure is whole, or grew by this sample only */
+      std::vector<uint32_t> after = lastBlock(temp.log);
+      std::vector<uint32_t> grown = before;
+      grown.push_back(i);
+      ok &= after == grown || (after.size() == 1 && after[0] == i);
+    }
+  }
+  bool counted;
+  ok &= exported(temp.log, counted) == expected && counted;
+
+  /* And the same once the open segment is recovered */
+  SampleLog reopened;
+  ok &= reopened.begin(temp.fs, temp.fs.root.c_str(), "/log");
+  ok &= exported(reopened, counted) == expected && counted;
+  printf("%-18s sample %u of %u failed, %zu kept: %s\n", name, fail, samples, expected.size(), ok ? "ok" : "FAILED");
+  return ok;
+}
+
+/** What the retention check reports as the card fill */
+static float cardFill = 0;
+
+static float fill()
+{
+  return cardFill;
+}
+
+static bool checkRetention(uint32_t perDay)
+{
+  TempLog temp("sample_log_retention");
+  if (!temp.begin())
+  {
+    printf("cannot create /tmp/sample_log_retention\n");
+    return false;
+  }
+  SampleLog &log = temp.log;
+  log.setRetention(0.9f, fill);
+  uint32_t day = 1700006400;
+  uint32_t id = 0;
+  bool ok = true;
+  for (uint32_t d = 0; d < 3; d++)
+  {
+    for (uint32_t i = 0; i < perDay; i++)
+    {
+      Sample sample = {id++, day + d * 86400 + i * 10, 320};
+      ok &= log.append(sample) > 0;
+    }
+  }
+
+  /* An export part way through the first segment */
+  SampleCsvExport *range = new SampleCsvExport(log, day, day + 86399);
+  Sample sample;
+  uint32_t expected = 0;
+  for (; expected < perDay / 4 && range->nextSample(sample); expected++)
+  {
+    ok &= sample.readingID == expected;
+  }
+
+  /* The card is full when the next day starts */
+  cardFill = 1.0f;
+  Sample next = {id++, day + 3 * 86400, 320};
+  ok &= log.append(next) > 0;
+  bool kept = temp.fs.exists("/log/00000000.seg") && temp.fs.exists("/log/00000001.seg");
+  ok &= kept && log.segmentCount() == 3 && log.deletedSegments() == 0;
+
+  for (; range->nextSample(sample); expected++)
+  {
+    ok &= sample.readingID == expected;
+  }
+  bool readToEnd = expected == perDay;
+  delete range;
+
+  cardFill = 0;
+  next.readingID = id++;
+  ok &= log.append(next) > 0;
+  bool removed = !temp.fs.exists("/log/00000000.seg") && log.deletedSegments() == 1;
+
+  SampleLog reopened;
+  ok &= reopened.begin(temp.fs, temp.fs.root.c_str(), "/log") && reopened.segmentCount() == 3;
+  ok &= readToEnd && removed;
+  printf("%-18s %s, %s, %s: %s\n", "retention", kept ? "kept while read" : "REMOVED WHILE READ",
+         readToEnd ? "read to the end" : "READ CUT SHORT", removed ? "removed after" : "NOT REMOVED", ok ? "ok" : "FAILED");
+  return ok;
+}
+
+/**
+ * @brief Export from each sample on, and check that the start is searched for, not read up to.
+ */
+static bool checkSeek(uint32_t samples)
+{
+  TempLog temp("sample_log_seek");
+  if (!temp.begin())
+  {
+    printf("cannot create /tmp/sample_log_seek\n");
+    return false;
+  }
+  bool ok = true;
+  for (uint32_t i = 0; i < samples; i++)
+  {
+    ok &= temp.log.append(makeSample(i)) > 0;
+  }
+
+  size_t fullBytes = 0;
+  size_t lateBytes = 0;
+  for (uint32_t first = 0; first < samples; first++)
+  {
+    size_t before = fs::File::bytesRead();
+    SampleCsvExport range(temp.log, makeSample(first).epoch, UINT32_MAX);
+    Sample sample;
+    uint32_t expected = first;
+    while (range.nextSample(sample))
+    {
+      ok &= sample.readingID == expected++;
+    }
+    ok &= expected == samples;
+    if (first == 0)
+    {
+      fullBytes = fs::File::bytesRead() - before;
+    }
+    if (first == samples * 3 / 4)
+    {
+      lateBytes = fs::File::bytesRead() - before;
+    }
+  }
+  ok &= lateBytes * 2 < fullBytes;
+  printf("%-18s %zu of %zu bytes read from 3/4 of the segment: %s\n", "seek", lateBytes, fullBytes,
+         ok ? "ok" : "FAILED");
+  return ok;
+}
+
+int main(int argc, char **argv)
+{
+  uint32_t samples = argc > 1 ? strtoul(argv[1], NULL, 10) : 2000;
+
+  /* Which samples start a new block, from a run without failures */
+  TempLog dry("sample_log_dry");
+  if (!dry.begin())
+  {
+    printf("cannot create /tmp/sample_log_dry\n");
+    return 1;
+  }
+  uint32_t grow = 0;
+  uint32_t start = 0;
+  for (uint32_t i = 0; i < samples; i++)
+  {
+    uint32_t seq = dry.log.journal().nextSeq();
+    dry.log.append(makeSample(i));
+    bool started = dry.log.journal().nextSeq() != seq;
+    if (i > samples / 2 && started && !start)
+    {
+      start = i;
+    }
+    if (i > samples / 2 && !started && !grow)
+    {
+      grow = i;
+    }
+  }
+
+  bool ok = grow && start;
+  ok &= check("sample_log_grow", samples, grow);
+  ok &= check("sample_log_start", samples, start);
+  ok &= checkRetention(samples / 4);
+  ok &= checkSeek(samples);
+  printf("result             %s\n", ok ? "ok" : "FAILED");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,131 @@
+/**
+ * @file sample_ring_stress.cpp
+ * @brief Host stress test of the sample ring.
+ *
+ * One producer thread publishes samples into a ring of the size the sketch
+ * uses, yielding every few samples so readers mostly keep up with it, while
+ * reader threads each poll it with their own cursor, standing in for the
+ * sensing task and the storage and network tasks. Every sample is built from its sequence number, so a reader detects
+ * a torn copy, a sample returned twice or out of order, and samples skipped
+ * without being counted: the gaps a reader sees must add up to what its
+ * cursor reports as dropped. One reader stalls now and then so it is lapped
+ * by the producer and has to skip ahead. In the end every reader must have
+ * read or dropped every sample. Build and run from the project root:
+ *
+ *     g++ -O2 -std=gnu++11 -pthread -Iinclude bench/sample_ring_stress.cpp -o ring_stress
+ *     ./ring_stress [samples] [readers]
+ */
+
+#include <atomic>
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <thread>
+#include <vector>
+
+#include "SampleRing.h"
+
+/** As in the sketch */
+#define RING_SIZE 32
+
+static Sample makeSample(uint32_t seq)
+{
+  Sample sample;
+  sample.readingID = seq;
+  sample.epoch = seq * 10 + 1715000000;
+  sample.raw = (int16_t)(seq * 7);
+  return sample;
+}
+
+/**
+ * @brief What one reader saw.
+ */
+struct ReaderStats
+{
+  size_t read = 0;
+  size_t torn = 0;
+  size_t duplicated = 0;  /**< Returned again, or older than one already read */
+  size_t gaps = 0;        /**< Samples skipped between two reads */
+  uint32_t dropped = 0;   /**< What the cursor counted as dropped */
+};
+
+int main(int argc, char **argv)
+{
+  uint32_t samples = argc > 1 ? strtoul(argv[1], NULL, 10) : 2000000;
+  size_t readers = argc > 2 ? strtoul(argv[2], NULL, 10) : 3;
+
+  SampleRing<Sample, RING_SIZE> ring;
+  std::atomic<bool> done(false);
+  std::vector<ReaderStats> stats(readers);
+
+  std::vector<std::thread> threads;
+  for (size_t r = 0; r < readers; r++)
+  {
+    SampleCursor cursor = ring.cursor();
+    threads.push_back(std::thread([&, r, cursor]() mutable {
+      ReaderStats &s = stats[r];
+      uint32_t expected = 0;
+      Sample sample;
+      for (;;)
+      {
+        bool finished = done;
+        while (ring.poll(cursor, sample))
+        {
+          Sample built = makeSample(sample.readingID);
+          s.torn += sample.epoch != built.epoch || sample.raw != built.raw;
+          if (sample.readingID < expected)
+          {
+            s.duplicated++;
+          }
+          else
+          {
+            s.gaps += sample.readingID - expected;
+            expected = sample.readingID + 1;
+          }
+          s.read++;
+          /* The last reader is slow now and then, and gets lapped */
+          if (r == readers - 1 && s.read % 100000 == 0)
+          {
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+          }
+        }
+        if (finished)
+        {
+          break;
+        }
+        std::this_thread::yield();
+      }
+      s.dropped = cursor.dropped;
+    }));
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t seq = 0; seq < samples; seq++)
+  {
+    ring.publish(makeSample(seq));
+    if (seq % (RING_SIZE / 4) == 0)
+    {
+      std::this_thread::yield();
+    }
+  }
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  done = true;
+  for (std::thread &t : threads)
+  {
+    t.join();
+  }
+
+  bool ok = ring.published() == samples;
+  printf("published          %u, %.1f M/s, ring of %d\n", samples, samples / seconds / 1e6, RING_SIZE);
+  printf("reader        read      dropped   torn  duplicated  uncounted gaps\n");
+  for (size_t r = 0; r < readers; r++)
+  {
+    ReaderStats &s = stats[r];
+    bool readerOk = s.torn == 0 && s.duplicated == 0 && s.gaps == s.dropped && s.read + s.dropped == samples;
+    printf("%-6zu %11zu %12u %6zu %11zu %15zd   %s\n", r, s.read, s.dropped, s.torn, s.duplicated,
+           (ssize_t)s.gaps - (ssize_t)s.dropped, readerOk ? "ok" : "FAILED");
+    ok &= readerOk;
+  }
+  printf("result             %s\n", ok ? "ok" : "FAILED");
+  return ok ? 0 : 1;
+}
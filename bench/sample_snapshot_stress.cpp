@@ -0,0 +1,106 @@
+/**
+ * @file sample_snapshot_stress.cpp
+ * @brief Host stress test of the latest-sample snapshot.
+ *
+ * One writer thread publishes readings as fast as it can while reader
+ * threads read them back, standing in for the sensing task and the web
+ * handlers. Each reading is built so that a torn copy is detected: its
+ * fields all derive from the sequence number it was published with. Readers
+ * also check that the sequence numbers they see never go back. Build and run
+ * from the project root:
+ *
+ *     g++ -O2 -std=gnu++11 -pthread -Iinclude bench/sample_snapshot_stress.cpp -o snapshot_stress
+ *     ./snapshot_stress [readings] [readers]
+ */
+
+#include <atomic>
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <thread>
+#include <vector>
+
+#include "SampleRing.h"
+#include "SampleSnapshot.h"
+
+/**
+ * @brief The reading as the sketch keeps it, with the sensor it came from.
+ */
+struct LatestReading
+{
+  Sample sample;
+  uint64_t sensorId;
+};
+
+static LatestReading makeReading(uint32_t seq)
+{
+  LatestReading reading;
+  reading.sample.readingID = seq;
+  reading.sample.epoch = seq * 10 + 1715000000;
+  reading.sample.raw = (int16_t)(seq * 7);
+  reading.sensorId = 0x28FF000000000000ULL | (uint64_t)seq * 2654435761u;
+  return reading;
+}
+
+int main(int argc, char **argv)
+{
+  uint32_t readings = argc > 1 ? strtoul(argv[1], NULL, 10) : 20000000;
+  size_t readers = argc > 2 ? strtoul(argv[2], NULL, 10) : 3;
+
+  SampleSnapshot<LatestReading> snapshot;
+  std::atomic<bool> done(false);
+  std::atomic<size_t> torn(0);
+  std::atomic<size_t> backwards(0);
+  std::atomic<size_t> reads(0);
+
+  std::vector<std::thread> threads;
+  for (size_t r = 0; r < readers; r++)
+  {
+    threads.push_back(std::thread([&]() {
+      uint32_t last = 0;
+      size_t count = 0;
+      LatestReading reading;
+      while (!done)
+      {
+        uint32_t seq = snapshot.read(reading);
+        count++;
+        if (!seq)
+        {
+          continue;
+        }
+        LatestReading expected = makeReading(seq);
+        torn += reading.sample.readingID != expected.sample.readingID ||
+                reading.sample.epoch != expected.sample.epoch || reading.sample.raw != expected.sample.raw ||
+                reading.sensorId != expected.sensorId;
+        backwards += seq < last;
+        last = seq;
+      }
+      reads += count;
+    }));
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t seq = 1; seq <= readings; seq++)
+  {
+    if (snapshot.publish(makeReading(seq)) != seq)
+    {
+      torn++;
+    }
+  }
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  done = true;
+  for (std::thread &t : threads)
+  {
+    t.join();
+  }
+
+  LatestReading last = makeReading(0);
+  bool ok = torn == 0 && backwards == 0 && snapshot.read(last) == readings &&
+            last.sample.readingID == readings;
+  printf("published          %u, %.1f M/s\n", readings, readings / seconds / 1e6);
+  printf("read               %zu by %zu readers\n", (size_t)reads, readers);
+  printf("torn               %zu\n", (size_t)torn);
+  printf("out of order       %zu\n", (size_t)backwards);
+  printf("result             %s\n", ok ? "ok" : "FAILED");
+  return ok ? 0 : 1;
+}
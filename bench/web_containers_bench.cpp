@@ -0,0 +1,398 @@
+/**
+ * @file web_containers_bench.cpp
+ * @brief Host check and benchmark of the web server containers.
+ *
+ * Replays what a request does to its containers, as seen serving the
+ * dashboard: a browser GET with its usual headers, three query parameters for
+ * `/history`, the filtering of headers no handler asked for, lookups by name
+ * and the free at the end, plus the walk of the handler list per request and
+ * the websocket queue a broadcast goes through. Each runs on SmallVector and
+ * IntrusiveQueue and on the node per item LinkedList they replaced, checking
+ * both end up with the same items, and reports time and heap allocations per
+ * request. Build and run from the project root:
+ *
+ *     g++ -O2 -std=gnu++11 -Ilib/ESPAsyncWebServer-master/src bench/web_containers_bench.cpp -o containers_bench
+ *     ./containers_bench [requests]
+ */
+
+#include <chrono>
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "AsyncWebContainers.h"
+
+static size_t allocations = 0;
+
+void *operator new(size_t size)
+{
+  allocations++;
+  void *p = malloc(size ? size : 1);
+  if (!p)
+  {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void operator delete(void *p) noexcept
+{
+  free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+  free(p);
+}
+
+/**
+ * @brief The list the server kept before, trimmed to what the benchmark uses: one heap node per item, add walks to the end.
+ */
+template <typename T>
+class LinkedList
+{
+public:
+  typedef std::function<void(const T &)> OnRemove;
+  typedef std::function<bool(const T &)> Predicate;
+
+private:
+  struct Node
+  {
+    T value;
+    Node *next;
+  };
+  Node *_root;
+  OnRemove _onRemove;
+
+  class Iterator
+  {
+    Node *_node;
+
+  public:
+    Iterator(Node *current = nullptr) : _node(current) {}
+    Iterator &operator++()
+    {
+      _node = _node->next;
+      return *this;
+    }
+    bool operator!=(const Iterator &i) const { return _node != i._node; }
+    const T &operator*() const { return _node->value; }
+  };
+
+public:
+  LinkedList(OnRemove onRemove) : _root(nullptr), _onRemove(onRemove) {}
+  Iterator begin() const { return Iterator(_root); }
+  Iterator end() const { return Iterator(nullptr); }
+
+  void add(const T &t)
+  {
+    Node *it = new Node{t, nullptr};
+    if (!_root)
+    {
+      _root = it;
+      return;
+    }
+    Node *i = _root;
+    while (i->next)
+    {
+      i = i->next;
+    }
+    i->next = it;
+  }
+  T &front() const { return _root->value; }
+  bool isEmpty() const { return _root == nullptr; }
+  size_t length() const
+  {
+    size_t i = 0;
+    for (Node *it = _root; it; it = it->next)
+    {
+      i++;
+    }
+    return i;
+  }
+  bool remove(const T &t)
+  {
+    return remove_first([&t](const T &v) { return v == t; });
+  }
+  bool remove_first(Predicate predicate)
+  {
+    Node *pit = _root;
+    for (Node *it = _root; it; pit = it, it = it->next)
+    {
+      if (predicate(it->value))
+      {
+        if (it == _root)
+        {
+          _root = _root->next;
+        }
+        else
+        {
+          pit->next = it->next;
+        }
+        if (_onRemove)
+        {
+          _onRemove(it->value);
+        }
+        delete it;
+        return true;
+      }
+    }
+    return false;
+  }
+  size_t remove_if(Predicate predicate)
+  {
+    size_t removed = 0;
+    while (remove_first(predicate))
+    {
+      removed++;
+    }
+    return removed;
+  }
+  void free()
+  {
+    while (_root)
+    {
+      Node *it = _root;
+      _root = _root->next;
+      if (_onRemove)
+      {
+        _onRemove(it->value);
+      }
+      delete it;
+    }
+  }
+};
+
+struct Header
+{
+  std::string name;
+  std::string value;
+};
+
+struct Handler
+{
+  const char *uri;
+};
+
+/**
+ * @brief A queued websocket message; the list version keeps the same object, just not linked through it.
+ */
+struct Message : public IntrusiveQueueItem
+{
+  size_t length;
+};
+
+/* What Chrome sends for the dashboard, in its order */
+static const char *requestHeaders[][2] = {
+    {"Host", "templog.local"},
+    {"Connection", "keep-alive"},
+    {"Cache-Control", "max-age=0"},
+    {"Upgrade-Insecure-Requests", "1"},
+    {"User-Agent", "Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 Chrome/124.0 Safari/537.36"},
+    {"Accept", "text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8"},
+    {"Accept-Encoding", "gzip, deflate"},
+    {"Accept-Language", "en-GB,en;q=0.9"},
+    {"If-None-Match", "\"5f3a-18c\""},
+};
+static const size_t headerCount = sizeof(requestHeaders) / sizeof(requestHeaders[0]);
+static const char *interesting[] = {"Host", "If-None-Match", "Accept-Encoding"};
+
+static bool isInteresting(const Header *header)
+{
+  for (const char *name : interesting)
+  {
+    if (!strcasecmp(header->name.c_str(), name))
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * @brief One request: parse headers and parameters, drop uninteresting headers, look some up, match a handler, free.
+ */
+template <typename Headers, typename Params, typename Handlers>
+static size_t request(Headers &headers, Params &params, const Handlers &handlers, std::vector<Header> &pool,
+                      const char *uri)
+{
+  for (size_t i = 0; i < headerCount; i++)
+  {
+    headers.add(&pool[i]);
+  }
+  for (size_t i = 0; i < 3; i++)
+  {
+    params.add(&pool[headerCount + i]);
+  }
+  headers.remove_if([](Header *const &h) { return !isInteresting(h); });
+
+  size_t found = 0;
+  for (const char *name : {"Host", "If-None-Match", "Authorization"})
+  {
+    for (Header *h : headers)
+    {
+      if (!strcasecmp(h->name.c_str(), name))
+      {
+        found++;
+        break;
+      }
+    }
+  }
+  for (Header *p : params)
+  {
+    found += p->value.size();
+  }
+  for (Handler *h : handlers)
+  {
+    if (!strcmp(h->uri, uri))
+    {
+      found++;
+      break;
+    }
+  }
+  found += headers.length();
+  headers.free();
+  params.free();
+  return found;
+}
+
+/**
+ * @brief Contents left after a single request without the final free, to compare both containers.
+ */
+template <typename Headers>
+static std::string kept(Headers &headers, std::vector<Header> &pool)
+{
+  for (size_t i = 0; i < headerCount; i++)
+  {
+    headers.add(&pool[i]);
+  }
+  headers.remove_if([](Header *const &h) { return !isInteresting(h); });
+  std::string out;
+  for (Header *h : headers)
+  {
+    out += h->name + ",";
+  }
+  headers.free();
+  return out;
+}
+
+int main(int argc, char **argv)
+{
+  size_t requests = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+
+  std::vector<Header> pool;
+  for (size_t i = 0; i < headerCount; i++)
+  {
+    pool.push_back(Header{requestHeaders[i][0], requestHeaders[i][1]});
+  }
+  pool.push_back(Header{"from", "1715000000"});
+  pool.push_back(Header{"to", "1715086400"});
+  pool.push_back(Header{"limit", "64"});
+
+  static const char *uris[] = {"/", "/index.html", "/app.js", "/style.css", "/history", "/config",
+                               "/metrics", "/update", "/ws", "/events"};
+  std::vector<Handler> handlerPool;
+  for (const char *uri : uris)
+  {
+    handlerPool.push_back(Handler{uri});
+  }
+
+  bool ok = true;
+  {
+    SmallVector<Header *, 8> vector([](Header *const &) {});
+    LinkedList<Header *> list([](Header *const &) {});
+    std::string a = kept(vector, pool);
+    std::string b = kept(list, pool);
+    ok &= a == b && a == "Host,Accept-Encoding,If-None-Match,";
+    printf("headers kept       %s\n", a.c_str());
+  }
+
+  size_t checksum = 0;
+  {
+    SmallVector<Header *, 8> headers([](Header *const &) {});
+    SmallVector<Header *, 4> params([](Header *const &) {});
+    SmallVector<Handler *, 8> handlers([](Handler *const &) {});
+    for (Handler &h : handlerPool)
+    {
+      handlers.add(&h);
+    }
+    size_t before = allocations;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t n = 0; n < requests; n++)
+    {
+      checksum += request(headers, params, handlers, pool, uris[n % 10]);
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("request vector     %6.1f ns, %.2f allocations\n", seconds / requests * 1e9,
+           (double)(allocations - before) / requests);
+  }
+  {
+    LinkedList<Header *> headers([](Header *const &) {});
+    LinkedList<Header *> params([](Header *const &) {});
+    LinkedList<Handler *> handlers([](Handler *const &) {});
+    for (Handler &h : handlerPool)
+    {
+      handlers.add(&h);
+    }
+    size_t before = allocations;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t n = 0; n < requests; n++)
+    {
+      checksum -= request(headers, params, handlers, pool, uris[n % 10]);
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("request list       %6.1f ns, %.2f allocations\n", seconds / requests * 1e9,
+           (double)(allocations - before) / requests);
+    handlers.free();
+  }
+  ok &= checksum == 0;
+
+  /* A broadcast queues one message per client, the ack of the previous one frees it */
+  size_t depth = 0;
+  {
+    IntrusiveQueue<Message> queue;
+    size_t before = allocations;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t n = 0; n < requests; n++)
+    {
+      Message *m = new Message();
+      m->length = n;
+      queue.add(m);
+      if (queue.length() > 2)
+      {
+        depth += queue.front()->length;
+        queue.remove(queue.front());
+      }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("queue intrusive    %6.1f ns, %.2f allocations\n", seconds / requests * 1e9,
+           (double)(allocations - before) / requests);
+  }
+  {
+    LinkedList<Message *> queue([](Message *const &m) { delete m; });
+    size_t before = allocations;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t n = 0; n < requests; n++)
+    {
+      Message *m = new Message();
+      m->length = n;
+      queue.add(m);
+      if (queue.length() > 2)
+      {
+        depth -= queue.front()->length;
+        queue.remove(queue.front());
+      }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("queue list         %6.1f ns, %.2f allocations\n", seconds / requests * 1e9,
+           (double)(allocations - before) / requests);
+    queue.free();
+  }
+  ok &= depth == 0;
+
+  printf("result             %s\n", ok ? "ok" : "FAILED");
+  return ok ? 0 : 1;
+}
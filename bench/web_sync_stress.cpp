@@ -0,0 +1,285 @@
+/**
+ * @file web_sync_stress.cpp
+ * @brief Host stress test of the web server lock, the way AsyncWebSocket uses it.
+ *
+ * Several producer threads broadcast frames to every client while a TCP
+ * thread acks and dequeues them one client at a time, and connects and
+ * disconnects clients, all on AsyncWebLock with the client table, the
+ * intrusive queues and the reference counted frames of the server. Every
+ * frame dequeued is checked whole and in order per producer, and every frame
+ * must be freed in the end. Run once encoding frames under the lock, as
+ * broadcasts did, and once encoding them before taking it, reporting the lock
+ * statistics of each. Build and run from the project root, with
+ * -fsanitize=thread to have the races looked for as well:
+ *
+ *     g++ -O2 -std=gnu++11 -pthread -Ilib/ESPAsyncWebServer-master/src bench/web_sync_stress.cpp \
+ *         lib/ESPAsyncWebServer-master/src/AsyncWebSocketClientTable.cpp -o sync_stress
+ *     ./sync_stress [broadcasts per producer] [producers]
+ */
+
+#include <atomic>
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+#include "AsyncWebContainers.h"
+#include "AsyncWebSocketClientTable.h"
+#include "AsyncWebSynchronization.h"
+
+#define FRAME_LENGTH 512
+#define MAX_QUEUED 32
+#define MAX_PRODUCERS 16
+
+static std::atomic<int> liveFrames(0);
+
+/**
+ * @brief Stand-in for AsyncWebSocketMessageBuffer: payload and the atomic count of messages referring to it.
+ */
+struct Frame
+{
+  std::atomic<uint32_t> count;
+  uint8_t data[FRAME_LENGTH];
+
+  Frame() : count(0) { liveFrames++; }
+  ~Frame() { liveFrames--; }
+};
+
+/**
+ * @brief Stand-in for AsyncWebSocketMultiMessage, releasing its frame when done.
+ */
+struct Message : public IntrusiveQueueItem
+{
+  Frame *frame;
+
+  Message(Frame *f) : frame(f) { frame->count++; }
+  ~Message() { frame->count--; }
+};
+
+class AsyncWebSocketClient
+{
+public:
+  uint32_t id;
+  IntrusiveQueue<Message> queue;
+  uint32_t lastSeq[MAX_PRODUCERS];
+
+  AsyncWebSocketClient(uint32_t i) : id(i) { memset(lastSeq, 0, sizeof(lastSeq)); }
+};
+
+struct Server
+{
+  AsyncWebLock lock;
+  AsyncWebSocketClientTable clients;
+  SmallVector<Frame *, 4> buffers;
+  uint32_t nextId;
+  std::atomic<size_t> dropped;
+
+  Server() : buffers([](Frame *const &f) { delete f; }), nextId(1), dropped(0) {}
+};
+
+static uint32_t checksum(const uint8_t *data, size_t len)
+{
+  uint32_t h = 2166136261u;
+  for (size_t i = 0; i < len; i++)
+  {
+    h = (h ^ data[i]) * 16777619u;
+  }
+  return h;
+}
+
+/**
+ * @brief Fill a frame as a broadcast encodes one: producer, sequence number, payload, checksum; a few passes stand in for compressing it.
+ */
+static Frame *encode(uint8_t producer, uint32_t seq)
+{
+  Frame *frame = new Frame();
+  frame->data[0] = producer;
+  memcpy(frame->data + 1, &seq, 4);
+  uint32_t h = seq * 2654435761u;
+  for (int pass = 0; pass < 8; pass++)
+  {
+    for (size_t i = 5; i < FRAME_LENGTH - 4; i++)
+    {
+      h = h * 1103515245u + 12345u + pass;
+      frame->data[i] = h >> 24;
+    }
+  }
+  uint32_t sum = checksum(frame->data, FRAME_LENGTH - 4);
+  memcpy(frame->data + FRAME_LENGTH - 4, &sum, 4);
+  return frame;
+}
+
+/**
+ * @brief As AsyncWebSocketClient::_queueMessage(), taking the lock again under the broadcast holding it.
+ */
+static void queueMessage(Server &server, AsyncWebSocketClient *client, Frame *frame)
+{
+  AsyncWebLockGuard l(server.lock);
+  if (client->queue.length() >= MAX_QUEUED)
+  {
+    server.dropped++;
+    return;
+  }
+  client->queue.add(new Message(frame));
+}
+
+static void cleanBuffers(Server &server)
+{
+  AsyncWebLockGuard l(server.lock);
+  server.buffers.remove_if([](Frame *const &f) { return f->count == 0; });
+}
+
+static void broadcast(Server &server, uint8_t producer, uint32_t seq, bool encodeUnlocked)
+{
+  Frame *frame = encodeUnlocked ? encode(producer, seq) : NULL;
+  AsyncWebLockGuard l(server.lock);
+  if (!frame)
+  {
+    frame = encode(producer, seq);
+  }
+  for (AsyncWebSocketClient *client : server.clients)
+  {
+    queueMessage(server, client, frame);
+  }
+  server.buffers.add(frame);
+  cleanBuffers(server);
+}
+
+/**
+ * @brief Take the message at the front of a client's queue as its ack would, checking it.
+ */
+static size_t ack(Server &server, uint32_t id)
+{
+  AsyncWebLockGuard l(server.lock);
+  AsyncWebSocketClient *client = server.clients.find(id);
+  if (!client || client->queue.isEmpty())
+  {
+    return 0;
+  }
+  Message *message = client->queue.front();
+  const uint8_t *data = message->frame->data;
+  size_t errors = 0;
+  uint32_t sum;
+  uint32_t seq;
+  memcpy(&sum, data + FRAME_LENGTH - 4, 4);
+  memcpy(&seq, data + 1, 4);
+  errors += sum != checksum(data, FRAME_LENGTH - 4);
+  errors += data[0] >= MAX_PRODUCERS || seq <= client->lastSeq[data[0]];
+  if (data[0] < MAX_PRODUCERS)
+  {
+    client->lastSeq[data[0]] = seq;
+  }
+  client->queue.remove(message);
+  cleanBuffers(server);
+  return errors;
+}
+
+static void connect(Server &server)
+{
+  AsyncWebLockGuard l(server.lock);
+  AsyncWebSocketClient *client = new AsyncWebSocketClient(server.nextId++);
+  server.clients.add(client->id, client);
+}
+
+static void disconnect(Server &server, uint32_t id)
+{
+  AsyncWebLockGuard l(server.lock);
+  delete server.clients.remove(id);
+  cleanBuffers(server);
+}
+
+static bool run(size_t broadcasts, size_t producers, bool encodeUnlocked)
+{
+  Server server;
+  for (int i = 0; i < 8; i++)
+  {
+    connect(server);
+  }
+
+  std::atomic<size_t> running(producers);
+  std::atomic<size_t> errors(0);
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> threads;
+  for (size_t p = 0; p < producers; p++)
+  {
+    threads.push_back(std::thread([&, p]() {
+      for (uint32_t seq = 1; seq <= broadcasts; seq++)
+      {
+        broadcast(server, (uint8_t)p, seq, encodeUnlocked);
+      }
+      running--;
+    }));
+  }
+
+  /* The TCP task: acks round the clients, now and then one leaves and another connects */
+  size_t acked = 0;
+  uint32_t rng = 7;
+  while (running || acked == 0)
+  {
+    for (int i = 0; i < 64; i++)
+    {
+      rng = rng * 1103515245u + 12345u;
+      uint32_t id;
+      {
+        AsyncWebLockGuard l(server.lock);
+        id = server.clients.isEmpty() ? 0 : server.clients[(rng >> 8) % server.clients.size()]->id;
+      }
+      size_t e = ack(server, id);
+      errors += e;
+      acked++;
+    }
+    rng = rng * 1103515245u + 12345u;
+    if ((rng >> 16) % 16 == 0)
+    {
+      uint32_t id;
+      {
+        AsyncWebLockGuard l(server.lock);
+        id = server.clients.isEmpty() ? 0 : server.clients[(rng >> 4) % server.clients.size()]->id;
+      }
+      disconnect(server, id);
+      connect(server);
+    }
+  }
+  for (std::thread &t : threads)
+  {
+    t.join();
+  }
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  AsyncWebLockStats stats = server.lock.stats();
+  while (!server.clients.isEmpty())
+  {
+    disconnect(server, server.clients[0]->id);
+  }
+  cleanBuffers(server);
+  bool ok = errors == 0 && liveFrames == 0 && server.buffers.isEmpty();
+
+  printf("%-10s %9.0f/s %9u %6.2f%% %8.2f us %9u us %9u us   %s\n", encodeUnlocked ? "unlocked" : "locked",
+         broadcasts * producers / seconds, stats.acquired, stats.contended * 100.0 / stats.acquired,
+         stats.contended ? (double)stats.waitMicros / stats.contended : 0.0, stats.maxWaitMicros,
+         stats.maxHoldMicros, ok ? "ok" : "FAILED");
+  if (!ok)
+  {
+    printf("           %zu errors, %d frames left\n", (size_t)errors, (int)liveFrames);
+  }
+  return ok;
+}
+
+int main(int argc, char **argv)
+{
+  size_t broadcasts = argc > 1 ? strtoul(argv[1], NULL, 10) : 20000;
+  size_t producers = argc > 2 ? strtoul(argv[2], NULL, 10) : 4;
+  if (producers < 1 || producers > MAX_PRODUCERS)
+  {
+    producers = 4;
+  }
+
+  printf("%zu producers, %zu broadcasts each, 8 clients churning\n", producers, broadcasts);
+  printf("encoding   broadcasts  acquired  contended  avg wait    max wait    max hold\n");
+  bool ok = run(broadcasts, producers, false);
+  ok &= run(broadcasts, producers, true);
+  printf("result     %s\n", ok ? "ok" : "FAILED");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,190 @@
+/**
+ * @file websocket_clients_bench.cpp
+ * @brief Host check and benchmark of the websocket client table.
+ *
+ * Connects and disconnects clients at random and checks
+ * AsyncWebSocketClientTable against a std::map after every step. Then, for a
+ * growing number of clients, reports the cost of looking one up by id, as
+ * every unicast reply does, and of visiting them all, as a broadcast does,
+ * against the linked list walk the table replaced. Build and run from the
+ * project root:
+ *
+ *     g++ -O2 -std=gnu++11 -Ilib/ESPAsyncWebServer-master/src bench/websocket_clients_bench.cpp \
+ *         lib/ESPAsyncWebServer-master/src/AsyncWebSocketClientTable.cpp -o clients_bench
+ *     ./clients_bench [rounds]
+ */
+
+#include <chrono>
+#include <iterator>
+#include <map>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+#include "AsyncWebSocketClientTable.h"
+
+/**
+ * @brief Stand-in for the real client, about as large, so walking them touches as much memory.
+ */
+class AsyncWebSocketClient
+{
+public:
+  uint32_t id;
+  bool connected;
+  uint8_t state[200];
+};
+
+static uint32_t rng = 42;
+
+static uint32_t next()
+{
+  rng ^= rng << 13;
+  rng ^= rng >> 17;
+  rng ^= rng << 5;
+  return rng;
+}
+
+/**
+ * @brief The list the server kept before: one heap node per client, walked for every lookup.
+ */
+struct Node
+{
+  AsyncWebSocketClient *client;
+  Node *next;
+};
+
+static AsyncWebSocketClient *listFind(const Node *node, uint32_t id)
+{
+  for (; node; node = node->next)
+  {
+    if (node->client->id == id && node->client->connected)
+    {
+      return node->client;
+    }
+  }
+  return NULL;
+}
+
+int main(int argc, char **argv)
+{
+  size_t rounds = argc > 1 ? strtoul(argv[1], NULL, 10) : 200000;
+
+  /* Random churn, ids handed out in order the way the server does */
+  size_t mismatches = 0;
+  {
+    AsyncWebSocketClientTable table;
+    std::map<uint32_t, AsyncWebSocketClient *> reference;
+    std::vector<AsyncWebSocketClient> clients(rounds + 1);
+    uint32_t nextId = 1;
+    for (size_t round = 0; round < rounds; round++)
+    {
+      /* Drifts around 16 clients */
+      if (reference.empty() || (int)(next() % 100) < 52 - (int)reference.size() / 8)
+      {
+        AsyncWebSocketClient *client = &clients[nextId];
+        client->id = nextId++;
+        mismatches += !table.add(client->id, client);
+        reference[client->id] = client;
+      }
+      else
+      {
+        auto it = reference.begin();
+        std::advance(it, next() % reference.size());
+        mismatches += table.remove(it->first) != it->second;
+        mismatches += table.remove(it->first) != NULL;
+        reference.erase(it);
+      }
+      mismatches += table.size() != reference.size();
+      uint32_t probe = 1 + next() % nextId;
+      auto found = reference.find(probe);
+      mismatches += table.find(probe) != (found == reference.end() ? NULL : found->second);
+      if (round % 1000 == 0)
+      {
+        size_t seen = 0;
+        for (AsyncWebSocketClient *client : table)
+        {
+          seen += reference.count(client->id) && reference[client->id] == client;
+        }
+        mismatches += seen != reference.size();
+      }
+    }
+  }
+  printf("churn rounds       %zu, %zu mismatches\n", rounds, mismatches);
+
+  printf("clients   unicast list  table     broadcast list  table\n");
+  uint64_t checksum = 0;
+  const size_t counts[] = {1, 4, 8, 16, 32, 64, 128};
+  for (size_t count : counts)
+  {
+    /* Clients come and go, so neither the list nodes nor the clients are allocated in order */
+    std::vector<AsyncWebSocketClient *> clients;
+    std::vector<void *> filler;
+    AsyncWebSocketClientTable table;
+    Node *list = NULL;
+    Node **tail = &list;
+    for (size_t i = 0; i < count; i++)
+    {
+      filler.push_back(malloc(64 + next() % 512));
+      AsyncWebSocketClient *client = new AsyncWebSocketClient();
+      client->id = 1 + i * 3;
+      client->connected = true;
+      clients.push_back(client);
+      table.add(client->id, client);
+      *tail = new Node{client, NULL};
+      tail = &(*tail)->next;
+    }
+
+    const size_t lookups = 2000000;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t n = 0; n < lookups; n++)
+    {
+      checksum += (uintptr_t)listFind(list, 1 + (next() % count) * 3);
+    }
+    double listLookup = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    start = std::chrono::steady_clock::now();
+    for (size_t n = 0; n < lookups; n++)
+    {
+      AsyncWebSocketClient *client = table.find(1 + (next() % count) * 3);
+      checksum += client && client->connected ? (uintptr_t)client : 0;
+    }
+    double tableLookup = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    const size_t broadcasts = 200000;
+    start = std::chrono::steady_clock::now();
+    for (size_t n = 0; n < broadcasts; n++)
+    {
+      for (const Node *node = list; node; node = node->next)
+      {
+        checksum += node->client->connected;
+      }
+    }
+    double listBroadcast = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    start = std::chrono::steady_clock::now();
+    for (size_t n = 0; n < broadcasts; n++)
+    {
+      for (AsyncWebSocketClient *client : table)
+      {
+        checksum += client->connected;
+      }
+    }
+    double tableBroadcast = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    printf("%7zu   %9.1f ns %6.1f ns   %11.1f ns %6.1f ns\n", count, listLookup / lookups * 1e9,
+           tableLookup / lookups * 1e9, listBroadcast / broadcasts * 1e9, tableBroadcast / broadcasts * 1e9);
+
+    while (list)
+    {
+      Node *node = list;
+      list = list->next;
+      delete node;
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+      delete clients[i];
+      free(filler[i]);
+    }
+  }
+  printf("checksum           %llu\n", (unsigned long long)checksum);
+  printf("result             %s\n", mismatches ? "FAILED" : "ok");
+  return mismatches ? 1 : 0;
+}
@@ -0,0 +1,145 @@
+/**
+ * @file websocket_deflate_bench.cpp
+ * @brief Host check and benchmark of the permessage-deflate compressor.
+ *
+ * Compresses `hist` replies as the sketch sends them, plus random messages,
+ * with every window size, inflates each one with zlib the way a browser
+ * does (appending 00 00 FF FF) and checks the round trip. Reports the
+ * compression ratio and throughput per window size, against zlib at level 1
+ * for reference. Build and run from the project root:
+ *
+ *     g++ -O2 -std=gnu++11 -Ilib/ESPAsyncWebServer-master/src bench/websocket_deflate_bench.cpp \
+ *         lib/ESPAsyncWebServer-master/src/AsyncWebSocketDeflate.cpp -lz -o deflate_bench
+ *     ./deflate_bench [messages]
+ */
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <zlib.h>
+
+#include "AsyncWebSocketDeflate.h"
+
+/**
+ * @brief A `hist` reply of 64 samples, 10 s apart, of a slowly drifting temperature.
+ */
+static std::string makeHistory(uint32_t seed)
+{
+  srand(seed);
+  std::string out = "{\"type\":\"hist\",\"samples\":[";
+  uint32_t id = 1000 + seed * 64;
+  uint32_t epoch = 1715000000 + seed * 640;
+  int centi = 2150 + rand() % 200;
+  for (int i = 0; i < 64; i++)
+  {
+    char sample[48];
+    centi += rand() % 13 - 6;
+    snprintf(sample, sizeof(sample), "%s[%u,%u,\"%d.%02d\"]", i ? "," : "", id + i, epoch + i * 10, centi / 100,
+             centi % 100);
+    out += sample;
+  }
+  char next[32];
+  snprintf(next, sizeof(next), "],\"next\":%u}", epoch + 640);
+  return out + next;
+}
+
+static bool inflates(const uint8_t *data, size_t length, const std::string &expected)
+{
+  std::vector<uint8_t> in(data, data + length);
+  static const uint8_t tail[4] = {0x00, 0x00, 0xFF, 0xFF};
+  in.insert(in.end(), tail, tail + 4);
+  std::vector<uint8_t> out(expected.size() + 1);
+  z_stream z;
+  memset(&z, 0, sizeof(z));
+  inflateInit2(&z, -15);
+  z.next_in = in.data();
+  z.avail_in = in.size();
+  z.next_out = out.data();
+  z.avail_out = out.size();
+  int status = inflate(&z, Z_SYNC_FLUSH);
+  size_t produced = z.total_out;
+  inflateEnd(&z);
+  return status == Z_OK && produced == expected.size() && !memcmp(out.data(), expected.data(), produced);
+}
+
+int main(int argc, char **argv)
+{
+  size_t count = argc > 1 ? strtoul(argv[1], NULL, 10) : 2000;
+  std::vector<std::string> messages;
+  size_t plain = 0;
+  for (size_t i = 0; i < count; i++)
+  {
+    messages.push_back(makeHistory(i));
+    plain += messages.back().size();
+  }
+
+  bool ok = true;
+  std::vector<uint8_t> out(70000);
+  printf("hist replies       %zu of %.0f bytes on average\n", count, (double)plain / count);
+  for (uint8_t bits = WS_DEFLATE_MIN_WINDOW_BITS; bits <= WS_DEFLATE_MAX_WINDOW_BITS; bits++)
+  {
+    size_t compressed = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < count; i++)
+    {
+      compressed += AsyncWebSocketDeflater::compress((const uint8_t *)messages[i].data(), messages[i].size(),
+                                                     out.data(), out.size(), bits);
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    for (size_t i = 0; i < count; i += 97)
+    {
+      size_t length = AsyncWebSocketDeflater::compress((const uint8_t *)messages[i].data(), messages[i].size(),
+                                                       out.data(), out.size(), bits);
+      ok &= length && inflates(out.data(), length, messages[i]);
+    }
+    printf("window %2u bits    %.2fx, %.1f MB/s, %6zu bytes of table\n", bits, (double)plain / compressed,
+           plain / seconds / 1e6, ((size_t)1 << bits) * 2);
+  }
+
+  size_t zlibCompressed = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < count; i++)
+  {
+    z_stream z;
+    memset(&z, 0, sizeof(z));
+    deflateInit2(&z, 1, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY);
+    z.next_in = (Bytef *)messages[i].data();
+    z.avail_in = messages[i].size();
+    z.next_out = out.data();
+    z.avail_out = out.size();
+    deflate(&z, Z_SYNC_FLUSH);
+    zlibCompressed += z.total_out - 4;
+    deflateEnd(&z);
+  }
+  double zlibSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  printf("zlib level 1       %.2fx, %.1f MB/s\n", (double)plain / zlibCompressed, plain / zlibSeconds / 1e6);
+
+  /* Random messages of every size and entropy, including ones that do not shrink */
+  srand(7);
+  size_t rejected = 0;
+  for (size_t i = 0; i < count * 5; i++)
+  {
+    std::string message(rand() % 3000, '\0');
+    int symbols = 1 + rand() % 256;
+    for (size_t j = 0; j < message.size(); j++)
+    {
+      message[j] = rand() % symbols;
+    }
+    uint8_t bits = WS_DEFLATE_MIN_WINDOW_BITS + rand() % 8;
+    size_t limit = message.size() ? message.size() - 1 : 0;
+    size_t length = AsyncWebSocketDeflater::compress((const uint8_t *)message.data(), message.size(), out.data(),
+                                                     limit, bits);
+    if (!length)
+    {
+      rejected++;
+      continue;
+    }
+    ok &= length <= limit && inflates(out.data(), length, message);
+  }
+  printf("random messages    %zu, %zu not shrinking\n", count * 5, rejected);
+  printf("round trip         %s\n", ok ? "ok" : "FAILED");
+  return ok ? 0 : 1;
+}
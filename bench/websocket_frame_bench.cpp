@@ -0,0 +1,327 @@
+/**
+ * @file websocket_frame_bench.cpp
+ * @brief Host fuzz and benchmark of the websocket frame header parser.
+ *
+ * Builds a stream of random frames, feeds it to AsyncWebSocketFrameParser cut
+ * at random points the way TCP segments arrive, and checks that every frame
+ * comes out with the header and unmasked payload it went in with. Random
+ * garbage must give the same result whether fed whole or a byte at a time.
+ * Then reports the cost of a header that is whole in the input, the common
+ * case, against one split byte by byte, and unmasking throughput against the
+ * byte-wise loop it replaced. Build and run from the project root:
+ *
+ *     g++ -O2 -std=gnu++11 -Ilib/ESPAsyncWebServer-master/src bench/websocket_frame_bench.cpp \
+ *         lib/ESPAsyncWebServer-master/src/AsyncWebSocketFrame.cpp -o frame_bench
+ *     ./frame_bench [rounds]
+ */
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "AsyncWebSocketFrame.h"
+
+struct Frame
+{
+  bool final;
+  uint8_t opcode;
+  bool masked;
+  uint8_t mask[4];
+  std::vector<uint8_t> payload;
+};
+
+static uint32_t rng = 42;
+
+static uint32_t next()
+{
+  rng ^= rng << 13;
+  rng ^= rng >> 17;
+  rng ^= rng << 5;
+  return rng;
+}
+
+/**
+ * @brief A valid frame, with lengths around the 7, 16 and 64-bit encodings.
+ */
+static Frame makeFrame()
+{
+  static const uint8_t opcodes[] = {0, 1, 2, 8, 9, 10};
+  static const size_t lengths[] = {0, 1, 125, 126, 127, 65535, 65536, 70000};
+  Frame frame;
+  frame.opcode = opcodes[next() % sizeof(opcodes)];
+  frame.final = frame.opcode >= 8 || next() % 2;
+  frame.masked = next() % 4 != 0;
+  for (int i = 0; i < 4; i++)
+  {
+    frame.mask[i] = next();
+  }
+  size_t length = next() % 4 ? next() % 200 : lengths[next() % 8];
+  if (frame.opcode >= 8 && length > 125)
+  {
+    length = 125;
+  }
+  frame.payload.resize(length);
+  for (size_t i = 0; i < length; i++)
+  {
+    frame.payload[i] = next();
+  }
+  return frame;
+}
+
+static void writeFrame(std::vector<uint8_t> &out, const Frame &frame)
+{
+  size_t length = frame.payload.size();
+  out.push_back((frame.final ? 0x80 : 0) | frame.opcode);
+  uint8_t maskBit = frame.masked ? 0x80 : 0;
+  if (length < 126)
+  {
+    out.push_back(maskBit | length);
+  }
+  else if (length < 65536)
+  {
+    out.push_back(maskBit | 126);
+    out.push_back(length >> 8);
+    out.push_back(length);
+  }
+  else
+  {
+    out.push_back(maskBit | 127);
+    for (int shift = 56; shift >= 0; shift -= 8)
+    {
+      out.push_back((uint64_t)length >> shift);
+    }
+  }
+  if (frame.masked)
+  {
+    out.insert(out.end(), frame.mask, frame.mask + 4);
+  }
+  for (size_t i = 0; i < length; i++)
+  {
+    out.push_back(frame.payload[i] ^ (frame.masked ? frame.mask[i % 4] : 0));
+  }
+}
+
+/**
+ * @brief Receiver state the way AsyncWebSocketClient::_onData keeps it.
+ */
+struct Receiver
+{
+  AsyncWebSocketFrameParser header;
+  bool inPayload = false;
+  Frame frame;
+  uint64_t expected = 0;
+  uint64_t index = 0;
+  std::vector<Frame> frames;
+
+  void finish()
+  {
+    frames.push_back(frame);
+    inPayload = false;
+  }
+
+  bool onData(uint8_t *data, size_t length)
+  {
+    while (length > 0)
+    {
+      if (!inPayload)
+      {
+        size_t used = header.parse(data, length);
+        data += used;
+        length -= used;
+        if (header.status() == WS_HEADER_INCOMPLETE)
+        {
+          return true;
+        }
+        if (header.status() == WS_HEADER_INVALID)
+        {
+          return false;
+        }
+        frame.final = header.final();
+        frame.opcode = header.opcode();
+        frame.masked = header.masked();
+        memcpy(frame.mask, header.mask(), 4);
+        frame.payload.clear();
+        expected = header.length();
+        index = 0;
+        inPayload = true;
+        header.reset();
+      }
+      /* Runs for an empty payload too, even at the end of the segment */
+      size_t chunk = remaining() < length ? remaining() : length;
+      if (frame.masked)
+      {
+        AsyncWebSocketFrameParser::unmask(data, chunk, frame.mask, index);
+      }
+      frame.payload.insert(frame.payload.end(), data, data + chunk);
+      index += chunk;
+      data += chunk;
+      length -= chunk;
+      if (!remaining())
+      {
+        finish();
+      }
+    }
+    return true;
+  }
+
+  uint64_t remaining() const { return expected - index; }
+};
+
+int main(int argc, char **argv)
+{
+  size_t rounds = argc > 1 ? strtoul(argv[1], NULL, 10) : 2000;
+  size_t failures = 0;
+  size_t framesChecked = 0;
+  size_t segments = 0;
+
+  for (size_t round = 0; round < rounds; round++)
+  {
+    std::vector<Frame> frames(1 + next() % 20);
+    std::vector<uint8_t> stream;
+    for (size_t i = 0; i < frames.size(); i++)
+    {
+      frames[i] = makeFrame();
+      writeFrame(stream, frames[i]);
+    }
+
+    Receiver receiver;
+    size_t pos = 0;
+    while (pos < stream.size())
+    {
+      size_t cut = next() % 3 ? 1 + next() % 16 : 1 + next() % 1500;
+      cut = cut < stream.size() - pos ? cut : stream.size() - pos;
+      std::vector<uint8_t> segment(stream.begin() + pos, stream.begin() + pos + cut);
+      if (!receiver.onData(segment.data(), cut))
+      {
+        break;
+      }
+      pos += cut;
+      segments++;
+    }
+
+    bool same = receiver.frames.size() == frames.size() && !receiver.inPayload;
+    for (size_t i = 0; same && i < frames.size(); i++)
+    {
+      const Frame &in = frames[i];
+      const Frame &out = receiver.frames[i];
+      same = in.final == out.final && in.opcode == out.opcode && in.masked == out.masked &&
+             (!in.masked || !memcmp(in.mask, out.mask, 4)) && in.payload == out.payload;
+    }
+    framesChecked += frames.size();
+    failures += !same;
+  }
+
+  /* Garbage: the outcome may not depend on how the bytes are split */
+  size_t garbageMismatches = 0;
+  for (size_t round = 0; round < rounds * 10; round++)
+  {
+    uint8_t bytes[WS_FRAME_HEADER_MAX];
+    size_t length = 1 + next() % WS_FRAME_HEADER_MAX;
+    for (size_t i = 0; i < length; i++)
+    {
+      bytes[i] = next();
+    }
+    AsyncWebSocketFrameParser whole, split;
+    size_t usedWhole = whole.parse(bytes, length);
+    size_t usedSplit = 0;
+    for (size_t i = 0; i < length; i++)
+    {
+      usedSplit += split.parse(bytes + i, 1);
+    }
+    bool same = usedWhole == usedSplit && whole.status() == split.status() && usedWhole <= length;
+    if (same && whole.status() != WS_HEADER_INCOMPLETE)
+    {
+      same = usedWhole == AsyncWebSocketFrameParser::headerSize(bytes[1]) && whole.final() == split.final() &&
+             whole.opcode() == split.opcode() && whole.length() == split.length() &&
+             whole.masked() == split.masked() && (!whole.masked() || !memcmp(whole.mask(), split.mask(), 4));
+    }
+    garbageMismatches += !same;
+  }
+
+  /* Headers of small masked text frames, as browsers send commands */
+  const size_t headers = 1000000;
+  std::vector<uint8_t> small;
+  for (size_t i = 0; i < 64; i++)
+  {
+    Frame frame = {true, 1, true, {1, 2, 3, 4}, std::vector<uint8_t>(8 + i % 32, 'x')};
+    writeFrame(small, frame);
+  }
+  AsyncWebSocketFrameParser parser;
+  uint64_t checksum = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (size_t n = 0, pos = 0; n < headers; n++)
+  {
+    if (pos >= small.size())
+    {
+      pos = 0;
+    }
+    parser.reset();
+    pos += parser.parse(small.data() + pos, small.size() - pos);
+    checksum += parser.length();
+    pos += parser.length();
+  }
+  double wholeSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  start = std::chrono::steady_clock::now();
+  for (size_t n = 0, pos = 0; n < headers; n++)
+  {
+    if (pos >= small.size())
+    {
+      pos = 0;
+    }
+    parser.reset();
+    while (parser.status() == WS_HEADER_INCOMPLETE)
+    {
+      pos += parser.parse(small.data() + pos, 1);
+    }
+    checksum += parser.length();
+    pos += parser.length();
+  }
+  double splitSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  /* Unmasking a payload at an odd offset, word-wise against the old loop */
+  std::vector<uint8_t> payload(1 << 20);
+  const uint8_t mask[4] = {0x12, 0x34, 0x56, 0x78};
+  const int passes = 64;
+  start = std::chrono::steady_clock::now();
+  for (int pass = 0; pass < passes; pass++)
+  {
+    AsyncWebSocketFrameParser::unmask(payload.data() + 1, payload.size() - 1, mask, pass);
+  }
+  double wordSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  checksum += payload[payload.size() / 2];
+
+  start = std::chrono::steady_clock::now();
+  for (int pass = 0; pass < passes; pass++)
+  {
+    volatile uint64_t index = pass;
+    uint8_t *data = payload.data() + 1;
+    for (size_t i = 0; i < payload.size() - 1; i++)
+    {
+      data[i] ^= mask[(index + i) % 4];
+    }
+  }
+  double byteSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  checksum += payload[payload.size() / 2];
+
+  /* Both ran the same passes, so the payload must be back to zeros */
+  bool restored = true;
+  for (size_t i = 0; i < payload.size(); i++)
+  {
+    restored &= payload[i] == 0;
+  }
+
+  bool ok = !failures && !garbageMismatches && restored;
+  printf("fuzz rounds        %zu (%zu frames, %zu segments)\n", rounds, framesChecked, segments);
+  printf("fuzz mismatches    %zu\n", failures);
+  printf("garbage mismatches %zu\n", garbageMismatches);
+  printf("header, whole      %.1f ns\n", wholeSeconds / headers * 1e9);
+  printf("header, split      %.1f ns\n", splitSeconds / headers * 1e9);
+  printf("unmask, word-wise  %.0f MB/s\n", passes * payload.size() / wordSeconds / 1e6);
+  printf("unmask, byte-wise  %.0f MB/s\n", passes * payload.size() / byteSeconds / 1e6);
+  printf("checksum           %llu\n", (unsigned long long)checksum);
+  printf("result             %s\n", ok ? "ok" : "FAILED");
+  return ok ? 0 : 1;
+}
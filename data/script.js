@@ -1,41 +1,387 @@
 /**
  * @file Main script for handling temperature data and updating the chart.
+ *
+ * Samples are kept in a fixed-capacity ring buffer and drawn straight onto the
+ * canvas. Long histories are decimated to roughly one point per pixel column
+ * before drawing, and drawing is coalesced to at most one frame per
+ * `requestAnimationFrame`, so days of 10 s samples stay cheap to display.
  */
 
 /**
- * @var {CanvasRenderingContext2D} ctx - Context for the temperature chart canvas.
+ * Ring-buffered time series store.
+ *
+ * Timestamps (ms since epoch) and values live in typed arrays of a power-of-two
+ * capacity. Pushing is O(1); once full, the oldest sample is overwritten
+ * instead of shifting the whole array.
  */
-let ctx = document.getElementById('temperatureChart').getContext('2d');
+class TimeSeries {
+    /**
+     * @param {number} capacity - Maximum number of samples kept, rounded up to a power of two.
+     */
+    constructor(capacity) {
+        let size = 1;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        this.mask = size - 1;
+        this.times = new Float64Array(size);
+        this.values = new Float32Array(size);
+        this.head = 0; /**< Index of the next write, grows without wrapping */
+        this.length = 0;
+        this.version = 0; /**< Bumped on every change so renderers can cache */
+    }
+
+    /**
+     * Appends one sample. Samples are expected in time order.
+     * @param {number} time - Timestamp in ms since epoch.
+     * @param {number} value - Sample value.
+     */
+    push(time, value) {
+        let i = this.head & this.mask;
+        this.times[i] = time;
+        this.values[i] = value;
+        this.head++;
+        if (this.length <= this.mask) {
+            this.length++;
+        }
+        this.version++;
+    }
+
+    /**
+     * Appends a batch of samples, e.g. from a history backfill.
+     * @param {ArrayLike<number>} times - Timestamps in ms since epoch.
+     * @param {ArrayLike<number>} values - Sample values.
+     */
+    pushBatch(times, values) {
+        for (let i = 0; i < times.length; i++) {
+            this.push(times[i], values[i]);
+        }
+    }
+
+    /**
+     * Removes all samples.
+     */
+    clear() {
+        this.head = 0;
+        this.length = 0;
+        this.version++;
+    }
+
+    /**
+     * @param {number} i - Logical index, 0 is the oldest retained sample.
+     * @returns {number} Timestamp of the i-th sample.
+     */
+    timeAt(i) {
+        return this.times[(this.head - this.length + i) & this.mask];
+    }
+
+    /**
+     * @param {number} i - Logical index, 0 is the oldest retained sample.
+     * @returns {number} Value of the i-th sample.
+     */
+    valueAt(i) {
+        return this.values[(this.head - this.length + i) & this.mask];
+    }
+
+    /**
+     * Binary search for the first sample at or after a timestamp.
+     * @param {number} time - Timestamp in ms since epoch.
+     * @returns {number} Logical index in [0, length].
+     */
+    lowerBound(time) {
+        let lo = 0;
+        let hi = this.length;
+        while (lo < hi) {
+            let mid = (lo + hi) >>> 1;
+            if (this.timeAt(mid) < time) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        return lo;
+    }
+}
 
 /**
- * @var {Chart} temperatureChart - Chart object for displaying temperature data.
+ * Min/max decimation: for every pixel column keep the first, minimum, maximum
+ * and last sample, which preserves spikes exactly at the drawn resolution.
+ * @param {TimeSeries} series - Source series.
+ * @param {number} from - First logical index (inclusive).
+ * @param {number} to - Last logical index (exclusive).
+ * @param {number} t0 - Timestamp mapped to the left edge.
+ * @param {number} t1 - Timestamp mapped to the right edge.
+ * @param {number} columns - Number of pixel columns.
+ * @param {Float64Array} outT - Output timestamps.
+ * @param {Float32Array} outV - Output values.
+ * @returns {number} Number of points written.
  */
-let temperatureChart = new Chart(ctx, {
-    type: 'line',
-    data: {
-        labels: [],
-        datasets: [{
-            label: 'Temperature (°C)',
-            data: [],
-            backgroundColor: 'rgba(255, 99, 132, 0.2)',
-            borderColor: 'rgba(255, 99, 132, 1)',
-            borderWidth: 1
-        }]
-    },
-    options: {
-        scales: {
-            x: {
-                type: 'time',
-                time: {
-                    unit: 'minute'
-                }
-            },
-            y: {
-                beginAtZero: false
+function decimateMinMax(series, from, to, t0, t1, columns, outT, outV) {
+    let n = 0;
+    let scale = columns / Math.max(t1 - t0, 1);
+    let i = from;
+    while (i < to) {
+        let column = Math.floor((series.timeAt(i) - t0) * scale);
+        let firstT = series.timeAt(i), firstV = series.valueAt(i);
+        let minT = firstT, minV = firstV, maxT = firstT, maxV = firstV;
+        let lastT = firstT, lastV = firstV;
+        i++;
+        while (i < to && Math.floor((series.timeAt(i) - t0) * scale) === column) {
+            lastT = series.timeAt(i);
+            lastV = series.valueAt(i);
+            if (lastV < minV) { minV = lastV; minT = lastT; }
+            if (lastV > maxV) { maxV = lastV; maxT = lastT; }
+            i++;
+        }
+        outT[n] = firstT; outV[n++] = firstV;
+        if (minT < maxT) {
+            if (minT !== firstT) { outT[n] = minT; outV[n++] = minV; }
+            if (maxT !== lastT) { outT[n] = maxT; outV[n++] = maxV; }
+        } else {
+            if (maxT !== firstT) { outT[n] = maxT; outV[n++] = maxV; }
+            if (minT !== lastT) { outT[n] = minT; outV[n++] = minV; }
+        }
+        if (lastT !== firstT) { outT[n] = lastT; outV[n++] = lastV; }
+    }
+    return n;
+}
+
+/**
+ * Largest-Triangle-Three-Buckets decimation. Keeps the visual shape of the
+ * series with a fixed number of output points.
+ * @param {TimeSeries} series - Source series.
+ * @param {number} from - First logical index (inclusive).
+ * @param {number} to - Last logical index (exclusive).
+ * @param {number} threshold - Number of output points.
+ * @param {Float64Array} outT - Output timestamps.
+ * @param {Float32Array} outV - Output values.
+ * @returns {number} Number of points written.
+ */
+function decimateLTTB(series, from, to, threshold, outT, outV) {
+    let count = to - from;
+    if (threshold >= count || threshold < 3) {
+        for (let i = 0; i < count; i++) {
+            outT[i] = series.timeAt(from + i);
+            outV[i] = series.valueAt(from + i);
+        }
+        return count;
+    }
+
+    let n = 0;
+    let every = (count - 2) / (threshold - 2);
+    let a = from;
+    outT[n] = series.timeAt(a); outV[n++] = series.valueAt(a);
+
+    for (let b = 0; b < threshold - 2; b++) {
+        /** Average of the next bucket is the third triangle vertex */
+        let avgStart = from + Math.floor((b + 1) * every) + 1;
+        let avgEnd = Math.min(from + Math.floor((b + 2) * every) + 1, to);
+        let avgT = 0, avgV = 0;
+        for (let j = avgStart; j < avgEnd; j++) {
+            avgT += series.timeAt(j);
+            avgV += series.valueAt(j);
+        }
+        let avgLen = avgEnd - avgStart;
+        avgT /= avgLen;
+        avgV /= avgLen;
+
+        let rangeStart = from + Math.floor(b * every) + 1;
+        let rangeEnd = from + Math.floor((b + 1) * every) + 1;
+        let aT = series.timeAt(a), aV = series.valueAt(a);
+        let maxArea = -1;
+        let next = rangeStart;
+        for (let j = rangeStart; j < rangeEnd; j++) {
+            let area = Math.abs((aT - avgT) * (series.valueAt(j) - aV) -
+                                (aT - series.timeAt(j)) * (avgV - aV));
+            if (area > maxArea) {
+                maxArea = area;
+                next = j;
             }
         }
+        outT[n] = series.timeAt(next); outV[n++] = series.valueAt(next);
+        a = next;
+    }
+
+    outT[n] = series.timeAt(to - 1); outV[n++] = series.valueAt(to - 1);
+    return n;
+}
+
+/**
+ * Canvas line chart drawing a decimated view of a TimeSeries.
+ */
+class ChartRenderer {
+    /**
+     * @param {HTMLCanvasElement} canvas - Target canvas.
+     * @param {TimeSeries} series - Data to draw.
+     * @param {Object} options - `decimation` ('minmax' or 'lttb'), `color`, `label`.
+     */
+    constructor(canvas, series, options) {
+        this.canvas = canvas;
+        this.ctx = canvas.getContext('2d');
+        this.series = series;
+        this.options = Object.assign({ decimation: 'minmax', color: 'rgba(255, 99, 132, 1)', label: '' }, options);
+        this.padding = { left: 44, right: 8, top: 18, bottom: 22 };
+        this.frameRequested = false;
+        this.cacheKey = '';
+        this.pointCount = 0;
+        this.outT = new Float64Array(0);
+        this.outV = new Float32Array(0);
+
+        window.addEventListener('resize', () => this.requestRender());
+    }
+
+    /**
+     * Schedules a redraw on the next animation frame. Calls made before that
+     * frame are coalesced into one draw.
+     */
+    requestRender() {
+        if (this.frameRequested) {
+            return;
+        }
+        this.frameRequested = true;
+        window.requestAnimationFrame(() => {
+            this.frameRequested = false;
+            this.render();
+        });
+    }
+
+    /**
+     * Resizes the backing store to the displayed size and device pixel ratio.
+     * @returns {number} Device pixel ratio in use.
+     */
+    resize() {
+        let ratio = window.devicePixelRatio || 1;
+        let width = Math.round(this.canvas.clientWidth * ratio);
+        let height = Math.round(this.canvas.clientHeight * ratio);
+        if (this.canvas.width !== width || this.canvas.height !== height) {
+            this.canvas.width = width;
+            this.canvas.height = height;
+        }
+        return ratio;
+    }
+
+    /**
+     * Decimates the visible range, reusing the previous result if neither the
+     * data nor the plot width changed.
+     * @param {number} columns - Plot width in device pixels.
+     */
+    decimate(columns) {
+        let key = this.series.version + ':' + columns + ':' + this.options.decimation;
+        if (key === this.cacheKey) {
+            return;
+        }
+        this.cacheKey = key;
+
+        let series = this.series;
+        let capacity = (columns + 1) * 4;
+        if (this.outT.length < capacity) {
+            this.outT = new Float64Array(capacity);
+            this.outV = new Float32Array(capacity);
+        }
+        if (series.length === 0) {
+            this.pointCount = 0;
+            return;
+        }
+        let t0 = series.timeAt(0);
+        let t1 = series.timeAt(series.length - 1);
+        if (this.options.decimation === 'lttb') {
+            this.pointCount = decimateLTTB(series, 0, series.length, columns * 2, this.outT, this.outV);
+        } else {
+            this.pointCount = decimateMinMax(series, 0, series.length, t0, t1, columns, this.outT, this.outV);
+        }
+    }
+
+    /**
+     * Draws axes and the decimated series.
+     */
+    render() {
+        let ratio = this.resize();
+        let ctx = this.ctx;
+        let pad = this.padding;
+        let width = this.canvas.width;
+        let height = this.canvas.height;
+        let plotX = pad.left * ratio;
+        let plotY = pad.top * ratio;
+        let plotW = Math.max(width - (pad.left + pad.right) * ratio, 1);
+        let plotH = Math.max(height - (pad.top + pad.bottom) * ratio, 1);
+
+        ctx.clearRect(0, 0, width, height);
+        ctx.font = (11 * ratio) + 'px Arial, sans-serif';
+        ctx.fillStyle = '#666';
+        ctx.textAlign = 'left';
+        ctx.textBaseline = 'top';
+        ctx.fillText(this.options.label, plotX, 2 * ratio);
+
+        this.decimate(Math.floor(plotW));
+        let n = this.pointCount;
+        if (n === 0) {
+            return;
+        }
+        let outT = this.outT;
+        let outV = this.outV;
+
+        let t0 = outT[0];
+        let t1 = outT[n - 1];
+        let vMin = Infinity;
+        let vMax = -Infinity;
+        for (let i = 0; i < n; i++) {
+            if (outV[i] < vMin) vMin = outV[i];
+            if (outV[i] > vMax) vMax = outV[i];
+        }
+        if (vMax - vMin < 0.5) {
+            let mid = (vMax + vMin) / 2;
+            vMin = mid - 0.25;
+            vMax = mid + 0.25;
+        }
+        let xScale = plotW / Math.max(t1 - t0, 1);
+        let yScale = plotH / (vMax - vMin);
+
+        /** Axes and labels */
+        ctx.strokeStyle = '#ddd';
+        ctx.lineWidth = ratio;
+        ctx.beginPath();
+        ctx.textAlign = 'right';
+        ctx.textBaseline = 'middle';
+        for (let k = 0; k <= 4; k++) {
+            let v = vMin + (vMax - vMin) * k / 4;
+            let y = plotY + plotH - (v - vMin) * yScale;
+            ctx.moveTo(plotX, y);
+            ctx.lineTo(plotX + plotW, y);
+            ctx.fillText(v.toFixed(1), plotX - 4 * ratio, y);
+        }
+        ctx.stroke();
+
+        ctx.textAlign = 'center';
+        ctx.textBaseline = 'top';
+        let span = t1 - t0;
+        for (let k = 0; k <= 3; k++) {
+            let t = t0 + span * k / 3;
+            let label = span > 86400000 ? new Date(t).toLocaleString([], { month: 'short', day: 'numeric', hour: '2-digit', minute: '2-digit' })
+                                        : new Date(t).toLocaleTimeString([], { hour: '2-digit', minute: '2-digit' });
+            ctx.fillText(label, plotX + (t - t0) * xScale, plotY + plotH + 4 * ratio);
+        }
+
+        /** Series */
+        ctx.strokeStyle = this.options.color;
+        ctx.lineWidth = ratio;
+        ctx.beginPath();
+        ctx.moveTo(plotX + (outT[0] - t0) * xScale, plotY + plotH - (outV[0] - vMin) * yScale);
+        for (let i = 1; i < n; i++) {
+            ctx.lineTo(plotX + (outT[i] - t0) * xScale, plotY + plotH - (outV[i] - vMin) * yScale);
+        }
+        ctx.stroke();
     }
-});
+}
+
+/**
+ * @var {TimeSeries} temperatureSeries - All samples received, enough for about two weeks of 10 s data.
+ */
+let temperatureSeries = new TimeSeries(131072);
+
+/**
+ * @var {ChartRenderer} temperatureChart - Renderer for the temperature chart canvas.
+ */
+let temperatureChart;
 
 /**
  * @var {WebSocket} socket - WebSocket object for connecting to the server.
@@ -55,24 +401,20 @@ function connectWebSocket() {
 
     socket.onmessage = function (event) {
         let temperature = parseFloat(event.data);
-        let time = new Date();
-
-        temperatureChart.data.datasets[0].data.push(temperature);
-        temperatureChart.data.labels.push(time);
 
         /**
-         * Limit the number of data points displayed to keep the chart readable (24 hours)
+         * A failed sensor reading arrives as "nan" and is not plotted
          */
-        let maxDataPoints = 144;
-        if (temperatureChart.data.labels.length >= maxDataPoints) {
-            temperatureChart.data.labels.shift();
-            temperatureChart.data.datasets[0].data.shift();
+        if (!Number.isFinite(temperature)) {
+            return;
         }
 
+        temperatureSeries.push(Date.now(), temperature);
+
         /**
-         * Update the chart
+         * Redraw on the next animation frame
          */
-        temperatureChart.update();
+        temperatureChart.requestRender();
 
         /**
          * Send new temperature to updateTemperature
@@ -106,8 +448,12 @@ function updateTemperature(temperature) {
 }
 
 /**
- * Establish WebSocket connection when the window loads
+ * Create the chart and establish WebSocket connection when the window loads
  */
 window.onload = function () {
+    temperatureChart = new ChartRenderer(document.getElementById('temperatureChart'), temperatureSeries, {
+        label: 'Temperature (°C)'
+    });
+    temperatureChart.requestRender();
     connectWebSocket();
-}
\ No newline at end of file
+}
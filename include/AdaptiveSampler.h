@@ -0,0 +1,144 @@
+/**
+ * @file AdaptiveSampler.h
+ * @brief Sample period that follows how fast the temperature changes.
+ *
+ * After every reading the rate of change since the previous one is compared
+ * with a threshold. Above it the period drops straight to the minimum so a
+ * transient is caught from its start; after a few flat readings in a row it
+ * doubles, up to the maximum. A change of one quantization step of the
+ * current resolution counts as flat, so sensor noise alone never speeds the
+ * sampling up.
+ *
+ * Only depends on Temperature.h so it can be used on a host as well.
+ */
+
+#ifndef ADAPTIVE_SAMPLER_H
+#define ADAPTIVE_SAMPLER_H
+
+#include <stdint.h>
+#include "Temperature.h"
+
+/** Readings below half the threshold before the period doubles */
+#ifndef SAMPLER_BACKOFF_SAMPLES
+#define SAMPLER_BACKOFF_SAMPLES 3
+#endif
+
+/** Slack between the end of a conversion and the next deadline */
+#define SAMPLER_PERIOD_MARGIN_MS 250U
+
+/**
+ * @brief Sensor resolution and sampling policy, as set through /config.
+ */
+struct SamplerConfig
+{
+  uint8_t resolution;            /**< DS18B20 resolution, 9 to 12 bits */
+  uint32_t minPeriodMs;          /**< Period while the temperature changes */
+  uint32_t maxPeriodMs;          /**< Period while it is flat, minPeriodMs for a fixed rate */
+  uint16_t thresholdCentiPerMin; /**< Rate of change in 1/100 °C per minute that counts as changing */
+
+  /** @brief Worst-case DS18B20 conversion time at a resolution, in ms. */
+  static uint16_t conversionMs(uint8_t resolution)
+  {
+    static const uint16_t times[] = {94, 188, 375, 750};
+    return times[resolution - 9];
+  }
+
+  /** @brief Whether the settings are usable, the minimum period leaving time to convert. */
+  bool valid() const
+  {
+    return resolution >= 9 && resolution <= 12 &&
+           minPeriodMs >= conversionMs(resolution) + SAMPLER_PERIOD_MARGIN_MS &&
+           maxPeriodMs >= minPeriodMs && maxPeriodMs <= 24UL * 3600 * 1000;
+  }
+};
+
+class AdaptiveSampler
+{
+public:
+  AdaptiveSampler()
+      : _config(), _period(0), _lastRaw(TEMPERATURE_RAW_INVALID), _flat(0), _speedUps(0), _backOffs(0)
+  {
+  }
+
+  /**
+   * @brief Apply new settings, keeping the current period if still in range.
+   */
+  void configure(const SamplerConfig &config)
+  {
+    _config = config;
+    if (!_period || _period < config.minPeriodMs)
+    {
+      _period = config.minPeriodMs;
+    }
+    if (_period > config.maxPeriodMs)
+    {
+      _period = config.maxPeriodMs;
+    }
+    _lastRaw = TEMPERATURE_RAW_INVALID;
+    _flat = 0;
+  }
+
+  /**
+   * @brief Account for a reading taken one period after the previous one.
+   *
+   * @param raw Reading in 1/16 °C, TEMPERATURE_RAW_INVALID if it failed.
+   * @return Period until the next reading, in ms.
+   */
+  uint32_t update(int16_t raw)
+  {
+    int16_t last = _lastRaw;
+    _lastRaw = raw;
+    if (raw == TEMPERATURE_RAW_INVALID || last == TEMPERATURE_RAW_INVALID)
+    {
+      return _period;
+    }
+
+    /** Change beyond one quantization step, in 1/100 °C per minute */
+    int32_t step = 1 << (12 - _config.resolution);
+    int32_t change = raw > last ? raw - last : last - raw;
+    change = change > step ? change - step : 0;
+    uint32_t rate = (uint64_t)rawToCentiCelsius(change) * 60000 / _period;
+
+    if (rate > _config.thresholdCentiPerMin)
+    {
+      _flat = 0;
+      if (_period != _config.minPeriodMs)
+      {
+        _period = _config.minPeriodMs;
+        _speedUps++;
+      }
+    }
+    else if (rate * 2 > _config.thresholdCentiPerMin)
+    {
+      _flat = 0;
+    }
+    else if (++_flat >= SAMPLER_BACKOFF_SAMPLES)
+    {
+      _flat = 0;
+      if (_period < _config.maxPeriodMs)
+      {
+        _period = _period > _config.maxPeriodMs / 2 ? _config.maxPeriodMs : _period * 2;
+        _backOffs++;
+      }
+    }
+    return _period;
+  }
+
+  const SamplerConfig &config() const { return _config; }
+  /** @brief Current period in ms. */
+  uint32_t period() const { return _period; }
+  /** @brief Times the period dropped to the minimum. */
+  uint32_t speedUps() const { return _speedUps; }
+  /** @brief Times the period doubled. */
+  uint32_t backOffs() const { return _backOffs; }
+
+private:
+  SamplerConfig _config;
+  uint32_t _period;
+  int16_t _lastRaw;
+  uint8_t _flat;
+  uint32_t _speedUps;
+  uint32_t _backOffs;
+};
+
+#endif /* ADAPTIVE_SAMPLER_H */
@@ -0,0 +1,73 @@
+/**
+ * @file FixedRateScheduler.h
+ * @brief Periodic wake-ups keyed to absolute deadlines.
+ *
+ * Deadlines are `start + n * period` on the microsecond esp_timer clock, so the
+ * time spent between two wake-ups never shifts the following ones. The task is
+ * woken by a one-shot esp_timer that notifies it, which keeps the wake-up
+ * accurate to well below the 1 ms FreeRTOS tick.
+ */
+
+#ifndef FIXED_RATE_SCHEDULER_H
+#define FIXED_RATE_SCHEDULER_H
+
+#include <Arduino.h>
+#include "esp_timer.h"
+
+class FixedRateScheduler
+{
+public:
+  /**
+   * @param periodMicros Time between two deadlines in microseconds.
+   */
+  explicit FixedRateScheduler(uint64_t periodMicros);
+  ~FixedRateScheduler();
+
+  /**
+   * @brief Bind the scheduler to the calling task and make now the first deadline.
+   */
+  void start();
+
+  /**
+   * @brief Block the calling task until the next deadline.
+   *
+   * If the caller overran one or more whole periods, those deadlines are
+   * skipped and counted in missed() rather than fired back to back.
+   *
+   * @return How late the task woke up relative to the deadline, in microseconds.
+   */
+  uint32_t waitNext();
+
+  /**
+   * @brief Change the period. Takes effect after the next deadline.
+   *
+   * @param periodMicros Time between two deadlines in microseconds.
+   */
+  void setPeriod(uint64_t periodMicros) { _period = periodMicros; }
+  uint64_t period() const { return _period; }
+
+  /**
+   * @brief Change the period starting from the last deadline.
+   *
+   * Unlike setPeriod() the next deadline moves too, so a shorter period takes
+   * effect right away. Only the task bound by start() may call this, between
+   * two waitNext().
+   *
+   * @param periodMicros Time between two deadlines in microseconds.
+   */
+  void reschedule(uint64_t periodMicros);
+
+  /** @brief Number of deadlines skipped because the task overran. */
+  uint32_t missed() const { return _missed; }
+
+private:
+  static void onTimer(void *arg);
+
+  esp_timer_handle_t _timer;
+  TaskHandle_t _task;
+  int64_t _deadline;
+  volatile uint64_t _period;
+  volatile uint32_t _missed;
+};
+
+#endif /* FIXED_RATE_SCHEDULER_H */
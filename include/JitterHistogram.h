@@ -0,0 +1,124 @@
+/**
+ * @file JitterHistogram.h
+ * @brief Fixed-size log-linear histogram of microsecond latencies.
+ *
+ * Every power of two is split into 8 linear sub-buckets, so a recorded value is
+ * known to within 12.5% while the whole 32-bit range fits in 240 counters:
+ * 8 exact ones below 8 us and 8 for each of the 29 powers of two above.
+ * Recording is O(1) and allocation free, so it can run in the sensing task on
+ * every sample.
+ *
+ * There is a single writer; readers in other tasks may see a snapshot that is
+ * off by the sample being recorded, which is fine for statistics.
+ */
+
+#ifndef JITTER_HISTOGRAM_H
+#define JITTER_HISTOGRAM_H
+
+#include <stdint.h>
+
+class JitterHistogram
+{
+public:
+  static const uint32_t SUB_BUCKET_BITS = 3;
+  static const uint32_t SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+  static const uint32_t BUCKETS = (32 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+  JitterHistogram() { reset(); }
+
+  /**
+   * @brief Count one value.
+   *
+   * @param value Latency in microseconds.
+   */
+  void record(uint32_t value)
+  {
+    _counts[bucketOf(value)]++;
+    _count++;
+    _sum += value;
+    if (value > _max)
+    {
+      _max = value;
+    }
+  }
+
+  /** @brief Forget all recorded values. */
+  void reset()
+  {
+    for (uint32_t i = 0; i < BUCKETS; i++)
+    {
+      _counts[i] = 0;
+    }
+    _count = 0;
+    _sum = 0;
+    _max = 0;
+  }
+
+  /**
+   * @brief Value below which a fraction of the recorded values fall.
+   *
+   * @param fraction Between 0 and 1, e.g. 0.99 for p99.
+   * @return Upper bound of the bucket holding that rank, capped at max().
+   */
+  uint32_t percentile(double fraction) const
+  {
+    if (_count == 0)
+    {
+      return 0;
+    }
+    uint32_t rank = (uint32_t)(fraction * _count + 0.5);
+    if (rank < 1)
+    {
+      rank = 1;
+    }
+    uint32_t seen = 0;
+    for (uint32_t i = 0; i < BUCKETS; i++)
+    {
+      seen += _counts[i];
+      if (seen >= rank)
+      {
+        uint32_t upper = upperBoundOf(i);
+        return upper < _max ? upper : _max;
+      }
+    }
+    return _max;
+  }
+
+  uint32_t count() const { return _count; }
+  uint32_t max() const { return _max; }
+  uint32_t mean() const { return _count ? (uint32_t)(_sum / _count) : 0; }
+
+  /** @brief Bucket index of a value. */
+  static uint32_t bucketOf(uint32_t value)
+  {
+    if (value < SUB_BUCKETS)
+    {
+      return value;
+    }
+    uint32_t msb = 31 - __builtin_clz(value);
+    uint32_t sub = (value >> (msb - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1);
+    return (msb - SUB_BUCKET_BITS + 1) * SUB_BUCKETS + sub;
+  }
+
+  /** @brief Largest value that falls into a bucket. */
+  static uint32_t upperBoundOf(uint32_t bucket)
+  {
+    if (bucket < SUB_BUCKETS)
+    {
+      return bucket;
+    }
+    uint32_t msb = bucket / SUB_BUCKETS + SUB_BUCKET_BITS - 1;
+    uint32_t sub = bucket % SUB_BUCKETS;
+    uint64_t lower = ((uint64_t)(SUB_BUCKETS + sub)) << (msb - SUB_BUCKET_BITS);
+    uint64_t width = 1ULL << (msb - SUB_BUCKET_BITS);
+    return (uint32_t)(lower + width - 1);
+  }
+
+private:
+  uint32_t _counts[BUCKETS];
+  uint32_t _count;
+  uint64_t _sum;
+  uint32_t _max;
+};
+
+#endif /* JITTER_HISTOGRAM_H */
@@ -0,0 +1,268 @@
+/**
+ * @file Journal.h
+ * @brief Append-only record journal that survives power loss mid-write.
+ *
+ * Every record is framed as
+ *
+ *     sync (0xA5) | length (1) | sequence number (4, LE) | payload | CRC-16 (2, LE)
+ *
+ * with the CRC covering length, sequence number and payload. A record torn by
+ * a power cut, or stale bytes exposed by a FAT size that ran ahead of the data,
+ * fail the CRC and are cut off at the next boot.
+ *
+ * A journal file comes in one of two layouts:
+ *
+ * - Growing: records from offset 0, the file ends after the last one. Every
+ *   append may allocate a cluster. Recovery scans backwards from the end in
+ *   JOURNAL_RECOVERY_WINDOW steps for the last record with a valid CRC that
+ *   continues the sequence numbers of the record before it, and gives up
+ *   after JOURNAL_RECOVERY_MAX bytes, so boot time does not grow with
+ *   the size of the log.
+ *
+ * - Preallocated: the file is created at its full capacity, so appends only
+ *   write data sectors that are already allocated. Two header copies in their
+ *   own sectors checkpoint the logical end every JOURNAL_CHECKPOINT_BYTES;
+ *   recovery reads forward from the newest checkpoint while the sequence
+ *   numbers continue. The CRCs are seeded with a per-file salt, so stale
+ *   records left in reused clusters by a deleted file never check out.
+ *   A record that would cross a sector boundary starts the next sector
+ *   instead, so every append is a single sector write and the last record can
+ *   be rewritten in place to grow it, see rewriteLast().
+ */
+
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <Arduino.h>
+#include "FS.h"
+
+#define JOURNAL_SYNC 0xA5
+#define JOURNAL_HEADER_SIZE 6  /**< Sync, length and sequence number */
+#define JOURNAL_TRAILER_SIZE 2 /**< CRC-16 */
+#define JOURNAL_MAX_PAYLOAD 255
+#define JOURNAL_MAX_RECORD (JOURNAL_HEADER_SIZE + JOURNAL_MAX_PAYLOAD + JOURNAL_TRAILER_SIZE)
+
+/** Default CRC seed, used by growing journals */
+#define JOURNAL_DEFAULT_SALT 0xFFFF
+
+/** Bytes read per recovery step */
+#ifndef JOURNAL_RECOVERY_WINDOW
+#define JOURNAL_RECOVERY_WINDOW 4096
+#endif
+
+/** Most bytes scanned from the end of the file during recovery */
+#ifndef JOURNAL_RECOVERY_MAX
+#define JOURNAL_RECOVERY_MAX 65536
+#endif
+
+/** "TLJ1", start of a preallocated journal */
+#define JOURNAL_MAGIC 0x314A4C54
+/** Each header copy has a sector to itself */
+#define JOURNAL_HEADER_SLOT 512
+/** First record of a preallocated journal */
+#define JOURNAL_DATA_OFFSET (2 * JOURNAL_HEADER_SLOT)
+/** Records of a preallocated journal never straddle a sector */
+#define JOURNAL_SECTOR 512
+
+/** Bytes appended to a preallocated journal between two checkpoints */
+#ifndef JOURNAL_CHECKPOINT_BYTES
+#define JOURNAL_CHECKPOINT_BYTES 4096
+#endif
+
+/**
+ * @brief One decoded record.
+ */
+struct JournalRecord
+{
+  uint32_t seq;
+  uint8_t length;
+  uint8_t payload[JOURNAL_MAX_PAYLOAD];
+};
+
+/**
+ * @brief Checkpoint of a preallocated journal.
+ */
+struct JournalCheckpoint
+{
+  uint16_t salt;       /**< CRC seed of the records */
+  uint32_t capacity;   /**< File size */
+  uint32_t end;        /**< Logical end, all records before it are valid */
+  uint32_t nextSeq;    /**< Sequence number of the record at `end` */
+  uint32_t lastOffset; /**< Start of the last record before `end`, 0 if none */
+  uint32_t generation; /**< Incremented per checkpoint, the highest valid copy wins */
+};
+
+/**
+ * @brief Writer side of a journal file.
+ */
+class Journal
+{
+public:
+  Journal();
+  ~Journal() { close(); }
+
+  /**
+   * @brief Open or create the journal and recover its tail.
+   *
+   * May be called again to switch to another file. An existing file keeps its
+   * layout; a new one is preallocated if `capacity` is not 0.
+   *
+   * @param fs File system holding the journal.
+   * @param mountPoint VFS mount point of `fs`, e.g. "/sd", used to truncate.
+   * @param path Path of the journal within `fs`.
+   * @param capacity Size of a new preallocated journal, 0 for a growing one.
+   * @param salt CRC seed of a new preallocated journal, unique per file.
+   * @return false if the file could not be opened or created.
+   */
+  bool begin(fs::FS &fs, const char *mountPoint, const char *path, uint32_t capacity = 0,
+             uint16_t salt = JOURNAL_DEFAULT_SALT);
+
+  /**
+   * @brief Append one record with the next sequence number.
+   *
+   * A failed or short write is cut off again, or overwritten, by the next append.
+   *
+   * @return false if the record could not be written completely, or does not
+   *         fit in a preallocated journal.
+   */
+  bool append(const uint8_t *payload, uint8_t length);
+
+  /**
+   * @brief Replace the last record of a preallocated journal with a longer
+   * one under the same sequence number.
+   *
+   * The rewrite stays within the record's sector, which SD cards write as a
+   * unit, so a power cut leaves either the old or the new record.
+   *
+   * @return false if the record would leave its sector, see fitsLast(), or
+   *         could not be written. A failed write is repeated by the next one.
+   */
+  bool rewriteLast(const uint8_t *payload, uint8_t length);
+
+  /** @brief Whether rewriteLast() can take a payload of `length` bytes. */
+  bool fitsLast(uint8_t length) const;
+
+  /**
+   * @brief Checkpoint and close a preallocated journal. Growing journals are
+   * only open while appending.
+   */
+  void close();
+
+  /** @brief Sequence number the next record will get. */
+  uint32_t nextSeq() const { return _nextSeq; }
+  /** @brief Logical end: header plus valid records. */
+  uint32_t size() const { return _size; }
+  /** @brief Size a preallocated journal was created with, 0 for a growing one. */
+  uint32_t capacity() const { return _capacity; }
+  /** @brief Bytes left before a preallocated journal is full. */
+  uint32_t remaining() const { return _capacity ? _capacity - _size : UINT32_MAX; }
+  /** @brief Garbage bytes cut off by the last recovery. */
+  uint32_t truncatedBytes() const { return _truncated; }
+  /** @brief Bytes read by the last recovery. */
+  uint32_t scannedBytes() const { return _scanned; }
+  /** @brief Last record in the file, or NULL if it is empty. */
+  const JournalRecord *last() const { return _hasLast ? &_last : NULL; }
+
+  /**
+   * @brief Frame a record.
+   *
+   * @param out At least length + JOURNAL_HEADER_SIZE + JOURNAL_TRAILER_SIZE bytes.
+   * @return Size of the framed record.
+   */
+  static size_t encode(uint8_t *out, uint32_t seq, const uint8_t *payload, uint8_t length,
+                       uint16_t salt = JOURNAL_DEFAULT_SALT);
+
+  /**
+   * @brief Check and decode a framed record at the start of a buffer.
+   *
+   * @param in Candidate record.
+   * @param available Bytes available at `in`.
+   * @param record Receives the record if valid.
+   * @return Size of the record, or 0 if `in` does not start with a valid one.
+   */
+  static size_t decode(const uint8_t *in, size_t available, JournalRecord &record,
+                       uint16_t salt = JOURNAL_DEFAULT_SALT);
+
+  /** @brief CRC-16/CCITT, 0xFFFF seeded by default. */
+  static uint16_t crc16(const uint8_t *data, size_t length, uint16_t crc = 0xFFFF);
+
+  /**
+   * @brief Read the newest valid checkpoint of a preallocated journal.
+   *
+   * @return false if `file` is not a preallocated journal or both copies are damaged.
+   */
+  static bool readCheckpoint(fs::File &file, JournalCheckpoint &checkpoint);
+
+  /**
+   * @brief Read and check the record at an offset.
+   *
+   * @return Size of the record, 0 if there is no valid one.
+   */
+  static size_t readRecord(fs::File &file, uint32_t offset, uint16_t salt, JournalRecord &record);
+
+private:
+  bool recover();
+  bool recoverPreallocated();
+  bool preallocate();
+  bool writeCheckpoint();
+
+  fs::FS *_fs;
+  fs::File _file; /**< Kept open for a preallocated journal */
+  char _path[32];
+  char _vfsPath[40];
+  uint32_t _nextSeq;
+  uint32_t _size;
+  uint32_t _truncated;
+  uint32_t _scanned;
+  bool _dirty; /**< A write failed, the tail needs recovery */
+  bool _hasLast;
+  JournalRecord _last;
+  uint32_t _lastOffset;
+  uint32_t _capacity;
+  uint16_t _salt;
+  JournalCheckpoint _checkpoint; /**< Last one written or recovered */
+};
+
+/**
+ * @brief Sequential reader of a journal file of either layout.
+ *
+ * Stops at the end of the file or at the first record that does not check out,
+ * which in a preallocated journal includes a gap in the sequence numbers.
+ */
+class JournalReader
+{
+public:
+  explicit JournalReader(fs::File &file) : _file(file), _started(false) {}
+
+  /**
+   * @brief Read the next record.
+   *
+   * @return false at the end of the valid records.
+   */
+  bool next(JournalRecord &record);
+
+  /** @brief Start over, e.g. after the file has been replaced. */
+  void restart() { _started = false; }
+
+  /**
+   * @brief Continue at the record starting at `offset` of a preallocated journal.
+   *
+   * Records never straddle a sector, so each used sector starts with one and a
+   * caller can search the sectors for where to start reading.
+   *
+   * @return false if no valid record starts there, the reader is then unchanged.
+   */
+  bool seek(uint32_t offset);
+
+private:
+  void start();
+
+  fs::File &_file;
+  bool _started;
+  bool _checkSeq; /**< Preallocated journal, sequence numbers must continue */
+  uint16_t _salt;
+  uint32_t _nextSeq;
+  uint32_t _offset;
+};
+
+#endif /* JOURNAL_H */
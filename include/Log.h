@@ -0,0 +1,84 @@
+/**
+ * @file Log.h
+ * @brief Compile-time filtered logging with an optional background sink.
+ *
+ * Every log statement is guarded by a constexpr comparison against LOG_LEVEL,
+ * so statements above the configured level are removed by the compiler along
+ * with their arguments and format strings. Set the level with a build flag,
+ * e.g. `-DLOG_LEVEL=LOG_LEVEL_DEBUG` to get the per-sample trace back.
+ *
+ * With `-DLOG_ASYNC=1` formatted lines go into a ring buffer and a low
+ * priority task drains them to the output, so a log call never waits on the
+ * UART. Lines that do not fit in the buffer are dropped and counted.
+ */
+
+#ifndef LOG_H
+#define LOG_H
+
+#include <Arduino.h>
+
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_INFO 3
+#define LOG_LEVEL_DEBUG 4
+
+/** Most verbose level compiled in */
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+/** Queue lines for a background task instead of writing them in the caller */
+#ifndef LOG_ASYNC
+#define LOG_ASYNC 0
+#endif
+
+/** Size of the background sink buffer in bytes */
+#ifndef LOG_BUFFER_SIZE
+#define LOG_BUFFER_SIZE 2048
+#endif
+
+/** Longest line written in one log call, longer ones are truncated */
+#define LOG_LINE_MAX 160
+
+/**
+ * @brief Whether statements at a level are compiled in.
+ */
+constexpr bool logEnabled(int level)
+{
+  return level <= LOG_LEVEL;
+}
+
+#define LOG_AT(level, format, ...)          \
+  do                                        \
+  {                                         \
+    if (logEnabled(level))                  \
+    {                                       \
+      logWrite(format "\n", ##__VA_ARGS__); \
+    }                                       \
+  } while (0)
+
+#define LOG_ERROR(format, ...) LOG_AT(LOG_LEVEL_ERROR, format, ##__VA_ARGS__)
+#define LOG_WARN(format, ...) LOG_AT(LOG_LEVEL_WARN, format, ##__VA_ARGS__)
+#define LOG_INFO(format, ...) LOG_AT(LOG_LEVEL_INFO, format, ##__VA_ARGS__)
+#define LOG_DEBUG(format, ...) LOG_AT(LOG_LEVEL_DEBUG, format, ##__VA_ARGS__)
+
+/**
+ * @brief Set the log output and, with LOG_ASYNC, start the drain task.
+ *
+ * Until this is called logs go to Serial.
+ *
+ * @param out Serial or an open File, must outlive the logger.
+ * @param core Core of the drain task.
+ */
+void logBegin(Print &out, BaseType_t core = tskNO_AFFINITY);
+
+/**
+ * @brief Format and write one log line. Use the LOG_* macros instead.
+ */
+void logWrite(const char *format, ...) __attribute__((format(printf, 1, 2)));
+
+/** @brief Lines dropped because the background sink was full. */
+uint32_t logDropped();
+
+#endif /* LOG_H */
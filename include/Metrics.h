@@ -0,0 +1,106 @@
+/**
+ * @file Metrics.h
+ * @brief Counters and histograms rendered in the Prometheus text format.
+ *
+ * Metrics are updated from any task through short critical sections and
+ * written straight to a Print (an AsyncResponseStream for /metrics), one line
+ * at a time, without building the exposition in a String first.
+ *
+ * Latencies are recorded in microseconds and exported in seconds.
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <Arduino.h>
+
+/** Default histogram bucket bounds, in microseconds */
+extern const uint32_t METRIC_LATENCY_BOUNDS[];
+extern const uint8_t METRIC_LATENCY_BOUND_COUNT;
+
+/**
+ * @brief Monotonic 64-bit counter.
+ */
+class MetricCounter
+{
+public:
+  MetricCounter() : _value(0), _mux(portMUX_INITIALIZER_UNLOCKED) {}
+
+  void add(uint64_t n = 1)
+  {
+    portENTER_CRITICAL(&_mux);
+    _value += n;
+    portEXIT_CRITICAL(&_mux);
+  }
+
+  uint64_t value() const
+  {
+    portENTER_CRITICAL(&_mux);
+    uint64_t v = _value;
+    portEXIT_CRITICAL(&_mux);
+    return v;
+  }
+
+private:
+  uint64_t _value;
+  mutable portMUX_TYPE _mux;
+};
+
+/**
+ * @brief Cumulative histogram with fixed bucket bounds.
+ */
+class MetricHistogram
+{
+public:
+  static const uint8_t MAX_BUCKETS = 12;
+
+  /**
+   * @param bounds Ascending upper bounds in microseconds, must outlive the histogram.
+   * @param count Number of bounds, at most MAX_BUCKETS.
+   */
+  MetricHistogram(const uint32_t *bounds = METRIC_LATENCY_BOUNDS,
+                  uint8_t count = METRIC_LATENCY_BOUND_COUNT);
+
+  /**
+   * @brief Count one observation.
+   *
+   * @param micros Observed latency in microseconds.
+   */
+  void observe(uint32_t micros);
+
+  /**
+   * @brief Write the _bucket, _sum and _count series of this histogram.
+   *
+   * @param out Destination.
+   * @param name Metric name without suffix.
+   * @param labels Extra labels such as `route="/"`, or NULL.
+   */
+  void write(Print &out, const char *name, const char *labels = NULL) const;
+
+private:
+  const uint32_t *_bounds;
+  uint8_t _size;
+  uint32_t _counts[MAX_BUCKETS + 1]; /**< Per bucket, last one is +Inf */
+  uint64_t _sum;
+  uint32_t _count;
+  mutable portMUX_TYPE _mux;
+};
+
+/**
+ * @brief Write the # HELP and # TYPE lines of a metric family.
+ */
+void writeMetricHeader(Print &out, const char *name, const char *type, const char *help);
+
+/**
+ * @brief Write one sample line `name{labels} value`.
+ *
+ * @param labels Labels without braces, or NULL.
+ */
+void writeMetricValue(Print &out, const char *name, const char *labels, uint64_t value);
+
+/**
+ * @brief Write one sample line with a value in microseconds, exported as seconds.
+ */
+void writeMetricSeconds(Print &out, const char *name, const char *labels, uint64_t micros);
+
+#endif /* METRICS_H */
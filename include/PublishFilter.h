@@ -0,0 +1,94 @@
+/**
+ * @file PublishFilter.h
+ * @brief Deadband filter deciding which samples are pushed to live clients.
+ *
+ * A sample passes when it differs from the last one that passed by more than
+ * the deadband, the larger of an absolute and a relative bound, or when the
+ * heartbeat interval has elapsed without anything passing. A change between
+ * a valid and a failed reading always passes. With both bounds at zero only
+ * changed values are pushed.
+ *
+ * Only filters what is pushed: the sample log still records every sample.
+ */
+
+#ifndef PUBLISH_FILTER_H
+#define PUBLISH_FILTER_H
+
+#include <stdint.h>
+#include "SampleRing.h"
+#include "Temperature.h"
+
+/**
+ * @brief Deadband of one channel, as set through /publish.
+ */
+struct DeadbandConfig
+{
+  uint16_t absoluteCenti;    /**< Changes up to this many 1/100 °C are suppressed */
+  uint16_t relativePermille; /**< Changes up to this fraction of the last value are suppressed */
+  uint32_t heartbeatS;       /**< Longest time without a push, 0 for none */
+
+  bool valid() const { return relativePermille <= 1000; }
+};
+
+class PublishFilter
+{
+public:
+  PublishFilter() : _config(), _pending(true), _lastRaw(0), _lastEpoch(0), _sent(0), _suppressed(0) {}
+
+  /** @brief Change the deadband, the next sample passes. */
+  void configure(const DeadbandConfig &config)
+  {
+    _config = config;
+    _pending = true;
+  }
+
+  /**
+   * @brief Decide whether to push a sample and count the decision.
+   *
+   * @return true if the sample should be pushed.
+   */
+  bool pass(const Sample &sample)
+  {
+    if (!_pending && !due(sample))
+    {
+      _suppressed++;
+      return false;
+    }
+    _pending = false;
+    _lastRaw = sample.raw;
+    _lastEpoch = sample.epoch;
+    _sent++;
+    return true;
+  }
+
+  const DeadbandConfig &config() const { return _config; }
+  uint32_t sent() const { return _sent; }
+  uint32_t suppressed() const { return _suppressed; }
+
+private:
+  bool due(const Sample &sample) const
+  {
+    if (_config.heartbeatS && sample.epoch - _lastEpoch >= _config.heartbeatS)
+    {
+      return true;
+    }
+    if ((sample.raw == TEMPERATURE_RAW_INVALID) != (_lastRaw == TEMPERATURE_RAW_INVALID))
+    {
+      return true;
+    }
+    int32_t change = rawToCentiCelsius(sample.raw > _lastRaw ? sample.raw - _lastRaw : _lastRaw - sample.raw);
+    int32_t last = rawToCentiCelsius(_lastRaw < 0 ? -_lastRaw : _lastRaw);
+    int32_t relative = last * _config.relativePermille / 1000;
+    int32_t deadband = relative > _config.absoluteCenti ? relative : _config.absoluteCenti;
+    return change > deadband;
+  }
+
+  DeadbandConfig _config;
+  bool _pending; /**< Push the next sample whatever it is */
+  int16_t _lastRaw;
+  uint32_t _lastEpoch;
+  volatile uint32_t _sent;
+  volatile uint32_t _suppressed;
+};
+
+#endif /* PUBLISH_FILTER_H */
@@ -0,0 +1,113 @@
+/**
+ * @file SampleCodec.h
+ * @brief Compressed blocks of consecutive samples.
+ *
+ * A block stores its first sample in full and every further one as deltas,
+ * in the spirit of Gorilla/TSZ but byte aligned:
+ *
+ *     version | firstIndex | readingID | epoch | zigzag(raw)
+ *     then per sample: (zigzag(delta of delta of epoch) << 1 | readingID changed)
+ *                      [zigzag(readingID delta)] zigzag(raw delta)
+ *
+ * with every field a LEB128 varint. Temperatures are the raw DS18B20 counts
+ * of 1/16 °C the samples carry, see Temperature.h. With a steady
+ * sample period and slowly changing temperature most samples take two bytes.
+ *
+ * `firstIndex` is the position of the block's first sample in its segment, so
+ * the sample count of a segment follows from its last block alone.
+ *
+ * Only depends on the C++ standard library so it can be benchmarked on a host.
+ */
+
+#ifndef SAMPLE_CODEC_H
+#define SAMPLE_CODEC_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "SampleRing.h"
+
+#define SAMPLE_BLOCK_VERSION 1
+
+/** Largest block payload, a few blocks share a sector */
+#ifndef SAMPLE_BLOCK_MAX_BYTES
+#define SAMPLE_BLOCK_MAX_BYTES 128
+#endif
+
+/**
+ * @brief Builds a block one sample at a time.
+ */
+class SampleBlockEncoder
+{
+public:
+  SampleBlockEncoder() { begin(0); }
+
+  /**
+   * @brief Start an empty block.
+   *
+   * @param firstIndex Position of the block's first sample in its segment.
+   */
+  void begin(uint32_t firstIndex);
+
+  /**
+   * @brief Add a sample.
+   *
+   * @return false, leaving the block as it was, if it would grow past
+   *         SAMPLE_BLOCK_MAX_BYTES.
+   */
+  bool add(const Sample &sample);
+
+  const uint8_t *data() const { return _data; }
+  uint8_t length() const { return _length; }
+  uint32_t count() const { return _count; }
+  uint32_t firstIndex() const { return _firstIndex; }
+
+private:
+  uint8_t _data[SAMPLE_BLOCK_MAX_BYTES];
+  uint8_t _length;
+  uint32_t _count;
+  uint32_t _firstIndex;
+  uint32_t _readingID; /**< Of the last sample */
+  uint32_t _epoch;
+  int64_t _delta;      /**< Epoch delta of the last two samples */
+  int32_t _raw;
+};
+
+/**
+ * @brief Reads the samples of a block back.
+ */
+class SampleBlockDecoder
+{
+public:
+  SampleBlockDecoder() : _data(NULL), _length(0), _pos(0), _count(0) {}
+
+  /**
+   * @brief Start decoding a block.
+   *
+   * @return false if it is not a block of a known version.
+   */
+  bool begin(const uint8_t *data, size_t length);
+
+  /**
+   * @brief Decode the next sample.
+   *
+   * @return false at the end of the block or on malformed data.
+   */
+  bool next(Sample &sample);
+
+  uint32_t firstIndex() const { return _firstIndex; }
+  /** @brief Samples decoded so far. */
+  uint32_t count() const { return _count; }
+
+private:
+  const uint8_t *_data;
+  size_t _length;
+  size_t _pos;
+  uint32_t _count;
+  uint32_t _firstIndex;
+  uint32_t _readingID;
+  uint32_t _epoch;
+  int64_t _delta;
+  int32_t _raw;
+};
+
+#endif /* SAMPLE_CODEC_H */
@@ -0,0 +1,264 @@
+/**
+ * @file SampleLog.h
+ * @brief Samples stored in rotating journal segments on the SD card.
+ *
+ * Samples go to numbered segment files in one directory, e.g. /log/00000042.seg.
+ * A new segment is started when the day changes or the current one is full,
+ * so no file grows without bound and a time range only touches the segments
+ * that cover it.
+ *
+ * Segments are preallocated journals of SEGMENT_MAX_BYTES, see Journal: all
+ * clusters are allocated when the segment is started, so appending a sample
+ * writes data sectors only and never waits on a FAT update.
+ *
+ * Samples are stored in compressed blocks, see SampleCodec.h, one block per
+ * Journal record. The open block is rewritten in place as samples are added
+ * and a new one is started once it is full or no longer fits in its sector,
+ * so each sample still reaches the card on its own and a power cut costs at
+ * most the sample being written.
+ *
+ * The manifest is itself a journal of segment events: opened (with the first
+ * epoch), closed (with time range, record count and size) and deleted. It is
+ * replayed into an in-memory index at boot and rewritten without the deleted
+ * segments once it holds mostly stale entries. The open segment is not in the
+ * manifest until it is closed; its count, size and last epoch come from the
+ * segment's own journal recovery.
+ *
+ * Retention deletes the oldest segments when a new one is started and the card
+ * is fuller than the configured fraction, or the index is full. Readers open
+ * segments through openSegment(), and a segment they hold open is only taken
+ * out of the index: its file is removed once the last of them closes it, as
+ * FATFS would let a reader walk clusters already given to another file.
+ */
+
+#ifndef SAMPLE_LOG_H
+#define SAMPLE_LOG_H
+
+#include <Arduino.h>
+#include "FS.h"
+#include "Journal.h"
+#include "SampleRing.h"
+#include "SampleCodec.h"
+#include "Temperature.h"
+
+/** Preallocated size of a segment, a day of 10 s samples takes 173 kB */
+#ifndef SEGMENT_MAX_BYTES
+#define SEGMENT_MAX_BYTES (256 * 1024)
+#endif
+
+/** Most segments kept, the oldest are deleted beyond that */
+#ifndef SEGMENT_INDEX_MAX
+#define SEGMENT_INDEX_MAX 1024
+#endif
+
+/** Most segments open for reading at once, see SampleLog::openSegment() */
+#ifndef SEGMENT_READERS_MAX
+#define SEGMENT_READERS_MAX 8
+#endif
+
+/**
+ * @brief Manifest entry of one segment.
+ */
+struct SegmentInfo
+{
+  uint32_t id;
+  uint32_t firstEpoch; /**< Epoch of the first sample */
+  uint32_t lastEpoch;  /**< Epoch of the last sample */
+  uint32_t count;      /**< Samples in the segment */
+  uint32_t bytes;      /**< Bytes used in the segment file */
+  bool closed;         /**< No more samples will be added */
+};
+
+/**
+ * @brief Readers of one segment, and whether it waits for them to be deleted.
+ */
+struct SegmentReaders
+{
+  SegmentInfo info;
+  uint16_t readers;
+  bool deleted; /**< Out of the index, the file goes with the last reader */
+};
+
+/**
+ * @brief Rotating, indexed journal of samples.
+ *
+ * append() and begin() belong to one task; the query functions, openSegment()
+ * and closeSegment() may be called from any task.
+ */
+class SampleLog
+{
+public:
+  /** @brief Fraction of the card in use, between 0 and 1. */
+  typedef float (*FillFunction)();
+
+  SampleLog();
+
+  /**
+   * @brief Replay the manifest and recover the open segment.
+   *
+   * @param fs File system holding the log.
+   * @param mountPoint VFS mount point of `fs`, e.g. "/sd", used to truncate.
+   * @param dir Directory of the segments and manifest, e.g. "/log".
+   * @return false if the log could not be opened.
+   */
+  bool begin(fs::FS &fs, const char *mountPoint, const char *dir);
+
+  /**
+   * @brief Delete the oldest segments at rotation while the card is fuller than `maxFill`.
+   */
+  void setRetention(float maxFill, FillFunction fill)
+  {
+    _maxFill = maxFill;
+    _fill = fill;
+  }
+
+  /**
+   * @brief Append one sample, starting a new segment first if needed.
+   *
+   * @return Bytes written, 0 on failure.
+   */
+  size_t append(const Sample &sample);
+
+  /**
+   * @brief IDs of the segments overlapping a time range, oldest first.
+   *
+   * @param from First epoch of the range.
+   * @param to Last epoch of the range.
+   * @param ids Receives up to `max` segment IDs.
+   * @return Number of IDs written.
+   */
+  size_t findSegments(uint32_t from, uint32_t to, uint32_t *ids, size_t max) const;
+
+  /**
+   * @brief Copy the manifest entry at a position, 0 being the oldest segment.
+   *
+   * @return false past the last segment.
+   */
+  bool segmentAt(size_t index, SegmentInfo &info) const;
+
+  /** @brief Path of a segment file within the file system. */
+  void segmentPath(char *out, size_t size, uint32_t id) const;
+
+  /**
+   * @brief Open a segment for reading, keeping retention from deleting it meanwhile.
+   *
+   * @param id Segment to open.
+   * @param file Receives the open file.
+   * @param info Receives the manifest entry of the segment if not NULL.
+   * @return false if the segment is no longer in the index, or too many are open.
+   */
+  bool openSegment(uint32_t id, File &file, SegmentInfo *info = NULL) const;
+
+  /** @brief Close a segment from openSegment(). */
+  void closeSegment(uint32_t id, File &file) const;
+
+  /** @brief CRC seed of a segment, distinct for neighbouring IDs. */
+  static uint16_t segmentSalt(uint32_t id);
+
+  fs::FS &fs() const { return *_fs; }
+  size_t segmentCount() const { return _count; }
+  uint64_t storedBytes() const;
+  uint32_t deletedSegments() const { return _deleted; }
+  /** @brief Journal of the open segment. */
+  const Journal &journal() const { return _segment; }
+
+private:
+  enum ManifestEvent : uint8_t { SEGMENT_OPENED = 'O', SEGMENT_CLOSED = 'C', SEGMENT_DELETED = 'D' };
+
+  bool replay();
+  bool rotate(uint32_t epoch);
+  bool writeEvent(Journal &journal, ManifestEvent event, const SegmentInfo &info);
+  void applyEvent(const JournalRecord &record);
+  void enforceRetention();
+  bool deleteOldest();
+  void removeSegment(const SegmentInfo &info);
+  void removeDeferred();
+  bool compactManifest();
+  int indexOf(uint32_t id) const;
+
+  fs::FS *_fs;
+  const char *_mountPoint;
+  char _dir[16];
+  char _manifestPath[32];
+  Journal _manifest;
+  Journal _segment;     /**< Open segment */
+  bool _segmentOpen;
+  SampleBlockEncoder _block; /**< Last block of the open segment */
+  SegmentInfo *_segments; /**< Index, oldest first, guarded by _mux */
+  mutable SegmentReaders _readers[SEGMENT_READERS_MAX]; /**< Open segments, guarded by _mux */
+  size_t _count;
+  uint32_t _nextId;
+  uint32_t _deleted;
+  size_t _deferred; /**< Deleted segments still being read */
+  float _maxFill;
+  FillFunction _fill;
+  mutable portMUX_TYPE _mux;
+};
+
+/**
+ * @brief Streams the samples of a time range as CSV, a buffer at a time.
+ *
+ * Only the segments overlapping the range are opened, one after the other.
+ * Reading starts at the sector of the first segment holding `from`, found by
+ * a binary search over the first block of each sector, so a range starting
+ * late in a segment does not decode it from its start. Like the end of the
+ * range, this relies on the samples being in time order. Meant as the filler of a chunked HTTP response: read() is called until it
+ * returns 0, and the last file is closed when the export is destroyed.
+ */
+class SampleCsvExport
+{
+public:
+  /**
+   * @param log Log to export.
+   * @param from First epoch of the range.
+   * @param to Last epoch of the range.
+   * @param fahrenheit Temperatures in °F instead of °C.
+   */
+  SampleCsvExport(const SampleLog &log, uint32_t from, uint32_t to, bool fahrenheit = false);
+  ~SampleCsvExport();
+
+  /**
+   * @brief Fill a buffer with the next part of the CSV.
+   *
+   * @return Bytes written to `buffer`, 0 once the range has been exported.
+   */
+  size_t read(uint8_t *buffer, size_t maxLen);
+
+  /**
+   * @brief Format one sample as a CSV line.
+   *
+   * @return Length of the line, as snprintf().
+   */
+  static int formatLine(char *out, size_t size, const Sample &sample, bool fahrenheit);
+
+  /**
+   * @brief Next sample of the range, for callers that format it themselves
+   * instead of calling read().
+   *
+   * @return false once the range has been exported.
+   */
+  bool nextSample(Sample &sample);
+
+private:
+  const SampleLog &_log;
+  uint32_t _from;
+  uint32_t _to;
+  bool _fahrenheit;
+  uint32_t *_ids;
+  size_t _idCount;
+  size_t _nextId;
+  uint32_t _fileId; /**< Segment _file belongs to */
+  File _file;
+  JournalReader _reader;
+  JournalRecord _record;
+  SampleBlockDecoder _decoder; /**< Over _record */
+  char _line[64];
+  uint8_t _lineLength;
+  uint8_t _linePos;
+  bool _done;
+
+  void closeFile();
+  void seekFrom(const SegmentInfo &info);
+};
+
+#endif /* SAMPLE_LOG_H */
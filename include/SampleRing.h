@@ -0,0 +1,158 @@
+/**
+ * @file SampleRing.h
+ * @brief Lock-free single-producer/multi-consumer ring buffer of samples.
+ *
+ * The acquisition side publishes samples without ever waiting on a consumer.
+ * Every consumer owns a cursor and reads at its own pace; a consumer that
+ * falls more than one ring behind skips ahead and counts what it missed,
+ * rather than holding the producer back.
+ *
+ * Each slot carries a stamp that is odd while the producer writes it and
+ * `2 * seq + 2` once sequence number `seq` is complete. Readers copy the slot
+ * and re-check the stamp, so a slot overwritten mid-read is detected and
+ * dropped instead of returned torn.
+ *
+ * The header only depends on <atomic> so it can be built and stress tested on
+ * a host as well as on the ESP32.
+ */
+
+#ifndef SAMPLE_RING_H
+#define SAMPLE_RING_H
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief One temperature reading as handed from acquisition to consumers.
+ */
+struct Sample
+{
+  uint32_t readingID;  /**< Boot-persistent reading number */
+  uint32_t epoch;      /**< Local time in seconds since 1970, from NTP */
+  int16_t raw;         /**< Temperature in 1/16 °C as read from the sensor, see Temperature.h */
+};
+
+/**
+ * @brief Read position of one consumer in a SampleRing.
+ */
+struct SampleCursor
+{
+  uint32_t next = 0;    /**< Sequence number of the next sample to read */
+  uint32_t dropped = 0; /**< Samples overwritten before this consumer read them */
+};
+
+/**
+ * @brief Lock-free SPMC ring buffer.
+ *
+ * @tparam T Trivially copyable element type.
+ * @tparam N Capacity, must be a power of two.
+ */
+template <typename T, size_t N>
+class SampleRing
+{
+  static_assert(N >= 2 && (N & (N - 1)) == 0, "SampleRing capacity must be a power of two");
+
+public:
+  SampleRing() : _head(0)
+  {
+    for (size_t i = 0; i < N; i++)
+    {
+      _slots[i].stamp.store(0, std::memory_order_relaxed);
+    }
+  }
+
+  /**
+   * @brief Publish a sample. Only one task may call this. Never blocks.
+   *
+   * @param value Sample to publish.
+   * @return Sequence number assigned to the sample.
+   */
+  uint32_t publish(const T &value)
+  {
+    uint32_t seq = _head.load(std::memory_order_relaxed);
+    Slot &slot = _slots[seq & (N - 1)];
+    slot.stamp.store(2 * seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.value = value;
+    slot.stamp.store(2 * seq + 2, std::memory_order_release);
+    _head.store(seq + 1, std::memory_order_release);
+    return seq;
+  }
+
+  /**
+   * @brief Read the next sample for a consumer. Safe to call from any number
+   * of tasks concurrently, as long as each uses its own cursor.
+   *
+   * @param cursor Consumer position, advanced on success.
+   * @param value Receives the sample.
+   * @return true if a sample was read, false if the consumer is up to date.
+   */
+  bool poll(SampleCursor &cursor, T &value) const
+  {
+    for (;;)
+    {
+      uint32_t head = _head.load(std::memory_order_acquire);
+      if (cursor.next == head)
+      {
+        return false;
+      }
+      if (head - cursor.next > N)
+      {
+        /** Fell behind by more than a ring: skip to the oldest retained slot */
+        cursor.dropped += head - cursor.next - N;
+        cursor.next = head - N;
+      }
+
+      const Slot &slot = _slots[cursor.next & (N - 1)];
+      uint32_t expected = 2 * cursor.next + 2;
+      uint32_t before = slot.stamp.load(std::memory_order_acquire);
+      if (before == expected)
+      {
+        value = slot.value;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.stamp.load(std::memory_order_relaxed) == expected)
+        {
+          cursor.next++;
+          return true;
+        }
+      }
+      /** Slot is being or has been overwritten by a newer sample */
+      cursor.dropped++;
+      cursor.next++;
+    }
+  }
+
+  /**
+   * @brief Cursor positioned at the next sample to be published, so a new
+   * consumer only sees samples from now on.
+   */
+  SampleCursor cursor() const
+  {
+    SampleCursor c;
+    c.next = _head.load(std::memory_order_acquire);
+    return c;
+  }
+
+  /** @brief Number of samples published so far. */
+  uint32_t published() const { return _head.load(std::memory_order_acquire); }
+
+  /** @brief Number of samples a consumer has not read yet, capped at the capacity. */
+  uint32_t pending(const SampleCursor &cursor) const
+  {
+    uint32_t behind = published() - cursor.next;
+    return behind > N ? N : behind;
+  }
+
+private:
+  struct Slot
+  {
+    std::atomic<uint32_t> stamp;
+    T value;
+  };
+
+  Slot _slots[N];
+  std::atomic<uint32_t> _head;
+};
+
+#endif /* SAMPLE_RING_H */
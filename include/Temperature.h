@@ -0,0 +1,129 @@
+/**
+ * @file Temperature.h
+ * @brief Raw DS18B20 temperatures and their fixed-point formatting.
+ *
+ * Samples carry the sensor's own 16-bit scratchpad value, a count of 1/16 °C,
+ * from acquisition to storage. It is converted to °C or °F only where a human
+ * or a CSV reads it, with integer arithmetic: the conversions round half away
+ * from zero without branching on the sign.
+ *
+ * Only depends on <stdint.h> so it can be used on a host as well.
+ */
+
+#ifndef TEMPERATURE_H
+#define TEMPERATURE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** Raw value of a failed reading, below anything the sensor can report */
+#define TEMPERATURE_RAW_INVALID INT16_MIN
+
+/** Longest formatted temperature of any 16-bit raw value, with its terminator */
+#define TEMPERATURE_STRING_SIZE 12
+
+/**
+ * @brief Scratchpad value from DallasTemperature::getTemp(), which is in 1/128 °C.
+ *
+ * @param raw128 getTemp() result, DEVICE_DISCONNECTED_RAW on failure.
+ * @param disconnected DEVICE_DISCONNECTED_RAW.
+ */
+inline int16_t temperatureFromDallas(int32_t raw128, int32_t disconnected)
+{
+  return raw128 == disconnected ? TEMPERATURE_RAW_INVALID : (int16_t)(raw128 >> 3);
+}
+
+/**
+ * @brief Clear the bits a DS18B20 leaves undefined below 12-bit resolution.
+ *
+ * @param raw Raw count in 1/16 °C.
+ * @param resolution 9 to 12 bits.
+ */
+inline int16_t temperatureAtResolution(int16_t raw, uint8_t resolution)
+{
+  return raw == TEMPERATURE_RAW_INVALID ? raw : (int16_t)(raw & ~((1 << (12 - resolution)) - 1));
+}
+
+/** @brief Divide by 2^shift, rounding half away from zero, without branches. */
+inline int32_t roundedShift(int32_t value, uint8_t shift)
+{
+  int32_t sign = value >> 31;
+  int32_t magnitude = (value ^ sign) - sign;
+  int32_t quotient = (magnitude + (1 << (shift - 1))) >> shift;
+  return (quotient ^ sign) - sign;
+}
+
+/** @brief Raw count in hundredths of a °C. */
+inline int32_t rawToCentiCelsius(int16_t raw)
+{
+  /** raw / 16 * 100 */
+  return roundedShift(raw * 25, 2);
+}
+
+/** @brief Raw count in hundredths of a °F. */
+inline int32_t rawToCentiFahrenheit(int16_t raw)
+{
+  /** raw / 16 * 9 / 5 * 100 + 3200 */
+  return roundedShift(raw * 45, 2) + 3200;
+}
+
+/** @brief Raw count in °C, for code that needs a float. */
+inline float rawToCelsius(int16_t raw)
+{
+  return raw * 0.0625f;
+}
+
+/**
+ * @brief Format hundredths with two decimals, e.g. 2350 as "23.50".
+ *
+ * @param out At least TEMPERATURE_STRING_SIZE bytes.
+ * @return Length of the string.
+ */
+inline size_t formatCenti(char *out, int32_t centi)
+{
+  char digits[12];
+  size_t count = 0;
+  size_t length = 0;
+  uint32_t magnitude = centi < 0 ? -(uint32_t)centi : centi;
+  if (centi < 0)
+  {
+    out[length++] = '-';
+  }
+  do
+  {
+    digits[count++] = '0' + magnitude % 10;
+    magnitude /= 10;
+  } while (magnitude || count < 3);
+  while (count > 2)
+  {
+    out[length++] = digits[--count];
+  }
+  out[length++] = '.';
+  out[length++] = digits[1];
+  out[length++] = digits[0];
+  out[length] = 0;
+  return length;
+}
+
+/**
+ * @brief Format a raw count as °C or °F with two decimals.
+ *
+ * @param out At least TEMPERATURE_STRING_SIZE bytes.
+ * @param raw Raw count, TEMPERATURE_RAW_INVALID gives "nan".
+ * @param fahrenheit Format in °F instead of °C.
+ * @return Length of the string.
+ */
+inline size_t formatTemperature(char *out, int16_t raw, bool fahrenheit = false)
+{
+  if (raw == TEMPERATURE_RAW_INVALID)
+  {
+    out[0] = 'n';
+    out[1] = 'a';
+    out[2] = 'n';
+    out[3] = 0;
+    return 3;
+  }
+  return formatCenti(out, fahrenheit ? rawToCentiFahrenheit(raw) : rawToCentiCelsius(raw));
+}
+
+#endif /* TEMPERATURE_H */
@@ -26,9 +26,9 @@ void AsyncElegantOtaClass::begin(AsyncWebServer *server, const char* username, c
             }
         }
         #if defined(ESP8266)
-            request->send(200, "application/json", "{\"id\": \""+_id+"\", \"hardware\": \"ESP8266\"}");
+            request->send(200, "application/json", "{\"id\": \""+_id+"\", \"hardware\": \"ESP8266\", \"ota\": "+_progressJson()+"}");
         #elif defined(ESP32)
-            request->send(200, "application/json", "{\"id\": \""+_id+"\", \"hardware\": \"ESP32\"}");
+            request->send(200, "application/json", "{\"id\": \""+_id+"\", \"hardware\": \"ESP32\", \"ota\": "+_progressJson()+"}");
         #endif
     });
 
@@ -86,26 +86,92 @@ void AsyncElegantOtaClass::begin(AsyncWebServer *server, const char* username, c
                 Update.printError(Serial);
                 return request->send(400, "text/plain", "OTA could not begin");
             }
+
+            // Flash a sector at a time, while the next one is received
+            _writer.begin([](uint8_t *block, size_t blockLen) {
+                return Update.write(block, blockLen);
+            }, request->contentLength());
+            // A client gone before the end leaves nobody to finish the update
+            request->onDisconnect([this]() {
+                _abort();
+            });
+            _progress(true);
+        }
+
+        // Given up on already, the rest of the upload is ignored
+        if(!_writer.progress().active){
+            return;
         }
 
         // Write chunked data to the free sketch space
         if(len){
-            if (Update.write(data, len) != len) {
+            if (!_writer.write(data, len)) {
+                _abort();
                 return request->send(400, "text/plain", "OTA could not begin");
             }
         }
             
         if (final) { // if the final flag is set then this is the last frame of data
-            if (!Update.end(true)) { //true to set the size to the current progress
+            bool written = _writer.end();
+            if (!Update.end(true) || !written) { //true to set the size to the current progress
                 Update.printError(Serial);
+                _progress(true);
                 return request->send(400, "text/plain", "Could not end OTA");
             }
+            _progress(true);
         }else{
+            _progress(false);
             return;
         }
     });
 }
 
+// Stop an update still being received, freeing the writer, so Update can be
+// begun again
+void AsyncElegantOtaClass::_abort(){
+    if(!_writer.progress().active){
+        return;
+    }
+    _writer.abort();
+    #if defined(ESP32)
+        Update.abort();
+    #else
+        Update.end(false);
+    #endif
+    _progress(true);
+}
+
+void AsyncElegantOtaClass::onProgress(AsyncElegantOtaProgressHandler handler){
+    _onProgress = handler;
+}
+
+AsyncElegantOtaProgress AsyncElegantOtaClass::progress() const {
+    AsyncElegantOtaProgress progress = _writer.progress();
+    // Update.end() may still refuse what was written, e.g. on a wrong MD5
+    progress.failed = progress.failed || Update.hasError();
+    return progress;
+}
+
+void AsyncElegantOtaClass::_progress(bool force){
+    if(!_onProgress || (!force && millis() - _progressMillis < OTA_PROGRESS_INTERVAL_MS)){
+        return;
+    }
+    _progressMillis = millis();
+    _onProgress(progress());
+}
+
+String AsyncElegantOtaClass::_progressJson() const {
+    AsyncElegantOtaProgress p = progress();
+    return String("{\"active\": ") + (p.active ? "true" : "false")
+        + ", \"failed\": " + (p.failed ? "true" : "false")
+        + ", \"total\": " + String((uint32_t)p.total)
+        + ", \"received\": " + String((uint32_t)p.received)
+        + ", \"written\": " + String((uint32_t)p.written)
+        + ", \"elapsedMs\": " + String(p.elapsedMillis)
+        + ", \"bytesPerS\": " + String(p.bytesPerSecond)
+        + ", \"waitMs\": " + String(p.waitMillis) + "}";
+}
+
 // deprecated, keeping for backward compatibility
 void AsyncElegantOtaClass::loop() {
 }
@@ -24,6 +24,14 @@
 #include "FS.h"
 
 #include "elegantWebpage.h"
+#include "AsyncElegantOtaWriter.h"
+
+// Least time between two progress callbacks while an update is received
+#ifndef OTA_PROGRESS_INTERVAL_MS
+    #define OTA_PROGRESS_INTERVAL_MS 500
+#endif
+
+typedef std::function<void(const AsyncElegantOtaProgress &progress)> AsyncElegantOtaProgressHandler;
 
 
 class AsyncElegantOtaClass{
@@ -35,6 +43,12 @@ class AsyncElegantOtaClass{
             loop(),
             restart();
 
+        // Called from the upload handler, at most every OTA_PROGRESS_INTERVAL_MS
+        // and once the update is done
+        void onProgress(AsyncElegantOtaProgressHandler handler);
+        // Progress of the update being received, or of the last one
+        AsyncElegantOtaProgress progress() const;
+
     private:
         AsyncWebServer *_server;
 
@@ -45,6 +59,14 @@ class AsyncElegantOtaClass{
         String _password = "";
         bool _authRequired = false;
 
+        AsyncElegantOtaWriter _writer;
+        AsyncElegantOtaProgressHandler _onProgress;
+        uint32_t _progressMillis = 0;
+
+        void _abort();
+        void _progress(bool force);
+        String _progressJson() const;
+
 };
 
 extern AsyncElegantOtaClass AsyncElegantOTA;
@@ -0,0 +1,248 @@
+#include "AsyncElegantOtaWriter.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+AsyncElegantOtaWriter::AsyncElegantOtaWriter()
+    : _buffers(NULL)
+    , _block(NULL)
+    , _fill(0)
+    , _active(false)
+    , _failed(false)
+    , _total(0)
+    , _start(0)
+    , _received(0)
+    , _written(0)
+    , _waitMillis(0)
+    , _elapsedMillis(0)
+    #ifndef ESP8266
+    , _filled(NULL)
+    , _free(NULL)
+    , _threaded(false)
+    #endif
+{
+}
+
+AsyncElegantOtaWriter::~AsyncElegantOtaWriter(){
+    end();
+    #ifndef ESP8266
+        delete _filled;
+        delete _free;
+    #endif
+}
+
+void AsyncElegantOtaWriter::begin(AsyncElegantOtaSink sink, size_t total){
+    if(_active){
+        end();
+    }
+    _sink = sink;
+    _failed = false;
+    _total = total;
+    _received = 0;
+    _written = 0;
+    _waitMillis = 0;
+    _elapsedMillis = 0;
+    _start = _now();
+    _block = NULL;
+    _fill = 0;
+
+    // Without the buffers, chunks go to the sink as they come
+    _buffers = (uint8_t *)malloc(OTA_BUFFERS * OTA_SECTOR_SIZE);
+    #ifndef ESP8266
+        if(_buffers){
+            _threaded = _startWriter();
+        }
+    #endif
+    _active = true;
+}
+
+bool AsyncElegantOtaWriter::write(const uint8_t *data, size_t len){
+    if(!_active){
+        return false;
+    }
+    _received += len;
+    if(!_buffers){
+        _writeBlock((uint8_t *)data, len);
+        return !_failed;
+    }
+    while(len){
+        if(!_block){
+            _block = _take();
+            _fill = 0;
+        }
+        size_t n = OTA_SECTOR_SIZE - _fill;
+        if(n > len){
+            n = len;
+        }
+        memcpy(_block + _fill, data, n);
+        _fill += n;
+        data += n;
+        len -= n;
+        if(_fill == OTA_SECTOR_SIZE){
+            _submit(_block, _fill);
+            _block = NULL;
+        }
+    }
+    return !_failed;
+}
+
+bool AsyncElegantOtaWriter::end(){
+    if(!_active){
+        return false;
+    }
+    if(_block){
+        _submit(_block, _fill);
+        _block = NULL;
+    }
+    _close();
+    return !_failed;
+}
+
+void AsyncElegantOtaWriter::abort(){
+    if(!_active){
+        return;
+    }
+    // Blocks still queued are skipped by the writer, the one being filled
+    // goes back to it empty so that all of them are returned
+    _failed = true;
+    if(_block){
+        _submit(_block, 0);
+        _block = NULL;
+    }
+    _close();
+}
+
+void AsyncElegantOtaWriter::_close(){
+    #ifndef ESP8266
+        if(_threaded){
+            _stopWriter();
+            _threaded = false;
+        }
+    #endif
+    free(_buffers);
+    _buffers = NULL;
+    _elapsedMillis = _now() - _start;
+    _active = false;
+}
+
+AsyncElegantOtaProgress AsyncElegantOtaWriter::progress() const {
+    AsyncElegantOtaProgress progress;
+    progress.active = _active;
+    progress.failed = _failed;
+    progress.total = _total;
+    progress.received = _received;
+    progress.written = _written;
+    progress.elapsedMillis = progress.active ? _now() - _start : _elapsedMillis.load();
+    progress.bytesPerSecond = progress.elapsedMillis ? (uint64_t)progress.written * 1000 / progress.elapsedMillis : 0;
+    progress.waitMillis = _waitMillis;
+    return progress;
+}
+
+uint8_t *AsyncElegantOtaWriter::_take(){
+    #ifndef ESP8266
+        if(_threaded){
+            // Both blocks full: the network waits for the flash here
+            uint32_t start = _now();
+            AsyncElegantOtaBlock block = _free->receive();
+            _waitMillis += _now() - start;
+            return block.data;
+        }
+    #endif
+    return _buffers;
+}
+
+void AsyncElegantOtaWriter::_submit(uint8_t *data, size_t len){
+    #ifndef ESP8266
+        if(_threaded){
+            AsyncElegantOtaBlock block = { data, len };
+            _filled->send(block);
+            return;
+        }
+    #endif
+    _writeBlock(data, len);
+}
+
+void AsyncElegantOtaWriter::_writeBlock(uint8_t *data, size_t len){
+    // After a failed write the rest is dropped, Update has given up anyway
+    if(!len || _failed){
+        return;
+    }
+    if(_sink(data, len) != len){
+        _failed = true;
+        return;
+    }
+    _written += len;
+}
+
+#ifndef ESP8266
+
+bool AsyncElegantOtaWriter::_startWriter(){
+    if(!_filled){
+        _filled = new AsyncElegantOtaQueue();
+        _free = new AsyncElegantOtaQueue();
+    }
+    if(!_filled->valid() || !_free->valid()){
+        return false;
+    }
+    for(size_t i = 0; i < OTA_BUFFERS; i++){
+        AsyncElegantOtaBlock block = { _buffers + i * OTA_SECTOR_SIZE, 0 };
+        _free->send(block);
+    }
+    #if defined(ESP32)
+        if(xTaskCreate(_task, "ota_writer", OTA_WRITER_STACK, this, OTA_WRITER_PRIORITY, NULL) != pdPASS){
+            for(size_t i = 0; i < OTA_BUFFERS; i++){
+                _free->receive();
+            }
+            return false;
+        }
+    #else
+        _thread = std::thread([this]{
+            _run();
+        });
+    #endif
+    return true;
+}
+
+void AsyncElegantOtaWriter::_stopWriter(){
+    // All blocks back means all of them were written
+    for(size_t i = 0; i < OTA_BUFFERS; i++){
+        _free->receive();
+    }
+    AsyncElegantOtaBlock stop = { NULL, 0 };
+    _filled->send(stop);
+    _free->receive();
+    #if !defined(ESP32)
+        _thread.join();
+    #endif
+}
+
+void AsyncElegantOtaWriter::_run(){
+    for(;;){
+        AsyncElegantOtaBlock block = _filled->receive();
+        if(!block.data){
+            break;
+        }
+        _writeBlock(block.data, block.len);
+        _free->send(block);
+    }
+    AsyncElegantOtaBlock stopped = { NULL, 0 };
+    _free->send(stopped);
+}
+
+#if defined(ESP32)
+void AsyncElegantOtaWriter::_task(void *writer){
+    ((AsyncElegantOtaWriter *)writer)->_run();
+    vTaskDelete(NULL);
+}
+#endif
+
+#endif
+
+uint32_t AsyncElegantOtaWriter::_now(){
+    #if defined(ESP32) || defined(ESP8266)
+        return millis();
+    #else
+        return (uint32_t)std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    #endif
+}
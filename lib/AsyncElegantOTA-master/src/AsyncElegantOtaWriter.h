@@ -0,0 +1,174 @@
+#ifndef AsyncElegantOtaWriter_h
+#define AsyncElegantOtaWriter_h
+
+// Write stage between the upload handler and Update: the firmware is gathered
+// into flash sector sized blocks, written by a task of their own while the
+// next block is being received. On the ESP8266, or if the buffers cannot be
+// had, blocks are written from the caller instead.
+//
+// Plain C++ apart from the writer task, so it can be benchmarked on a host,
+// see bench/ota_writer_bench.cpp in the project.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <functional>
+
+#if defined(ESP32) || defined(ESP8266)
+    #include "Arduino.h"
+#else
+    #include <chrono>
+    #include <condition_variable>
+    #include <mutex>
+    #include <thread>
+#endif
+
+// One flash sector, what Update erases and writes at a time
+#define OTA_SECTOR_SIZE 4096
+// One block being received while the other is written
+#define OTA_BUFFERS 2
+
+#ifndef OTA_WRITER_PRIORITY
+    #define OTA_WRITER_PRIORITY 3 // as async_tcp, so neither starves the other
+#endif
+#ifndef OTA_WRITER_STACK
+    #define OTA_WRITER_STACK 4096
+#endif
+
+// Where the blocks go, Update.write(): returns how much of it was written
+typedef std::function<size_t(uint8_t *data, size_t len)> AsyncElegantOtaSink;
+
+struct AsyncElegantOtaProgress {
+    bool active;
+    bool failed;
+    size_t total;              // size announced by the client, 0 if unknown
+    size_t received;
+    size_t written;            // to flash
+    uint32_t elapsedMillis;
+    uint32_t bytesPerSecond;   // written over elapsed
+    uint32_t waitMillis;       // receiving waited for a block to be written
+};
+
+// A block on its way to the writer and back, data NULL to stop it
+struct AsyncElegantOtaBlock {
+    uint8_t *data;
+    size_t len;
+};
+
+#if defined(ESP32)
+
+// Blocks handed between the tasks, a FreeRTOS queue
+class AsyncElegantOtaQueue {
+    private:
+        QueueHandle_t _queue;
+
+    public:
+        AsyncElegantOtaQueue() {
+            _queue = xQueueCreate(OTA_BUFFERS + 1, sizeof(AsyncElegantOtaBlock));
+        }
+        ~AsyncElegantOtaQueue() {
+            vQueueDelete(_queue);
+        }
+        bool valid() const {
+            return _queue != NULL;
+        }
+        void send(const AsyncElegantOtaBlock &block) {
+            xQueueSend(_queue, &block, portMAX_DELAY);
+        }
+        AsyncElegantOtaBlock receive() {
+            AsyncElegantOtaBlock block;
+            xQueueReceive(_queue, &block, portMAX_DELAY);
+            return block;
+        }
+};
+
+#elif !defined(ESP8266)
+
+// The host version of the queue
+class AsyncElegantOtaQueue {
+    private:
+        std::mutex _mutex;
+        std::condition_variable _ready;
+        AsyncElegantOtaBlock _blocks[OTA_BUFFERS + 1];
+        size_t _head = 0;
+        size_t _count = 0;
+
+    public:
+        bool valid() const {
+            return true;
+        }
+        void send(const AsyncElegantOtaBlock &block) {
+            std::lock_guard<std::mutex> l(_mutex);
+            _blocks[(_head + _count++) % (OTA_BUFFERS + 1)] = block;
+            _ready.notify_one();
+        }
+        AsyncElegantOtaBlock receive() {
+            std::unique_lock<std::mutex> l(_mutex);
+            _ready.wait(l, [this]{ return _count > 0; });
+            AsyncElegantOtaBlock block = _blocks[_head];
+            _head = (_head + 1) % (OTA_BUFFERS + 1);
+            _count--;
+            return block;
+        }
+};
+
+#endif
+
+class AsyncElegantOtaWriter {
+
+    public:
+        AsyncElegantOtaWriter();
+        ~AsyncElegantOtaWriter();
+
+        // Start an update of total bytes (0 if unknown), finishing a previous
+        // one that never got to end()
+        void begin(AsyncElegantOtaSink sink, size_t total);
+        // Take a chunk of the upload; false once a block failed to be written,
+        // or outside of begin() and end()
+        bool write(const uint8_t *data, size_t len);
+        // Write what is left and wait for all of it; false if any write failed
+        bool end();
+        // Give up on the update: what is not written yet is dropped, and the
+        // writer and its buffers are gone once it returns. Marks it failed.
+        void abort();
+        // Safe to call from any task
+        AsyncElegantOtaProgress progress() const;
+
+    private:
+        AsyncElegantOtaSink _sink;
+        uint8_t *_buffers;
+        uint8_t *_block;           // being filled, NULL until the next one is taken
+        size_t _fill;
+        std::atomic<bool> _active;
+        std::atomic<bool> _failed;
+        std::atomic<uint32_t> _total;
+        std::atomic<uint32_t> _start;
+        std::atomic<uint32_t> _received;
+        std::atomic<uint32_t> _written;
+        std::atomic<uint32_t> _waitMillis;
+        std::atomic<uint32_t> _elapsedMillis;
+
+        #ifndef ESP8266
+            // kept from one update to the next, the writer may still be
+            // returning from its last send when it is done with them
+            AsyncElegantOtaQueue *_filled;  // to the writer
+            AsyncElegantOtaQueue *_free;    // back from it
+            bool _threaded;
+            #if defined(ESP32)
+                static void _task(void *writer);
+            #else
+                std::thread _thread;
+            #endif
+            void _run();
+            bool _startWriter();
+            void _stopWriter();
+        #endif
+
+        void _close();
+        uint8_t *_take();
+        void _submit(uint8_t *data, size_t len);
+        void _writeBlock(uint8_t *data, size_t len);
+        static uint32_t _now();
+};
+
+#endif
@@ -50,7 +50,7 @@ class AsyncEventSourceResponse;
 class AsyncEventSourceClient;
 typedef std::function<void(AsyncEventSourceClient *client)> ArEventHandlerFunction;
 
-class AsyncEventSourceMessage {
+class AsyncEventSourceMessage: public IntrusiveQueueItem {
   private:
     uint8_t * _data; 
     size_t _len;
@@ -71,7 +71,7 @@ class AsyncEventSourceClient {
     AsyncClient *_client;
     AsyncEventSource *_server;
     uint32_t _lastId;
-    LinkedList<AsyncEventSourceMessage *> _messageQueue;
+    IntrusiveQueue<AsyncEventSourceMessage> _messageQueue;
     void _queueMessage(AsyncEventSourceMessage *dataMessage);
     void _runQueue();
 
@@ -98,7 +98,7 @@ class AsyncEventSourceClient {
 class AsyncEventSource: public AsyncWebHandler {
   private:
     String _url;
-    LinkedList<AsyncEventSourceClient *> _clients;
+    SmallVector<AsyncEventSourceClient *, 4> _clients;
     ArEventHandlerFunction _connectcb;
   public:
     AsyncEventSource(const String& url);
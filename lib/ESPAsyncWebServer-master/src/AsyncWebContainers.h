@@ -0,0 +1,252 @@
+/*
+  Asynchronous WebServer library for Espressif MCUs
+
+  Copyright (c) 2016 Hristo Gochkov. All rights reserved.
+  This file is part of the esp8266 core for Arduino environment.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#ifndef ASYNCWEBCONTAINERS_H_
+#define ASYNCWEBCONTAINERS_H_
+
+// Plain C++ without Arduino dependencies, so it can be benchmarked on a host,
+// see bench/web_containers_bench.cpp in the project.
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// Array keeping its first N items inside the object, so a container that stays
+// that small, as those of a typical request do, never allocates. Past N the
+// items move to the heap, doubling its size as it fills. Order is kept, so
+// removing is a shift of the items after it; add() is constant time. Items
+// handed to onRemove are out of the container already, so it may be changed
+// from there. If memory runs out add() hands the item to onRemove instead of
+// keeping it.
+template <typename T, size_t N>
+class SmallVector {
+  public:
+    typedef std::function<void(const T&)> OnRemove;
+    typedef std::function<bool(const T&)> Predicate;
+    typedef const T* ConstIterator;
+  private:
+    T* _data;
+    size_t _length;
+    size_t _capacity;
+    OnRemove _onRemove;
+    typename std::aligned_storage<sizeof(T), alignof(T)>::type _inline[N ? N : 1];
+
+    T* _inlineData(){ return reinterpret_cast<T*>(_inline); }
+    bool _grow(){
+      size_t capacity = _capacity < 2 ? 4 : _capacity * 2;
+      T* data = (T*)malloc(capacity * sizeof(T));
+      if(data == nullptr)
+        return false;
+      for(size_t i = 0; i < _length; i++){
+        new(&data[i]) T(std::move(_data[i]));
+        _data[i].~T();
+      }
+      if(_data != _inlineData())
+        ::free(_data);
+      _data = data;
+      _capacity = capacity;
+      return true;
+    }
+    // take the item at i out, shifting the ones after it down
+    T _take(size_t i){
+      T value(std::move(_data[i]));
+      for(; i + 1 < _length; i++)
+        _data[i] = std::move(_data[i + 1]);
+      _data[--_length].~T();
+      return value;
+    }
+
+  public:
+    SmallVector(OnRemove onRemove) : _data(_inlineData()), _length(0), _capacity(N), _onRemove(onRemove) {}
+    ~SmallVector(){
+      for(size_t i = 0; i < _length; i++)
+        _data[i].~T();
+      if(_data != _inlineData())
+        ::free(_data);
+    }
+    SmallVector(const SmallVector&) = delete;
+    SmallVector& operator=(const SmallVector&) = delete;
+
+    ConstIterator begin() const { return _data; }
+    ConstIterator end() const { return _data + _length; }
+
+    void add(const T& t){
+      if(_length == _capacity && !_grow()){
+        if(_onRemove)
+          _onRemove(t);
+        return;
+      }
+      new(&_data[_length++]) T(t);
+    }
+    T& front() const {
+      return _data[0];
+    }
+    bool isEmpty() const {
+      return _length == 0;
+    }
+    size_t length() const {
+      return _length;
+    }
+    size_t count_if(Predicate predicate) const {
+      size_t count = 0;
+      for(size_t i = 0; i < _length; i++){
+        if(!predicate || predicate(_data[i]))
+          count++;
+      }
+      return count;
+    }
+    const T* nth(size_t n) const {
+      return n < _length ? &_data[n] : nullptr;
+    }
+    bool remove(const T& t){
+      for(size_t i = 0; i < _length; i++){
+        if(_data[i] == t){
+          T value = _take(i);
+          if(_onRemove)
+            _onRemove(value);
+          return true;
+        }
+      }
+      return false;
+    }
+    bool remove_first(Predicate predicate){
+      for(size_t i = 0; i < _length; i++){
+        if(predicate(_data[i])){
+          T value = _take(i);
+          if(_onRemove)
+            _onRemove(value);
+          return true;
+        }
+      }
+      return false;
+    }
+    // remove every item matching, returns how many
+    size_t remove_if(Predicate predicate){
+      size_t removed = 0;
+      while(remove_first(predicate))
+        removed++;
+      return removed;
+    }
+
+    void free(){
+      while(_length){
+        T value(std::move(_data[_length - 1]));
+        _data[--_length].~T();
+        if(_onRemove)
+          _onRemove(value);
+      }
+      if(_data != _inlineData()){
+        ::free(_data);
+        _data = _inlineData();
+        _capacity = N;
+      }
+    }
+};
+
+// Link of an item in an IntrusiveQueue, which the item derives from.
+class IntrusiveQueueItem {
+  template <typename T> friend class IntrusiveQueue;
+  IntrusiveQueueItem* _queueNext;
+  public:
+    IntrusiveQueueItem() : _queueNext(nullptr) {}
+};
+
+// FIFO of items linked through their own IntrusiveQueueItem, so queueing and
+// dequeueing allocate nothing and take constant time. The queue owns its
+// items: they are deleted when removed, and an item is in one queue at most.
+template <typename T>
+class IntrusiveQueue {
+  private:
+    T* _head;
+    T* _tail;
+    size_t _length;
+
+    static T* _next(const T* item){ return static_cast<T*>(item->_queueNext); }
+
+    class Iterator {
+      T* _item;
+    public:
+      Iterator(T* item = nullptr) : _item(item) {}
+      Iterator& operator ++() { _item = _next(_item); return *this; }
+      bool operator != (const Iterator& i) const { return _item != i._item; }
+      T* operator * () const { return _item; }
+    };
+
+  public:
+    typedef const Iterator ConstIterator;
+    ConstIterator begin() const { return ConstIterator(_head); }
+    ConstIterator end() const { return ConstIterator(nullptr); }
+
+    IntrusiveQueue() : _head(nullptr), _tail(nullptr), _length(0) {}
+    ~IntrusiveQueue(){ free(); }
+    IntrusiveQueue(const IntrusiveQueue&) = delete;
+    IntrusiveQueue& operator=(const IntrusiveQueue&) = delete;
+
+    void add(T* item){
+      item->_queueNext = nullptr;
+      if(_tail)
+        _tail->_queueNext = item;
+      else
+        _head = item;
+      _tail = item;
+      _length++;
+    }
+    T* front() const {
+      return _head;
+    }
+    bool isEmpty() const {
+      return _head == nullptr;
+    }
+    size_t length() const {
+      return _length;
+    }
+    // unlink and delete item, constant time for the front one
+    bool remove(T* item){
+      T* previous = nullptr;
+      for(T* it = _head; it; previous = it, it = _next(it)){
+        if(it == item){
+          if(previous)
+            previous->_queueNext = it->_queueNext;
+          else
+            _head = _next(it);
+          if(_tail == it)
+            _tail = previous;
+          _length--;
+          delete it;
+          return true;
+        }
+      }
+      return false;
+    }
+    void free(){
+      while(_head){
+        T* it = _head;
+        _head = _next(it);
+        _length--;
+        delete it;
+      }
+      _tail = nullptr;
+    }
+};
+
+#endif /* ASYNCWEBCONTAINERS_H_ */
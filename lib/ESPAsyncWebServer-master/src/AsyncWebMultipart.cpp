@@ -0,0 +1,60 @@
+/*
+  Asynchronous WebServer library for Espressif MCUs
+
+  Copyright (c) 2016 Hristo Gochkov. All rights reserved.
+  This file is part of the esp8266 core for Arduino environment.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#include "AsyncWebMultipart.h"
+
+#include <string.h>
+
+bool AsyncWebMultipartDelimiter::begin(const char * boundary, size_t length){
+  if(length == 0 || length > MULTIPART_BOUNDARY_MAX)
+    return false;
+  memcpy(_pattern, "\r\n--", 4);
+  memcpy(_pattern + 4, boundary, length);
+  _length = length + 4;
+  memset(_skip, _length, sizeof(_skip));
+  for(size_t i = 0; i + 1 < _length; i++)
+    _skip[_pattern[i]] = _length - 1 - i;
+  return true;
+}
+
+size_t AsyncWebMultipartDelimiter::dataLength(const uint8_t * data, size_t len) const {
+  size_t m = _length;
+  size_t pos = 0;
+  if(m == 0)
+    return 0;
+  uint8_t last = _pattern[m - 1];
+  while(pos + m <= len){
+    uint8_t c = data[pos + m - 1];
+    if(c == last && memcmp(data + pos, _pattern, m - 1) == 0)
+      return pos;
+    pos += _skip[c];
+  }
+  //the skips never pass over the start of a delimiter cut by the end of data
+  while(pos < len){
+    const uint8_t * cr = (const uint8_t *)memchr(data + pos, '\r', len - pos);
+    if(cr == NULL)
+      return len;
+    pos = cr - data;
+    if(memcmp(cr, _pattern, len - pos) == 0)
+      return pos;
+    pos++;
+  }
+  return len;
+}
@@ -0,0 +1,56 @@
+/*
+  Asynchronous WebServer library for Espressif MCUs
+
+  Copyright (c) 2016 Hristo Gochkov. All rights reserved.
+  This file is part of the esp8266 core for Arduino environment.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#ifndef ASYNCWEBMULTIPART_H_
+#define ASYNCWEBMULTIPART_H_
+
+// Plain C++ without Arduino dependencies, so it can be benchmarked on a host,
+// see bench/multipart_bench.cpp in the project.
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Longest boundary RFC 2046 allows
+#define MULTIPART_BOUNDARY_MAX 70
+// The delimiter ending a part: CRLF, two dashes and the boundary
+#define MULTIPART_DELIMITER_MAX (MULTIPART_BOUNDARY_MAX + 4)
+
+// Boyer-Moore-Horspool search for the delimiter ending a part of a multipart
+// body, so the data of a part is found in slices rather than byte by byte:
+// on file data it moves by up to the delimiter's length per comparison.
+class AsyncWebMultipartDelimiter {
+  private:
+    uint8_t _pattern[MULTIPART_DELIMITER_MAX];
+    uint8_t _length;
+    //how far the pattern may move on when the byte under its end is this one
+    uint8_t _skip[256];
+
+  public:
+    AsyncWebMultipartDelimiter():_length(0){}
+    // false if the boundary is empty or longer than MULTIPART_BOUNDARY_MAX
+    bool begin(const char * boundary, size_t length);
+    size_t length() const { return _length; }
+    // Bytes at the start of data that are part data for sure: all of them up to
+    // the first delimiter, or up to a tail that could be the start of one and
+    // needs the next segment to tell.
+    size_t dataLength(const uint8_t * data, size_t len) const;
+};
+
+#endif /* ASYNCWEBMULTIPART_H_ */
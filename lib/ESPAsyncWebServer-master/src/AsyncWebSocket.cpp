@@ -29,6 +29,14 @@
 #include <Hash.h>
 #endif
 
+#ifdef ESP32
+#if __has_include("esp32/rom/miniz.h")
+#include "esp32/rom/miniz.h"
+#else
+#include "rom/miniz.h"
+#endif
+#endif
+
 #define MAX_PRINTF_LEN 64
 
 size_t webSocketSendFrameWindow(AsyncClient *client){
@@ -69,7 +77,7 @@ size_t webSocketSendFrame(AsyncClient *client, bool final, uint8_t opcode, bool
     return 0;
   }
 
-  buf[0] = opcode & 0x0F;
+  buf[0] = opcode & (0x0F | WS_COMPRESSED);
   if(final)
     buf[0] |= 0x80;
   if(len < 126)
@@ -165,7 +173,7 @@ AsyncWebSocketMessageBuffer::AsyncWebSocketMessageBuffer(const AsyncWebSocketMes
   ,_count(0)
 {
   _len = copy._len;
-  _lock = copy._lock;
+  _lock = copy._lock.load();
   _count = 0;
 
   if (_len) {
@@ -187,7 +195,7 @@ AsyncWebSocketMessageBuffer::AsyncWebSocketMessageBuffer(AsyncWebSocketMessageBu
   ,_count(0)
 {
   _len = copy._len;
-  _lock = copy._lock;
+  _lock = copy._lock.load();
   _count = 0;
 
   if (copy._data) {
@@ -225,12 +233,59 @@ bool AsyncWebSocketMessageBuffer::reserve(size_t size)
 }
 
 
+/*
+ * Reassembly Buffer Pool
+ */
+
+AsyncWebSocketBufferPool::AsyncWebSocketBufferPool(size_t count, size_t size)
+  :_memory(nullptr)
+  ,_count(count > 32 ? 32 : count)
+  ,_size(size)
+  ,_free(_count == 32 ? 0xFFFFFFFF : ((uint32_t)1 << _count) - 1)
+  ,_exhausted(0)
+{
+}
+
+AsyncWebSocketBufferPool::~AsyncWebSocketBufferPool()
+{
+  free(_memory);
+}
+
+uint8_t * AsyncWebSocketBufferPool::take()
+{
+  AsyncWebLockGuard l(_lock);
+  if(!_memory){
+    _memory = (uint8_t*)malloc(_count * (_size + 1));
+  }
+  if(!_memory || !_free){
+    _exhausted++;
+    return nullptr;
+  }
+  uint8_t index = __builtin_ctz(_free);
+  _free &= ~((uint32_t)1 << index);
+  return _memory + index * (_size + 1);
+}
+
+void AsyncWebSocketBufferPool::give(uint8_t * buffer)
+{
+  if(!buffer)
+    return;
+  AsyncWebLockGuard l(_lock);
+  size_t index = (buffer - _memory) / (_size + 1);
+  _free |= (uint32_t)1 << index;
+}
+
+size_t AsyncWebSocketBufferPool::available() const
+{
+  return __builtin_popcount(_free);
+}
+
 
 /*
  * Control Frame
  */
 
-class AsyncWebSocketControl {
+class AsyncWebSocketControl: public IntrusiveQueueItem {
   private:
     uint8_t _opcode;
     uint8_t *_data;
@@ -279,7 +334,7 @@ AsyncWebSocketBasicMessage::AsyncWebSocketBasicMessage(const char * data, size_t
   ,_ack(0)
   ,_acked(0)
 {
-  _opcode = opcode & 0x07;
+  _opcode = opcode & (0x07 | WS_COMPRESSED);
   _mask = mask;
   _data = (uint8_t*)malloc(_len+1);
   if(_data == NULL){
@@ -298,7 +353,7 @@ AsyncWebSocketBasicMessage::AsyncWebSocketBasicMessage(uint8_t opcode, bool mask
   ,_acked(0)
   ,_data(NULL)
 {
-  _opcode = opcode & 0x07;
+  _opcode = opcode & (0x07 | WS_COMPRESSED);
   _mask = mask;
   
 }
@@ -374,15 +429,16 @@ AsyncWebSocketBasicMessage::~AsyncWebSocketBasicMessage() {
  */
 
 
-AsyncWebSocketMultiMessage::AsyncWebSocketMultiMessage(AsyncWebSocketMessageBuffer * buffer, uint8_t opcode, bool mask)
+AsyncWebSocketMultiMessage::AsyncWebSocketMultiMessage(AsyncWebSocketMessageBuffer * buffer, uint8_t opcode, bool mask, bool encoded)
   :_len(0)
+  ,_headLen(0)
   ,_sent(0)
   ,_ack(0)
   ,_acked(0)
   ,_WSbuffer(nullptr)
 {
 
-  _opcode = opcode & 0x07;
+  _opcode = opcode & (0x07 | WS_COMPRESSED);
   _mask = mask;
 
   if (buffer) {
@@ -390,6 +446,13 @@ AsyncWebSocketMultiMessage::AsyncWebSocketMultiMessage(AsyncWebSocketMessageBuff
     (*_WSbuffer)++; 
     _data = buffer->get(); 
     _len = buffer->length(); 
+    if (encoded && _len >= 2) {
+      //a whole frame: the payload follows the header, the opcode is in it
+      _headLen = AsyncWebSocketFrameParser::headerSize(_data[1]);
+      _opcode = _data[0] & (0x07 | WS_COMPRESSED);
+      _data += _headLen;
+      _len -= _headLen;
+    }
     _status = WS_MSG_SENDING;
     //ets_printf("M: %u\n", _len);
   } else {
@@ -399,6 +462,10 @@ AsyncWebSocketMultiMessage::AsyncWebSocketMultiMessage(AsyncWebSocketMessageBuff
 } 
 
 
+AsyncWebSocketMultiMessage * AsyncWebSocketMultiMessage::copy() const {
+  return new AsyncWebSocketMultiMessage(_WSbuffer, _opcode, _mask, _headLen != 0);
+}
+
 AsyncWebSocketMultiMessage::~AsyncWebSocketMultiMessage() {
   if (_WSbuffer) {
     (*_WSbuffer)--; // decreases the counter. 
@@ -429,6 +496,16 @@ AsyncWebSocketMultiMessage::~AsyncWebSocketMultiMessage() {
       return 0;
   }
 
+  //the frame encoded once for every client goes out as it is when the window takes it whole
+  if(_headLen && !_sent && !_mask && client->canSend() && client->space() >= _headLen + _len){
+    size_t frameLen = _headLen + _len;
+    if(client->add((const char *)(_data - _headLen), frameLen) != frameLen || !client->send())
+      return 0;
+    _sent = _len;
+    _ack += frameLen;
+    return _len;
+  }
+
   size_t toSend = _len - _sent;
   size_t window = webSocketSendFrameWindow(client);
 
@@ -463,18 +540,30 @@ AsyncWebSocketMultiMessage::~AsyncWebSocketMultiMessage() {
  const char * AWSC_PING_PAYLOAD = "ESPAsyncWebServer-PING";
  const size_t AWSC_PING_PAYLOAD_LEN = 22;
 
-AsyncWebSocketClient::AsyncWebSocketClient(AsyncWebServerRequest *request, AsyncWebSocket *server)
-  : _controlQueue(LinkedList<AsyncWebSocketControl *>([](AsyncWebSocketControl *c){ delete  c; }))
-  , _messageQueue(LinkedList<AsyncWebSocketMessage *>([](AsyncWebSocketMessage *m){ delete  m; }))
-  , _tempObject(NULL)
+AsyncWebSocketClient::AsyncWebSocketClient(AsyncWebServerRequest *request, AsyncWebSocket *server, uint8_t deflateBits)
+  : _tempObject(NULL)
 {
   _client = request->client();
   _server = server;
   _clientId = _server->_getNextId();
   _status = WS_CONNECTED;
   _pstate = 0;
+  _pcompressed = false;
+  _deflateBits = deflateBits;
+  if(_deflateBits)
+    _pheader.allowRsv(WS_HEADER_RSV1);
   _lastMessageTime = millis();
-  _keepAlivePeriod = 0;
+  _lastRxTime = _lastMessageTime;
+  _keepAlivePeriod = _server->pingInterval();
+  _awaitingReply = false;
+  _awaitingSince = 0;
+  _closeInitiated = false;
+  _rxBuffer = NULL;
+  _rxLen = 0;
+  _rxOpcode = 0;
+  _rxStreaming = false;
+  _rxDiscard = false;
+  _rxCompressed = false;
   _client->setRxTimeout(0);
   _client->onError([](void *r, AsyncClient* c, int8_t error){ (void)c; ((AsyncWebSocketClient*)(r))->_onError(error); }, this);
   _client->onAck([](void *r, AsyncClient* c, size_t len, uint32_t time){ (void)c; ((AsyncWebSocketClient*)(r))->_onAck(len, time); }, this);
@@ -488,18 +577,21 @@ AsyncWebSocketClient::AsyncWebSocketClient(AsyncWebServerRequest *request, Async
 }
 
 AsyncWebSocketClient::~AsyncWebSocketClient(){
+  _releaseRxBuffer();
   _messageQueue.free();
   _controlQueue.free();
   _server->_handleEvent(this, WS_EVT_DISCONNECT, NULL, NULL, 0);
 }
 
 void AsyncWebSocketClient::_onAck(size_t len, uint32_t time){
+  AsyncWebLockGuard l(_server->lock());
   _lastMessageTime = millis();
   if(!_controlQueue.isEmpty()){
     auto head = _controlQueue.front();
     if(head->finished()){
       len -= head->len();
-      if(_status == WS_DISCONNECTING && head->opcode() == WS_DISCONNECT){
+      //our reply to the close of the peer is through, a close of our own waits for the peer's reply
+      if(_status == WS_DISCONNECTING && head->opcode() == WS_DISCONNECT && !_closeInitiated){
         _controlQueue.remove(head);
         _status = WS_DISCONNECTED;
         _client->close(true);
@@ -516,9 +608,20 @@ void AsyncWebSocketClient::_onAck(size_t len, uint32_t time){
 }
 
 void AsyncWebSocketClient::_onPoll(){
+  AsyncWebLockGuard l(_server->lock());
+  uint32_t now = millis();
+  if(_awaitingReply && _server->pongTimeout() && (now - _awaitingSince) >= _server->pongTimeout()){
+    //gone without a word, as a device that slept or lost its network does
+    _server->_dropClient(this);
+    return;
+  }
   if(_client->canSend() && (!_controlQueue.isEmpty() || !_messageQueue.isEmpty())){
     _runQueue();
-  } else if(_keepAlivePeriod > 0 && _controlQueue.isEmpty() && _messageQueue.isEmpty() && (millis() - _lastMessageTime) >= _keepAlivePeriod){
+  }
+  //a client only receiving sends nothing on its own, so this pings it even while messages go out
+  if(_keepAlivePeriod > 0 && _status == WS_CONNECTED && !_awaitingReply && _controlQueue.isEmpty() && (now - _lastRxTime) >= _keepAlivePeriod){
+    _awaitingReply = true;
+    _awaitingSince = now;
     ping((uint8_t *)AWSC_PING_PAYLOAD, AWSC_PING_PAYLOAD_LEN);
   }
 }
@@ -535,14 +638,26 @@ void AsyncWebSocketClient::_runQueue(){
   }
 }
 
+size_t AsyncWebSocketClient::queuedBytes() const {
+  AsyncWebLockGuard l(_server->lock());
+  size_t bytes = 0;
+  for(const auto& m: _messageQueue){
+    bytes += m->queuedBytes();
+  }
+  return bytes;
+}
+
 bool AsyncWebSocketClient::queueIsFull(){
   if((_messageQueue.length() >= WS_MAX_QUEUED_MESSAGES) || (_status != WS_CONNECTED) ) return true;
   return false;
 }
 
+// The queues are shared with the async_tcp task, sending and acking from them,
+// so they are only touched under the server's lock.
 void AsyncWebSocketClient::_queueMessage(AsyncWebSocketMessage *dataMessage){
   if(dataMessage == NULL)
     return;
+  AsyncWebLockGuard l(_server->lock());
   if(_status != WS_CONNECTED){
     delete dataMessage;
     return;
@@ -560,14 +675,21 @@ void AsyncWebSocketClient::_queueMessage(AsyncWebSocketMessage *dataMessage){
 void AsyncWebSocketClient::_queueControl(AsyncWebSocketControl *controlMessage){
   if(controlMessage == NULL)
     return;
+  AsyncWebLockGuard l(_server->lock());
   _controlQueue.add(controlMessage);
   if(_client->canSend())
     _runQueue();
 }
 
 void AsyncWebSocketClient::close(uint16_t code, const char * message){
+  AsyncWebLockGuard l(_server->lock());
   if(_status != WS_CONNECTED)
     return;
+  //nothing more is sent or counted as connected, the connection ends with the reply
+  _status = WS_DISCONNECTING;
+  _closeInitiated = true;
+  _awaitingReply = true;
+  _awaitingSince = millis();
   if(code){
     uint8_t packetLen = 2;
     if(message != NULL){
@@ -603,47 +725,56 @@ void AsyncWebSocketClient::_onTimeout(uint32_t time){
 }
 
 void AsyncWebSocketClient::_onDisconnect(){
+  //not while another task is queueing to it
+  AsyncWebLockGuard l(_server->lock());
   _client = NULL;
   _server->_handleDisconnect(this);
 }
 
+// The status and timers are shared with the tasks sending and closing, and
+// only changed under the lock here. It is not held across the whole segment:
+// the message handlers called from it may take their time, and lock out every
+// other task meanwhile if it were.
 void AsyncWebSocketClient::_onData(void *pbuf, size_t plen){
-  _lastMessageTime = millis();
+  {
+    AsyncWebLockGuard l(_server->lock());
+    _lastMessageTime = millis();
+    _lastRxTime = _lastMessageTime;
+    if(_status == WS_CONNECTED)
+      _awaitingReply = false;
+  }
   uint8_t *data = (uint8_t*)pbuf;
   while(plen > 0){
     if(!_pstate){
-      const uint8_t *fdata = data;
-      _pinfo.index = 0;
-      _pinfo.final = (fdata[0] & 0x80) != 0;
-      _pinfo.opcode = fdata[0] & 0x0F;
-      _pinfo.masked = (fdata[1] & 0x80) != 0;
-      _pinfo.len = fdata[1] & 0x7F;
-      data += 2;
-      plen -= 2;
-      if(_pinfo.len == 126){
-        _pinfo.len = fdata[3] | (uint16_t)(fdata[2]) << 8;
-        data += 2;
-        plen -= 2;
-      } else if(_pinfo.len == 127){
-        _pinfo.len = fdata[9] | (uint16_t)(fdata[8]) << 8 | (uint32_t)(fdata[7]) << 16 | (uint32_t)(fdata[6]) << 24 | (uint64_t)(fdata[5]) << 32 | (uint64_t)(fdata[4]) << 40 | (uint64_t)(fdata[3]) << 48 | (uint64_t)(fdata[2]) << 56;
-        data += 8;
-        plen -= 8;
-      }
-
-      if(_pinfo.masked){
-        memcpy(_pinfo.mask, data, 4);
-        data += 4;
-        plen -= 4;
+      //the header may continue in the next segment, the parser keeps what it has seen
+      size_t used = _pheader.parse(data, plen);
+      data += used;
+      plen -= used;
+      if(_pheader.status() == WS_HEADER_INCOMPLETE)
+        return;
+      if(_pheader.status() == WS_HEADER_INVALID){
+        //stays invalid, so nothing more is parsed until the connection is gone
+        close(1002, "Protocol error");
+        return;
       }
+      _pinfo.index = 0;
+      _pinfo.final = _pheader.final();
+      _pinfo.opcode = _pheader.opcode();
+      _pinfo.masked = _pheader.masked();
+      _pinfo.len = _pheader.length();
+      _pcompressed = (_pheader.rsv() & WS_HEADER_RSV1) != 0;
+      if(_pinfo.masked)
+        memcpy(_pinfo.mask, _pheader.mask(), 4);
+      _pheader.reset();
     }
 
     const size_t datalen = std::min((size_t)(_pinfo.len - _pinfo.index), plen);
-    const auto datalast = data[datalen];
+    //the byte after the payload may belong to the next frame, and is past the end of the buffer if not
+    const bool restore = datalen < plen;
+    const uint8_t datalast = restore ? data[datalen] : 0;
 
-    if(_pinfo.masked){
-      for(size_t i=0;i<datalen;i++)
-        data[i] ^= _pinfo.mask[(_pinfo.index+i)%4];
-    }
+    if(_pinfo.masked)
+      AsyncWebSocketFrameParser::unmask(data, datalen, _pinfo.mask, _pinfo.index);
 
     if((datalen + _pinfo.index) < _pinfo.len){
       _pstate = 1;
@@ -654,7 +785,10 @@ void AsyncWebSocketClient::_onData(void *pbuf, size_t plen){
           _pinfo.num = 0;
         } else _pinfo.num += 1;
       }
-      _server->_handleEvent(this, WS_EVT_DATA, (void *)&_pinfo, (uint8_t*)data, datalen);
+      if(_server->_reassembles())
+        _onMessageData(data, datalen, false);
+      else
+        _server->_handleEvent(this, WS_EVT_DATA, (void *)&_pinfo, (uint8_t*)data, datalen);
 
       _pinfo.index += datalen;
     } else if((datalen + _pinfo.index) == _pinfo.len){
@@ -667,11 +801,16 @@ void AsyncWebSocketClient::_onData(void *pbuf, size_t plen){
             _server->_handleEvent(this, WS_EVT_ERROR, (void *)&reasonCode, (uint8_t*)reasonString, strlen(reasonString));
           }
         }
+        AsyncWebLockGuard l(_server->lock());
         if(_status == WS_DISCONNECTING){
           _status = WS_DISCONNECTED;
+          //gone with the connection, as in _onAck()
           _client->close(true);
+          return;
         } else {
           _status = WS_DISCONNECTING;
+          _awaitingReply = true;
+          _awaitingSince = millis();
           _client->ackLater();
           _queueControl(new AsyncWebSocketControl(WS_DISCONNECT, data, datalen));
         }
@@ -681,7 +820,10 @@ void AsyncWebSocketClient::_onData(void *pbuf, size_t plen){
         if(datalen != AWSC_PING_PAYLOAD_LEN || memcmp(AWSC_PING_PAYLOAD, data, AWSC_PING_PAYLOAD_LEN) != 0)
           _server->_handleEvent(this, WS_EVT_PONG, NULL, data, datalen);
       } else if(_pinfo.opcode < 8){//continuation or text/binary frame
-        _server->_handleEvent(this, WS_EVT_DATA, (void *)&_pinfo, data, datalen);
+        if(_server->_reassembles())
+          _onMessageData(data, datalen, _pinfo.final);
+        else
+          _server->_handleEvent(this, WS_EVT_DATA, (void *)&_pinfo, data, datalen);
       }
     } else {
       //os_printf("frame error: len: %u, index: %llu, total: %llu\n", datalen, _pinfo.index, _pinfo.len);
@@ -690,7 +832,7 @@ void AsyncWebSocketClient::_onData(void *pbuf, size_t plen){
     }
 
     // restore byte as _handleEvent may have added a null terminator i.e., data[len] = 0;
-    if (datalen > 0)
+    if (restore)
       data[datalen] = datalast;
 
     data += datalen;
@@ -698,6 +840,117 @@ void AsyncWebSocketClient::_onData(void *pbuf, size_t plen){
   }
 }
 
+// Part of a text or binary message; last is set on the end of its final frame.
+void AsyncWebSocketClient::_onMessageData(uint8_t *data, size_t len, bool last){
+  if(_pinfo.index == 0 && _pinfo.opcode != WS_CONTINUATION){
+    //first frame of a new message, drop whatever was left of the previous one
+    _releaseRxBuffer();
+    _rxOpcode = _pinfo.opcode;
+    _rxLen = 0;
+    _rxStreaming = false;
+    _rxDiscard = false;
+    _rxCompressed = _pcompressed;
+    if(_pinfo.len > _server->_rxBuffers().bufferSize()){
+      //known to be too large from the first frame header, never buffer it
+      if(!_server->_streams() || _rxCompressed){
+        _discardMessage(1009, "Message too big");
+      } else {
+        _rxStreaming = true;
+      }
+    }
+  } else if(_pinfo.index == 0 && !_rxOpcode){
+    //continuation frame without a message to continue
+    _discardMessage(1002, "Unexpected continuation");
+    return;
+  }
+
+  if(_rxDiscard){
+    if(last)
+      _rxOpcode = 0;
+    return;
+  }
+
+  if(!_rxStreaming){
+    if(!_rxBuffer)
+      _rxBuffer = _server->_rxBuffers().take();
+    if(_rxBuffer && _rxLen + len <= _server->_rxBuffers().bufferSize()){
+      memcpy(_rxBuffer + _rxLen, data, len);
+      _rxLen += len;
+      if(last){
+        if(_rxCompressed){
+          _inflateMessage();
+        } else {
+          _rxBuffer[_rxLen] = 0;
+          _server->_handleMessage(this, _rxOpcode, _rxBuffer, _rxLen);
+        }
+        _releaseRxBuffer();
+        _rxOpcode = 0;
+      }
+      return;
+    }
+    //no buffer free or the message outgrew it: stream it from here on, unless
+    //it is compressed as it can only be inflated whole
+    if(!_server->_streams() || _rxCompressed){
+      _discardMessage(_rxBuffer ? 1009 : 1013, _rxBuffer ? "Message too big" : "Try again later");
+      return;
+    }
+    _rxStreaming = true;
+    if(_rxLen){
+      size_t buffered = _rxLen;
+      _rxLen = 0;
+      _streamMessageData(_rxBuffer, buffered, false);
+    }
+    _releaseRxBuffer();
+    if(_rxDiscard)
+      return;
+  }
+  _streamMessageData(data, len, last);
+}
+
+// Deliver the compressed message in _rxBuffer once inflated into a second buffer.
+void AsyncWebSocketClient::_inflateMessage(){
+  AsyncWebSocketBufferPool &pool = _server->_rxBuffers();
+  uint8_t * out = pool.take();
+  if(!out){
+    _discardMessage(1013, "Try again later");
+    return;
+  }
+  size_t len = pool.bufferSize();
+  uint16_t code = _server->_inflate(_rxBuffer, _rxLen, out, len);
+  if(code){
+    pool.give(out);
+    _discardMessage(code, code == 1009 ? "Message too big" : "Invalid compressed data");
+    return;
+  }
+  out[len] = 0;
+  _server->_handleMessage(this, _rxOpcode, out, len);
+  pool.give(out);
+}
+
+void AsyncWebSocketClient::_streamMessageData(uint8_t *data, size_t len, bool last){
+  if(!_server->_handleStream(this, _rxOpcode, _rxLen, data, len, last)){
+    _discardMessage(1008, "Message rejected");
+    return;
+  }
+  _rxLen += len;
+  if(last)
+    _rxOpcode = 0;
+}
+
+// Skip the rest of the message being received and close the connection.
+void AsyncWebSocketClient::_discardMessage(uint16_t code, const char * reason){
+  _releaseRxBuffer();
+  _rxDiscard = true;
+  close(code, reason);
+}
+
+void AsyncWebSocketClient::_releaseRxBuffer(){
+  if(_rxBuffer){
+    _server->_rxBuffers().give(_rxBuffer);
+    _rxBuffer = NULL;
+  }
+}
+
 size_t AsyncWebSocketClient::printf(const char *format, ...) {
   va_list arg;
   va_start(arg, format);
@@ -760,8 +1013,16 @@ size_t AsyncWebSocketClient::printf_P(PGM_P formatP, ...) {
 }
 #endif
 
+// A message with its own copy of data, compressed if deflate was negotiated and it is worth it.
+AsyncWebSocketMessage * AsyncWebSocketClient::_message(const char * data, size_t len, uint8_t opcode){
+  AsyncWebSocketMessage * message = NULL;
+  if(_deflateBits)
+    message = _server->_compress(data, len, opcode, _deflateBits);
+  return message ? message : new AsyncWebSocketBasicMessage(data, len, opcode);
+}
+
 void AsyncWebSocketClient::text(const char * message, size_t len){
-  _queueMessage(new AsyncWebSocketBasicMessage(message, len));
+  _queueMessage(_message(message, len, WS_TEXT));
 }
 void AsyncWebSocketClient::text(const char * message){
   text(message, strlen(message));
@@ -797,7 +1058,7 @@ void AsyncWebSocketClient::text(AsyncWebSocketMessageBuffer * buffer)
 }
 
 void AsyncWebSocketClient::binary(const char * message, size_t len){
-  _queueMessage(new AsyncWebSocketBasicMessage(message, len, WS_BINARY));
+  _queueMessage(_message(message, len, WS_BINARY));
 }
 void AsyncWebSocketClient::binary(const char * message){
   binary(message, strlen(message));
@@ -849,15 +1110,27 @@ uint16_t AsyncWebSocketClient::remotePort() {
 
 AsyncWebSocket::AsyncWebSocket(const String& url)
   :_url(url)
-  ,_clients(LinkedList<AsyncWebSocketClient *>([](AsyncWebSocketClient *c){ delete c; }))
   ,_cNextId(1)
+  ,_rxPool(WS_RX_BUFFER_COUNT, WS_RX_BUFFER_SIZE)
+  ,_deflateBits(0)
+  ,_deflateThreshold(0)
+  ,_inflater(NULL)
+  ,_maxClients(0)
+  ,_pingInterval(0)
+  ,_pongTimeout(0)
   ,_enabled(true)
-  ,_buffers(LinkedList<AsyncWebSocketMessageBuffer *>([](AsyncWebSocketMessageBuffer *b){ delete b; }))
+  ,_buffers([](AsyncWebSocketMessageBuffer *b){ delete b; })
 {
   _eventHandler = NULL;
+  _messageHandler = NULL;
+  _streamHandler = NULL;
+  memset(&_deflateStats, 0, sizeof(_deflateStats));
+  memset(&_clientStats, 0, sizeof(_clientStats));
 }
 
-AsyncWebSocket::~AsyncWebSocket(){}
+AsyncWebSocket::~AsyncWebSocket(){
+  free(_inflater);
+}
 
 void AsyncWebSocket::_handleEvent(AsyncWebSocketClient * client, AwsEventType type, void * arg, uint8_t *data, size_t len){
   if(_eventHandler != NULL){
@@ -865,18 +1138,60 @@ void AsyncWebSocket::_handleEvent(AsyncWebSocketClient * client, AwsEventType ty
   }
 }
 
+void AsyncWebSocket::_handleMessage(AsyncWebSocketClient * client, uint8_t opcode, uint8_t *data, size_t len){
+  if(_messageHandler != NULL){
+    _messageHandler(client, opcode, data, len);
+  }
+}
+
+bool AsyncWebSocket::_handleStream(AsyncWebSocketClient * client, uint8_t opcode, size_t index, uint8_t *data, size_t len, bool final){
+  if(_streamHandler != NULL){
+    return _streamHandler(client, opcode, index, data, len, final);
+  }
+  return false;
+}
+
 void AsyncWebSocket::_addClient(AsyncWebSocketClient * client){
-  _clients.add(client);
+  AsyncWebLockGuard l(_lock);
+  if(!_clients.add(client->id(), client)){
+    //it is deleted on disconnecting all the same
+    client->close(1011, "Out of memory");
+    return;
+  }
+  if(_maxClients && count() > _maxClients)
+    _evictIdlest(client);
+}
+
+// Close the connected client, other than keep, that has sent nothing for the longest.
+bool AsyncWebSocket::_evictIdlest(AsyncWebSocketClient * keep){
+  AsyncWebLockGuard l(_lock);
+  AsyncWebSocketClient * idlest = NULL;
+  for(const auto& c: _clients){
+    if(c != keep && c->status() == WS_CONNECTED && (idlest == NULL || c->idleTime() > idlest->idleTime()))
+      idlest = c;
+  }
+  if(idlest == NULL)
+    return false;
+  _clientStats.evicted++;
+  idlest->close(1013, "Too many clients");
+  return true;
+}
+
+// A client that did not answer a ping or a close in time: its connection is
+// most likely half-open, so it is aborted rather than closed.
+void AsyncWebSocket::_dropClient(AsyncWebSocketClient * client){
+  _clientStats.timedOut++;
+  client->client()->close(true);
 }
 
 void AsyncWebSocket::_handleDisconnect(AsyncWebSocketClient * client){
-  
-  _clients.remove_first([=](AsyncWebSocketClient * c){
-    return c->id() == client->id();
-  });
+  AsyncWebLockGuard l(_lock);
+  _clients.remove(client->id());
+  delete client;
 }
 
 bool AsyncWebSocket::availableForWriteAll(){
+  AsyncWebLockGuard l(_lock);
   for(const auto& c: _clients){
     if(c->queueIsFull()) return false;
   }
@@ -884,35 +1199,61 @@ bool AsyncWebSocket::availableForWriteAll(){
 }
 
 bool AsyncWebSocket::availableForWrite(uint32_t id){
+  AsyncWebLockGuard l(_lock);
+  AsyncWebSocketClient * c = _clients.find(id);
+  return !(c && c->queueIsFull());
+}
+
+size_t AsyncWebSocket::count() const {
+  AsyncWebLockGuard l(_lock);
+  size_t connected = 0;
   for(const auto& c: _clients){
-    if(c->queueIsFull() && (c->id() == id )) return false;
+    if(c->status() == WS_CONNECTED)
+      connected++;
   }
-  return true;
+  return connected;
 }
 
-size_t AsyncWebSocket::count() const {
-  return _clients.count_if([](AsyncWebSocketClient * c){
-    return c->status() == WS_CONNECTED;
-  });
+AwsClientStats AsyncWebSocket::clientStats() const {
+  AsyncWebLockGuard l(_lock);
+  AwsClientStats stats = _clientStats;
+  stats.live = 0;
+  stats.idle = 0;
+  for(const auto& c: _clients){
+    if(c->status() != WS_CONNECTED)
+      continue;
+    stats.live++;
+    if(c->keepAlivePeriod() && c->idleTime() >= c->keepAlivePeriod() * 1000U)
+      stats.idle++;
+  }
+  return stats;
 }
 
-AsyncWebSocketClient * AsyncWebSocket::client(uint32_t id){
-  for(const auto &c: _clients){
-    if(c->id() == id && c->status() == WS_CONNECTED){
-      return c;
-    }
+size_t AsyncWebSocket::queuedBytes() const {
+  AsyncWebLockGuard l(_lock);
+  size_t bytes = 0;
+  for(const auto& c: _clients){
+    bytes += c->queuedBytes();
   }
-  return nullptr;
+  return bytes;
+}
+
+AsyncWebSocketClient * AsyncWebSocket::client(uint32_t id){
+  AsyncWebLockGuard l(_lock);
+  AsyncWebSocketClient * c = _clients.find(id);
+  return (c && c->status() == WS_CONNECTED) ? c : nullptr;
 }
 
 
 void AsyncWebSocket::close(uint32_t id, uint16_t code, const char * message){
+  AsyncWebLockGuard l(_lock);
   AsyncWebSocketClient * c = client(id);
   if(c)
     c->close(code, message);
 }
 
 void AsyncWebSocket::closeAll(uint16_t code, const char * message){
+  AsyncWebLockGuard l(_lock);
   for(const auto& c: _clients){
     if(c->status() == WS_CONNECTED)
       c->close(code, message);
@@ -921,97 +1262,203 @@ void AsyncWebSocket::closeAll(uint16_t code, const char * message){
 
 void AsyncWebSocket::cleanupClients(uint16_t maxClients)
 {
-  if (count() > maxClients){
-    _clients.front()->close();
-  }
+  AsyncWebLockGuard l(_lock);
+  while (count() > maxClients && _evictIdlest(NULL));
 }
 
 void AsyncWebSocket::ping(uint32_t id, uint8_t *data, size_t len){
+  AsyncWebLockGuard l(_lock);
   AsyncWebSocketClient * c = client(id);
   if(c)
     c->ping(data, len);
 }
 
 void AsyncWebSocket::pingAll(uint8_t *data, size_t len){
+  AsyncWebLockGuard l(_lock);
   for(const auto& c: _clients){
     if(c->status() == WS_CONNECTED)
       c->ping(data, len);
   }
 }
 
+// Through _messageAll() so compression, if the client negotiated it, runs
+// without the lock, as for the messages to all clients.
 void AsyncWebSocket::text(uint32_t id, const char * message, size_t len){
-  AsyncWebSocketClient * c = client(id);
-  if(c)
-    c->text(message, len);
+  _messageAll((const uint8_t *)message, len, WS_TEXT, &id, 1);
 }
 
 void AsyncWebSocket::textAll(AsyncWebSocketMessageBuffer * buffer){
-  if (!buffer) return;
-  buffer->lock(); 
-  for(const auto& c: _clients){
-    if(c->status() == WS_CONNECTED){
-        c->text(buffer);
+  _messageAllBuffer(buffer, WS_TEXT);
+}
+
+static bool webSocketIdListed(const uint32_t * ids, size_t count, uint32_t id){
+  if(!ids)
+    return true;
+  for(size_t i = 0; i < count; i++){
+    if(ids[i] == id)
+      return true;
+  }
+  return false;
+}
+
+// Queue a message to every connected client, or to those among ids if given.
+// Its frame is encoded once and shared by all of them, and once more
+// compressed, with the smallest window among them, for the clients that
+// negotiated deflate. Encoding, compression above all, runs without the lock,
+// which is only held to pick the window and then to queue the frames.
+void AsyncWebSocket::_messageAll(const uint8_t * data, size_t len, uint8_t opcode, const uint32_t * ids, size_t count){
+  uint8_t windowBits = 0;
+  bool plain = false;
+  {
+    AsyncWebLockGuard l(_lock);
+    for(const auto& c: _clients){
+      if(c->status() != WS_CONNECTED || !webSocketIdListed(ids, count, c->id()))
+        continue;
+      uint8_t bits = c->deflateWindowBits();
+      if(!bits)
+        plain = true;
+      else if(!windowBits || bits < windowBits)
+        windowBits = bits;
     }
   }
+  AsyncWebSocketMessageBuffer * compressed = windowBits ? _compressFrame(data, len, opcode, windowBits) : NULL;
+  AsyncWebSocketMessageBuffer * frame = (plain || (windowBits && !compressed)) ? _makeFrame(data, len, opcode) : NULL;
+
+  AsyncWebLockGuard l(_lock);
+  for(const auto& c: _clients){
+    if(c->status() != WS_CONNECTED || !webSocketIdListed(ids, count, c->id()))
+      continue;
+    //a client that connected meanwhile may have a smaller window, or none
+    uint8_t bits = c->deflateWindowBits();
+    AsyncWebSocketMessageBuffer * shared = (compressed && bits >= windowBits) ? compressed : frame;
+    if(shared)
+      c->message(new AsyncWebSocketMultiMessage(shared, WS_CONTINUATION, false, true));
+    else
+      c->message(new AsyncWebSocketBasicMessage((const char *)data, len, opcode));
+  }
+  //only now do they become visible to _cleanBuffers(), referred to or not
+  if(compressed)
+    _buffers.add(compressed);
+  if(frame)
+    _buffers.add(frame);
+  _cleanBuffers();
+}
+
+// Send a buffer from makeBuffer() to every connected client, keeping it alive meanwhile.
+void AsyncWebSocket::_messageAllBuffer(AsyncWebSocketMessageBuffer * buffer, uint8_t opcode){
+  if (!buffer) return;
+  {
+    AsyncWebLockGuard l(_lock);
+    buffer->lock();
+  }
+  _messageAll(buffer->get(), buffer->length(), opcode);
+  AsyncWebLockGuard l(_lock);
   buffer->unlock();
-  _cleanBuffers(); 
+  _cleanBuffers();
+}
+
+// A final frame holding data, header included, in a buffer that is not yet
+// among _buffers, so it can be filled without the lock.
+AsyncWebSocketMessageBuffer * AsyncWebSocket::_makeFrame(const uint8_t * data, size_t len, uint8_t opcode){
+  uint8_t headLen = len < 126 ? 2 : len < 65536 ? 4 : 10;
+  AsyncWebSocketMessageBuffer * frame = new AsyncWebSocketMessageBuffer(headLen + len);
+  if(!frame)
+    return NULL;
+  if(!frame->get()){
+    delete frame;
+    return NULL;
+  }
+  uint8_t * buf = frame->get();
+  buf[0] = 0x80 | (opcode & (0x0F | WS_COMPRESSED));
+  if(len < 126){
+    buf[1] = len;
+  } else if(len < 65536){
+    buf[1] = 126;
+    buf[2] = len >> 8;
+    buf[3] = len;
+  } else {
+    buf[1] = 127;
+    for(int i = 0; i < 8; i++)
+      buf[2 + i] = (uint64_t)len >> (56 - 8 * i);
+  }
+  memcpy(buf + headLen, data, len);
+  return frame;
 }
 
 
 void AsyncWebSocket::textAll(const char * message, size_t len){
-  AsyncWebSocketMessageBuffer * WSBuffer = makeBuffer((uint8_t *)message, len); 
-    textAll(WSBuffer); 
+  _messageAll((const uint8_t *)message, len, WS_TEXT);
+}
+
+void AsyncWebSocket::textAll(const uint32_t * ids, size_t count, const char * message, size_t len){
+  if(count)
+    _messageAll((const uint8_t *)message, len, WS_TEXT, ids, count);
+}
+
+void AsyncWebSocket::textAll(const uint32_t * ids, size_t count, const char * message){
+  textAll(ids, count, message, strlen(message));
 }
 
 void AsyncWebSocket::binary(uint32_t id, const char * message, size_t len){
-  AsyncWebSocketClient * c = client(id);
-  if(c)
-    c->binary(message, len);
+  _messageAll((const uint8_t *)message, len, WS_BINARY, &id, 1);
 }
 
 void AsyncWebSocket::binaryAll(const char * message, size_t len){
-  AsyncWebSocketMessageBuffer * buffer = makeBuffer((uint8_t *)message, len); 
-  binaryAll(buffer); 
+  _messageAll((const uint8_t *)message, len, WS_BINARY);
 }
 
 void AsyncWebSocket::binaryAll(AsyncWebSocketMessageBuffer * buffer)
 {
-  if (!buffer) return;
-  buffer->lock(); 
-    for(const auto& c: _clients){
-    if(c->status() == WS_CONNECTED)
-      c->binary(buffer);
-  }
-  buffer->unlock(); 
-  _cleanBuffers(); 
+  _messageAllBuffer(buffer, WS_BINARY);
 }
 
 void AsyncWebSocket::message(uint32_t id, AsyncWebSocketMessage *message){
+  AsyncWebLockGuard l(_lock);
   AsyncWebSocketClient * c = client(id);
   if(c)
     c->message(message);
 }
 
 void AsyncWebSocket::messageAll(AsyncWebSocketMultiMessage *message){
+  AsyncWebLockGuard l(_lock);
   for(const auto& c: _clients){
     if(c->status() == WS_CONNECTED)
-      c->message(message);
+      c->message(message->copy());
   }
+  delete message;
   _cleanBuffers(); 
 }
 
+// Formatted here, as printfAll(), and sent as text(id) so it is compressed
+// without the lock.
 size_t AsyncWebSocket::printf(uint32_t id, const char *format, ...){
-  AsyncWebSocketClient * c = client(id);
-  if(c){
-    va_list arg;
+  if(!client(id))
+    return 0;
+  va_list arg;
+  char* temp = new char[MAX_PRINTF_LEN];
+  if(!temp){
+    return 0;
+  }
+  va_start(arg, format);
+  size_t len = vsnprintf(temp, MAX_PRINTF_LEN, format, arg);
+  va_end(arg);
+  if(len >= MAX_PRINTF_LEN){
+    delete[] temp;
+    temp = new char[len + 1];
+    if(!temp){
+      return 0;
+    }
     va_start(arg, format);
-    size_t len = c->printf(format, arg);
+    vsnprintf(temp, len + 1, format, arg);
     va_end(arg);
-    return len;
   }
-  return 0;
+  _messageAll((const uint8_t *)temp, len, WS_TEXT, &id, 1);
+  delete[] temp;
+  return len;
 }
 
+// Formatted into a buffer of its own rather than one from makeBuffer(), which
+// another task could clean up before it is sent.
 size_t AsyncWebSocket::printfAll(const char *format, ...) {
   va_list arg;
   char* temp = new char[MAX_PRINTF_LEN];
@@ -1021,23 +1468,24 @@ size_t AsyncWebSocket::printfAll(const char *format, ...) {
   va_start(arg, format);
   size_t len = vsnprintf(temp, MAX_PRINTF_LEN, format, arg);
   va_end(arg);
-  delete[] temp;
-  
-  AsyncWebSocketMessageBuffer * buffer = makeBuffer(len); 
-  if (!buffer) {
-    return 0;
+  if(len >= MAX_PRINTF_LEN){
+    delete[] temp;
+    temp = new char[len + 1];
+    if(!temp){
+      return 0;
+    }
+    va_start(arg, format);
+    vsnprintf(temp, len + 1, format, arg);
+    va_end(arg);
   }
-
-  va_start(arg, format);
-  vsnprintf( (char *)buffer->get(), len + 1, format, arg);
-  va_end(arg);
-
-  textAll(buffer);
+  _messageAll((const uint8_t *)temp, len, WS_TEXT);
+  delete[] temp;
   return len;
 }
 
 #ifndef ESP32
 size_t AsyncWebSocket::printf_P(uint32_t id, PGM_P formatP, ...){
+  AsyncWebLockGuard l(_lock);
   AsyncWebSocketClient * c = client(id);
   if(c != NULL){
     va_list arg;
@@ -1059,18 +1507,18 @@ size_t AsyncWebSocket::printfAll_P(PGM_P formatP, ...) {
   va_start(arg, formatP);
   size_t len = vsnprintf_P(temp, MAX_PRINTF_LEN, formatP, arg);
   va_end(arg);
-  delete[] temp;
-  
-  AsyncWebSocketMessageBuffer * buffer = makeBuffer(len + 1); 
-  if (!buffer) {
-    return 0;
+  if(len >= MAX_PRINTF_LEN){
+    delete[] temp;
+    temp = new char[len + 1];
+    if(!temp){
+      return 0;
+    }
+    va_start(arg, formatP);
+    vsnprintf_P(temp, len + 1, formatP, arg);
+    va_end(arg);
   }
-
-  va_start(arg, formatP);
-  vsnprintf_P((char *)buffer->get(), len + 1, formatP, arg);
-  va_end(arg);
-
-  textAll(buffer);
+  _messageAll((const uint8_t *)temp, len, WS_TEXT);
+  delete[] temp;
   return len;
 }
 
@@ -1087,6 +1535,7 @@ void AsyncWebSocket::text(uint32_t id, const String &message){
   text(id, message.c_str(), message.length());
 }
 void AsyncWebSocket::text(uint32_t id, const __FlashStringHelper *message){
+  AsyncWebLockGuard l(_lock);
   AsyncWebSocketClient * c = client(id);
   if(c != NULL)
     c->text(message);
@@ -1104,6 +1553,7 @@ void AsyncWebSocket::textAll(const String &message){
   textAll(message.c_str(), message.length());
 }
 void AsyncWebSocket::textAll(const __FlashStringHelper *message){
+  AsyncWebLockGuard l(_lock);
   for(const auto& c: _clients){
     if(c->status() == WS_CONNECTED)
       c->text(message);
@@ -1122,6 +1572,7 @@ void AsyncWebSocket::binary(uint32_t id, const String &message){
   binary(id, message.c_str(), message.length());
 }
 void AsyncWebSocket::binary(uint32_t id, const __FlashStringHelper *message, size_t len){
+  AsyncWebLockGuard l(_lock);
   AsyncWebSocketClient * c = client(id);
   if(c != NULL)
     c-> binary(message, len);
@@ -1139,6 +1590,7 @@ void AsyncWebSocket::binaryAll(const String &message){
   binaryAll(message.c_str(), message.length());
 }
 void AsyncWebSocket::binaryAll(const __FlashStringHelper *message, size_t len){
+  AsyncWebLockGuard l(_lock);
   for(const auto& c: _clients){
     if(c->status() == WS_CONNECTED)
       c-> binary(message, len);
@@ -1152,6 +1604,7 @@ const char * WS_STR_VERSION = "Sec-WebSocket-Version";
 const char * WS_STR_KEY = "Sec-WebSocket-Key";
 const char * WS_STR_PROTOCOL = "Sec-WebSocket-Protocol";
 const char * WS_STR_ACCEPT = "Sec-WebSocket-Accept";
+const char * WS_STR_EXTENSIONS = "Sec-WebSocket-Extensions";
 const char * WS_STR_UUID = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
 
 bool AsyncWebSocket::canHandle(AsyncWebServerRequest *request){
@@ -1167,6 +1620,7 @@ bool AsyncWebSocket::canHandle(AsyncWebServerRequest *request){
   request->addInterestingHeader(WS_STR_VERSION);
   request->addInterestingHeader(WS_STR_KEY);
   request->addInterestingHeader(WS_STR_PROTOCOL);
+  request->addInterestingHeader(WS_STR_EXTENSIONS);
   return true;
 }
 
@@ -1186,7 +1640,13 @@ void AsyncWebSocket::handleRequest(AsyncWebServerRequest *request){
     return;
   }
   AsyncWebHeader* key = request->getHeader(WS_STR_KEY);
-  AsyncWebServerResponse *response = new AsyncWebSocketResponse(key->value(), this);
+  uint8_t deflateBits = 0;
+  String extensions;
+  if(_deflateBits && _messageHandler && request->hasHeader(WS_STR_EXTENSIONS))
+    deflateBits = _negotiateDeflate(request->getHeader(WS_STR_EXTENSIONS)->value(), extensions);
+  AsyncWebServerResponse *response = new AsyncWebSocketResponse(key->value(), this, deflateBits);
+  if(deflateBits)
+    response->addHeader(WS_STR_EXTENSIONS, extensions);
   if(request->hasHeader(WS_STR_PROTOCOL)){
     AsyncWebHeader* protocol = request->getHeader(WS_STR_PROTOCOL);
     //ToDo: check protocol
@@ -1221,15 +1681,169 @@ void AsyncWebSocket::_cleanBuffers()
 {
   AsyncWebLockGuard l(_lock);
 
-  for(AsyncWebSocketMessageBuffer * c: _buffers){
-    if(c && c->canDelete()){
-        _buffers.remove(c);
+  _buffers.remove_if([](AsyncWebSocketMessageBuffer * const & c){ return c && c->canDelete(); });
+}
+
+/*
+ * permessage-deflate (RFC 7692)
+ */
+
+void AsyncWebSocket::setDeflate(uint8_t windowBits, size_t threshold){
+#ifdef ESP32
+  if(windowBits && (windowBits < WS_DEFLATE_MIN_WINDOW_BITS || windowBits > WS_DEFLATE_MAX_WINDOW_BITS))
+    windowBits = 0;
+  _deflateBits = windowBits;
+  _deflateThreshold = threshold;
+#else
+  (void)windowBits;
+  (void)threshold;
+#endif
+}
+
+// Take the first permessage-deflate offer whose parameters can be honoured and
+// write the matching response. Every message is compressed on its own and
+// clients are asked to do the same, so that each one inflates by itself into
+// a buffer holding the whole message: the client's window does not matter and
+// only a smaller server window needs agreeing on.
+uint8_t AsyncWebSocket::_negotiateDeflate(const String& offers, String& response){
+  int start = 0;
+  while(start < (int)offers.length()){
+    int end = offers.indexOf(',', start);
+    if(end < 0)
+      end = offers.length();
+    String offer = offers.substring(start, end);
+    start = end + 1;
+
+    int param = offer.indexOf(';');
+    String name = offer.substring(0, param < 0 ? offer.length() : param);
+    name.trim();
+    if(!name.equalsIgnoreCase("permessage-deflate"))
+      continue;
+
+    uint8_t windowBits = _deflateBits;
+    bool limited = false;
+    bool acceptable = true;
+    while(param >= 0 && acceptable){
+      int next = offer.indexOf(';', param + 1);
+      String token = offer.substring(param + 1, next < 0 ? offer.length() : next);
+      param = next;
+      int eq = token.indexOf('=');
+      String key = eq < 0 ? token : token.substring(0, eq);
+      String value = eq < 0 ? String() : token.substring(eq + 1);
+      key.trim();
+      value.trim();
+      value.replace("\"", "");
+      if(key == "server_max_window_bits"){
+        long bits = value.toInt();
+        acceptable = bits >= WS_DEFLATE_MIN_WINDOW_BITS && bits <= WS_DEFLATE_MAX_WINDOW_BITS;
+        limited = true;
+        if(acceptable && bits < windowBits)
+          windowBits = bits;
+      } else if(key != "server_no_context_takeover" && key != "client_no_context_takeover" && key != "client_max_window_bits"){
+        acceptable = false;
+      }
     }
+    if(!acceptable)
+      continue;
+    response = "permessage-deflate; server_no_context_takeover; client_no_context_takeover";
+    if(limited)
+      response += "; server_max_window_bits=" + String(windowBits);
+    return windowBits;
   }
+  return 0;
 }
 
-AsyncWebSocket::AsyncWebSocketClientLinkedList AsyncWebSocket::getClients() const {
-  return _clients;
+// Compress len bytes into out, of len - 1 bytes, and count it. 0 if it did not shrink.
+size_t AsyncWebSocket::_deflate(const uint8_t * in, size_t len, uint8_t * out, uint8_t windowBits){
+  uint32_t start = micros();
+  size_t outLen = AsyncWebSocketDeflater::compress(in, len, out, len - 1, windowBits);
+  uint32_t spent = micros() - start;
+
+  AsyncWebLockGuard l(_lock);
+  _deflateStats.deflateMicros += spent;
+  if(outLen){
+    _deflateStats.deflated++;
+    _deflateStats.deflateIn += len;
+    _deflateStats.deflateOut += outLen;
+  } else {
+    _deflateStats.notDeflated++;
+  }
+  return outLen;
+}
+
+// A message with the compressed data, NULL when under the threshold or it did not shrink.
+AsyncWebSocketMessage * AsyncWebSocket::_compress(const char * data, size_t len, uint8_t opcode, uint8_t windowBits){
+  if(!len || len < _deflateThreshold)
+    return NULL;
+  uint8_t * out = (uint8_t*)malloc(len);
+  if(out == NULL)
+    return NULL;
+  size_t outLen = _deflate((const uint8_t *)data, len, out, windowBits);
+  AsyncWebSocketMessage * message = outLen ? new AsyncWebSocketBasicMessage((const char *)out, outLen, opcode | WS_COMPRESSED) : NULL;
+  free(out);
+  return message;
+}
+
+// A frame as _makeFrame() with the compressed data, NULL when under the threshold or it did not shrink.
+AsyncWebSocketMessageBuffer * AsyncWebSocket::_compressFrame(const uint8_t * data, size_t len, uint8_t opcode, uint8_t windowBits){
+  if(!len || len < _deflateThreshold)
+    return NULL;
+  uint8_t * out = (uint8_t*)malloc(len);
+  if(out == NULL)
+    return NULL;
+  size_t outLen = _deflate(data, len, out, windowBits);
+  AsyncWebSocketMessageBuffer * frame = outLen ? _makeFrame(out, outLen, opcode | WS_COMPRESSED) : NULL;
+  free(out);
+  return frame;
+}
+
+// Inflate a whole received message into out, of outLen bytes; outLen is set to
+// its inflated length. Returns 0, or the close code to refuse the message with.
+uint16_t AsyncWebSocket::_inflate(const uint8_t * in, size_t len, uint8_t * out, size_t &outLen){
+#ifdef ESP32
+  //received messages are only handled from the TCP task, one decompressor does
+  if(_inflater == NULL){
+    _inflater = malloc(sizeof(tinfl_decompressor));
+    if(_inflater == NULL)
+      return 1013;
+  }
+  tinfl_decompressor * inflater = (tinfl_decompressor *)_inflater;
+  //the sender left out the end of the sync flush, the RFC has it put back
+  static const uint8_t tail[4] = {0x00, 0x00, 0xFF, 0xFF};
+  const mz_uint32 flags = TINFL_FLAG_HAS_MORE_INPUT | TINFL_FLAG_USING_NON_WRAPPING_OUTPUT_BUF;
+  uint32_t start = micros();
+  tinfl_init(inflater);
+  size_t inSize = len;
+  size_t outSize = outLen;
+  tinfl_status status = tinfl_decompress(inflater, in, &inSize, out, out, &outSize, flags);
+  size_t produced = outSize;
+  if(status == TINFL_STATUS_NEEDS_MORE_INPUT){
+    inSize = sizeof(tail);
+    outSize = outLen - produced;
+    status = tinfl_decompress(inflater, tail, &inSize, out, out + produced, &outSize, flags);
+    produced += outSize;
+  }
+  uint32_t spent = micros() - start;
+  if(status == TINFL_STATUS_HAS_MORE_OUTPUT)
+    return 1009;
+  //after the empty stored block of the flush the stream waits for the next one
+  if(status != TINFL_STATUS_NEEDS_MORE_INPUT && status != TINFL_STATUS_DONE)
+    return 1007;
+  outLen = produced;
+
+  AsyncWebLockGuard l(_lock);
+  _deflateStats.inflated++;
+  _deflateStats.inflateIn += len;
+  _deflateStats.inflateOut += produced;
+  _deflateStats.inflateMicros += spent;
+  return 0;
+#else
+  (void)in;
+  (void)len;
+  (void)out;
+  (void)outLen;
+  return 1003;
+#endif
 }
 
 /*
@@ -1237,8 +1851,9 @@ AsyncWebSocket::AsyncWebSocketClientLinkedList AsyncWebSocket::getClients() cons
  * Authentication code from https://github.com/Links2004/arduinoWebSockets/blob/master/src/WebSockets.cpp#L480
  */
 
-AsyncWebSocketResponse::AsyncWebSocketResponse(const String& key, AsyncWebSocket *server){
+AsyncWebSocketResponse::AsyncWebSocketResponse(const String& key, AsyncWebSocket *server, uint8_t deflateBits){
   _server = server;
+  _deflateBits = deflateBits;
   _code = 101;
   _sendContentLength = false;
 
@@ -1288,7 +1903,7 @@ void AsyncWebSocketResponse::_respond(AsyncWebServerRequest *request){
 size_t AsyncWebSocketResponse::_ack(AsyncWebServerRequest *request, size_t len, uint32_t time){
   (void)time;
   if(len){
-    new AsyncWebSocketClient(request, _server);
+    new AsyncWebSocketClient(request, _server, _deflateBits);
   }
   return 0;
 }
@@ -22,6 +22,7 @@
 #define ASYNCWEBSOCKET_H_
 
 #include <Arduino.h>
+#include <atomic>
 #ifdef ESP32
 #include <AsyncTCP.h>
 #define WS_MAX_QUEUED_MESSAGES 32
@@ -32,6 +33,9 @@
 #include <ESPAsyncWebServer.h>
 
 #include "AsyncWebSynchronization.h"
+#include "AsyncWebSocketFrame.h"
+#include "AsyncWebSocketDeflate.h"
+#include "AsyncWebSocketClientTable.h"
 
 #ifdef ESP8266
 #include <Hash.h>
@@ -46,6 +50,19 @@
 #define DEFAULT_MAX_WS_CLIENTS 4
 #endif
 
+// Seconds a client has to answer a ping or a close, see AsyncWebSocket::setKeepAlive()
+#ifndef WS_DEFAULT_PONG_TIMEOUT
+#define WS_DEFAULT_PONG_TIMEOUT 10
+#endif
+
+// Reassembly buffers shared by the clients of a server, see AsyncWebSocket::onMessage()
+#ifndef WS_RX_BUFFER_COUNT
+#define WS_RX_BUFFER_COUNT 4
+#endif
+#ifndef WS_RX_BUFFER_SIZE
+#define WS_RX_BUFFER_SIZE 1024
+#endif
+
 class AsyncWebSocket;
 class AsyncWebSocketResponse;
 class AsyncWebSocketClient;
@@ -78,14 +95,39 @@ typedef struct {
 typedef enum { WS_DISCONNECTED, WS_CONNECTED, WS_DISCONNECTING } AwsClientStatus;
 typedef enum { WS_CONTINUATION, WS_TEXT, WS_BINARY, WS_DISCONNECT = 0x08, WS_PING, WS_PONG } AwsFrameType;
 typedef enum { WS_MSG_SENDING, WS_MSG_SENT, WS_MSG_ERROR } AwsMessageStatus;
+//added to the opcode of a message whose payload is compressed (RSV1 of its first frame)
+#define WS_COMPRESSED 0x40
 typedef enum { WS_EVT_CONNECT, WS_EVT_DISCONNECT, WS_EVT_PONG, WS_EVT_ERROR, WS_EVT_DATA } AwsEventType;
 
+//permessage-deflate counters of a server, see AsyncWebSocket::setDeflate()
+typedef struct {
+    uint32_t deflated;      //messages sent compressed
+    uint32_t notDeflated;   //messages over the threshold sent as they were, as they did not shrink
+    uint32_t deflateIn;     //bytes of the messages sent compressed, before
+    uint32_t deflateOut;    //and after compression
+    uint32_t deflateMicros; //time spent compressing, including attempts that did not shrink
+    uint32_t inflated;      //compressed messages received
+    uint32_t inflateIn;     //their bytes as received
+    uint32_t inflateOut;    //and after inflating
+    uint32_t inflateMicros;
+} AwsDeflateStats;
+
+//client lifecycle counters of a server, see AsyncWebSocket::setMaxClients() and setKeepAlive()
+typedef struct {
+    uint32_t live;          //connected clients
+    uint32_t idle;          //connected clients that sent nothing for their ping interval
+    uint32_t evicted;       //closed to make room for a new client
+    uint32_t timedOut;      //dropped for not answering a ping or a close in time
+} AwsClientStats;
+
+// Payload shared by the messages sending it. The count of messages referring
+// to it is atomic, as they come and go from both the sketch and the TCP task.
 class AsyncWebSocketMessageBuffer {
   private:
     uint8_t * _data;
     size_t _len;
-    bool _lock; 
-    uint32_t _count;  
+    std::atomic<bool> _lock;
+    std::atomic<uint32_t> _count;
 
   public:
     AsyncWebSocketMessageBuffer();
@@ -95,7 +137,11 @@ class AsyncWebSocketMessageBuffer {
     AsyncWebSocketMessageBuffer(AsyncWebSocketMessageBuffer &&); 
     ~AsyncWebSocketMessageBuffer(); 
     void operator ++(int i) { (void)i; _count++; }
-    void operator --(int i) { (void)i; if (_count > 0) { _count--; } ;  }
+    void operator --(int i) {
+      (void)i;
+      uint32_t count = _count.load();
+      while (count > 0 && !_count.compare_exchange_weak(count, count - 1));
+    }
     bool reserve(size_t size);
     void lock() { _lock = true; }
     void unlock() { _lock = false; }
@@ -108,7 +154,31 @@ class AsyncWebSocketMessageBuffer {
 
 };
 
-class AsyncWebSocketMessage {
+// Fixed set of equally sized buffers, allocated together on first use and then
+// reused, so reassembling messages neither fragments the heap nor grows with
+// the number of clients. At most 32 buffers.
+class AsyncWebSocketBufferPool {
+  private:
+    uint8_t * _memory;
+    size_t _count;
+    size_t _size;
+    uint32_t _free;
+    uint32_t _exhausted;
+    AsyncWebLock _lock;
+
+  public:
+    AsyncWebSocketBufferPool(size_t count, size_t size);
+    ~AsyncWebSocketBufferPool();
+    //a buffer of bufferSize() + 1 bytes, NULL if all are in use
+    uint8_t * take();
+    void give(uint8_t * buffer);
+    size_t bufferSize() const { return _size; }
+    size_t available() const;
+    //number of take() that found no free buffer
+    uint32_t exhausted() const { return _exhausted; }
+};
+
+class AsyncWebSocketMessage: public IntrusiveQueueItem {
   protected:
     uint8_t _opcode;
     bool _mask;
@@ -120,6 +190,7 @@ class AsyncWebSocketMessage {
     virtual size_t send(AsyncClient *client __attribute__((unused))){ return 0; }
     virtual bool finished(){ return _status != WS_MSG_SENDING; }
     virtual bool betweenFrames() const { return false; }
+    virtual size_t queuedBytes() const { return 0; }
 };
 
 class AsyncWebSocketBasicMessage: public AsyncWebSocketMessage {
@@ -134,6 +205,7 @@ public:
     AsyncWebSocketBasicMessage(uint8_t opcode=WS_TEXT, bool mask=false);
     virtual ~AsyncWebSocketBasicMessage() override;
     virtual bool betweenFrames() const override { return _acked == _ack; }
+    virtual size_t queuedBytes() const override { return _len - _sent; }
     virtual void ack(size_t len, uint32_t time) override ;
     virtual size_t send(AsyncClient *client) override ;
 };
@@ -142,14 +214,20 @@ class AsyncWebSocketMultiMessage: public AsyncWebSocketMessage {
   private:
     uint8_t * _data;
     size_t _len;
+    size_t _headLen;
     size_t _sent;
     size_t _ack;
     size_t _acked;
     AsyncWebSocketMessageBuffer * _WSbuffer; 
 public:
-    AsyncWebSocketMultiMessage(AsyncWebSocketMessageBuffer * buffer, uint8_t opcode=WS_TEXT, bool mask=false); 
+    //encoded: buffer holds a whole frame, header included, as AsyncWebSocket::textAll() builds them;
+    //it is then sent in one go when the TCP window allows, split into frames of its own if not
+    AsyncWebSocketMultiMessage(AsyncWebSocketMessageBuffer * buffer, uint8_t opcode=WS_TEXT, bool mask=false, bool encoded=false); 
     virtual ~AsyncWebSocketMultiMessage() override;
+    //another message sending the same buffer, as a message is queued to one client only
+    AsyncWebSocketMultiMessage * copy() const;
     virtual bool betweenFrames() const override { return _acked == _ack; }
+    virtual size_t queuedBytes() const override { return _len - _sent; }
     virtual void ack(size_t len, uint32_t time) override ;
     virtual size_t send(AsyncClient *client) override ;
 };
@@ -161,15 +239,40 @@ class AsyncWebSocketClient {
     uint32_t _clientId;
     AwsClientStatus _status;
 
-    LinkedList<AsyncWebSocketControl *> _controlQueue;
-    LinkedList<AsyncWebSocketMessage *> _messageQueue;
+    IntrusiveQueue<AsyncWebSocketControl> _controlQueue;
+    IntrusiveQueue<AsyncWebSocketMessage> _messageQueue;
 
+    //the frame parser and the reassembly below are only used from the async_tcp
+    //task, by _onData() and the destructor, so they go without the lock
     uint8_t _pstate;
+    AsyncWebSocketFrameParser _pheader;
     AwsFrameInfo _pinfo;
+    bool _pcompressed;
+    uint8_t _deflateBits;
 
     uint32_t _lastMessageTime;
+    uint32_t _lastRxTime;
     uint32_t _keepAlivePeriod;
-
+    //a keep-alive ping or a close is out, the peer is dropped if no reply comes in time
+    bool _awaitingReply;
+    uint32_t _awaitingSince;
+    bool _closeInitiated;
+
+    //reassembly of the message being received, see AsyncWebSocket::onMessage()
+    uint8_t * _rxBuffer;
+    size_t _rxLen;
+    uint8_t _rxOpcode;
+    bool _rxStreaming;
+    bool _rxDiscard;
+    bool _rxCompressed;
+
+    void _onMessageData(uint8_t *data, size_t len, bool last);
+    void _inflateMessage();
+    void _streamMessageData(uint8_t *data, size_t len, bool last);
+    void _discardMessage(uint16_t code, const char * reason);
+    void _releaseRxBuffer();
+
+    AsyncWebSocketMessage * _message(const char * data, size_t len, uint8_t opcode);
     void _queueMessage(AsyncWebSocketMessage *dataMessage);
     void _queueControl(AsyncWebSocketControl *controlMessage);
     void _runQueue();
@@ -177,7 +280,7 @@ class AsyncWebSocketClient {
   public:
     void *_tempObject;
 
-    AsyncWebSocketClient(AsyncWebServerRequest *request, AsyncWebSocket *server);
+    AsyncWebSocketClient(AsyncWebServerRequest *request, AsyncWebSocket *server, uint8_t deflateBits = 0);
     ~AsyncWebSocketClient();
 
     //client id increments for the given server
@@ -186,6 +289,8 @@ class AsyncWebSocketClient {
     AsyncClient* client(){ return _client; }
     AsyncWebSocket *server(){ return _server; }
     AwsFrameInfo const &pinfo() const { return _pinfo; }
+    //window bits of the permessage-deflate negotiated with this client, 0 if none
+    uint8_t deflateWindowBits() const { return _deflateBits; }
 
     IPAddress remoteIP();
     uint16_t  remotePort();
@@ -194,13 +299,16 @@ class AsyncWebSocketClient {
     void close(uint16_t code=0, const char * message=NULL);
     void ping(uint8_t *data=NULL, size_t len=0);
 
-    //set auto-ping period in seconds. disabled if zero (default)
+    //set auto-ping period in seconds, pinging when nothing was received for
+    //that long. disabled if zero, the server's setKeepAlive() by default
     void keepAlivePeriod(uint16_t seconds){
       _keepAlivePeriod = seconds * 1000;
     }
     uint16_t keepAlivePeriod(){
       return (uint16_t)(_keepAlivePeriod / 1000);
     }
+    //milliseconds since anything was received
+    uint32_t idleTime() const { return millis() - _lastRxTime; }
 
     //data packets
     void message(AsyncWebSocketMessage *message){ _queueMessage(message); }
@@ -227,6 +335,8 @@ class AsyncWebSocketClient {
     void binary(AsyncWebSocketMessageBuffer *buffer); 
 
     bool canSend() { return _messageQueue.length() < WS_MAX_QUEUED_MESSAGES; }
+    //payload bytes queued but not yet handed to TCP
+    size_t queuedBytes() const;
 
     //system callbacks (do not call)
     void _onAck(size_t len, uint32_t time);
@@ -238,19 +348,39 @@ class AsyncWebSocketClient {
 };
 
 typedef std::function<void(AsyncWebSocket * server, AsyncWebSocketClient * client, AwsEventType type, void * arg, uint8_t *data, size_t len)> AwsEventHandler;
+//complete text or binary message, data is NUL terminated and only valid during the call
+typedef std::function<void(AsyncWebSocketClient * client, uint8_t opcode, uint8_t *data, size_t len)> AwsMessageHandler;
+//part of a message too large to reassemble, index is its offset in the message; return false to reject the message
+typedef std::function<bool(AsyncWebSocketClient * client, uint8_t opcode, size_t index, uint8_t *data, size_t len, bool final)> AwsStreamHandler;
 
 //WebServer Handler implementation that plays the role of a socket server
 class AsyncWebSocket: public AsyncWebHandler {
-  public:
-    typedef LinkedList<AsyncWebSocketClient *> AsyncWebSocketClientLinkedList;
   private:
     String _url;
-    AsyncWebSocketClientLinkedList _clients;
+    AsyncWebSocketClientTable _clients;
     uint32_t _cNextId;
     AwsEventHandler _eventHandler;
+    AwsMessageHandler _messageHandler;
+    AwsStreamHandler _streamHandler;
+    AsyncWebSocketBufferPool _rxPool;
+    uint8_t _deflateBits;
+    size_t _deflateThreshold;
+    AwsDeflateStats _deflateStats;
+    void * _inflater;
+    uint16_t _maxClients;
+    uint32_t _pingInterval;
+    uint32_t _pongTimeout;
+    AwsClientStats _clientStats;
     bool _enabled;
     AsyncWebLock _lock;
 
+    size_t _deflate(const uint8_t * in, size_t len, uint8_t * out, uint8_t windowBits);
+    AsyncWebSocketMessageBuffer * _makeFrame(const uint8_t * data, size_t len, uint8_t opcode);
+    void _messageAllBuffer(AsyncWebSocketMessageBuffer * buffer, uint8_t opcode);
+    AsyncWebSocketMessageBuffer * _compressFrame(const uint8_t * data, size_t len, uint8_t opcode, uint8_t windowBits);
+    void _messageAll(const uint8_t * data, size_t len, uint8_t opcode, const uint32_t * ids = NULL, size_t count = 0);
+    bool _evictIdlest(AsyncWebSocketClient * keep);
+
   public:
     AsyncWebSocket(const String& url);
     ~AsyncWebSocket();
@@ -261,11 +391,13 @@ class AsyncWebSocket: public AsyncWebHandler {
     bool availableForWrite(uint32_t id);
 
     size_t count() const;
+    size_t queuedBytes() const;
     AsyncWebSocketClient * client(uint32_t id);
     bool hasClient(uint32_t id){ return client(id) != NULL; }
 
     void close(uint32_t id, uint16_t code=0, const char * message=NULL);
     void closeAll(uint16_t code=0, const char * message=NULL);
+    //close the clients that sent nothing for the longest until at most maxClients are left
     void cleanupClients(uint16_t maxClients = DEFAULT_MAX_WS_CLIENTS);
 
     void ping(uint32_t id, uint8_t *data=NULL, size_t len=0);
@@ -285,6 +417,9 @@ class AsyncWebSocket: public AsyncWebHandler {
     void textAll(const String &message);
     void textAll(const __FlashStringHelper *message); //  need to convert
     void textAll(AsyncWebSocketMessageBuffer * buffer); 
+    //to the connected clients among ids, encoded and compressed once for all of them
+    void textAll(const uint32_t * ids, size_t count, const char * message, size_t len);
+    void textAll(const uint32_t * ids, size_t count, const char * message);
 
     void binary(uint32_t id, const char * message, size_t len);
     void binary(uint32_t id, const char * message);
@@ -316,22 +451,80 @@ class AsyncWebSocket: public AsyncWebHandler {
       _eventHandler = handler;
     }
 
+    //Reassemble fragmented and multi-packet messages instead of raising
+    //WS_EVT_DATA for each part. Messages up to WS_RX_BUFFER_SIZE are collected
+    //in a buffer from a pool of WS_RX_BUFFER_COUNT and handed over whole.
+    //Larger ones go to the stream handler piece by piece, straight from the
+    //TCP buffers; without one they are refused with close code 1009.
+    void onMessage(AwsMessageHandler handler){
+      _messageHandler = handler;
+    }
+    void onStream(AwsStreamHandler handler){
+      _streamHandler = handler;
+    }
+    const AsyncWebSocketBufferPool &rxPool() const { return _rxPool; }
+
+    //Offer permessage-deflate (RFC 7692) to connecting clients. Messages of at
+    //least threshold bytes are compressed with matches reaching 1 << windowBits
+    //bytes back (8 to 15, or less if the client asks), 0 turns it off. Each
+    //message is compressed on its own, so no memory is kept per client.
+    //Compressed messages from clients are inflated into the onMessage()
+    //buffers, so it is only offered with onMessage() set, and messages that
+    //inflate past WS_RX_BUFFER_SIZE are refused with close code 1009.
+    //ESP32 only, as inflating uses the miniz in its ROM.
+    void setDeflate(uint8_t windowBits, size_t threshold);
+    const AwsDeflateStats &deflateStats() const { return _deflateStats; }
+
+    //Most clients kept connected, 0 for no limit. A client connecting past it
+    //gets the place of the one that has sent nothing for the longest, which
+    //is closed with code 1013.
+    void setMaxClients(uint16_t maxClients){ _maxClients = maxClients; }
+    //Ping clients that sent nothing for pingInterval seconds (0 to not ping
+    //unless a client asks for it with keepAlivePeriod()) and drop those that
+    //do not answer a ping, or a close, within pongTimeout seconds: half-open
+    //connections of sleeping devices would otherwise hold their place
+    //forever. Checked from the TCP poll of each client, so the sketch has
+    //nothing to call.
+    void setKeepAlive(uint16_t pingInterval, uint16_t pongTimeout = WS_DEFAULT_PONG_TIMEOUT){
+      _pingInterval = pingInterval * 1000;
+      _pongTimeout = pongTimeout * 1000;
+    }
+    uint32_t pingInterval() const { return _pingInterval; }
+    uint32_t pongTimeout() const { return _pongTimeout; }
+    AwsClientStats clientStats() const;
+
     //system callbacks (do not call)
     uint32_t _getNextId(){ return _cNextId++; }
     void _addClient(AsyncWebSocketClient * client);
     void _handleDisconnect(AsyncWebSocketClient * client);
+    void _dropClient(AsyncWebSocketClient * client);
     void _handleEvent(AsyncWebSocketClient * client, AwsEventType type, void * arg, uint8_t *data, size_t len);
+    bool _reassembles() const { return _messageHandler || _streamHandler; }
+    bool _streams() const { return (bool)_streamHandler; }
+    void _handleMessage(AsyncWebSocketClient * client, uint8_t opcode, uint8_t *data, size_t len);
+    bool _handleStream(AsyncWebSocketClient * client, uint8_t opcode, size_t index, uint8_t *data, size_t len, bool final);
+    AsyncWebSocketBufferPool &_rxBuffers(){ return _rxPool; }
+    uint8_t _negotiateDeflate(const String& offers, String& response);
+    AsyncWebSocketMessage * _compress(const char * data, size_t len, uint8_t opcode, uint8_t windowBits);
+    uint16_t _inflate(const uint8_t * in, size_t len, uint8_t * out, size_t &outLen);
     virtual bool canHandle(AsyncWebServerRequest *request) override final;
     virtual void handleRequest(AsyncWebServerRequest *request) override final;
 
 
     //  messagebuffer functions/objects. 
+    //  Buffers are deleted once no message refers to them: from another task,
+    //  hold lock() from making one until it is sent.
     AsyncWebSocketMessageBuffer * makeBuffer(size_t size = 0); 
     AsyncWebSocketMessageBuffer * makeBuffer(uint8_t * data, size_t size); 
-    LinkedList<AsyncWebSocketMessageBuffer *> _buffers;
+    SmallVector<AsyncWebSocketMessageBuffer *, 4> _buffers;
     void _cleanBuffers(); 
 
-    AsyncWebSocketClientLinkedList getClients() const;
+    //The clients, without copying them. Outside the async_tcp task hold
+    //AsyncWebLockGuard l(ws.lock()) while iterating, clients come and go otherwise.
+    const AsyncWebSocketClientTable &getClients() const { return _clients; }
+    //guards the clients, their queues and the message buffers
+    const AsyncWebLock &lock() const { return _lock; }
+    AsyncWebLockStats lockStats() const { return _lock.stats(); }
 };
 
 //WebServer response to authenticate the socket and detach the tcp client from the web server request
@@ -339,8 +532,9 @@ class AsyncWebSocketResponse: public AsyncWebServerResponse {
   private:
     String _content;
     AsyncWebSocket *_server;
+    uint8_t _deflateBits;
   public:
-    AsyncWebSocketResponse(const String& key, AsyncWebSocket *server);
+    AsyncWebSocketResponse(const String& key, AsyncWebSocket *server, uint8_t deflateBits = 0);
     void _respond(AsyncWebServerRequest *request);
     size_t _ack(AsyncWebServerRequest *request, size_t len, uint32_t time);
     bool _sourceValid() const { return true; }
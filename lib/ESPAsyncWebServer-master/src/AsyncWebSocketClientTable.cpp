@@ -0,0 +1,127 @@
+/*
+  Asynchronous WebServer library for Espressif MCUs
+
+  Copyright (c) 2016 Hristo Gochkov. All rights reserved.
+  This file is part of the esp8266 core for Arduino environment.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#include "AsyncWebSocketClientTable.h"
+
+#include <stdlib.h>
+
+#define CLIENT_TABLE_MIN_CAPACITY 4
+
+AsyncWebSocketClientTable::AsyncWebSocketClientTable()
+  :_clients(NULL)
+  ,_ids(NULL)
+  ,_count(0)
+  ,_capacity(0)
+  ,_slots(NULL)
+  ,_slotBits(0)
+{}
+
+AsyncWebSocketClientTable::~AsyncWebSocketClientTable(){
+  free(_clients);
+  free(_ids);
+  free(_slots);
+}
+
+// Slot holding id, or the free slot ending its probe sequence if it is not there.
+size_t AsyncWebSocketClientTable::_slotOf(uint32_t id) const {
+  size_t mask = ((size_t)1 << _slotBits) - 1;
+  size_t slot = _home(id);
+  while(_slots[slot] && _ids[_slots[slot] - 1] != id)
+    slot = (slot + 1) & mask;
+  return slot;
+}
+
+bool AsyncWebSocketClientTable::_grow(){
+  size_t capacity = _capacity ? _capacity * 2 : CLIENT_TABLE_MIN_CAPACITY;
+  AsyncWebSocketClient ** clients = (AsyncWebSocketClient **)realloc(_clients, capacity * sizeof(*clients));
+  if(clients == NULL)
+    return false;
+  _clients = clients;
+  uint32_t * ids = (uint32_t *)realloc(_ids, capacity * sizeof(*ids));
+  if(ids == NULL)
+    return false;
+  _ids = ids;
+  //at most half full, so probe sequences stay short
+  uint8_t bits = _slotBits;
+  while(((size_t)1 << bits) < capacity * 2)
+    bits++;
+  uint32_t * slots = (uint32_t *)calloc((size_t)1 << bits, sizeof(*slots));
+  if(slots == NULL)
+    return false;
+  free(_slots);
+  _slots = slots;
+  _slotBits = bits;
+  _capacity = capacity;
+  for(size_t i = 0; i < _count; i++)
+    _slots[_slotOf(_ids[i])] = i + 1;
+  return true;
+}
+
+bool AsyncWebSocketClientTable::add(uint32_t id, AsyncWebSocketClient * client){
+  if(_count == _capacity && !_grow())
+    return false;
+  size_t slot = _slotOf(id);
+  if(_slots[slot]){
+    _clients[_slots[slot] - 1] = client;
+    return true;
+  }
+  _clients[_count] = client;
+  _ids[_count] = id;
+  _count++;
+  _slots[slot] = _count;
+  return true;
+}
+
+AsyncWebSocketClient * AsyncWebSocketClientTable::find(uint32_t id) const {
+  if(_count == 0)
+    return NULL;
+  size_t slot = _slots[_slotOf(id)];
+  return slot ? _clients[slot - 1] : NULL;
+}
+
+AsyncWebSocketClient * AsyncWebSocketClientTable::remove(uint32_t id){
+  if(_count == 0)
+    return NULL;
+  size_t hole = _slotOf(id);
+  if(!_slots[hole])
+    return NULL;
+  size_t index = _slots[hole] - 1;
+  AsyncWebSocketClient * client = _clients[index];
+
+  //shift back the entries after it that would no longer be found past the hole
+  size_t mask = ((size_t)1 << _slotBits) - 1;
+  for(size_t next = (hole + 1) & mask; _slots[next]; next = (next + 1) & mask){
+    size_t home = _home(_ids[_slots[next] - 1]);
+    if(((next - home) & mask) >= ((next - hole) & mask)){
+      _slots[hole] = _slots[next];
+      hole = next;
+    }
+  }
+  _slots[hole] = 0;
+
+  //the last client takes its place in the dense array
+  _count--;
+  if(index != _count){
+    _clients[index] = _clients[_count];
+    _ids[index] = _ids[_count];
+    _slots[_slotOf(_ids[index])] = index + 1;
+  }
+  return client;
+}
@@ -0,0 +1,68 @@
+/*
+  Asynchronous WebServer library for Espressif MCUs
+
+  Copyright (c) 2016 Hristo Gochkov. All rights reserved.
+  This file is part of the esp8266 core for Arduino environment.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#ifndef ASYNCWEBSOCKETCLIENTTABLE_H_
+#define ASYNCWEBSOCKETCLIENTTABLE_H_
+
+// Plain C++ without Arduino dependencies, so it can be benchmarked on a host,
+// see bench/websocket_clients_bench.cpp in the project.
+
+#include <stddef.h>
+#include <stdint.h>
+
+class AsyncWebSocketClient;
+
+// Clients of a server: a dense array to iterate over, in no particular order,
+// and an open addressing map from client id to position in it. Ids are the
+// stable handles, a pointer is only good until the client disconnects.
+// Removal moves the last client into the freed place, so the table must not
+// change while it is iterated; AsyncWebSocket holds its lock for both.
+class AsyncWebSocketClientTable {
+  private:
+    AsyncWebSocketClient ** _clients;
+    uint32_t * _ids;
+    size_t _count;
+    size_t _capacity;
+    //position + 1 of the client hashed there, 0 for a free slot; twice the capacity
+    uint32_t * _slots;
+    uint8_t _slotBits;
+
+    size_t _home(uint32_t id) const { return (uint32_t)(id * 2654435761u) >> (32 - _slotBits); }
+    size_t _slotOf(uint32_t id) const;
+    bool _grow();
+
+  public:
+    AsyncWebSocketClientTable();
+    ~AsyncWebSocketClientTable();
+
+    // false if memory ran out
+    bool add(uint32_t id, AsyncWebSocketClient * client);
+    // the client removed, NULL if there was none with that id
+    AsyncWebSocketClient * remove(uint32_t id);
+    AsyncWebSocketClient * find(uint32_t id) const;
+
+    size_t size() const { return _count; }
+    bool isEmpty() const { return _count == 0; }
+    AsyncWebSocketClient * operator[](size_t i) const { return _clients[i]; }
+    AsyncWebSocketClient * const * begin() const { return _clients; }
+    AsyncWebSocketClient * const * end() const { return _clients + _count; }
+};
+
+#endif /* ASYNCWEBSOCKETCLIENTTABLE_H_ */
@@ -0,0 +1,159 @@
+/*
+  Asynchronous WebServer library for Espressif MCUs
+
+  Copyright (c) 2016 Hristo Gochkov. All rights reserved.
+  This file is part of the esp8266 core for Arduino environment.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#include "AsyncWebSocketDeflate.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define DEFLATE_MIN_MATCH 3
+#define DEFLATE_MAX_MATCH 258
+
+// RFC 1951 section 3.2.5
+static const uint16_t lengthBase[29] = {3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,43,51,59,67,83,99,115,131,163,195,227,258};
+static const uint8_t lengthExtra[29] = {0,0,0,0,0,0,0,0,1,1,1,1,2,2,2,2,3,3,3,3,4,4,4,4,5,5,5,5,0};
+static const uint16_t distanceBase[30] = {1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,257,385,513,769,1025,1537,2049,3073,4097,6145,8193,12289,16385,24577};
+static const uint8_t distanceExtra[30] = {0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13};
+
+namespace {
+
+// LSB first bit stream into a bounded buffer
+class BitWriter {
+  private:
+    uint8_t *_out;
+    uint8_t *_end;
+    uint32_t _bits;
+    uint8_t _count;
+    bool _full;
+
+  public:
+    BitWriter(uint8_t *out, size_t len):_out(out),_end(out + len),_bits(0),_count(0),_full(false){}
+    void put(uint32_t value, uint8_t count){
+      _bits |= value << _count;
+      _count += count;
+      while(_count >= 8){
+        if(_out == _end){
+          _full = true;
+          _count = 0;
+          return;
+        }
+        *_out++ = _bits;
+        _bits >>= 8;
+        _count -= 8;
+      }
+    }
+    // Huffman codes are defined most significant bit first
+    void code(uint32_t value, uint8_t count){
+      uint32_t reversed = 0;
+      for(uint8_t i = 0; i < count; i++){
+        reversed = (reversed << 1) | (value & 1);
+        value >>= 1;
+      }
+      put(reversed, count);
+    }
+    void align(){
+      if(_count)
+        put(0, 8 - _count);
+    }
+    bool full() const { return _full; }
+    uint8_t * position() const { return _out; }
+};
+
+}
+
+static void putLiteral(BitWriter &bits, uint16_t symbol){
+  if(symbol < 144)
+    bits.code(0x30 + symbol, 8);
+  else if(symbol < 256)
+    bits.code(0x190 + symbol - 144, 9);
+  else if(symbol < 280)
+    bits.code(symbol - 256, 7);
+  else
+    bits.code(0xC0 + symbol - 280, 8);
+}
+
+static void putMatch(BitWriter &bits, uint16_t length, uint16_t distance){
+  uint8_t code = 28;
+  while(lengthBase[code] > length)
+    code--;
+  putLiteral(bits, 257 + code);
+  bits.put(length - lengthBase[code], lengthExtra[code]);
+  code = 29;
+  while(distanceBase[code] > distance)
+    code--;
+  bits.code(code, 5);
+  bits.put(distance - distanceBase[code], distanceExtra[code]);
+}
+
+static inline uint32_t hash3(const uint8_t *p, uint8_t bits){
+  return ((uint32_t)(p[0] << 16 | p[1] << 8 | p[2]) * 2654435761u) >> (32 - bits);
+}
+
+size_t AsyncWebSocketDeflater::compress(const uint8_t *in, size_t len, uint8_t *out, size_t outLen, uint8_t windowBits){
+  if(len > WS_DEFLATE_MAX_MESSAGE || windowBits < WS_DEFLATE_MIN_WINDOW_BITS || windowBits > WS_DEFLATE_MAX_WINDOW_BITS)
+    return 0;
+  //positions plus one, 0 for none yet
+  uint16_t *head = (uint16_t *)calloc((size_t)1 << windowBits, sizeof(uint16_t));
+  if(head == NULL)
+    return 0;
+  const size_t window = (size_t)1 << windowBits;
+
+  BitWriter bits(out, outLen);
+  bits.put(0, 1);//not the final block, a sync flush follows
+  bits.put(1, 2);//fixed Huffman codes
+
+  size_t pos = 0;
+  while(pos < len && !bits.full()){
+    size_t length = 0;
+    size_t distance = 0;
+    if(len - pos >= DEFLATE_MIN_MATCH){
+      uint32_t h = hash3(in + pos, windowBits);
+      size_t candidate = head[h];
+      head[h] = pos + 1;
+      if(candidate && pos - (candidate - 1) <= window){
+        candidate--;
+        size_t limit = len - pos < DEFLATE_MAX_MATCH ? len - pos : DEFLATE_MAX_MATCH;
+        while(length < limit && in[candidate + length] == in[pos + length])
+          length++;
+        distance = pos - candidate;
+      }
+    }
+    if(length >= DEFLATE_MIN_MATCH){
+      putMatch(bits, length, distance);
+      //index the positions covered by the match too, for later ones to refer to
+      size_t end = pos + length;
+      for(pos++; pos < end; pos++){
+        if(len - pos >= DEFLATE_MIN_MATCH)
+          head[hash3(in + pos, windowBits)] = pos + 1;
+      }
+    } else {
+      putLiteral(bits, in[pos]);
+      pos++;
+    }
+  }
+  free(head);
+
+  putLiteral(bits, 256);//end of block
+  bits.put(0, 3);//empty stored block of the sync flush, its 00 00 FF FF left out
+  bits.align();
+  if(bits.full())
+    return 0;
+  return bits.position() - out;
+}
@@ -0,0 +1,47 @@
+/*
+  Asynchronous WebServer library for Espressif MCUs
+
+  Copyright (c) 2016 Hristo Gochkov. All rights reserved.
+  This file is part of the esp8266 core for Arduino environment.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#ifndef ASYNCWEBSOCKETDEFLATE_H_
+#define ASYNCWEBSOCKETDEFLATE_H_
+
+// Plain C++ without Arduino dependencies, so it can be checked against zlib
+// on a host, see bench/websocket_deflate_bench.cpp in the project.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define WS_DEFLATE_MIN_WINDOW_BITS 8
+#define WS_DEFLATE_MAX_WINDOW_BITS 15
+// messages are indexed with 16 bit positions, longer ones are sent as they are
+#define WS_DEFLATE_MAX_MESSAGE 65535
+
+// Compressor for permessage-deflate (RFC 7692) without context takeover: each
+// message is one raw DEFLATE block with the fixed Huffman codes, ended by a
+// sync flush whose trailing 00 00 FF FF is left out as the RFC asks. Matches
+// are found greedily through a single hash table of 1 << windowBits 16-bit
+// entries, 2 << windowBits bytes and the only memory used besides the output,
+// and reach at most 1 << windowBits bytes back. Gives up when the result would not be shorter than outLen.
+class AsyncWebSocketDeflater {
+  public:
+    // compressed length, 0 if it did not fit in outLen or memory ran out
+    static size_t compress(const uint8_t *in, size_t len, uint8_t *out, size_t outLen, uint8_t windowBits);
+};
+
+#endif /* ASYNCWEBSOCKETDEFLATE_H_ */
@@ -0,0 +1,111 @@
+/*
+  Asynchronous WebServer library for Espressif MCUs
+
+  Copyright (c) 2016 Hristo Gochkov. All rights reserved.
+  This file is part of the esp8266 core for Arduino environment.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#include "AsyncWebSocketFrame.h"
+
+#include <string.h>
+
+size_t AsyncWebSocketFrameParser::parse(const uint8_t *data, size_t len){
+  if(_status != WS_HEADER_INCOMPLETE)
+    return 0;
+
+  //fast path: the whole header is in the input
+  if(!_have && len >= 2){
+    size_t size = headerSize(data[1]);
+    if(len >= size){
+      _decode(data);
+      return size;
+    }
+  }
+
+  size_t used = 0;
+  while(used < len){
+    size_t take = _need - _have;
+    if(take > len - used)
+      take = len - used;
+    memcpy(_buf + _have, data + used, take);
+    _have += take;
+    used += take;
+    if(_have < _need)
+      break;
+    if(_have == 2){
+      //now the second byte tells how long the header is
+      _need = headerSize(_buf[1]);
+      if(_need > 2)
+        continue;
+    }
+    _decode(_buf);
+    break;
+  }
+  return used;
+}
+
+void AsyncWebSocketFrameParser::_decode(const uint8_t *header){
+  _final = (header[0] & 0x80) != 0;
+  _rsv = (header[0] >> 4) & 0x07;
+  _opcode = header[0] & 0x0F;
+  _masked = (header[1] & 0x80) != 0;
+  _len = header[1] & 0x7F;
+  const uint8_t *p = header + 2;
+  if(_len == 126){
+    _len = (uint16_t)p[0] << 8 | p[1];
+    p += 2;
+  } else if(_len == 127){
+    _len = 0;
+    for(int i = 0; i < 8; i++)
+      _len = _len << 8 | p[i];
+    p += 8;
+  }
+  if(_masked)
+    memcpy(_mask, p, 4);
+
+  _status = WS_HEADER_COMPLETE;
+  if(_rsv & ~_rsvAllowed)
+    _status = WS_HEADER_INVALID;//no extension defines these bits
+  else if(_rsv && _opcode != 1 && _opcode != 2)
+    _status = WS_HEADER_INVALID;//permessage-deflate marks the first frame of a message only
+  else if(_len >> 63)
+    _status = WS_HEADER_INVALID;//most significant bit must be 0
+  else if((_opcode > 2 && _opcode < 8) || _opcode > 10)
+    _status = WS_HEADER_INVALID;//reserved opcode
+  else if(_opcode >= 8 && (!_final || _len > 125))
+    _status = WS_HEADER_INVALID;//control frames are not fragmented and carry at most 125 bytes
+}
+
+void AsyncWebSocketFrameParser::unmask(uint8_t *data, size_t len, const uint8_t *mask, uint64_t offset){
+  size_t i = 0;
+  uint8_t pos = offset & 3;
+  //bytes up to a word boundary, then a word at a time with the mask rotated to match
+  while(i < len && ((uintptr_t)(data + i) & 3)){
+    data[i++] ^= mask[pos];
+    pos = (pos + 1) & 3;
+  }
+  if(len - i >= 4){
+    uint8_t rotated[4] = { mask[pos], mask[(pos + 1) & 3], mask[(pos + 2) & 3], mask[(pos + 3) & 3] };
+    uint32_t word;
+    memcpy(&word, rotated, 4);
+    for(; len - i >= 4; i += 4)
+      *(uint32_t *)(data + i) ^= word;
+  }
+  while(i < len){
+    data[i++] ^= mask[pos];
+    pos = (pos + 1) & 3;
+  }
+}
@@ -0,0 +1,88 @@
+/*
+  Asynchronous WebServer library for Espressif MCUs
+
+  Copyright (c) 2016 Hristo Gochkov. All rights reserved.
+  This file is part of the esp8266 core for Arduino environment.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#ifndef ASYNCWEBSOCKETFRAME_H_
+#define ASYNCWEBSOCKETFRAME_H_
+
+// Plain C++ without Arduino dependencies, so it can be fuzzed and benchmarked
+// on a host, see bench/websocket_frame_bench.cpp in the project.
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Largest frame header: 2 bytes, 8 bytes of extended length and the mask
+#define WS_FRAME_HEADER_MAX 14
+
+// RSV1 in rsv(), set on the first frame of a permessage-deflate compressed message
+#define WS_HEADER_RSV1 0x04
+
+typedef enum { WS_HEADER_INCOMPLETE, WS_HEADER_COMPLETE, WS_HEADER_INVALID } AwsHeaderStatus;
+
+// Incremental decoder of a frame header (RFC 6455 section 5.2). Bytes are fed
+// as they arrive and a header split across TCP segments is picked up where it
+// stopped. A header that is whole in the input, the usual case, is decoded in
+// place; only a split one is staged in a 14 byte buffer.
+class AsyncWebSocketFrameParser {
+  private:
+    uint8_t _buf[WS_FRAME_HEADER_MAX];
+    uint8_t _have;
+    uint8_t _need;
+    AwsHeaderStatus _status;
+    uint8_t _rsvAllowed;
+    bool _final;
+    uint8_t _rsv;
+    uint8_t _opcode;
+    bool _masked;
+    uint8_t _mask[4];
+    uint64_t _len;
+
+    void _decode(const uint8_t *header);
+
+  public:
+    AsyncWebSocketFrameParser():_rsvAllowed(0){ reset(); }
+    // start on a new header
+    void reset(){ _have = 0; _need = 2; _status = WS_HEADER_INCOMPLETE; }
+    // consume header bytes from data, returns how many were used; the rest is
+    // payload once status() is WS_HEADER_COMPLETE. Nothing is used after the
+    // header is complete or found invalid, until reset().
+    size_t parse(const uint8_t *data, size_t len);
+    AwsHeaderStatus status() const { return _status; }
+    // RSV bits an extension has been negotiated for, others make a header invalid;
+    // they are only accepted on the first frame of a text or binary message
+    void allowRsv(uint8_t bits){ _rsvAllowed = bits; }
+
+    bool final() const { return _final; }
+    // RSV1..3 as the low three bits
+    uint8_t rsv() const { return _rsv; }
+    uint8_t opcode() const { return _opcode; }
+    bool masked() const { return _masked; }
+    const uint8_t * mask() const { return _mask; }
+    uint64_t length() const { return _len; }
+
+    // size of a header from its second byte
+    static uint8_t headerSize(uint8_t second){
+      uint8_t len = second & 0x7F;
+      return 2 + (len == 126 ? 2 : len == 127 ? 8 : 0) + ((second & 0x80) ? 4 : 0);
+    }
+    // xor payload bytes with the mask, offset being the position of data in the frame payload
+    static void unmask(uint8_t *data, size_t len, const uint8_t *mask, uint64_t offset);
+};
+
+#endif /* ASYNCWEBSOCKETFRAME_H_ */
@@ -1,43 +1,143 @@
 #ifndef ASYNCWEBSYNCHRONIZATION_H_
 #define ASYNCWEBSYNCHRONIZATION_H_
 
-// Synchronisation is only available on ESP32, as the ESP8266 isn't using FreeRTOS by default
+// Synchronisation is only available on ESP32, as the ESP8266 isn't using FreeRTOS by default.
+// Other targets get a std::recursive_mutex, so the locking can be stress tested
+// on a host, see bench/web_sync_stress.cpp in the project.
 
-#include <ESPAsyncWebServer.h>
+#include <stdint.h>
 
-#ifdef ESP32
+// Lock statistics, see AsyncWebLock::stats()
+typedef struct {
+  uint32_t acquired;      // outermost lock() calls
+  uint32_t contended;     // of those, the ones that found the lock held by another task
+  uint32_t waitMicros;    // spent waiting for it by those
+  uint32_t maxWaitMicros;
+  uint32_t maxHoldMicros; // longest it was held in one go
+} AsyncWebLockStats;
 
-// This is the ESP32 version of the Sync Lock, using the FreeRTOS Semaphore
-class AsyncWebLock
+#if defined(ESP32)
+
+#include <Arduino.h>
+
+// This is the ESP32 version of the native lock, a FreeRTOS recursive mutex
+class AsyncWebMutex
 {
 private:
-  SemaphoreHandle_t _lock;
-  mutable void *_lockedBy;
+  SemaphoreHandle_t _mutex;
 
 public:
-  AsyncWebLock() {
-    _lock = xSemaphoreCreateBinary();
-    _lockedBy = NULL;
-    xSemaphoreGive(_lock);
+  AsyncWebMutex() {
+    _mutex = xSemaphoreCreateRecursiveMutex();
   }
 
-  ~AsyncWebLock() {
-    vSemaphoreDelete(_lock);
+  ~AsyncWebMutex() {
+    vSemaphoreDelete(_mutex);
+  }
+
+  bool tryLock() {
+    return xSemaphoreTakeRecursive(_mutex, 0) == pdTRUE;
+  }
+
+  void lock() {
+    xSemaphoreTakeRecursive(_mutex, portMAX_DELAY);
+  }
+
+  void unlock() {
+    xSemaphoreGiveRecursive(_mutex);
+  }
+
+  static uint32_t now() {
+    return micros();
+  }
+};
+
+#elif !defined(ESP8266)
+
+#include <chrono>
+#include <mutex>
+
+// This is the host version of the native lock
+class AsyncWebMutex
+{
+private:
+  std::recursive_mutex _mutex;
+
+public:
+  bool tryLock() {
+    return _mutex.try_lock();
+  }
+
+  void lock() {
+    _mutex.lock();
+  }
+
+  void unlock() {
+    _mutex.unlock();
+  }
+
+  static uint32_t now() {
+    return (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+};
+
+#endif
+
+#ifndef ESP8266
+
+// Recursive lock counting how often, and for how long, tasks wait for it.
+// The same task may take it again, each lock() needing its unlock(). Keep what
+// runs under it short: the async_tcp task blocks on it for every ack and poll.
+class AsyncWebLock
+{
+private:
+  mutable AsyncWebMutex _mutex;
+  mutable uint32_t _depth;
+  mutable uint32_t _heldSince;
+  mutable AsyncWebLockStats _stats;
+
+public:
+  AsyncWebLock() : _depth(0), _heldSince(0), _stats() {
   }
 
   bool lock() const {
-    extern void *pxCurrentTCB;
-    if (_lockedBy != pxCurrentTCB) {
-      xSemaphoreTake(_lock, portMAX_DELAY);
-      _lockedBy = pxCurrentTCB;
-      return true;
+    bool contended = !_mutex.tryLock();
+    uint32_t waited = 0;
+    if (contended) {
+      uint32_t start = AsyncWebMutex::now();
+      _mutex.lock();
+      waited = AsyncWebMutex::now() - start;
     }
-    return false;
+    if (_depth++ == 0) {
+      _heldSince = AsyncWebMutex::now();
+      _stats.acquired++;
+      if (contended) {
+        _stats.contended++;
+        _stats.waitMicros += waited;
+        if (waited > _stats.maxWaitMicros) {
+          _stats.maxWaitMicros = waited;
+        }
+      }
+    }
+    return true;
   }
 
   void unlock() const {
-    _lockedBy = NULL;
-    xSemaphoreGive(_lock);
+    if (--_depth == 0) {
+      uint32_t held = AsyncWebMutex::now() - _heldSince;
+      if (held > _stats.maxHoldMicros) {
+        _stats.maxHoldMicros = held;
+      }
+    }
+    _mutex.unlock();
+  }
+
+  AsyncWebLockStats stats() const {
+    _mutex.lock();
+    AsyncWebLockStats stats = _stats;
+    _mutex.unlock();
+    return stats;
   }
 };
 
@@ -60,6 +160,10 @@ public:
 
   void unlock() const {
   }
+
+  AsyncWebLockStats stats() const {
+    return AsyncWebLockStats();
+  }
 };
 #endif
 
@@ -84,4 +188,4 @@ public:
   }
 };
 
-#endif // ASYNCWEBSYNCHRONIZATION_H_
\ No newline at end of file
+#endif // ASYNCWEBSYNCHRONIZATION_H_
@@ -48,6 +48,7 @@
 
 class AsyncWebServer;
 class AsyncWebServerRequest;
+class AsyncWebMultipartDelimiter;
 class AsyncWebServerResponse;
 class AsyncWebHeader;
 class AsyncWebParameter;
@@ -163,9 +164,10 @@ class AsyncWebServerRequest {
     size_t _contentLength;
     size_t _parsedLength;
 
-    LinkedList<AsyncWebHeader *> _headers;
-    LinkedList<AsyncWebParameter *> _params;
-    LinkedList<String *> _pathParams;
+    //sized for a typical request, so parsing one allocates no container
+    SmallVector<AsyncWebHeader *, 8> _headers;
+    SmallVector<AsyncWebParameter *, 4> _params;
+    SmallVector<String *, 2> _pathParams;
 
     uint8_t _multiParseState;
     uint8_t _boundaryPosition;
@@ -178,6 +180,7 @@ class AsyncWebServerRequest {
     uint8_t *_itemBuffer;
     size_t _itemBufferIndex;
     bool _itemIsFile;
+    AsyncWebMultipartDelimiter *_multipartDelimiter;
 
     void _onPoll();
     void _onAck(size_t len, uint32_t time);
@@ -193,11 +196,13 @@ class AsyncWebServerRequest {
     bool _parseReqHeader();
     void _parseLine();
     void _parsePlainPostChar(uint8_t data);
+    void _parseMultipartPost(uint8_t *data, size_t len);
     void _parseMultipartPostByte(uint8_t data, bool last);
     void _addGetParams(const String& params);
 
     void _handleUploadStart();
     void _handleUploadByte(uint8_t data, bool last);
+    void _handleUploadData(uint8_t *data, size_t len);
     void _handleUploadEnd();
 
   public:
@@ -358,7 +363,7 @@ typedef enum {
 class AsyncWebServerResponse {
   protected:
     int _code;
-    LinkedList<AsyncWebHeader *> _headers;
+    SmallVector<AsyncWebHeader *, 4> _headers;
     String _contentType;
     size_t _contentLength;
     bool _sendContentLength;
@@ -397,8 +402,8 @@ typedef std::function<void(AsyncWebServerRequest *request, uint8_t *data, size_t
 class AsyncWebServer {
   protected:
     AsyncServer _server;
-    LinkedList<AsyncWebRewrite*> _rewrites;
-    LinkedList<AsyncWebHandler*> _handlers;
+    SmallVector<AsyncWebRewrite*, 2> _rewrites;
+    SmallVector<AsyncWebHandler*, 8> _handlers;
     AsyncCallbackWebHandler* _catchAllHandler;
 
   public:
@@ -439,11 +444,11 @@ class AsyncWebServer {
 };
 
 class DefaultHeaders {
-  using headers_t = LinkedList<AsyncWebHeader *>;
+  using headers_t = SmallVector<AsyncWebHeader *, 4>;
   headers_t _headers;
   
   DefaultHeaders()
-  :_headers(headers_t([](AsyncWebHeader *h){ delete h; }))
+  :_headers([](AsyncWebHeader *h){ delete h; })
   {}
 public:
   using ConstIterator = headers_t::ConstIterator;
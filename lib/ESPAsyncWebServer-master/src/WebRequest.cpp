@@ -21,6 +21,7 @@
 #include "ESPAsyncWebServer.h"
 #include "WebResponseImpl.h"
 #include "WebAuthentication.h"
+#include "AsyncWebMultipart.h"
 
 #ifndef ESP8266
 #define os_strlen strlen
@@ -53,9 +54,9 @@ AsyncWebServerRequest::AsyncWebServerRequest(AsyncWebServer* s, AsyncClient* c)
   , _expectingContinue(false)
   , _contentLength(0)
   , _parsedLength(0)
-  , _headers(LinkedList<AsyncWebHeader *>([](AsyncWebHeader *h){ delete h; }))
-  , _params(LinkedList<AsyncWebParameter *>([](AsyncWebParameter *p){ delete p; }))
-  , _pathParams(LinkedList<String *>([](String *p){ delete p; }))
+  , _headers([](AsyncWebHeader *h){ delete h; })
+  , _params([](AsyncWebParameter *p){ delete p; })
+  , _pathParams([](String *p){ delete p; })
   , _multiParseState(0)
   , _boundaryPosition(0)
   , _itemStartIndex(0)
@@ -67,6 +68,7 @@ AsyncWebServerRequest::AsyncWebServerRequest(AsyncWebServer* s, AsyncClient* c)
   , _itemBuffer(0)
   , _itemBufferIndex(0)
   , _itemIsFile(false)
+  , _multipartDelimiter(NULL)
   , _tempObject(NULL)
 {
   c->onError([](void *r, AsyncClient* c, int8_t error){ (void)c; AsyncWebServerRequest *req = (AsyncWebServerRequest*)r; req->_onError(error); }, this);
@@ -85,6 +87,8 @@ AsyncWebServerRequest::~AsyncWebServerRequest(){
 
   _interestingHeaders.free();
 
+  delete _multipartDelimiter;
+
   if(_response != NULL){
     delete _response;
   }
@@ -134,11 +138,7 @@ void AsyncWebServerRequest::_onData(void *buf, size_t len){
     const bool needParse = _handler && !_handler->isRequestHandlerTrivial();
     if(_isMultipart){
       if(needParse){
-        size_t i;
-        for(i=0; i<len; i++){
-          _parseMultipartPostByte(((uint8_t*)buf)[i], i == len - 1);
-          _parsedLength++;
-        }
+        _parseMultipartPost((uint8_t*)buf, len);
       } else
           _parsedLength += len;
     } else {
@@ -180,11 +180,9 @@ void AsyncWebServerRequest::_onData(void *buf, size_t len){
 
 void AsyncWebServerRequest::_removeNotInterestingHeaders(){
   if (_interestingHeaders.containsIgnoreCase("ANY")) return; // nothing to do
-  for(const auto& header: _headers){
-      if(!_interestingHeaders.containsIgnoreCase(header->name().c_str())){
-        _headers.remove(header);
-      }
-  }
+  _headers.remove_if([this](AsyncWebHeader * const & header){
+    return !_interestingHeaders.containsIgnoreCase(header->name().c_str());
+  });
 }
 
 void AsyncWebServerRequest::_onPoll(){
@@ -377,6 +375,19 @@ void AsyncWebServerRequest::_handleUploadByte(uint8_t data, bool last){
   }
 }
 
+// A slice of file data straight from the segment, after what the byte parser buffered.
+void AsyncWebServerRequest::_handleUploadData(uint8_t *data, size_t len){
+  //check if authenticated before calling the upload
+  if(_itemBufferIndex){
+    if(_handler)
+      _handler->handleUpload(this, _itemFilename, _itemSize - _itemBufferIndex, _itemBuffer, _itemBufferIndex, false);
+    _itemBufferIndex = 0;
+  }
+  if(_handler)
+    _handler->handleUpload(this, _itemFilename, _itemSize, data, len, false);
+  _itemSize += len;
+}
+
 enum {
   EXPECT_BOUNDARY,
   PARSE_HEADERS,
@@ -391,6 +402,36 @@ enum {
   PARSE_ERROR
 };
 
+// Parse a segment of a multipart body. The data of a file is searched for the
+// delimiter ending it and handed to handleUpload() in slices as large as the
+// segment allows; part headers, form fields and the delimiters themselves go
+// through the byte parser.
+void AsyncWebServerRequest::_parseMultipartPost(uint8_t *data, size_t len){
+  if(!_parsedLength && !_multipartDelimiter){
+    _multipartDelimiter = new AsyncWebMultipartDelimiter();
+    //byte by byte only for a boundary too long to search for
+    if(_multipartDelimiter && !_multipartDelimiter->begin(_boundary.c_str(), _boundary.length())){
+      delete _multipartDelimiter;
+      _multipartDelimiter = NULL;
+    }
+  }
+  size_t i = 0;
+  while(i < len){
+    if(_multipartDelimiter && _multiParseState == WAIT_FOR_RETURN1 && _itemIsFile){
+      size_t n = _multipartDelimiter->dataLength(data + i, len - i);
+      if(n){
+        _handleUploadData(data + i, n);
+        _parsedLength += n;
+        i += n;
+        continue;
+      }
+    }
+    _parseMultipartPostByte(data[i], i == len - 1);
+    _parsedLength++;
+    i++;
+  }
+}
+
 void AsyncWebServerRequest::_parseMultipartPostByte(uint8_t data, bool last){
 #define itemWriteByte(b) do { _itemSize++; if(_itemIsFile) _handleUploadByte(b, last); else _itemValue+=(char)(b); } while(0)
 
@@ -0,0 +1,76 @@
+/**
+ * @file FixedRateScheduler.cpp
+ * @brief Periodic wake-ups keyed to absolute deadlines.
+ */
+
+#include "FixedRateScheduler.h"
+
+FixedRateScheduler::FixedRateScheduler(uint64_t periodMicros)
+    : _timer(NULL), _task(NULL), _deadline(0), _period(periodMicros), _missed(0)
+{
+}
+
+FixedRateScheduler::~FixedRateScheduler()
+{
+  if (_timer)
+  {
+    esp_timer_stop(_timer);
+    esp_timer_delete(_timer);
+  }
+}
+
+void FixedRateScheduler::start()
+{
+  _task = xTaskGetCurrentTaskHandle();
+  if (!_timer)
+  {
+    esp_timer_create_args_t args = {};
+    args.callback = onTimer;
+    args.arg = this;
+    args.dispatch_method = ESP_TIMER_TASK;
+    args.name = "scheduler";
+    esp_timer_create(&args, &_timer);
+  }
+  _deadline = esp_timer_get_time();
+}
+
+uint32_t FixedRateScheduler::waitNext()
+{
+  int64_t now = esp_timer_get_time();
+  if (_deadline > now)
+  {
+    esp_timer_start_once(_timer, _deadline - now);
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    now = esp_timer_get_time();
+  }
+  int64_t lateness = now - _deadline;
+
+  /** Next deadline stays on the original grid, skipping any we overran */
+  int64_t period = (int64_t)_period;
+  _deadline += period;
+  if (now >= _deadline)
+  {
+    int64_t skipped = (now - _deadline) / period + 1;
+    _missed += skipped;
+    _deadline += skipped * period;
+  }
+  return lateness > 0xFFFFFFFF ? 0xFFFFFFFF : (uint32_t)lateness;
+}
+
+void FixedRateScheduler::reschedule(uint64_t periodMicros)
+{
+  /** The wait just ended at _deadline - _period, move on from there */
+  _deadline += (int64_t)periodMicros - (int64_t)_period;
+  _period = periodMicros;
+  int64_t now = esp_timer_get_time();
+  if (_deadline < now)
+  {
+    _deadline = now;
+  }
+}
+
+void FixedRateScheduler::onTimer(void *arg)
+{
+  FixedRateScheduler *scheduler = (FixedRateScheduler *)arg;
+  xTaskNotifyGive(scheduler->_task);
+}
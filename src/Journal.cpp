@@ -0,0 +1,605 @@
+/**
+ * @file Journal.cpp
+ * @brief Framed, checksummed append-only records with bounded tail recovery.
+ */
+
+#include "Journal.h"
+#include "Log.h"
+
+#include <unistd.h>
+
+static_assert(JOURNAL_RECOVERY_WINDOW > 2 * JOURNAL_MAX_RECORD,
+              "Recovery windows must be larger than the records they overlap by");
+
+/** Nibble table of CRC-16/CCITT, polynomial 0x1021 */
+static const uint16_t CRC16_TABLE[16] = {
+  0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+  0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF
+};
+
+uint16_t Journal::crc16(const uint8_t *data, size_t length, uint16_t crc)
+{
+  while (length--)
+  {
+    uint8_t byte = *data++;
+    crc = (crc << 4) ^ CRC16_TABLE[(crc >> 12) ^ (byte >> 4)];
+    crc = (crc << 4) ^ CRC16_TABLE[(crc >> 12) ^ (byte & 0x0F)];
+  }
+  return crc;
+}
+
+size_t Journal::encode(uint8_t *out, uint32_t seq, const uint8_t *payload, uint8_t length,
+                       uint16_t salt)
+{
+  out[0] = JOURNAL_SYNC;
+  out[1] = length;
+  out[2] = seq;
+  out[3] = seq >> 8;
+  out[4] = seq >> 16;
+  out[5] = seq >> 24;
+  memcpy(out + JOURNAL_HEADER_SIZE, payload, length);
+  size_t end = JOURNAL_HEADER_SIZE + length;
+  uint16_t crc = crc16(out + 1, end - 1, salt);
+  out[end] = crc;
+  out[end + 1] = crc >> 8;
+  return end + JOURNAL_TRAILER_SIZE;
+}
+
+size_t Journal::decode(const uint8_t *in, size_t available, JournalRecord &record, uint16_t salt)
+{
+  if (available < JOURNAL_HEADER_SIZE + JOURNAL_TRAILER_SIZE || in[0] != JOURNAL_SYNC)
+  {
+    return 0;
+  }
+  size_t end = JOURNAL_HEADER_SIZE + in[1];
+  if (available < end + JOURNAL_TRAILER_SIZE)
+  {
+    return 0;
+  }
+  uint16_t crc = in[end] | (in[end + 1] << 8);
+  if (crc16(in + 1, end - 1, salt) != crc)
+  {
+    return 0;
+  }
+  record.length = in[1];
+  record.seq = in[2] | (in[3] << 8) | (in[4] << 16) | ((uint32_t)in[5] << 24);
+  memcpy(record.payload, in + JOURNAL_HEADER_SIZE, record.length);
+  return end + JOURNAL_TRAILER_SIZE;
+}
+
+/** Serialized checkpoint: magic, the JournalCheckpoint fields and a CRC */
+#define CHECKPOINT_SIZE 28
+
+static void putU32(uint8_t *out, uint32_t value)
+{
+  out[0] = value;
+  out[1] = value >> 8;
+  out[2] = value >> 16;
+  out[3] = value >> 24;
+}
+
+static uint32_t getU32(const uint8_t *in)
+{
+  return in[0] | (in[1] << 8) | (in[2] << 16) | ((uint32_t)in[3] << 24);
+}
+
+static void encodeCheckpoint(uint8_t *out, const JournalCheckpoint &checkpoint)
+{
+  putU32(out, JOURNAL_MAGIC);
+  out[4] = checkpoint.salt;
+  out[5] = checkpoint.salt >> 8;
+  putU32(out + 6, checkpoint.capacity);
+  putU32(out + 10, checkpoint.end);
+  putU32(out + 14, checkpoint.nextSeq);
+  putU32(out + 18, checkpoint.lastOffset);
+  putU32(out + 22, checkpoint.generation);
+  uint16_t crc = Journal::crc16(out, CHECKPOINT_SIZE - 2);
+  out[26] = crc;
+  out[27] = crc >> 8;
+}
+
+static bool decodeCheckpoint(const uint8_t *in, JournalCheckpoint &checkpoint)
+{
+  if (getU32(in) != JOURNAL_MAGIC || Journal::crc16(in, CHECKPOINT_SIZE - 2) != (in[26] | (in[27] << 8)))
+  {
+    return false;
+  }
+  checkpoint.salt = in[4] | (in[5] << 8);
+  checkpoint.capacity = getU32(in + 6);
+  checkpoint.end = getU32(in + 10);
+  checkpoint.nextSeq = getU32(in + 14);
+  checkpoint.lastOffset = getU32(in + 18);
+  checkpoint.generation = getU32(in + 22);
+  return checkpoint.end >= JOURNAL_DATA_OFFSET && checkpoint.end <= checkpoint.capacity;
+}
+
+bool Journal::readCheckpoint(fs::File &file, JournalCheckpoint &checkpoint)
+{
+  bool found = false;
+  uint8_t buffer[CHECKPOINT_SIZE];
+  JournalCheckpoint candidate;
+  for (uint32_t slot = 0; slot < 2; slot++)
+  {
+    if (file.seek(slot * JOURNAL_HEADER_SLOT) && file.read(buffer, sizeof(buffer)) == sizeof(buffer) &&
+        decodeCheckpoint(buffer, candidate) && (!found || candidate.generation > checkpoint.generation))
+    {
+      checkpoint = candidate;
+      found = true;
+    }
+  }
+  return found;
+}
+
+Journal::Journal()
+    : _fs(NULL), _nextSeq(0), _size(0), _truncated(0), _scanned(0), _dirty(false), _hasLast(false),
+      _lastOffset(0), _capacity(0), _salt(JOURNAL_DEFAULT_SALT)
+{
+  _path[0] = 0;
+  _vfsPath[0] = 0;
+}
+
+bool Journal::begin(fs::FS &fs, const char *mountPoint, const char *path, uint32_t capacity, uint16_t salt)
+{
+  close();
+  _fs = &fs;
+  snprintf(_path, sizeof(_path), "%s", path);
+  snprintf(_vfsPath, sizeof(_vfsPath), "%s%s", mountPoint, path);
+  _nextSeq = 0;
+  _size = 0;
+  _truncated = 0;
+  _scanned = 0;
+  _dirty = false;
+  _hasLast = false;
+  _lastOffset = 0;
+  _capacity = 0;
+  _salt = salt;
+  if (!fs.exists(_path))
+  {
+    if (capacity)
+    {
+      _capacity = capacity;
+      return preallocate();
+    }
+    File file = fs.open(_path, FILE_WRITE);
+    if (!file)
+    {
+      LOG_ERROR("Failed to create journal %s", _path);
+      return false;
+    }
+    file.close();
+    return true;
+  }
+
+  File file = fs.open(_path, FILE_READ);
+  uint8_t magic[4];
+  bool preallocated = file && file.read(magic, sizeof(magic)) == sizeof(magic) && getU32(magic) == JOURNAL_MAGIC;
+  file.close();
+  return preallocated ? recoverPreallocated() : recover();
+}
+
+/**
+ * Writing the last byte makes the file system allocate every cluster of the
+ * file now rather than on the appends. Both header copies are written so that
+ * a stale header left in the second sector by a deleted file cannot win.
+ */
+bool Journal::preallocate()
+{
+  if (_capacity < JOURNAL_DATA_OFFSET + JOURNAL_MAX_RECORD)
+  {
+    return false;
+  }
+  File file = _fs->open(_path, FILE_WRITE);
+  if (!file)
+  {
+    LOG_ERROR("Failed to create journal %s", _path);
+    return false;
+  }
+  uint8_t buffer[CHECKPOINT_SIZE];
+  _checkpoint.salt = _salt;
+  _checkpoint.capacity = _capacity;
+  _checkpoint.end = JOURNAL_DATA_OFFSET;
+  _checkpoint.nextSeq = 0;
+  _checkpoint.lastOffset = 0;
+  for (uint32_t slot = 0; slot < 2; slot++)
+  {
+    _checkpoint.generation = slot;
+    encodeCheckpoint(buffer, _checkpoint);
+    file.seek(slot * JOURNAL_HEADER_SLOT);
+    file.write(buffer, sizeof(buffer));
+  }
+  uint8_t zero = 0;
+  bool allocated = file.seek(_capacity - 1) && file.write(&zero, 1) == 1;
+  file.close();
+  if (!allocated)
+  {
+    LOG_ERROR("Failed to preallocate %u bytes for %s", _capacity, _path);
+    _fs->remove(_path);
+    return false;
+  }
+  _file = _fs->open(_path, "r+");
+  _size = JOURNAL_DATA_OFFSET;
+  return (bool)_file;
+}
+
+bool Journal::writeCheckpoint()
+{
+  uint8_t buffer[CHECKPOINT_SIZE];
+  _checkpoint.generation++;
+  _checkpoint.end = _size;
+  _checkpoint.nextSeq = _nextSeq;
+  _checkpoint.lastOffset = _lastOffset;
+  encodeCheckpoint(buffer, _checkpoint);
+  bool written = _file.seek((_checkpoint.generation & 1) * JOURNAL_HEADER_SLOT) &&
+                 _file.write(buffer, sizeof(buffer)) == sizeof(buffer);
+  _file.flush();
+  return written;
+}
+
+void Journal::close()
+{
+  if (_file)
+  {
+    if (_checkpoint.end != _size)
+    {
+      writeCheckpoint();
+    }
+    _file.close();
+  }
+}
+
+/**
+ * Reads forward from the last record of the newest checkpoint, which may have
+ * been rewritten since, for as long as records check out with the file's salt
+ * and continue its sequence numbers. Without a valid checkpoint, which only
+ * happens if both header sectors were damaged, it reads from the first record.
+ */
+bool Journal::recoverPreallocated()
+{
+  _file = _fs->open(_path, "r+");
+  if (!_file)
+  {
+    LOG_ERROR("Failed to open journal %s", _path);
+    return false;
+  }
+  if (!readCheckpoint(_file, _checkpoint))
+  {
+    LOG_WARN("Journal %s: no valid checkpoint", _path);
+    _checkpoint.salt = _salt;
+    _checkpoint.capacity = _file.size();
+    _checkpoint.end = JOURNAL_DATA_OFFSET;
+    _checkpoint.nextSeq = 0;
+    _checkpoint.lastOffset = 0;
+    _checkpoint.generation = 0;
+  }
+  _salt = _checkpoint.salt;
+  _capacity = _checkpoint.capacity;
+  _size = _checkpoint.lastOffset ? _checkpoint.lastOffset : _checkpoint.end;
+  _nextSeq = _checkpoint.lastOffset ? _checkpoint.nextSeq - 1 : _checkpoint.nextSeq;
+  _lastOffset = 0;
+
+  JournalRecord record;
+  _scanned = 0;
+  while (_size < _capacity && _scanned < JOURNAL_RECOVERY_MAX)
+  {
+    uint32_t offset = _size;
+    size_t size = readRecord(_file, offset, _salt, record);
+    if ((!size || record.seq != _nextSeq) && offset % JOURNAL_SECTOR)
+    {
+      /** The next record may have been placed at the start of the next sector */
+      offset += JOURNAL_SECTOR - offset % JOURNAL_SECTOR;
+      size = offset < _capacity ? readRecord(_file, offset, _salt, record) : 0;
+    }
+    if (!size || record.seq != _nextSeq)
+    {
+      break;
+    }
+    _last = record;
+    _hasLast = true;
+    _lastOffset = offset;
+    _size = offset + size;
+    _nextSeq++;
+    _scanned += size;
+  }
+
+  if (_size != _checkpoint.end)
+  {
+    writeCheckpoint();
+  }
+  LOG_INFO("Journal %s: %u of %u bytes used, next record %u", _path, _size, _capacity, _nextSeq);
+  return true;
+}
+
+size_t Journal::readRecord(fs::File &file, uint32_t offset, uint16_t salt, JournalRecord &record)
+{
+  uint8_t buffer[JOURNAL_MAX_RECORD];
+  if (!file.seek(offset) || file.read(buffer, JOURNAL_HEADER_SIZE) != JOURNAL_HEADER_SIZE ||
+      buffer[0] != JOURNAL_SYNC)
+  {
+    return 0;
+  }
+  size_t rest = buffer[1] + JOURNAL_TRAILER_SIZE;
+  if (file.read(buffer + JOURNAL_HEADER_SIZE, rest) != rest)
+  {
+    return 0;
+  }
+  return decode(buffer, JOURNAL_HEADER_SIZE + rest, record, salt);
+}
+
+/**
+ * Whether the record with sequence number `seq` at `offset` of a growing
+ * journal continues the one before it: a valid record numbered `seq - 1` ends
+ * right where it starts. The first record of a file has none, nor has the
+ * first one appended after a recovery that found nothing and started over at 0.
+ */
+static bool followsRecord(fs::File &file, uint32_t offset, uint32_t seq)
+{
+  if (offset == 0 || seq == 0)
+  {
+    return seq == 0;
+  }
+  uint8_t buffer[JOURNAL_MAX_RECORD];
+  uint32_t length = offset < JOURNAL_MAX_RECORD ? offset : JOURNAL_MAX_RECORD;
+  if (!file.seek(offset - length) || file.read(buffer, length) != length)
+  {
+    return false;
+  }
+  JournalRecord record;
+  for (uint32_t start = 0; start + JOURNAL_HEADER_SIZE + JOURNAL_TRAILER_SIZE <= length; start++)
+  {
+    if (Journal::decode(buffer + start, length - start, record) == length - start && record.seq == seq - 1)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * Scans windows of JOURNAL_RECOVERY_WINDOW bytes from the end of the file
+ * backwards. Consecutive windows overlap by a maximum record, so every record
+ * lies whole in at least one of them; the first window holding a valid record
+ * therefore holds the last one.
+ *
+ * A CRC-16 matches by chance somewhere in enough garbage, so as
+ * recoverPreallocated() checks records against the checkpoint, a record is
+ * only taken if it continues the sequence numbers of the one before it, see
+ * followsRecord().
+ */
+bool Journal::recover()
+{
+  File file = _fs->open(_path, FILE_READ);
+  if (!file)
+  {
+    LOG_ERROR("Failed to open journal %s", _path);
+    return false;
+  }
+  uint32_t fileSize = file.size();
+  uint8_t *window = (uint8_t *)malloc(JOURNAL_RECOVERY_WINDOW);
+  if (!window)
+  {
+    file.close();
+    return false;
+  }
+  bool found = false;
+  uint32_t validEnd = 0;
+  uint32_t windowEnd = fileSize;
+  _scanned = 0;
+  while (!found && windowEnd > 0 && _scanned < JOURNAL_RECOVERY_MAX)
+  {
+    uint32_t windowStart = windowEnd > JOURNAL_RECOVERY_WINDOW ? windowEnd - JOURNAL_RECOVERY_WINDOW : 0;
+    uint32_t length = windowEnd - windowStart;
+    file.seek(windowStart);
+    if (file.read(window, length) != length)
+    {
+      break;
+    }
+    _scanned += length;
+    JournalRecord record;
+    bool chained = false;
+    for (uint32_t i = 0; i < length; i++)
+    {
+      size_t size = Journal::decode(window + i, length - i, record);
+      if (!size)
+      {
+        continue;
+      }
+      /** Most records follow one already taken from this window */
+      bool follows = chained && validEnd == windowStart + i && record.seq == _last.seq + 1;
+      if (!follows && !followsRecord(file, windowStart + i, record.seq))
+      {
+        continue;
+      }
+      _last = record;
+      found = true;
+      chained = true;
+      validEnd = windowStart + i + size;
+      i += size - 1;
+    }
+    if (windowStart == 0)
+    {
+      break;
+    }
+    windowEnd = windowStart + JOURNAL_MAX_RECORD;
+  }
+  file.close();
+  free(window);
+
+  if (!found)
+  {
+    if (fileSize > JOURNAL_RECOVERY_MAX)
+    {
+      /** Valid records may still lie further back, leave the file alone */
+      LOG_ERROR("No valid record in the last %u bytes of %s", _scanned, _path);
+      _size = fileSize;
+      return true;
+    }
+    validEnd = 0;
+  }
+
+  _truncated = fileSize - validEnd;
+  _size = validEnd;
+  _nextSeq = found ? _last.seq + 1 : 0;
+  _hasLast = found;
+  if (_truncated)
+  {
+    LOG_WARN("Journal %s: cutting %u bytes of garbage after offset %u", _path, _truncated, validEnd);
+    if (truncate(_vfsPath, validEnd) != 0)
+    {
+      LOG_ERROR("Failed to truncate %s", _vfsPath);
+      _dirty = true;
+    }
+  }
+  LOG_INFO("Journal %s: %u bytes, next record %u", _path, _size, _nextSeq);
+  return true;
+}
+
+bool Journal::append(const uint8_t *payload, uint8_t length)
+{
+  if (!_fs)
+  {
+    return false;
+  }
+  uint8_t buffer[JOURNAL_MAX_RECORD];
+  size_t size = encode(buffer, _nextSeq, payload, length, _salt);
+  uint32_t offset = _size;
+
+  if (_capacity)
+  {
+    /** Records never straddle a sector, so each one is a single sector write */
+    if (offset % JOURNAL_SECTOR + size > JOURNAL_SECTOR)
+    {
+      offset += JOURNAL_SECTOR - offset % JOURNAL_SECTOR;
+    }
+    /** A failed write is simply overwritten by the next one */
+    if (!_file || offset + size > _capacity || !_file.seek(offset))
+    {
+      return false;
+    }
+    size_t written = _file.write(buffer, size);
+    _file.flush();
+    if (written != size)
+    {
+      return false;
+    }
+  }
+  else
+  {
+    if (_dirty)
+    {
+      if (truncate(_vfsPath, _size) != 0)
+      {
+        return false;
+      }
+      _dirty = false;
+    }
+    File file = _fs->open(_path, FILE_APPEND);
+    if (!file)
+    {
+      return false;
+    }
+    size_t written = file.write(buffer, size);
+    file.close();
+    if (written != size)
+    {
+      /** Part of the record may be on the card, cut it off before the next one */
+      _dirty = true;
+      return false;
+    }
+  }
+
+  _lastOffset = offset;
+  _size = offset + size;
+  _last.seq = _nextSeq++;
+  _last.length = length;
+  memcpy(_last.payload, payload, length);
+  _hasLast = true;
+  if (_capacity && _size - _checkpoint.end >= JOURNAL_CHECKPOINT_BYTES)
+  {
+    writeCheckpoint();
+  }
+  return true;
+}
+
+bool Journal::fitsLast(uint8_t length) const
+{
+  return _capacity && _hasLast &&
+         _lastOffset % JOURNAL_SECTOR + JOURNAL_HEADER_SIZE + length + JOURNAL_TRAILER_SIZE <= JOURNAL_SECTOR;
+}
+
+bool Journal::rewriteLast(const uint8_t *payload, uint8_t length)
+{
+  if (!fitsLast(length) || !_file)
+  {
+    return false;
+  }
+  uint8_t buffer[JOURNAL_MAX_RECORD];
+  size_t size = encode(buffer, _last.seq, payload, length, _salt);
+  if (!_file.seek(_lastOffset))
+  {
+    return false;
+  }
+  size_t written = _file.write(buffer, size);
+  _file.flush();
+  if (written != size)
+  {
+    return false;
+  }
+  _size = _lastOffset + size;
+  _last.length = length;
+  memcpy(_last.payload, payload, length);
+  if (_size - _checkpoint.end >= JOURNAL_CHECKPOINT_BYTES)
+  {
+    writeCheckpoint();
+  }
+  return true;
+}
+
+void JournalReader::start()
+{
+  JournalCheckpoint checkpoint;
+  _started = true;
+  _checkSeq = Journal::readCheckpoint(_file, checkpoint);
+  _salt = _checkSeq ? checkpoint.salt : JOURNAL_DEFAULT_SALT;
+  _nextSeq = 0;
+  _offset = _checkSeq ? JOURNAL_DATA_OFFSET : 0;
+}
+
+bool JournalReader::seek(uint32_t offset)
+{
+  if (!_started)
+  {
+    start();
+  }
+  JournalRecord record;
+  if (!_checkSeq || !Journal::readRecord(_file, offset, _salt, record))
+  {
+    return false;
+  }
+  /** next() reads the record again, now as the one expected */
+  _offset = offset;
+  _nextSeq = record.seq;
+  return true;
+}
+
+bool JournalReader::next(JournalRecord &record)
+{
+  if (!_started)
+  {
+    start();
+  }
+  size_t size = Journal::readRecord(_file, _offset, _salt, record);
+  if (_checkSeq && (!size || record.seq != _nextSeq) && _offset % JOURNAL_SECTOR)
+  {
+    /** The record did not fit in the rest of the sector and starts the next one */
+    _offset += JOURNAL_SECTOR - _offset % JOURNAL_SECTOR;
+    size = Journal::readRecord(_file, _offset, _salt, record);
+  }
+  /** Stale records of an earlier file never continue the sequence */
+  if (!size || (_checkSeq && record.seq != _nextSeq))
+  {
+    return false;
+  }
+  _offset += size;
+  _nextSeq = record.seq + 1;
+  return true;
+}
@@ -0,0 +1,126 @@
+/**
+ * @file Log.cpp
+ * @brief Compile-time filtered logging with an optional background sink.
+ */
+
+#include "Log.h"
+
+static Print *logOutput = &Serial;
+static volatile uint32_t logDroppedLines = 0;
+
+#if LOG_ASYNC
+
+/** Byte ring shared by all writers, drained by logTask */
+static uint8_t logBuffer[LOG_BUFFER_SIZE];
+static size_t logHead = 0; /**< Next byte to write */
+static size_t logTail = 0; /**< Next byte to drain */
+static portMUX_TYPE logMux = portMUX_INITIALIZER_UNLOCKED;
+static TaskHandle_t logTaskHandle = NULL;
+
+/**
+ * @brief Copy a whole line into the ring, or drop it if it does not fit.
+ */
+static bool logPush(const char *line, size_t len)
+{
+  bool pushed = false;
+  portENTER_CRITICAL(&logMux);
+  size_t used = logHead - logTail;
+  if (LOG_BUFFER_SIZE - used >= len)
+  {
+    size_t start = logHead % LOG_BUFFER_SIZE;
+    size_t first = min(len, (size_t)LOG_BUFFER_SIZE - start);
+    memcpy(logBuffer + start, line, first);
+    memcpy(logBuffer, line + first, len - first);
+    logHead += len;
+    pushed = true;
+  }
+  portEXIT_CRITICAL(&logMux);
+  return pushed;
+}
+
+/**
+ * @brief Take up to `size` contiguous bytes out of the ring.
+ */
+static size_t logPop(uint8_t *out, size_t size)
+{
+  portENTER_CRITICAL(&logMux);
+  size_t start = logTail % LOG_BUFFER_SIZE;
+  size_t len = min(min(logHead - logTail, (size_t)LOG_BUFFER_SIZE - start), size);
+  memcpy(out, logBuffer + start, len);
+  logTail += len;
+  portEXIT_CRITICAL(&logMux);
+  return len;
+}
+
+/**
+ * @brief Drain task: write queued lines whenever a writer signals.
+ */
+static void logTask(void *param)
+{
+  uint8_t chunk[64];
+  for (;;)
+  {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    size_t len;
+    while ((len = logPop(chunk, sizeof(chunk))) > 0)
+    {
+      logOutput->write(chunk, len);
+    }
+    logOutput->flush();
+  }
+}
+
+#endif
+
+void logBegin(Print &out, BaseType_t core)
+{
+  logOutput = &out;
+#if LOG_ASYNC
+  if (!logTaskHandle)
+  {
+    xTaskCreatePinnedToCore(logTask, "log", 3072, NULL, 1, &logTaskHandle, core);
+  }
+#else
+  (void)core;
+#endif
+}
+
+void logWrite(const char *format, ...)
+{
+  char line[LOG_LINE_MAX];
+  va_list args;
+  va_start(args, format);
+  int len = vsnprintf(line, sizeof(line), format, args);
+  va_end(args);
+  if (len < 0)
+  {
+    return;
+  }
+  if ((size_t)len >= sizeof(line))
+  {
+    len = sizeof(line) - 1;
+    line[len - 1] = '\n';
+  }
+
+#if LOG_ASYNC
+  if (!logTaskHandle)
+  {
+    logOutput->write((const uint8_t *)line, len);
+  }
+  else if (logPush(line, len))
+  {
+    xTaskNotifyGive(logTaskHandle);
+  }
+  else
+  {
+    logDroppedLines++;
+  }
+#else
+  logOutput->write((const uint8_t *)line, len);
+#endif
+}
+
+uint32_t logDropped()
+{
+  return logDroppedLines;
+}
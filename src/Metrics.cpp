@@ -0,0 +1,112 @@
+/**
+ * @file Metrics.cpp
+ * @brief Counters and histograms rendered in the Prometheus text format.
+ *
+ * Lines end in a bare '\n' as the text format requires, so println() is not used.
+ */
+
+#include "Metrics.h"
+
+const uint32_t METRIC_LATENCY_BOUNDS[] = {
+  100, 500, 1000, 5000, 10000, 50000, 100000, 250000, 500000, 1000000, 2500000, 5000000
+};
+const uint8_t METRIC_LATENCY_BOUND_COUNT = sizeof(METRIC_LATENCY_BOUNDS) / sizeof(METRIC_LATENCY_BOUNDS[0]);
+
+MetricHistogram::MetricHistogram(const uint32_t *bounds, uint8_t count)
+    : _bounds(bounds), _size(count > MAX_BUCKETS ? MAX_BUCKETS : count), _sum(0), _count(0),
+      _mux(portMUX_INITIALIZER_UNLOCKED)
+{
+  memset(_counts, 0, sizeof(_counts));
+}
+
+void MetricHistogram::observe(uint32_t micros)
+{
+  uint8_t bucket = 0;
+  while (bucket < _size && micros > _bounds[bucket])
+  {
+    bucket++;
+  }
+  portENTER_CRITICAL(&_mux);
+  _counts[bucket]++;
+  _sum += micros;
+  _count++;
+  portEXIT_CRITICAL(&_mux);
+}
+
+void MetricHistogram::write(Print &out, const char *name, const char *labels) const
+{
+  uint32_t counts[MAX_BUCKETS + 1];
+  portENTER_CRITICAL(&_mux);
+  memcpy(counts, _counts, sizeof(counts));
+  uint64_t sum = _sum;
+  uint32_t count = _count;
+  portEXIT_CRITICAL(&_mux);
+
+  const char *sep = labels ? "," : "";
+  labels = labels ? labels : "";
+  uint32_t cumulative = 0;
+  for (uint8_t i = 0; i <= _size; i++)
+  {
+    cumulative += counts[i];
+    out.print(name);
+    out.print("_bucket{");
+    out.print(labels);
+    out.print(sep);
+    if (i < _size)
+    {
+      out.printf("le=\"%u.%06u\"} ", _bounds[i] / 1000000, _bounds[i] % 1000000);
+    }
+    else
+    {
+      out.print("le=\"+Inf\"} ");
+    }
+    out.printf("%u\n", cumulative);
+  }
+
+  out.print(name);
+  out.print("_sum");
+  writeMetricSeconds(out, "", labels[0] ? labels : NULL, sum);
+  out.print(name);
+  out.print("_count");
+  writeMetricValue(out, "", labels[0] ? labels : NULL, count);
+}
+
+void writeMetricHeader(Print &out, const char *name, const char *type, const char *help)
+{
+  out.print("# HELP ");
+  out.print(name);
+  out.print(' ');
+  out.print(help);
+  out.print("\n# TYPE ");
+  out.print(name);
+  out.print(' ');
+  out.print(type);
+  out.print('\n');
+}
+
+/**
+ * @brief Write `name{labels} ` ahead of a value.
+ */
+static void writeMetricName(Print &out, const char *name, const char *labels)
+{
+  out.print(name);
+  if (labels)
+  {
+    out.print('{');
+    out.print(labels);
+    out.print('}');
+  }
+  out.print(' ');
+}
+
+void writeMetricValue(Print &out, const char *name, const char *labels, uint64_t value)
+{
+  writeMetricName(out, name, labels);
+  out.printf("%llu\n", (unsigned long long)value);
+}
+
+void writeMetricSeconds(Print &out, const char *name, const char *labels, uint64_t micros)
+{
+  writeMetricName(out, name, labels);
+  out.printf("%llu.%06u\n", (unsigned long long)(micros / 1000000), (unsigned)(micros % 1000000));
+}
@@ -0,0 +1,160 @@
+/**
+ * @file SampleCodec.cpp
+ * @brief Delta-of-delta and zig-zag varint coding of sample blocks.
+ */
+
+#include "SampleCodec.h"
+
+#include <string.h>
+
+/** Longest varint of a 64-bit value */
+#define VARINT_MAX 10
+
+static inline uint64_t zigzag(int64_t value)
+{
+  return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static inline int64_t unzigzag(uint64_t value)
+{
+  return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+static inline size_t putVarint(uint8_t *out, uint64_t value)
+{
+  size_t length = 0;
+  while (value >= 0x80)
+  {
+    out[length++] = (uint8_t)value | 0x80;
+    value >>= 7;
+  }
+  out[length++] = (uint8_t)value;
+  return length;
+}
+
+static inline bool getVarint(const uint8_t *in, size_t length, size_t &pos, uint64_t &value)
+{
+  value = 0;
+  for (unsigned shift = 0; shift < 64 && pos < length; shift += 7)
+  {
+    uint8_t byte = in[pos++];
+    value |= (uint64_t)(byte & 0x7F) << shift;
+    if (!(byte & 0x80))
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+void SampleBlockEncoder::begin(uint32_t firstIndex)
+{
+  _length = 0;
+  _count = 0;
+  _firstIndex = firstIndex;
+}
+
+bool SampleBlockEncoder::add(const Sample &sample)
+{
+  uint8_t encoded[1 + 4 * VARINT_MAX];
+  size_t length = 0;
+  int32_t raw = sample.raw;
+  int64_t delta = 0;
+  if (_count == 0)
+  {
+    encoded[length++] = SAMPLE_BLOCK_VERSION;
+    length += putVarint(encoded + length, _firstIndex);
+    length += putVarint(encoded + length, sample.readingID);
+    length += putVarint(encoded + length, sample.epoch);
+    length += putVarint(encoded + length, zigzag(raw));
+  }
+  else
+  {
+    delta = (int64_t)sample.epoch - _epoch;
+    bool idChanged = sample.readingID != _readingID;
+    length += putVarint(encoded + length, zigzag(delta - _delta) << 1 | idChanged);
+    if (idChanged)
+    {
+      length += putVarint(encoded + length, zigzag((int64_t)sample.readingID - _readingID));
+    }
+    length += putVarint(encoded + length, zigzag((int64_t)raw - _raw));
+  }
+  if (_length + length > SAMPLE_BLOCK_MAX_BYTES)
+  {
+    return false;
+  }
+  memcpy(_data + _length, encoded, length);
+  _length += length;
+  _count++;
+  _readingID = sample.readingID;
+  _epoch = sample.epoch;
+  _delta = delta;
+  _raw = raw;
+  return true;
+}
+
+bool SampleBlockDecoder::begin(const uint8_t *data, size_t length)
+{
+  _data = data;
+  _length = length;
+  _pos = 0;
+  _count = 0;
+  uint64_t firstIndex;
+  if (length == 0 || data[_pos++] != SAMPLE_BLOCK_VERSION || !getVarint(data, length, _pos, firstIndex))
+  {
+    _length = 0;
+    return false;
+  }
+  _firstIndex = firstIndex;
+  return true;
+}
+
+bool SampleBlockDecoder::next(Sample &sample)
+{
+  if (_pos >= _length)
+  {
+    return false;
+  }
+  uint64_t value;
+  if (_count == 0)
+  {
+    uint64_t readingID, epoch, raw;
+    if (!getVarint(_data, _length, _pos, readingID) || !getVarint(_data, _length, _pos, epoch) ||
+        !getVarint(_data, _length, _pos, raw))
+    {
+      return false;
+    }
+    _readingID = readingID;
+    _epoch = epoch;
+    _delta = 0;
+    _raw = unzigzag(raw);
+  }
+  else
+  {
+    if (!getVarint(_data, _length, _pos, value))
+    {
+      return false;
+    }
+    _delta += unzigzag(value >> 1);
+    _epoch += _delta;
+    if (value & 1)
+    {
+      uint64_t idDelta;
+      if (!getVarint(_data, _length, _pos, idDelta))
+      {
+        return false;
+      }
+      _readingID += unzigzag(idDelta);
+    }
+    if (!getVarint(_data, _length, _pos, value))
+    {
+      return false;
+    }
+    _raw += unzigzag(value);
+  }
+  _count++;
+  sample.readingID = _readingID;
+  sample.epoch = _epoch;
+  sample.raw = _raw;
+  return true;
+}
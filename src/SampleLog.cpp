@@ -0,0 +1,699 @@
+/**
+ * @file SampleLog.cpp
+ * @brief Segment rotation, manifest, retention and CSV export of samples.
+ */
+
+#include "SampleLog.h"
+#include "Log.h"
+
+#include <time.h>
+
+/** Labels of the CSV columns */
+static const char CSV_HEADER[] = "Reading ID, Date, Hour, Temperature \r\n";
+
+/** Event byte and five 32-bit fields */
+#define MANIFEST_RECORD_SIZE 21
+
+/** Stale manifest records tolerated before it is rewritten */
+#define MANIFEST_SLACK 64
+
+static void putU32(uint8_t *out, uint32_t value)
+{
+  out[0] = value;
+  out[1] = value >> 8;
+  out[2] = value >> 16;
+  out[3] = value >> 24;
+}
+
+static uint32_t getU32(const uint8_t *in)
+{
+  return in[0] | (in[1] << 8) | (in[2] << 16) | ((uint32_t)in[3] << 24);
+}
+
+SampleLog::SampleLog()
+    : _fs(NULL), _mountPoint(NULL), _segmentOpen(false), _segments(NULL), _count(0), _nextId(0),
+      _deleted(0), _deferred(0), _maxFill(1.0f), _fill(NULL), _mux(portMUX_INITIALIZER_UNLOCKED)
+{
+  _dir[0] = 0;
+  _manifestPath[0] = 0;
+  memset(_readers, 0, sizeof(_readers));
+}
+
+bool SampleLog::begin(fs::FS &fs, const char *mountPoint, const char *dir)
+{
+  _fs = &fs;
+  _mountPoint = mountPoint;
+  snprintf(_dir, sizeof(_dir), "%s", dir);
+  snprintf(_manifestPath, sizeof(_manifestPath), "%s/manifest", dir);
+  if (!_segments)
+  {
+    _segments = (SegmentInfo *)malloc(SEGMENT_INDEX_MAX * sizeof(SegmentInfo));
+    if (!_segments)
+    {
+      return false;
+    }
+  }
+  if (!fs.exists(_dir) && !fs.mkdir(_dir))
+  {
+    LOG_ERROR("Failed to create %s", _dir);
+    return false;
+  }
+  return replay();
+}
+
+void SampleLog::segmentPath(char *out, size_t size, uint32_t id) const
+{
+  snprintf(out, size, "%s/%08u.seg", _dir, id);
+}
+
+uint16_t SampleLog::segmentSalt(uint32_t id)
+{
+  uint8_t bytes[4];
+  putU32(bytes, id);
+  return Journal::crc16(bytes, sizeof(bytes));
+}
+
+int SampleLog::indexOf(uint32_t id) const
+{
+  for (int i = _count - 1; i >= 0; i--)
+  {
+    if (_segments[i].id == id)
+    {
+      return i;
+    }
+  }
+  return -1;
+}
+
+/**
+ * A rewrite of the manifest goes to manifest.new, which then replaces the old
+ * one. Finding both at boot means the rewrite was cut short and the old one is
+ * still complete; finding only the new one means it was cut short after the
+ * old one was removed.
+ */
+bool SampleLog::replay()
+{
+  char rewritePath[40];
+  snprintf(rewritePath, sizeof(rewritePath), "%s.new", _manifestPath);
+  if (_fs->exists(rewritePath))
+  {
+    if (_fs->exists(_manifestPath))
+    {
+      _fs->remove(rewritePath);
+    }
+    else
+    {
+      _fs->rename(rewritePath, _manifestPath);
+    }
+  }
+
+  if (!_manifest.begin(*_fs, _mountPoint, _manifestPath))
+  {
+    return false;
+  }
+  _count = 0;
+  _nextId = 0;
+  File file = _fs->open(_manifestPath, FILE_READ);
+  if (file)
+  {
+    JournalReader reader(file);
+    JournalRecord *record = (JournalRecord *)malloc(sizeof(JournalRecord));
+    while (record && reader.next(*record))
+    {
+      applyEvent(*record);
+    }
+    free(record);
+    file.close();
+  }
+
+  /** The newest segment is still open if the manifest has not seen it closed */
+  _segmentOpen = false;
+  if (_count && !_segments[_count - 1].closed)
+  {
+    SegmentInfo &info = _segments[_count - 1];
+    char path[40];
+    segmentPath(path, sizeof(path), info.id);
+    if (!_segment.begin(*_fs, _mountPoint, path, SEGMENT_MAX_BYTES, segmentSalt(info.id)))
+    {
+      return false;
+    }
+    /** Count and last epoch follow from the last block */
+    info.bytes = _segment.size();
+    const JournalRecord *last = _segment.last();
+    SampleBlockDecoder decoder;
+    Sample sample;
+    if (last && decoder.begin(last->payload, last->length))
+    {
+      while (decoder.next(sample))
+      {
+        info.lastEpoch = sample.epoch;
+      }
+      info.count = decoder.firstIndex() + decoder.count();
+    }
+    _segmentOpen = true;
+    _block.begin(info.count);
+  }
+  LOG_INFO("Sample log: %u segments, %llu bytes", (unsigned)_count, (unsigned long long)storedBytes());
+  return true;
+}
+
+void SampleLog::applyEvent(const JournalRecord &record)
+{
+  if (record.length != MANIFEST_RECORD_SIZE)
+  {
+    return;
+  }
+  SegmentInfo info;
+  info.id = getU32(record.payload + 1);
+  info.firstEpoch = getU32(record.payload + 5);
+  info.lastEpoch = getU32(record.payload + 9);
+  info.count = getU32(record.payload + 13);
+  info.bytes = getU32(record.payload + 17);
+  info.closed = record.payload[0] == SEGMENT_CLOSED;
+
+  int index = indexOf(info.id);
+  switch (record.payload[0])
+  {
+    case SEGMENT_OPENED:
+    case SEGMENT_CLOSED:
+      if (index < 0)
+      {
+        if (_count == SEGMENT_INDEX_MAX)
+        {
+          memmove(_segments, _segments + 1, (_count - 1) * sizeof(SegmentInfo));
+          _count--;
+        }
+        index = _count++;
+      }
+      _segments[index] = info;
+      if (info.id >= _nextId)
+      {
+        _nextId = info.id + 1;
+      }
+      break;
+    case SEGMENT_DELETED:
+      if (index >= 0)
+      {
+        memmove(_segments + index, _segments + index + 1, (_count - index - 1) * sizeof(SegmentInfo));
+        _count--;
+      }
+      break;
+  }
+}
+
+bool SampleLog::writeEvent(Journal &journal, ManifestEvent event, const SegmentInfo &info)
+{
+  uint8_t payload[MANIFEST_RECORD_SIZE];
+  payload[0] = event;
+  putU32(payload + 1, info.id);
+  putU32(payload + 5, info.firstEpoch);
+  putU32(payload + 9, info.lastEpoch);
+  putU32(payload + 13, info.count);
+  putU32(payload + 17, info.bytes);
+  return journal.append(payload, sizeof(payload));
+}
+
+size_t SampleLog::append(const Sample &sample)
+{
+  if (_deferred)
+  {
+    removeDeferred();
+  }
+  if (!_segmentOpen || sample.epoch / 86400 != _segments[_count - 1].firstEpoch / 86400 ||
+      _segment.remaining() < JOURNAL_HEADER_SIZE + SAMPLE_BLOCK_MAX_BYTES + JOURNAL_TRAILER_SIZE)
+  {
+    if (!rotate(sample.epoch))
+    {
+      return 0;
+    }
+  }
+
+  /**
+   * Grow the open block if the sample fits, else start a new one. _block
+   * follows the last record on the card: it only takes the new block once
+   * that is written, so a failed write neither rewrites the last block
+   * without its samples later nor leaves a sample in it that was not counted.
+   */
+  bool written;
+  SampleBlockEncoder block = _block;
+  if (_block.count() && block.add(sample) && _segment.fitsLast(block.length()))
+  {
+    written = _segment.rewriteLast(block.data(), block.length());
+  }
+  else
+  {
+    block.begin(_block.firstIndex() + _block.count());
+    block.add(sample);
+    written = _segment.append(block.data(), block.length());
+  }
+  if (!written)
+  {
+    return 0;
+  }
+  _block = block;
+
+  portENTER_CRITICAL(&_mux);
+  SegmentInfo &info = _segments[_count - 1];
+  if (info.count == 0)
+  {
+    info.firstEpoch = sample.epoch;
+  }
+  info.lastEpoch = sample.epoch;
+  info.count++;
+  info.bytes = _segment.size();
+  portEXIT_CRITICAL(&_mux);
+  return JOURNAL_HEADER_SIZE + _block.length() + JOURNAL_TRAILER_SIZE;
+}
+
+/**
+ * The open event is written before the segment file is created, so a crash in
+ * between leaves an empty entry whose file is created again at the next boot.
+ * Preallocating the new segment is the one place where clusters get allocated.
+ */
+bool SampleLog::rotate(uint32_t epoch)
+{
+  if (_segmentOpen)
+  {
+    portENTER_CRITICAL(&_mux);
+    _segments[_count - 1].closed = true;
+    SegmentInfo info = _segments[_count - 1];
+    portEXIT_CRITICAL(&_mux);
+    _segmentOpen = false;
+    _segment.close();
+    if (!writeEvent(_manifest, SEGMENT_CLOSED, info))
+    {
+      LOG_ERROR("Failed to close segment %u in the manifest", info.id);
+    }
+  }
+
+  enforceRetention();
+  if (_manifest.nextSeq() > 2 * _count + MANIFEST_SLACK && !compactManifest())
+  {
+    LOG_ERROR("Failed to rewrite the manifest");
+  }
+
+  SegmentInfo info = {_nextId, epoch, epoch, 0, 0, false};
+  if (!writeEvent(_manifest, SEGMENT_OPENED, info))
+  {
+    return false;
+  }
+  _nextId++;
+  portENTER_CRITICAL(&_mux);
+  _segments[_count++] = info;
+  portEXIT_CRITICAL(&_mux);
+
+  char path[40];
+  segmentPath(path, sizeof(path), info.id);
+  if (!_segment.begin(*_fs, _mountPoint, path, SEGMENT_MAX_BYTES, segmentSalt(info.id)))
+  {
+    return false;
+  }
+  _segmentOpen = true;
+  _block.begin(0);
+  LOG_INFO("Started segment %s", path);
+  return true;
+}
+
+/**
+ * A segment deleted while being read frees no space until its readers are
+ * done, so the fill is not checked again until then: the next segments would
+ * go for nothing.
+ */
+void SampleLog::enforceRetention()
+{
+  while (_count >= SEGMENT_INDEX_MAX)
+  {
+    deleteOldest();
+  }
+  while (_fill && _count > 1 && !_deferred && _fill() > _maxFill)
+  {
+    deleteOldest();
+  }
+}
+
+/**
+ * @return false if the segment is being read and its file was left to removeDeferred().
+ */
+bool SampleLog::deleteOldest()
+{
+  SegmentInfo info = _segments[0];
+
+  /** Removed from the index first so no query opens it any more */
+  bool inUse = false;
+  portENTER_CRITICAL(&_mux);
+  memmove(_segments, _segments + 1, (_count - 1) * sizeof(SegmentInfo));
+  _count--;
+  for (size_t i = 0; i < SEGMENT_READERS_MAX; i++)
+  {
+    SegmentReaders &entry = _readers[i];
+    if (entry.readers && entry.info.id == info.id)
+    {
+      entry.info = info;
+      entry.deleted = true;
+      inUse = true;
+    }
+  }
+  portEXIT_CRITICAL(&_mux);
+  if (inUse)
+  {
+    LOG_INFO("Retention: segment %u is being read, deleting it later", info.id);
+    _deferred++;
+    return false;
+  }
+  removeSegment(info);
+  return true;
+}
+
+/**
+ * The deleted event is only written with the file gone, so a reboot before
+ * leaves the segment in the manifest to be deleted again rather than a file
+ * nothing knows about.
+ */
+void SampleLog::removeSegment(const SegmentInfo &info)
+{
+  char path[40];
+  segmentPath(path, sizeof(path), info.id);
+  LOG_INFO("Retention: deleting %s", path);
+  _fs->remove(path);
+  writeEvent(_manifest, SEGMENT_DELETED, info);
+  _deleted++;
+}
+
+void SampleLog::removeDeferred()
+{
+  for (size_t i = 0; i < SEGMENT_READERS_MAX; i++)
+  {
+    portENTER_CRITICAL(&_mux);
+    SegmentReaders &entry = _readers[i];
+    bool done = entry.deleted && !entry.readers;
+    SegmentInfo info = entry.info;
+    if (done)
+    {
+      entry.deleted = false;
+    }
+    portEXIT_CRITICAL(&_mux);
+    if (done)
+    {
+      removeSegment(info);
+      _deferred--;
+    }
+  }
+}
+
+bool SampleLog::openSegment(uint32_t id, File &file, SegmentInfo *info) const
+{
+  /** Counted first, so retention sees the reader before the file is open */
+  bool counted = false;
+  portENTER_CRITICAL(&_mux);
+  int index = indexOf(id);
+  if (index >= 0)
+  {
+    if (info)
+    {
+      *info = _segments[index];
+    }
+    SegmentReaders *slot = NULL;
+    for (size_t i = 0; i < SEGMENT_READERS_MAX && !counted; i++)
+    {
+      SegmentReaders &entry = _readers[i];
+      if (entry.readers && entry.info.id == id)
+      {
+        entry.readers++;
+        counted = true;
+      }
+      else if (!entry.readers && !entry.deleted && !slot)
+      {
+        slot = &entry;
+      }
+    }
+    if (!counted && slot)
+    {
+      slot->info.id = id;
+      slot->readers = 1;
+      counted = true;
+    }
+  }
+  portEXIT_CRITICAL(&_mux);
+  if (!counted)
+  {
+    return false;
+  }
+  char path[40];
+  segmentPath(path, sizeof(path), id);
+  file = _fs->open(path, FILE_READ);
+  if (!file)
+  {
+    closeSegment(id, file);
+    return false;
+  }
+  return true;
+}
+
+void SampleLog::closeSegment(uint32_t id, File &file) const
+{
+  file.close();
+  file = File();
+  portENTER_CRITICAL(&_mux);
+  for (size_t i = 0; i < SEGMENT_READERS_MAX; i++)
+  {
+    SegmentReaders &entry = _readers[i];
+    if (entry.readers && entry.info.id == id)
+    {
+      entry.readers--;
+      break;
+    }
+  }
+  portEXIT_CRITICAL(&_mux);
+}
+
+bool SampleLog::compactManifest()
+{
+  char rewritePath[40];
+  snprintf(rewritePath, sizeof(rewritePath), "%s.new", _manifestPath);
+  _fs->remove(rewritePath);
+  Journal rewrite;
+  if (!rewrite.begin(*_fs, _mountPoint, rewritePath))
+  {
+    return false;
+  }
+  /** Segments waiting for their readers stay, their deleted event is still to come */
+  for (size_t i = 0; i < SEGMENT_READERS_MAX; i++)
+  {
+    portENTER_CRITICAL(&_mux);
+    bool deleted = _readers[i].deleted;
+    SegmentInfo info = _readers[i].info;
+    portEXIT_CRITICAL(&_mux);
+    if (deleted && !writeEvent(rewrite, SEGMENT_CLOSED, info))
+    {
+      _fs->remove(rewritePath);
+      return false;
+    }
+  }
+  for (size_t i = 0; i < _count; i++)
+  {
+    if (!writeEvent(rewrite, _segments[i].closed ? SEGMENT_CLOSED : SEGMENT_OPENED, _segments[i]))
+    {
+      _fs->remove(rewritePath);
+      return false;
+    }
+  }
+  if (!_fs->remove(_manifestPath) || !_fs->rename(rewritePath, _manifestPath))
+  {
+    return false;
+  }
+  return _manifest.begin(*_fs, _mountPoint, _manifestPath);
+}
+
+size_t SampleLog::findSegments(uint32_t from, uint32_t to, uint32_t *ids, size_t max) const
+{
+  size_t found = 0;
+  portENTER_CRITICAL(&_mux);
+  for (size_t i = 0; i < _count; i++)
+  {
+    const SegmentInfo &info = _segments[i];
+    if (info.firstEpoch <= to && info.lastEpoch >= from)
+    {
+      if (ids && found < max)
+      {
+        ids[found] = info.id;
+      }
+      found++;
+    }
+  }
+  portEXIT_CRITICAL(&_mux);
+  return ids && found > max ? max : found;
+}
+
+bool SampleLog::segmentAt(size_t index, SegmentInfo &info) const
+{
+  portENTER_CRITICAL(&_mux);
+  bool valid = index < _count;
+  if (valid)
+  {
+    info = _segments[index];
+  }
+  portEXIT_CRITICAL(&_mux);
+  return valid;
+}
+
+uint64_t SampleLog::storedBytes() const
+{
+  uint64_t bytes = 0;
+  portENTER_CRITICAL(&_mux);
+  for (size_t i = 0; i < _count; i++)
+  {
+    bytes += _segments[i].bytes;
+  }
+  portEXIT_CRITICAL(&_mux);
+  return bytes;
+}
+
+SampleCsvExport::SampleCsvExport(const SampleLog &log, uint32_t from, uint32_t to, bool fahrenheit)
+    : _log(log), _from(from), _to(to), _fahrenheit(fahrenheit), _ids(NULL), _idCount(0), _nextId(0), _fileId(0),
+      _reader(_file),
+      _lineLength(sizeof(CSV_HEADER) - 1), _linePos(0), _done(false)
+{
+  memcpy(_line, CSV_HEADER, sizeof(CSV_HEADER) - 1);
+  size_t count = log.findSegments(from, to, NULL, 0);
+  if (count)
+  {
+    _ids = (uint32_t *)malloc(count * sizeof(uint32_t));
+    _idCount = _ids ? log.findSegments(from, to, _ids, count) : 0;
+  }
+}
+
+SampleCsvExport::~SampleCsvExport()
+{
+  closeFile();
+  free(_ids);
+}
+
+void SampleCsvExport::closeFile()
+{
+  if (_file)
+  {
+    _log.closeSegment(_fileId, _file);
+  }
+}
+
+/**
+ * Later segments start after `from`, so only the first one is searched. The
+ * last sector whose first sample is before `from` is where reading starts:
+ * every sample in the sectors before it is older still. Each sector up to the
+ * end of the segment in the index starts with a valid record.
+ */
+void SampleCsvExport::seekFrom(const SegmentInfo &info)
+{
+  uint16_t salt = SampleLog::segmentSalt(info.id);
+  uint32_t low = JOURNAL_DATA_OFFSET / JOURNAL_SECTOR;
+  uint32_t high = (info.bytes + JOURNAL_SECTOR - 1) / JOURNAL_SECTOR;
+  uint32_t found = 0;
+  while (low < high)
+  {
+    uint32_t middle = low + (high - low) / 2;
+    Sample sample;
+    if (Journal::readRecord(_file, middle * JOURNAL_SECTOR, salt, _record) &&
+        _decoder.begin(_record.payload, _record.length) && _decoder.next(sample) && sample.epoch < _from)
+    {
+      found = middle;
+      low = middle + 1;
+    }
+    else
+    {
+      high = middle;
+    }
+  }
+  _decoder.begin(NULL, 0);
+  if (found)
+  {
+    _reader.seek(found * JOURNAL_SECTOR);
+  }
+}
+
+int SampleCsvExport::formatLine(char *out, size_t size, const Sample &sample, bool fahrenheit)
+{
+  /** The epoch is already local time, so it is broken down as UTC */
+  time_t epoch = sample.epoch;
+  struct tm time;
+  gmtime_r(&epoch, &time);
+  char temperature[TEMPERATURE_STRING_SIZE];
+  formatTemperature(temperature, sample.raw, fahrenheit);
+  return snprintf(out, size, "%u,%04d-%02d-%02d,%02d:%02d:%02d,%s\r\n",
+                  sample.readingID, time.tm_year + 1900, time.tm_mon + 1, time.tm_mday,
+                  time.tm_hour, time.tm_min, time.tm_sec, temperature);
+}
+
+bool SampleCsvExport::nextSample(Sample &sample)
+{
+  for (;;)
+  {
+    if (_decoder.next(sample))
+    {
+      if (sample.epoch < _from)
+      {
+        continue;
+      }
+      if (sample.epoch > _to)
+      {
+        /** Segments are in time order, nothing later can be in range */
+        closeFile();
+        _decoder.begin(NULL, 0);
+        _nextId = _idCount;
+        continue;
+      }
+      return true;
+    }
+    if (!_file)
+    {
+      if (_nextId >= _idCount)
+      {
+        return false;
+      }
+      /** A segment deleted since the export started is skipped */
+      _fileId = _ids[_nextId++];
+      SegmentInfo info;
+      _log.openSegment(_fileId, _file, &info);
+      _reader.restart();
+      if (_nextId == 1 && _file)
+      {
+        seekFrom(info);
+      }
+      continue;
+    }
+    if (!_reader.next(_record))
+    {
+      closeFile();
+      continue;
+    }
+    _decoder.begin(_record.payload, _record.length);
+  }
+}
+
+size_t SampleCsvExport::read(uint8_t *buffer, size_t maxLen)
+{
+  size_t filled = 0;
+  while (filled < maxLen)
+  {
+    if (_linePos == _lineLength)
+    {
+      Sample sample;
+      if (_done || !nextSample(sample))
+      {
+        _done = true;
+        break;
+      }
+      int length = formatLine(_line, sizeof(_line), sample, _fahrenheit);
+      _lineLength = length < (int)sizeof(_line) ? length : sizeof(_line) - 1;
+      _linePos = 0;
+    }
+    size_t chunk = _lineLength - _linePos;
+    if (chunk > maxLen - filled)
+    {
+      chunk = maxLen - filled;
+    }
+    memcpy(buffer + filled, _line + _linePos, chunk);
+    _linePos += chunk;
+    filled += chunk;
+  }
+  return filled;
+}
@@ -52,12 +52,32 @@
 #include "SPIFFS.h"
 /** @} */
 
+#include "SampleRing.h"
+#include "SampleSnapshot.h"
+#include "FixedRateScheduler.h"
+#include "JitterHistogram.h"
+#include "Metrics.h"
+#include "Log.h"
+#include "SampleLog.h"
+#include "Temperature.h"
+#include "AdaptiveSampler.h"
+#include "PublishFilter.h"
+
+#include <memory>
+#include <Preferences.h>
+
 /** Declarations */
 void getReadings();
 void getTimeStamp();
-void logSDCard();
-void writeFile(fs::FS &fs, const char *path, const char *message);
-void appendFile(fs::FS &fs, const char *path, const char *message);
+void publishSample();
+void logSDCard(const Sample &sample);
+void notifyWebSocket(const Sample &sample);
+void notifyEvents(const Sample &sample);
+void sensingTask(void *param);
+void storageTask(void *param);
+void networkTask(void *param);
+struct HistoryRequest;
+void sendWebSocketHistory(const HistoryRequest &request);
 
 /** Define deep sleep options */
 uint64_t uS_TO_S_FACTOR = 1000000; /**< Conversion factor for micro seconds to seconds */
@@ -68,18 +88,40 @@ uint64_t TIME_TO_SLEEP = 600;
 const char *ssid = "E308";
 const char *password = "98806829";
 
+/**
+ * Credentials for firmware updates on /update. The route flashes whatever
+ * it is sent, so it is only registered when both are defined, e.g. with
+ * -DOTA_USERNAME='"admin"' -DOTA_PASSWORD='"..."' in build_flags.
+ */
+#if defined(OTA_USERNAME) != defined(OTA_PASSWORD)
+#error "Define both OTA_USERNAME and OTA_PASSWORD to enable firmware updates, or neither"
+#endif
+
 /** Define serverport */
 AsyncWebServer server(80); /**< Set up an AsyncWebServer instance */
 AsyncWebSocket ws("/ws");
+AsyncEventSource events("/events");
 
 /** Define CS pin for the SD card module */
 #define SD_CS 5
 
+/** VFS mount point of the SD card, as set by SD.begin() */
+#define SD_MOUNT_POINT "/sd"
+
+/** Directory of the sample log segments and manifest on the SD card */
+#define SAMPLE_LOG_DIR "/log"
+
+/** Card fill above which the oldest segments are deleted */
+#ifndef SD_RETENTION_FILL
+#define SD_RETENTION_FILL 0.9f
+#endif
+
+SampleLog sampleLog;
+bool sampleLogReady = false;
+
 /** Save reading number on RTC memory */
 RTC_DATA_ATTR int readingID = 0;
 
-String dataMessage;
-
 /** Data wire is connected to ESP32 GPIO 21 */
 #define ONE_WIRE_BUS 21
 
@@ -89,17 +131,210 @@ OneWire oneWire(ONE_WIRE_BUS);
 /** Pass our oneWire reference to Dallas Temperature sensor */
 DallasTemperature sensors(&oneWire);
 
-/** Temperature Sensor variables */
-float temperature;
+/** Address of the sensor, read once so readings skip the bus search */
+DeviceAddress sensorAddress;
+
+/** 64-bit ROM code of the sensor, most significant byte first as usually printed; set before the tasks start */
+uint64_t sensorId = 0;
+
+/** Reading being taken in 1/16 °C, TEMPERATURE_RAW_INVALID if the sensor failed; sensing task only */
+int16_t temperatureRaw = TEMPERATURE_RAW_INVALID;
 
 /** Define NTP Client to get time */
 WiFiUDP ntpUDP;
 NTPClient timeClient(ntpUDP);
 
-/** Variables to save date and time */
-String formattedDate;
-String dayStamp;
-String timeStamp;
+/** Epoch of the reading being taken, local time; sensing task only */
+uint32_t epochTime;
+
+/** Time between two NTP syncs in milliseconds */
+#define NTP_SYNC_INTERVAL_MS 60000
+
+/** Last NTP sync, written by the network task and read by the sensing task */
+portMUX_TYPE timeMux = portMUX_INITIALIZER_UNLOCKED;
+uint32_t syncedEpoch;  /**< Local epoch at the last sync */
+uint32_t syncedMillis; /**< millis() at the last sync */
+bool timeSynced = false;
+
+/** Samples handed from the sensing task to the storage and network tasks */
+SampleRing<Sample, 32> samples;
+
+/**
+ * @brief The latest reading and the sensor it came from, as served to web clients.
+ */
+struct LatestReading
+{
+  Sample sample;
+  uint64_t sensorId;
+};
+
+/** Latest reading, for handlers in any task; its sequence number counts readings since boot */
+SampleSnapshot<LatestReading> latestReading;
+
+/** -------------------------------------------- Tasks */
+
+/** Default time between two samples while the temperature changes, in milliseconds */
+#define SAMPLE_PERIOD_MS 10000
+// #define SAMPLE_PERIOD_MS (1000 * 60) /**< Update every minute */
+// #define SAMPLE_PERIOD_MS (1000 * 60 * 60) /**< Update every hour */
+
+/** Default sampling policy, changed at run time through /config */
+#ifndef SAMPLE_MAX_PERIOD_MS
+#define SAMPLE_MAX_PERIOD_MS (SAMPLE_PERIOD_MS * 6)
+#endif
+#ifndef SAMPLE_THRESHOLD_CENTI_PER_MIN
+#define SAMPLE_THRESHOLD_CENTI_PER_MIN 25
+#endif
+#ifndef SENSOR_RESOLUTION
+#define SENSOR_RESOLUTION 12
+#endif
+
+/** Core affinity of the application tasks, can be overridden with build flags */
+#ifndef SENSING_TASK_CORE
+#define SENSING_TASK_CORE 1
+#endif
+#ifndef STORAGE_TASK_CORE
+#define STORAGE_TASK_CORE 1
+#endif
+#ifndef NETWORK_TASK_CORE
+#define NETWORK_TASK_CORE 0
+#endif
+
+/**
+ * @brief An application task pinned to a core, with its run-time statistics.
+ */
+struct AppTask
+{
+  const char *name;        /**< Task name */
+  TaskFunction_t function; /**< Task body, gets the AppTask as parameter */
+  uint32_t stackSize;      /**< Task stack in bytes */
+  UBaseType_t priority;    /**< FreeRTOS priority */
+  BaseType_t core;         /**< Core the task is pinned to */
+  TaskHandle_t handle;
+  uint64_t busyMicros;     /**< CPU time spent working, guarded by taskStatsMux */
+  SampleCursor cursor;     /**< Position in the sample ring, for consumers */
+};
+
+enum { TASK_SENSING, TASK_STORAGE, TASK_NETWORK, TASK_COUNT };
+
+/** Sensing runs above everything else so the sample period stays fixed */
+AppTask tasks[TASK_COUNT] = {
+  {"sensing", sensingTask, 4096, 5, SENSING_TASK_CORE, NULL, 0, {}},
+  {"storage", storageTask, 4096, 2, STORAGE_TASK_CORE, NULL, 0, {}},
+  {"network", networkTask, 4096, 1, NETWORK_TASK_CORE, NULL, 0, {}},
+};
+
+portMUX_TYPE taskStatsMux = portMUX_INITIALIZER_UNLOCKED;
+
+/**
+ * @brief A websocket `hist` command, answered by the storage task.
+ *
+ * The client is named by ID, it may have disconnected by the time the reply
+ * is sent.
+ */
+struct HistoryRequest
+{
+  uint32_t clientId;
+  uint32_t from; /**< First epoch of the range */
+  uint32_t to;   /**< Last epoch of the range */
+  uint32_t skip; /**< Samples at `from` already sent */
+};
+
+/** `hist` commands waiting for the storage task, more are refused */
+#ifndef WS_HISTORY_QUEUE
+#define WS_HISTORY_QUEUE 4
+#endif
+
+QueueHandle_t historyRequests;
+
+/** -------------------------------------------- Live publishing */
+
+/** Default deadband of every channel, changed at run time through /publish */
+#ifndef PUBLISH_DEADBAND_CENTI
+#define PUBLISH_DEADBAND_CENTI 0
+#endif
+#ifndef PUBLISH_DEADBAND_PERMILLE
+#define PUBLISH_DEADBAND_PERMILLE 0
+#endif
+#ifndef PUBLISH_HEARTBEAT_S
+#define PUBLISH_HEARTBEAT_S 300
+#endif
+
+/**
+ * @brief A way samples are pushed to live clients, with its own deadband.
+ */
+struct PublishChannel
+{
+  const char *name;                      /**< Channel name in /publish and metrics */
+  void (*notify)(const Sample &sample);  /**< Pushes a sample to the clients */
+  PublishFilter filter;                  /**< Owned by the network task */
+  DeadbandConfig config;                 /**< Latest settings, guarded by publishConfigMux */
+  volatile bool changed;                 /**< config not yet applied to filter */
+};
+
+enum { CHANNEL_WS, CHANNEL_EVENTS, CHANNEL_COUNT };
+
+PublishChannel channels[CHANNEL_COUNT] = {
+  {"ws", notifyWebSocket, PublishFilter(),
+   {PUBLISH_DEADBAND_CENTI, PUBLISH_DEADBAND_PERMILLE, PUBLISH_HEARTBEAT_S}, true},
+  {"events", notifyEvents, PublishFilter(),
+   {PUBLISH_DEADBAND_CENTI, PUBLISH_DEADBAND_PERMILLE, PUBLISH_HEARTBEAT_S}, true},
+};
+
+portMUX_TYPE publishConfigMux = portMUX_INITIALIZER_UNLOCKED;
+
+/** -------------------------------------------- Metrics */
+
+MetricHistogram sampleAcquisitionTime;  /**< Sensor conversion and read */
+MetricHistogram ntpSyncTime;            /**< NTP round trips, successful or not */
+MetricCounter ntpSyncFailures;
+MetricHistogram sdAppendTime;           /**< Write and flush of one record, or a rotation */
+volatile uint32_t sdAppendMaxMicros = 0;
+MetricCounter sdAppendBytes;
+MetricCounter sdAppendFailures;
+uint32_t sdRecoveryMicros = 0;          /**< Journal tail recovery at boot */
+MetricCounter wsCommands;               /**< Websocket commands handled */
+MetricCounter wsCommandsLimited;        /**< Websocket commands dropped by the rate limit */
+MetricCounter wsCommandErrors;          /**< Malformed or unknown websocket commands */
+
+/** Maximum number of instrumented HTTP routes */
+#define MAX_ROUTES 16
+
+/**
+ * @brief Request count and handler latency of one HTTP route.
+ */
+struct RouteMetrics
+{
+  const char *route;
+  MetricCounter requests;
+  MetricHistogram latency;
+};
+
+RouteMetrics routeMetrics[MAX_ROUTES];
+uint8_t routeCount = 0;
+
+/** Largest acceptable wake-up lateness of the sensing task */
+#define SAMPLE_JITTER_TOLERANCE_US 2000
+
+/** Wakes the sensing task on a fixed grid of absolute deadlines */
+FixedRateScheduler sampleScheduler(SAMPLE_PERIOD_MS * 1000ULL);
+
+/** Picks the period of the next sample, owned by the sensing task */
+AdaptiveSampler sampler;
+
+/** Settings from /config, picked up by the sensing task at its next sample */
+portMUX_TYPE samplerConfigMux = portMUX_INITIALIZER_UNLOCKED;
+SamplerConfig samplerConfig = {SENSOR_RESOLUTION, SAMPLE_PERIOD_MS, SAMPLE_MAX_PERIOD_MS,
+                               SAMPLE_THRESHOLD_CENTI_PER_MIN};
+volatile bool samplerConfigChanged = true;
+
+/** Sampler settings in NVS, so they survive a power cycle */
+Preferences preferences;
+
+/** Wake-up lateness of the sensing task per sample, in microseconds */
+JitterHistogram sampleJitter;
+volatile uint32_t samplesOverTolerance = 0;
+volatile bool jitterResetRequested = false;
 
 /** -------------------------------------------- Temperature logging functions */
 
@@ -107,144 +342,1372 @@ String timeStamp;
  * @brief Get temperature reading from DS18B20 sensor.
  * 
  * This function requests temperature readings from the DS18B20 sensor and stores
- * the temperature value in the global variable `temperature`.
+ * its raw scratchpad value in the global variable `temperatureRaw`. It is only
+ * converted to °C or °F when displayed or exported.
  */
 void getReadings()
 {
-  sensors.requestTemperatures();
-  temperature = sensors.getTempCByIndex(0); /**< Temperature in Celsius */
-  /// temperature = sensors.getTempFByIndex(0); /**< Temperature in Fahrenheit */
-  Serial.print("Temperature: ");
-  Serial.println(temperature);
-
-  /// sends last temp read to websocket to update chart
-  ws.textAll(String(temperature));
+  int64_t start = esp_timer_get_time();
+  sensors.requestTemperaturesByAddress(sensorAddress);
+  temperatureRaw = temperatureAtResolution(
+      temperatureFromDallas(sensors.getTemp(sensorAddress), DEVICE_DISCONNECTED_RAW),
+      sampler.config().resolution);
+  sampleAcquisitionTime.observe(esp_timer_get_time() - start);
+  LOG_DEBUG("Temperature: %d/16 C", temperatureRaw);
 
   getTimeStamp();
 }
 
 /**
- * @brief Get date and time from NTP server.
+ * @brief Get date and time of the current reading.
  * 
- * This function retrieves the current date and time from an NTP server and stores
- * them in the global variables `formattedDate`, `dayStamp`, and `timeStamp`.
+ * The time is extrapolated from the last NTP sync made by the network task, so
+ * the sensing task never waits on the network. It is stored in the global
+ * variable `epochTime`.
  */
 void getTimeStamp()
 {
-  while (!timeClient.update())
+  portENTER_CRITICAL(&timeMux);
+  uint32_t epoch = syncedEpoch;
+  uint32_t since = millis() - syncedMillis;
+  portEXIT_CRITICAL(&timeMux);
+  epochTime = epoch + since / 1000;
+
+  publishSample();
+}
+
+/**
+ * @brief Sync the time with the NTP server if NTP_SYNC_INTERVAL_MS has passed.
+ *
+ * Only the network task (and setup, before the tasks run) may call this, as
+ * NTPClient itself is not thread safe. A failed sync is retried on the next
+ * call.
+ *
+ * @return false if a due sync failed.
+ */
+bool syncTime()
+{
+  if (timeSynced && millis() - syncedMillis < NTP_SYNC_INTERVAL_MS)
+  {
+    return true;
+  }
+  int64_t start = esp_timer_get_time();
+  bool synced = timeClient.forceUpdate();
+  ntpSyncTime.observe(esp_timer_get_time() - start);
+  if (!synced)
   {
-    timeClient.forceUpdate();
+    ntpSyncFailures.add();
+    return false;
   }
-  /// The formattedDate comes with the following format:
-  /// 2018-05-28T16:00:13Z
-  /// We need to extract date and time
-  formattedDate = timeClient.getFormattedDate();
-  Serial.println(formattedDate);
+  uint32_t epoch = timeClient.getEpochTime();
+  uint32_t now = millis();
+  portENTER_CRITICAL(&timeMux);
+  syncedEpoch = epoch;
+  syncedMillis = now;
+  portEXIT_CRITICAL(&timeMux);
+  timeSynced = true;
+  return true;
+}
 
-  /// Extract date
-  int splitT = formattedDate.indexOf("T");
-  dayStamp = formattedDate.substring(0, splitT);
-  Serial.println(dayStamp);
-  /// Extract time
-  timeStamp = formattedDate.substring(splitT + 1, formattedDate.length() - 1);
-  Serial.println(timeStamp);
+/**
+ * @brief Hand the current reading to the consumer tasks.
+ *
+ * Publishing never blocks: consumers are only woken up and read the sample
+ * from the ring when they get to run.
+ */
+void publishSample()
+{
+  Sample sample;
+  sample.readingID = readingID;
+  sample.epoch = epochTime;
+  sample.raw = temperatureRaw;
+  samples.publish(sample);
+
+  LatestReading latest;
+  latest.sample = sample;
+  latest.sensorId = sensorId;
+  latestReading.publish(latest);
 
-  logSDCard();
+  xTaskNotifyGive(tasks[TASK_STORAGE].handle);
+  xTaskNotifyGive(tasks[TASK_NETWORK].handle);
 }
 
 /**
- * @brief Log sensor readings onto the SD card.
- * 
- * This function constructs a data message including the reading ID, date, time, and
- * temperature, and appends it to the SD card file.
+ * @brief Add the time since `start` to a task's CPU time.
+ *
+ * @param task Task that did the work.
+ * @param start esp_timer_get_time() when the work started.
  */
-void logSDCard()
+void addBusyTime(AppTask *task, int64_t start)
 {
-  dataMessage = String(readingID) + "," + String(dayStamp) + "," + String(timeStamp) + "," +
-                String(temperature) + "\r\n";
-  Serial.print("Save data: ");
-  Serial.println(dataMessage);
-  appendFile(SD, "/data.txt", dataMessage.c_str());
+  int64_t elapsed = esp_timer_get_time() - start;
+  portENTER_CRITICAL(&taskStatsMux);
+  task->busyMicros += elapsed;
+  portEXIT_CRITICAL(&taskStatsMux);
 }
 
 /**
- * @brief Write data to a file on the file system.
- * 
- * @param fs File system object.
- * @param path Path to the file.
- * @param message Message to write to the file.
+ * @brief Pass every sample a consumer task has not seen yet to `consume`.
+ *
+ * @param task Consumer task, owns the cursor.
+ * @param consume Called once per sample, in order.
+ */
+void drainSamples(AppTask *task, void (*consume)(const Sample &sample))
+{
+  Sample sample;
+  uint32_t dropped = task->cursor.dropped;
+  while (samples.poll(task->cursor, sample))
+  {
+    consume(sample);
+  }
+  if (task->cursor.dropped != dropped)
+  {
+    LOG_WARN("Task %s fell behind, %u samples dropped", task->name, task->cursor.dropped);
+  }
+}
+
+/**
+ * @brief Apply the settings from /config to the sensor and the sampler.
+ *
+ * Runs in the sensing task, which owns the OneWire bus.
+ */
+void applySamplerConfig()
+{
+  portENTER_CRITICAL(&samplerConfigMux);
+  SamplerConfig config = samplerConfig;
+  samplerConfigChanged = false;
+  portEXIT_CRITICAL(&samplerConfigMux);
+
+  if (!sensors.setResolution(sensorAddress, config.resolution))
+  {
+    LOG_WARN("Setting the sensor to %u bits failed", config.resolution);
+  }
+  sampler.configure(config);
+  sampleScheduler.reschedule(sampler.period() * 1000ULL);
+  LOG_INFO("Sampling at %u bits every %u to %u ms", config.resolution, config.minPeriodMs,
+           config.maxPeriodMs);
+}
+
+/**
+ * @brief Sensing task: take a reading at the period chosen by `sampler`.
+ *
+ * The scheduler wakes the task at fixed absolute deadlines, so neither the
+ * conversion time nor anything else done per sample adds to the period. How
+ * late each wake-up was is recorded in `sampleJitter`. After each reading the
+ * sampler may shorten the period while the temperature changes or lengthen it
+ * while it is flat.
+ *
+ * @param param The AppTask entry of this task.
+ */
+void sensingTask(void *param)
+{
+  AppTask *task = (AppTask *)param;
+  sampleScheduler.start();
+  for (;;)
+  {
+    if (samplerConfigChanged)
+    {
+      applySamplerConfig();
+    }
+    uint32_t lateness = sampleScheduler.waitNext();
+    if (jitterResetRequested)
+    {
+      sampleJitter.reset();
+      samplesOverTolerance = 0;
+      jitterResetRequested = false;
+    }
+    sampleJitter.record(lateness);
+    if (lateness > SAMPLE_JITTER_TOLERANCE_US)
+    {
+      samplesOverTolerance++;
+    }
+
+    int64_t start = esp_timer_get_time();
+    getReadings();
+    uint64_t period = sampler.update(temperatureRaw) * 1000ULL;
+    if (period != sampleScheduler.period())
+    {
+      sampleScheduler.reschedule(period);
+    }
+    addBusyTime(task, start);
+  }
+}
+
+/**
+ * @brief Storage task: append every published sample to the SD card, and
+ * answer the queued `hist` commands from it.
+ *
+ * The card is only read here, between appends, so the web server task never
+ * waits on it. Samples are appended first, and published ones wait in the
+ * ring while a page is read.
+ *
+ * @param param The AppTask entry of this task.
+ */
+void storageTask(void *param)
+{
+  AppTask *task = (AppTask *)param;
+  for (;;)
+  {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    int64_t start = esp_timer_get_time();
+    drainSamples(task, logSDCard);
+    HistoryRequest request;
+    while (xQueueReceive(historyRequests, &request, 0) == pdTRUE)
+    {
+      sendWebSocketHistory(request);
+    }
+    addBusyTime(task, start);
+  }
+}
+
+/**
+ * @brief Push a sample to websocket and Server-Sent Events clients.
+ *
+ * @param sample Reading to send.
+ */
+void notifyNetwork(const Sample &sample)
+{
+  for (int i = 0; i < CHANNEL_COUNT; i++)
+  {
+    PublishChannel &channel = channels[i];
+    if (channel.changed)
+    {
+      portENTER_CRITICAL(&publishConfigMux);
+      DeadbandConfig config = channel.config;
+      channel.changed = false;
+      portEXIT_CRITICAL(&publishConfigMux);
+      channel.filter.configure(config);
+    }
+    if (channel.filter.pass(sample))
+    {
+      channel.notify(sample);
+    }
+  }
+}
+
+/**
+ * @brief Network task: keep NTP time in sync and push samples to web clients.
+ *
+ * @param param The AppTask entry of this task.
+ */
+void networkTask(void *param)
+{
+  AppTask *task = (AppTask *)param;
+  for (;;)
+  {
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(1000));
+    int64_t start = esp_timer_get_time();
+    if (!syncTime())
+    {
+      LOG_WARN("NTP sync failed");
+    }
+    drainSamples(task, notifyNetwork);
+    addBusyTime(task, start);
+  }
+}
+
+/**
+ * @brief Create the application tasks, each pinned to its configured core.
+ *
+ * The consumers are created first so no sample is published before they have
+ * a cursor.
+ */
+void startTasks()
+{
+  historyRequests = xQueueCreate(WS_HISTORY_QUEUE, sizeof(HistoryRequest));
+  for (int i = TASK_COUNT - 1; i >= 0; i--)
+  {
+    AppTask &task = tasks[i];
+    task.cursor = samples.cursor();
+    xTaskCreatePinnedToCore(task.function, task.name, task.stackSize, &task,
+                            task.priority, &task.handle, task.core);
+  }
+}
+
+/**
+ * @brief Write per-task statistics as a JSON array.
+ *
+ * For each task: core, priority, the stack high-water mark (lowest free stack
+ * seen, in bytes), the CPU time spent working and its share of the uptime.
+ *
+ * @param out Destination, e.g. Serial or an AsyncResponseStream.
+ */
+void printTaskStats(Print &out)
+{
+  uint64_t uptime = esp_timer_get_time();
+  out.print("[");
+  for (int i = 0; i < TASK_COUNT; i++)
+  {
+    AppTask &task = tasks[i];
+    portENTER_CRITICAL(&taskStatsMux);
+    uint64_t busy = task.busyMicros;
+    portEXIT_CRITICAL(&taskStatsMux);
+    unsigned stackFree = task.handle ? uxTaskGetStackHighWaterMark(task.handle) : 0;
+    out.printf("%s{\"name\":\"%s\",\"core\":%d,\"priority\":%u,\"stackHighWater\":%u,"
+               "\"cpuMicros\":%llu,\"cpuPercent\":%.3f}",
+               i ? "," : "", task.name, (int)task.core, (unsigned)task.priority, stackFree,
+               (unsigned long long)busy, uptime ? 100.0 * busy / uptime : 0.0);
+  }
+  out.println("]");
+}
+
+/**
+ * @brief Wrap a request handler to count requests and time the handler.
+ *
+ * The latency covers the handler itself, i.e. building the response; the
+ * response body is sent asynchronously afterwards.
+ *
+ * @param route Route label, must outlive the server.
+ * @param handler Handler to instrument.
+ * @return Handler to register with server.on().
+ */
+ArRequestHandlerFunction instrumentRoute(const char *route, ArRequestHandlerFunction handler)
+{
+  RouteMetrics *metrics = &routeMetrics[routeCount < MAX_ROUTES ? routeCount++ : MAX_ROUTES - 1];
+  metrics->route = route;
+  return [metrics, handler](AsyncWebServerRequest *request){
+    int64_t start = esp_timer_get_time();
+    handler(request);
+    metrics->requests.add();
+    metrics->latency.observe(esp_timer_get_time() - start);
+  };
+}
+
+/**
+ * @brief Write all metrics in the Prometheus text format.
+ *
+ * @param out Destination, an AsyncResponseStream for /metrics.
+ */
+void printMetrics(Print &out)
+{
+  char labels[48];
+
+  writeMetricHeader(out, "templog_sample_acquisition_seconds", "histogram", "Time to convert and read the temperature sensor.");
+  sampleAcquisitionTime.write(out, "templog_sample_acquisition_seconds");
+  writeMetricHeader(out, "templog_samples_total", "counter", "Samples published by the sensing task.");
+  writeMetricValue(out, "templog_samples_total", NULL, samples.published());
+  writeMetricHeader(out, "templog_sample_lateness_seconds", "summary", "Wake-up lateness of the sensing task.");
+  writeMetricSeconds(out, "templog_sample_lateness_seconds", "quantile=\"0.5\"", sampleJitter.percentile(0.5));
+  writeMetricSeconds(out, "templog_sample_lateness_seconds", "quantile=\"0.99\"", sampleJitter.percentile(0.99));
+  writeMetricSeconds(out, "templog_sample_lateness_seconds", "quantile=\"1\"", sampleJitter.max());
+  writeMetricHeader(out, "templog_sample_missed_deadlines_total", "counter", "Sample deadlines skipped because the sensing task overran.");
+  writeMetricValue(out, "templog_sample_missed_deadlines_total", NULL, sampleScheduler.missed());
+  writeMetricHeader(out, "templog_sample_period_seconds", "gauge", "Current time between two samples.");
+  writeMetricSeconds(out, "templog_sample_period_seconds", NULL, sampleScheduler.period());
+  writeMetricHeader(out, "templog_sample_speedups_total", "counter", "Times the sample period dropped to its minimum.");
+  writeMetricValue(out, "templog_sample_speedups_total", NULL, sampler.speedUps());
+  writeMetricHeader(out, "templog_sample_backoffs_total", "counter", "Times the sample period doubled.");
+  writeMetricValue(out, "templog_sample_backoffs_total", NULL, sampler.backOffs());
+  writeMetricHeader(out, "templog_sensor_resolution_bits", "gauge", "Resolution of the temperature sensor.");
+  writeMetricValue(out, "templog_sensor_resolution_bits", NULL, sampler.config().resolution);
+
+  writeMetricHeader(out, "templog_ntp_sync_seconds", "histogram", "NTP request round trip time.");
+  ntpSyncTime.write(out, "templog_ntp_sync_seconds");
+  writeMetricHeader(out, "templog_ntp_sync_failures_total", "counter", "NTP requests that timed out or were invalid.");
+  writeMetricValue(out, "templog_ntp_sync_failures_total", NULL, ntpSyncFailures.value());
+
+  writeMetricHeader(out, "templog_sd_append_seconds", "histogram", "Time to append one record to the SD card.");
+  sdAppendTime.write(out, "templog_sd_append_seconds");
+  writeMetricHeader(out, "templog_sd_append_max_seconds", "gauge", "Worst-case time to append one record since boot.");
+  writeMetricSeconds(out, "templog_sd_append_max_seconds", NULL, sdAppendMaxMicros);
+  writeMetricHeader(out, "templog_sd_append_bytes_total", "counter", "Bytes written to the SD card, rewritten blocks included.");
+  writeMetricValue(out, "templog_sd_append_bytes_total", NULL, sdAppendBytes.value());
+  writeMetricHeader(out, "templog_sd_append_failures_total", "counter", "Failed SD card appends.");
+  writeMetricValue(out, "templog_sd_append_failures_total", NULL, sdAppendFailures.value());
+  writeMetricHeader(out, "templog_sd_log_bytes", "gauge", "Bytes of valid records in the sample log.");
+  writeMetricValue(out, "templog_sd_log_bytes", NULL, sampleLog.storedBytes());
+  writeMetricHeader(out, "templog_sd_log_segments", "gauge", "Segment files in the sample log.");
+  writeMetricValue(out, "templog_sd_log_segments", NULL, sampleLog.segmentCount());
+  writeMetricHeader(out, "templog_sd_log_deleted_segments_total", "counter", "Segments deleted by the retention policy.");
+  writeMetricValue(out, "templog_sd_log_deleted_segments_total", NULL, sampleLog.deletedSegments());
+  writeMetricHeader(out, "templog_sd_recovery_seconds", "gauge", "Time spent recovering the sample log at boot.");
+  writeMetricSeconds(out, "templog_sd_recovery_seconds", NULL, sdRecoveryMicros);
+  writeMetricHeader(out, "templog_sd_recovery_scanned_bytes", "gauge", "Bytes read from the sample log tail at boot.");
+  writeMetricValue(out, "templog_sd_recovery_scanned_bytes", NULL, sampleLog.journal().scannedBytes());
+  writeMetricHeader(out, "templog_sd_recovery_truncated_bytes", "gauge", "Garbage bytes cut off the sample log at boot.");
+  writeMetricValue(out, "templog_sd_recovery_truncated_bytes", NULL, sampleLog.journal().truncatedBytes());
+
+  AwsClientStats clients = ws.clientStats();
+  writeMetricHeader(out, "templog_websocket_clients", "gauge", "Connected websocket clients.");
+  writeMetricValue(out, "templog_websocket_clients", NULL, clients.live);
+  writeMetricHeader(out, "templog_websocket_idle_clients", "gauge", "Websocket clients silent for a ping interval.");
+  writeMetricValue(out, "templog_websocket_idle_clients", NULL, clients.idle);
+  writeMetricHeader(out, "templog_websocket_dropped_clients_total", "counter", "Websocket clients closed by the server, by reason.");
+  writeMetricValue(out, "templog_websocket_dropped_clients_total", "reason=\"evicted\"", clients.evicted);
+  writeMetricValue(out, "templog_websocket_dropped_clients_total", "reason=\"timeout\"", clients.timedOut);
+  writeMetricHeader(out, "templog_websocket_queued_bytes", "gauge", "Websocket payload bytes queued but not yet sent.");
+  writeMetricValue(out, "templog_websocket_queued_bytes", NULL, ws.queuedBytes());
+  AsyncWebLockStats wsLock = ws.lockStats();
+  writeMetricHeader(out, "templog_websocket_lock_acquisitions_total", "counter", "Websocket server lock acquisitions, by whether another task held it.");
+  writeMetricValue(out, "templog_websocket_lock_acquisitions_total", "contended=\"false\"", wsLock.acquired - wsLock.contended);
+  writeMetricValue(out, "templog_websocket_lock_acquisitions_total", "contended=\"true\"", wsLock.contended);
+  writeMetricHeader(out, "templog_websocket_lock_wait_seconds_total", "counter", "Time tasks spent waiting for the websocket server lock.");
+  writeMetricSeconds(out, "templog_websocket_lock_wait_seconds_total", NULL, wsLock.waitMicros);
+  writeMetricHeader(out, "templog_websocket_lock_max_wait_seconds", "gauge", "Longest wait for the websocket server lock since boot.");
+  writeMetricSeconds(out, "templog_websocket_lock_max_wait_seconds", NULL, wsLock.maxWaitMicros);
+  writeMetricHeader(out, "templog_websocket_lock_max_hold_seconds", "gauge", "Longest the websocket server lock was held since boot.");
+  writeMetricSeconds(out, "templog_websocket_lock_max_hold_seconds", NULL, wsLock.maxHoldMicros);
+
+  writeMetricHeader(out, "templog_publish_frames_total", "counter", "Samples pushed to or held back from live clients, by channel.");
+  for (int i = 0; i < CHANNEL_COUNT; i++)
+  {
+    snprintf(labels, sizeof(labels), "channel=\"%s\",result=\"sent\"", channels[i].name);
+    writeMetricValue(out, "templog_publish_frames_total", labels, channels[i].filter.sent());
+    snprintf(labels, sizeof(labels), "channel=\"%s\",result=\"suppressed\"", channels[i].name);
+    writeMetricValue(out, "templog_publish_frames_total", labels, channels[i].filter.suppressed());
+  }
+
+  writeMetricHeader(out, "templog_websocket_commands_total", "counter", "Websocket commands by outcome.");
+  writeMetricValue(out, "templog_websocket_commands_total", "result=\"handled\"", wsCommands.value());
+  writeMetricValue(out, "templog_websocket_commands_total", "result=\"limited\"", wsCommandsLimited.value());
+  writeMetricValue(out, "templog_websocket_commands_total", "result=\"error\"", wsCommandErrors.value());
+
+  writeMetricHeader(out, "templog_websocket_rx_buffers", "gauge", "Free websocket receive buffers.");
+  writeMetricValue(out, "templog_websocket_rx_buffers", NULL, ws.rxPool().available());
+  writeMetricHeader(out, "templog_websocket_rx_pool_exhausted_total", "counter", "Websocket messages that found no free receive buffer.");
+  writeMetricValue(out, "templog_websocket_rx_pool_exhausted_total", NULL, ws.rxPool().exhausted());
+
+  const AwsDeflateStats &deflate = ws.deflateStats();
+  writeMetricHeader(out, "templog_websocket_compressed_messages_total", "counter", "Websocket messages compressed for sending or inflated on receipt.");
+  writeMetricValue(out, "templog_websocket_compressed_messages_total", "direction=\"sent\"", deflate.deflated);
+  writeMetricValue(out, "templog_websocket_compressed_messages_total", "direction=\"received\"", deflate.inflated);
+  writeMetricHeader(out, "templog_websocket_uncompressible_messages_total", "counter", "Websocket messages over the threshold sent uncompressed as they did not shrink.");
+  writeMetricValue(out, "templog_websocket_uncompressible_messages_total", NULL, deflate.notDeflated);
+  writeMetricHeader(out, "templog_websocket_compression_bytes_total", "counter", "Bytes of compressed websocket messages before and after compression.");
+  writeMetricValue(out, "templog_websocket_compression_bytes_total", "direction=\"sent\",form=\"plain\"", deflate.deflateIn);
+  writeMetricValue(out, "templog_websocket_compression_bytes_total", "direction=\"sent\",form=\"compressed\"", deflate.deflateOut);
+  writeMetricValue(out, "templog_websocket_compression_bytes_total", "direction=\"received\",form=\"plain\"", deflate.inflateOut);
+  writeMetricValue(out, "templog_websocket_compression_bytes_total", "direction=\"received\",form=\"compressed\"", deflate.inflateIn);
+  writeMetricHeader(out, "templog_websocket_compression_seconds_total", "counter", "CPU time spent compressing and inflating websocket messages.");
+  writeMetricSeconds(out, "templog_websocket_compression_seconds_total", "direction=\"sent\"", deflate.deflateMicros);
+  writeMetricSeconds(out, "templog_websocket_compression_seconds_total", "direction=\"received\"", deflate.inflateMicros);
+
+  writeMetricHeader(out, "templog_http_requests_total", "counter", "HTTP requests by route.");
+  for (uint8_t i = 0; i < routeCount; i++)
+  {
+    snprintf(labels, sizeof(labels), "route=\"%s\"", routeMetrics[i].route);
+    writeMetricValue(out, "templog_http_requests_total", labels, routeMetrics[i].requests.value());
+  }
+  writeMetricHeader(out, "templog_http_handler_seconds", "histogram", "HTTP handler time by route.");
+  for (uint8_t i = 0; i < routeCount; i++)
+  {
+    snprintf(labels, sizeof(labels), "route=\"%s\"", routeMetrics[i].route);
+    routeMetrics[i].latency.write(out, "templog_http_handler_seconds", labels);
+  }
+
+  writeMetricHeader(out, "templog_heap_free_bytes", "gauge", "Free heap.");
+  writeMetricValue(out, "templog_heap_free_bytes", NULL, ESP.getFreeHeap());
+  writeMetricHeader(out, "templog_heap_min_free_bytes", "gauge", "Lowest free heap since boot.");
+  writeMetricValue(out, "templog_heap_min_free_bytes", NULL, ESP.getMinFreeHeap());
+  writeMetricHeader(out, "templog_heap_largest_block_bytes", "gauge", "Largest allocatable heap block.");
+  writeMetricValue(out, "templog_heap_largest_block_bytes", NULL, ESP.getMaxAllocHeap());
+
+  writeMetricHeader(out, "templog_task_cpu_seconds_total", "counter", "CPU time spent working, by task.");
+  for (int i = 0; i < TASK_COUNT; i++)
+  {
+    portENTER_CRITICAL(&taskStatsMux);
+    uint64_t busy = tasks[i].busyMicros;
+    portEXIT_CRITICAL(&taskStatsMux);
+    snprintf(labels, sizeof(labels), "task=\"%s\"", tasks[i].name);
+    writeMetricSeconds(out, "templog_task_cpu_seconds_total", labels, busy);
+  }
+  writeMetricHeader(out, "templog_task_stack_free_bytes", "gauge", "Lowest free stack seen, by task.");
+  for (int i = 0; i < TASK_COUNT; i++)
+  {
+    snprintf(labels, sizeof(labels), "task=\"%s\"", tasks[i].name);
+    writeMetricValue(out, "templog_task_stack_free_bytes", labels,
+                     tasks[i].handle ? uxTaskGetStackHighWaterMark(tasks[i].handle) : 0);
+  }
+  writeMetricHeader(out, "templog_log_dropped_lines_total", "counter", "Log lines dropped because the log buffer was full.");
+  writeMetricValue(out, "templog_log_dropped_lines_total", NULL, logDropped());
+  writeMetricHeader(out, "templog_uptime_seconds", "counter", "Time since boot.");
+  writeMetricSeconds(out, "templog_uptime_seconds", NULL, esp_timer_get_time());
+}
+
+/**
+ * @brief Write the sampling jitter statistics as JSON.
+ *
+ * @param out Destination, e.g. Serial or an AsyncResponseStream.
+ */
+void printJitterStats(Print &out)
+{
+  out.printf("{\"periodMicros\":%llu,\"toleranceMicros\":%u,\"samples\":%u,"
+             "\"p50\":%u,\"p99\":%u,\"max\":%u,\"mean\":%u,"
+             "\"overTolerance\":%u,\"missedDeadlines\":%u}\n",
+             (unsigned long long)sampleScheduler.period(), (unsigned)SAMPLE_JITTER_TOLERANCE_US,
+             sampleJitter.count(), sampleJitter.percentile(0.5), sampleJitter.percentile(0.99),
+             sampleJitter.max(), sampleJitter.mean(), samplesOverTolerance,
+             sampleScheduler.missed());
+}
+
+/**
+ * @brief Write the sampler settings and the current period as JSON.
+ *
+ * @param out Destination, e.g. Serial or an AsyncResponseStream.
  */
-void writeFile(fs::FS &fs, const char *path, const char *message)
+void printSamplerConfig(Print &out)
 {
-  Serial.printf("Writing file: %s\n", path);
+  portENTER_CRITICAL(&samplerConfigMux);
+  SamplerConfig config = samplerConfig;
+  portEXIT_CRITICAL(&samplerConfigMux);
+  out.printf("{\"resolution\":%u,\"conversionMs\":%u,\"minPeriodMs\":%u,\"maxPeriodMs\":%u,"
+             "\"thresholdCentiPerMin\":%u,\"periodMs\":%u}\n",
+             config.resolution, SamplerConfig::conversionMs(config.resolution), config.minPeriodMs,
+             config.maxPeriodMs, config.thresholdCentiPerMin,
+             (unsigned)(sampleScheduler.period() / 1000));
+}
 
-  File file = fs.open(path, FILE_WRITE);
-  if (!file)
+/**
+ * @brief Load the sampler settings saved by /config, keeping the defaults
+ * for any that are missing or unusable.
+ */
+void loadSamplerConfig()
+{
+  preferences.begin("sampler", true);
+  SamplerConfig config;
+  config.resolution = preferences.getUChar("resolution", samplerConfig.resolution);
+  config.minPeriodMs = preferences.getULong("minPeriod", samplerConfig.minPeriodMs);
+  config.maxPeriodMs = preferences.getULong("maxPeriod", samplerConfig.maxPeriodMs);
+  config.thresholdCentiPerMin = preferences.getUShort("threshold", samplerConfig.thresholdCentiPerMin);
+  preferences.end();
+  if (config.valid())
   {
-    Serial.println("Failed to open file for writing");
+    samplerConfig = config;
+  }
+}
+
+/**
+ * @brief Show or change the sampler settings.
+ *
+ * A POST may give any of the form parameters `resolution`, `minPeriodMs`,
+ * `maxPeriodMs` and `thresholdCentiPerMin`, the others are kept. The settings
+ * are saved and applied at the next sample; the minimum period must leave time
+ * for a conversion at the requested resolution.
+ *
+ * @param request GET or POST request.
+ */
+void handleSamplerConfig(AsyncWebServerRequest *request)
+{
+  if (request->method() != HTTP_POST)
+  {
+    AsyncResponseStream *response = request->beginResponseStream("application/json");
+    printSamplerConfig(*response);
+    request->send(response);
     return;
   }
-  if (file.print(message))
+
+  portENTER_CRITICAL(&samplerConfigMux);
+  SamplerConfig config = samplerConfig;
+  portEXIT_CRITICAL(&samplerConfigMux);
+  if (request->hasParam("resolution", true))
   {
-    Serial.println("File written");
+    config.resolution = request->getParam("resolution", true)->value().toInt();
   }
-  else
+  if (request->hasParam("minPeriodMs", true))
   {
-    Serial.println("Write failed");
+    config.minPeriodMs = strtoul(request->getParam("minPeriodMs", true)->value().c_str(), NULL, 10);
   }
-  file.close();
+  if (request->hasParam("maxPeriodMs", true))
+  {
+    config.maxPeriodMs = strtoul(request->getParam("maxPeriodMs", true)->value().c_str(), NULL, 10);
+  }
+  if (request->hasParam("thresholdCentiPerMin", true))
+  {
+    config.thresholdCentiPerMin = request->getParam("thresholdCentiPerMin", true)->value().toInt();
+  }
+  if (!config.valid())
+  {
+    request->send(400, "text/plain", "Invalid sampler settings");
+    return;
+  }
+
+  portENTER_CRITICAL(&samplerConfigMux);
+  samplerConfig = config;
+  samplerConfigChanged = true;
+  portEXIT_CRITICAL(&samplerConfigMux);
+
+  preferences.begin("sampler", false);
+  preferences.putUChar("resolution", config.resolution);
+  preferences.putULong("minPeriod", config.minPeriodMs);
+  preferences.putULong("maxPeriod", config.maxPeriodMs);
+  preferences.putUShort("threshold", config.thresholdCentiPerMin);
+  preferences.end();
+
+  AsyncResponseStream *response = request->beginResponseStream("application/json");
+  printSamplerConfig(*response);
+  request->send(response);
 }
 
 /**
- * @brief Append data to a file on the file system.
- * 
- * @param fs File system object.
- * @param path Path to the file.
- * @param message Message to append to the file.
+ * @brief Write the deadband settings and counters of every channel as a JSON array.
+ *
+ * @param out Destination, e.g. Serial or an AsyncResponseStream.
+ */
+void printPublishConfig(Print &out)
+{
+  out.print("[");
+  for (int i = 0; i < CHANNEL_COUNT; i++)
+  {
+    portENTER_CRITICAL(&publishConfigMux);
+    DeadbandConfig config = channels[i].config;
+    portEXIT_CRITICAL(&publishConfigMux);
+    out.printf("%s{\"channel\":\"%s\",\"absoluteCenti\":%u,\"relativePermille\":%u,"
+               "\"heartbeatS\":%u,\"sent\":%u,\"suppressed\":%u}",
+               i ? "," : "", channels[i].name, config.absoluteCenti, config.relativePermille,
+               config.heartbeatS, channels[i].filter.sent(), channels[i].filter.suppressed());
+  }
+  out.println("]");
+}
+
+/**
+ * @brief Load the deadbands saved by /publish, keeping the defaults for any
+ * that are missing.
+ */
+void loadPublishConfig()
+{
+  char key[16];
+  preferences.begin("publish", true);
+  for (int i = 0; i < CHANNEL_COUNT; i++)
+  {
+    DeadbandConfig &config = channels[i].config;
+    snprintf(key, sizeof(key), "%s.abs", channels[i].name);
+    config.absoluteCenti = preferences.getUShort(key, config.absoluteCenti);
+    snprintf(key, sizeof(key), "%s.rel", channels[i].name);
+    config.relativePermille = preferences.getUShort(key, config.relativePermille);
+    snprintf(key, sizeof(key), "%s.hb", channels[i].name);
+    config.heartbeatS = preferences.getULong(key, config.heartbeatS);
+  }
+  preferences.end();
+}
+
+/**
+ * @brief Show or change the deadband of a live channel.
+ *
+ * A POST names the `channel`, `ws` or `events`, and may give any of the form
+ * parameters `absoluteCenti`, `relativePermille` and `heartbeatS`, the others
+ * are kept. The settings are saved and applied to the next sample.
+ *
+ * @param request GET or POST request.
+ */
+void handlePublishConfig(AsyncWebServerRequest *request)
+{
+  if (request->method() != HTTP_POST)
+  {
+    AsyncResponseStream *response = request->beginResponseStream("application/json");
+    printPublishConfig(*response);
+    request->send(response);
+    return;
+  }
+
+  PublishChannel *channel = NULL;
+  if (request->hasParam("channel", true))
+  {
+    const String &name = request->getParam("channel", true)->value();
+    for (int i = 0; i < CHANNEL_COUNT; i++)
+    {
+      if (name == channels[i].name)
+      {
+        channel = &channels[i];
+      }
+    }
+  }
+  if (!channel)
+  {
+    request->send(400, "text/plain", "Unknown channel");
+    return;
+  }
+
+  portENTER_CRITICAL(&publishConfigMux);
+  DeadbandConfig config = channel->config;
+  portEXIT_CRITICAL(&publishConfigMux);
+  if (request->hasParam("absoluteCenti", true))
+  {
+    config.absoluteCenti = request->getParam("absoluteCenti", true)->value().toInt();
+  }
+  if (request->hasParam("relativePermille", true))
+  {
+    config.relativePermille = request->getParam("relativePermille", true)->value().toInt();
+  }
+  if (request->hasParam("heartbeatS", true))
+  {
+    config.heartbeatS = strtoul(request->getParam("heartbeatS", true)->value().c_str(), NULL, 10);
+  }
+  if (!config.valid())
+  {
+    request->send(400, "text/plain", "Invalid deadband");
+    return;
+  }
+
+  portENTER_CRITICAL(&publishConfigMux);
+  channel->config = config;
+  channel->changed = true;
+  portEXIT_CRITICAL(&publishConfigMux);
+
+  char key[16];
+  preferences.begin("publish", false);
+  snprintf(key, sizeof(key), "%s.abs", channel->name);
+  preferences.putUShort(key, config.absoluteCenti);
+  snprintf(key, sizeof(key), "%s.rel", channel->name);
+  preferences.putUShort(key, config.relativePermille);
+  snprintf(key, sizeof(key), "%s.hb", channel->name);
+  preferences.putULong(key, config.heartbeatS);
+  preferences.end();
+
+  AsyncResponseStream *response = request->beginResponseStream("application/json");
+  printPublishConfig(*response);
+  request->send(response);
+}
+
+/**
+ * @brief Write the sample log manifest as a JSON array, oldest segment first.
+ *
+ * @param out Destination, e.g. Serial or an AsyncResponseStream.
  */
-void appendFile(fs::FS &fs, const char *path, const char *message)
+void printSegments(Print &out)
 {
-  Serial.printf("Appending to file: %s\n", path);
+  SegmentInfo info;
+  out.print("[");
+  for (size_t i = 0; sampleLog.segmentAt(i, info); i++)
+  {
+    out.printf("%s{\"id\":%u,\"from\":%u,\"to\":%u,\"samples\":%u,\"bytes\":%u,\"closed\":%s}",
+               i ? "," : "", info.id, info.firstEpoch, info.lastEpoch, info.count, info.bytes,
+               info.closed ? "true" : "false");
+  }
+  out.println("]");
+}
 
-  File file = fs.open(path, FILE_APPEND);
-  if (!file)
+/**
+ * @brief Stream the samples of a time range as CSV.
+ *
+ * @param request GET request with optional `from` and `to` epochs and `unit`,
+ *                `F` for °F instead of °C.
+ */
+void sendHistory(AsyncWebServerRequest *request)
+{
+  if (!sampleLogReady)
   {
-    Serial.println("Failed to open file for appending");
+    request->send(503, "text/plain", "No SD card");
     return;
   }
-  if (file.print(message))
+  uint32_t from = 0;
+  uint32_t to = UINT32_MAX;
+  if (request->hasParam("from"))
+  {
+    from = strtoul(request->getParam("from")->value().c_str(), NULL, 10);
+  }
+  if (request->hasParam("to"))
   {
-    Serial.println("Message appended");
+    to = strtoul(request->getParam("to")->value().c_str(), NULL, 10);
+  }
+  bool fahrenheit = request->hasParam("unit") && request->getParam("unit")->value() == "F";
+  std::shared_ptr<SampleCsvExport> csv(new SampleCsvExport(sampleLog, from, to, fahrenheit));
+  AsyncWebServerResponse *response = request->beginChunkedResponse("text/csv",
+      [csv](uint8_t *buffer, size_t maxLen, size_t index) -> size_t {
+    return csv->read(buffer, maxLen);
+  });
+  response->addHeader("Content-Disposition", "attachment; filename=data.csv");
+  request->send(response);
+}
+
+/**
+ * @brief Fraction of the SD card in use, for the retention policy.
+ */
+float sdFill()
+{
+  uint64_t total = SD.totalBytes();
+  return total ? (float)SD.usedBytes() / total : 0.0f;
+}
+
+/**
+ * @brief Log sensor readings onto the SD card.
+ * 
+ * The sample is appended to the open segment as one checksummed record, see
+ * SampleLog. Each record is flushed on its own, so a power cut loses at most
+ * the record being written.
+ *
+ * @param sample Reading to log.
+ */
+void logSDCard(const Sample &sample)
+{
+  if (!sampleLogReady)
+  {
+    return;
+  }
+  int64_t start = esp_timer_get_time();
+  size_t written = sampleLog.append(sample);
+  uint32_t elapsed = esp_timer_get_time() - start;
+  sdAppendTime.observe(elapsed);
+  if (elapsed > sdAppendMaxMicros)
+  {
+    sdAppendMaxMicros = elapsed;
+  }
+  if (written)
+  {
+    sdAppendBytes.add(written);
+    LOG_DEBUG("Sample %u logged", sample.readingID);
   }
   else
   {
-    Serial.println("Append failed");
+    sdAppendFailures.add();
+    LOG_ERROR("Append failed");
   }
-  file.close();
 }
 
 /** -------------------------------------------- Websocket */
 
+/** Longest command a client may send */
+#define WS_COMMAND_MAX 64
+
+/** Commands a client may send in a burst, and refilled per second after it */
+#ifndef WS_COMMAND_BURST
+#define WS_COMMAND_BURST 5
+#endif
+#ifndef WS_COMMANDS_PER_S
+#define WS_COMMANDS_PER_S 2
+#endif
+
+/** Most samples in one reply to `hist`, the client pages through the rest */
+#define WS_HISTORY_MAX_SAMPLES 64
+/** Longest row of a `hist` reply: `,[id,epoch,"temperature"]` */
+#define WS_HISTORY_ROW_SIZE (2 + 10 + 1 + 10 + 2 + TEMPERATURE_STRING_SIZE - 1 + 2 + 1)
+/** Longest end of a `hist` reply: `],"next":epoch,"skip":n}` */
+#define WS_HISTORY_END_SIZE (9 + 10 + 8 + 10 + 1 + 1)
+
+/** Longest interval a client may ask for with `rate` */
+#define WS_RATE_MAX_MS 3600000
+
+/**
+ * permessage-deflate window, 0 to not offer compression. A match table of
+ * 2^bits 16-bit entries, 2 * 2^bits bytes, is used only while a message is
+ * compressed.
+ */
+#ifndef WS_DEFLATE_WINDOW_BITS
+#define WS_DEFLATE_WINDOW_BITS 10
+#endif
+/** Shortest message to compress: live readings go as they are, history replies are deflated */
+#ifndef WS_DEFLATE_THRESHOLD
+#define WS_DEFLATE_THRESHOLD 128
+#endif
+
+/**
+ * Clients are pinged after this many seconds without a word from them, and
+ * dropped if they do not answer within WS_PONG_TIMEOUT_S.
+ */
+#ifndef WS_PING_INTERVAL_S
+#define WS_PING_INTERVAL_S 20
+#endif
+#ifndef WS_PONG_TIMEOUT_S
+#define WS_PONG_TIMEOUT_S 10
+#endif
+
+/** Live channels a websocket client may subscribe to */
+enum
+{
+  WS_CHANNEL_TEMP = 1,   /**< Formatted temperature, what the dashboard plots */
+  WS_CHANNEL_SAMPLE = 2, /**< The whole sample as JSON */
+  WS_CHANNEL_OTA = 4,    /**< Firmware update progress, see formatOtaProgress() */
+};
+
+/**
+ * @brief Subscriptions and limits of one connected websocket client.
+ */
+struct WsSession
+{
+  bool used;
+  uint32_t clientId;
+  uint8_t channels;    /**< WS_CHANNEL_* bits */
+  uint32_t intervalMs; /**< Least time between two pushes, set with `rate` */
+  uint32_t lastPushMs;
+  uint32_t tokens;     /**< Commands left in the bucket, in thousandths */
+  uint32_t refillMs;   /**< millis() of the last refill */
+};
+
+/** One session per client the server accepts, guarded by wsSessionMux */
+WsSession wsSessions[DEFAULT_MAX_WS_CLIENTS];
+portMUX_TYPE wsSessionMux = portMUX_INITIALIZER_UNLOCKED;
+
+/** Room for formatLatestReading() */
+#define LATEST_READING_JSON_SIZE 128
+
+/**
+ * @brief Write the latest reading as JSON, as /latest and the `latest` command reply.
+ *
+ * `{"type":"latest","seq":n,"sensor":"28...","id":id,"epoch":epoch,"temperature":t}`,
+ * just `{"type":"latest","seq":0}` before the first reading. Reads the
+ * snapshot, so it may run in any task.
+ *
+ * @param out At least LATEST_READING_JSON_SIZE bytes.
+ * @return Length written.
+ */
+size_t formatLatestReading(char *out)
+{
+  LatestReading latest;
+  uint32_t seq = latestReading.read(latest);
+  if (!seq)
+  {
+    return snprintf(out, LATEST_READING_JSON_SIZE, "{\"type\":\"latest\",\"seq\":0}");
+  }
+  char temperature[TEMPERATURE_STRING_SIZE];
+  formatTemperature(temperature, latest.sample.raw);
+  const char *quote = latest.sample.raw == TEMPERATURE_RAW_INVALID ? "\"" : "";
+  return snprintf(out, LATEST_READING_JSON_SIZE,
+                  "{\"type\":\"latest\",\"seq\":%u,\"sensor\":\"%08X%08X\",\"id\":%u,\"epoch\":%u,\"temperature\":%s%s%s}",
+                  seq, (uint32_t)(latest.sensorId >> 32), (uint32_t)latest.sensorId, latest.sample.readingID,
+                  latest.sample.epoch, quote, temperature, quote);
+}
+
 /**
- * @brief Notify all websocket clients with the latest temperature reading.
+ * @brief Format the latest temperature, as pushed on the `temp` channel and to SSE clients.
+ *
+ * @param out At least TEMPERATURE_STRING_SIZE bytes.
+ * @return Reading ID of the latest reading, 0 before the first one.
  */
-void notifyClients() {
-  ws.textAll(String(temperature));
+uint32_t formatLatestTemperature(char *out)
+{
+  LatestReading latest;
+  latest.sample.readingID = 0;
+  latest.sample.raw = TEMPERATURE_RAW_INVALID;
+  latestReading.read(latest);
+  formatTemperature(out, latest.sample.raw);
+  return latest.sample.readingID;
 }
 
+/** Room for formatOtaProgress() */
+#define OTA_PROGRESS_JSON_SIZE 192
+
 /**
- * @brief Handle incoming WebSocket messages.
- * 
- * @param arg WebSocket frame information.
- * @param data Pointer to the message data.
- * @param len Length of the message data.
+ * @brief Write firmware update progress as JSON, as the `ota` channel and command send it.
+ *
+ * `{"type":"ota","active":a,"failed":f,"total":n,"received":n,"written":n,"elapsedMs":ms,"bytesPerS":n,"waitMs":ms}`
+ * where `total` is the size of the upload request, 0 if unknown, `written`
+ * what reached the flash and `waitMs` how long receiving waited on it. Once
+ * an update is done it stays at its last values.
+ *
+ * @param out At least OTA_PROGRESS_JSON_SIZE bytes.
+ * @param progress From AsyncElegantOTA.
+ * @return Length written.
+ */
+size_t formatOtaProgress(char *out, const AsyncElegantOtaProgress &progress)
+{
+  return snprintf(out, OTA_PROGRESS_JSON_SIZE,
+                  "{\"type\":\"ota\",\"active\":%s,\"failed\":%s,\"total\":%u,\"received\":%u,\"written\":%u,"
+                  "\"elapsedMs\":%u,\"bytesPerS\":%u,\"waitMs\":%u}",
+                  progress.active ? "true" : "false", progress.failed ? "true" : "false", (uint32_t)progress.total,
+                  (uint32_t)progress.received, (uint32_t)progress.written, progress.elapsedMillis,
+                  progress.bytesPerSecond, progress.waitMillis);
+}
+
+/**
+ * @brief Send a new reading to the subscribed websocket clients.
+ *
+ * Each client gets the channels it subscribed to, at most once per the
+ * interval it set. Each message goes to all the clients due for it at once,
+ * so its frame is encoded, and compressed, once for all of them; a client
+ * with a full queue still does not hold back the others.
+ *
+ * @param sample Reading to send.
+ */
+void notifyWebSocket(const Sample &sample)
+{
+  char temperature[TEMPERATURE_STRING_SIZE];
+  formatTemperature(temperature, sample.raw);
+  char json[80];
+  snprintf(json, sizeof(json), "{\"type\":\"sample\",\"id\":%u,\"epoch\":%u,\"temperature\":%s%s%s}",
+           sample.readingID, sample.epoch, sample.raw == TEMPERATURE_RAW_INVALID ? "\"" : "",
+           temperature, sample.raw == TEMPERATURE_RAW_INVALID ? "\"" : "");
+
+  /** Due clients by channel */
+  uint32_t tempIds[DEFAULT_MAX_WS_CLIENTS];
+  uint32_t sampleIds[DEFAULT_MAX_WS_CLIENTS];
+  size_t tempCount = 0;
+  size_t sampleCount = 0;
+  uint32_t now = millis();
+  portENTER_CRITICAL(&wsSessionMux);
+  for (size_t i = 0; i < DEFAULT_MAX_WS_CLIENTS; i++)
+  {
+    WsSession &session = wsSessions[i];
+    if (session.used && session.channels && now - session.lastPushMs >= session.intervalMs)
+    {
+      session.lastPushMs = now;
+      if (session.channels & WS_CHANNEL_TEMP)
+      {
+        tempIds[tempCount++] = session.clientId;
+      }
+      if (session.channels & WS_CHANNEL_SAMPLE)
+      {
+        sampleIds[sampleCount++] = session.clientId;
+      }
+    }
+  }
+  portEXIT_CRITICAL(&wsSessionMux);
+
+  ws.textAll(tempIds, tempCount, temperature);
+  ws.textAll(sampleIds, sampleCount, json);
+}
+
+/**
+ * @brief Send firmware update progress to the clients subscribed to `ota`.
+ *
+ * Called by AsyncElegantOTA from the upload handler, throttled there, so it
+ * ignores the interval set with `rate`.
+ *
+ * @param progress Of the update being received.
+ */
+void notifyOtaProgress(const AsyncElegantOtaProgress &progress)
+{
+  char json[OTA_PROGRESS_JSON_SIZE];
+  size_t length = formatOtaProgress(json, progress);
+
+  uint32_t ids[DEFAULT_MAX_WS_CLIENTS];
+  size_t count = 0;
+  portENTER_CRITICAL(&wsSessionMux);
+  for (size_t i = 0; i < DEFAULT_MAX_WS_CLIENTS; i++)
+  {
+    if (wsSessions[i].used && (wsSessions[i].channels & WS_CHANNEL_OTA))
+    {
+      ids[count++] = wsSessions[i].clientId;
+    }
+  }
+  portEXIT_CRITICAL(&wsSessionMux);
+
+  ws.textAll(ids, count, json, length);
+}
+
+/**
+ * @brief Session of a client, NULL if it has none. Call with wsSessionMux held.
+ */
+WsSession *findSession(uint32_t clientId)
+{
+  for (size_t i = 0; i < DEFAULT_MAX_WS_CLIENTS; i++)
+  {
+    if (wsSessions[i].used && wsSessions[i].clientId == clientId)
+    {
+      return &wsSessions[i];
+    }
+  }
+  return NULL;
+}
+
+/**
+ * @brief Take a command from the client's token bucket.
+ *
+ * @return false if the client is over its rate and the command must be dropped.
+ */
+bool takeCommandToken(uint32_t clientId)
+{
+  uint32_t now = millis();
+  bool allowed = false;
+  portENTER_CRITICAL(&wsSessionMux);
+  WsSession *session = findSession(clientId);
+  if (session)
+  {
+    /** Thousandths of a command per ms is commands per second */
+    uint64_t tokens = session->tokens + (uint64_t)(now - session->refillMs) * WS_COMMANDS_PER_S;
+    session->tokens = tokens > WS_COMMAND_BURST * 1000 ? WS_COMMAND_BURST * 1000 : tokens;
+    session->refillMs = now;
+    if (session->tokens >= 1000)
+    {
+      session->tokens -= 1000;
+      allowed = true;
+    }
+  }
+  portEXIT_CRITICAL(&wsSessionMux);
+  return allowed;
+}
+
+/**
+ * @brief Parse a comma separated list of channel names.
+ *
+ * @return WS_CHANNEL_* bits, 0 if a name is unknown.
+ */
+uint8_t parseChannels(char *list)
+{
+  uint8_t channels = 0;
+  char *save;
+  for (char *name = strtok_r(list, ",", &save); name; name = strtok_r(NULL, ",", &save))
+  {
+    if (!strcmp(name, "temp"))
+    {
+      channels |= WS_CHANNEL_TEMP;
+    }
+    else if (!strcmp(name, "sample"))
+    {
+      channels |= WS_CHANNEL_SAMPLE;
+    }
+    else if (!strcmp(name, "ota"))
+    {
+      channels |= WS_CHANNEL_OTA;
+    }
+    else
+    {
+      return 0;
+    }
+  }
+  return channels;
+}
+
+/**
+ * @brief Reply to `hist` with the samples of a range, at most WS_HISTORY_MAX_SAMPLES.
+ *
+ * Runs on the storage task, see storageTask(). A page starts where `from` is
+ * found in its segment, see SampleCsvExport, so paging through a segment does
+ * not decode it again from its start for every page.
+ *
+ * The reply is `{"type":"hist","samples":[[id,epoch,temperature],...],"next":epoch,"skip":n}`
+ * where `next` and `skip`, when present, are what to ask again with for the
+ * rest of the range. Pages resume at an epoch and skip the samples of that
+ * epoch already sent, since at short periods more samples than fit in a page
+ * can share one; reading IDs restart on power loss, so they cannot be used.
+ *
+ * @param request Client and range to send.
+ */
+void sendWebSocketHistory(const HistoryRequest &request)
+{
+  if (!sampleLogReady)
+  {
+    ws.text(request.clientId, "{\"type\":\"error\",\"cmd\":\"hist\",\"reason\":\"no SD card\"}");
+    return;
+  }
+  uint32_t from = request.from;
+  uint32_t skip = request.skip;
+  size_t size = 32 + WS_HISTORY_MAX_SAMPLES * WS_HISTORY_ROW_SIZE + WS_HISTORY_END_SIZE;
+  char *out = (char *)malloc(size);
+  /** On the heap, the storage task stack is sized for appending */
+  SampleCsvExport *range = out ? new SampleCsvExport(sampleLog, from, request.to) : NULL;
+  if (!range)
+  {
+    free(out);
+    ws.text(request.clientId, "{\"type\":\"error\",\"cmd\":\"hist\",\"reason\":\"out of memory\"}");
+    return;
+  }
+  size_t length = snprintf(out, size, "{\"type\":\"hist\",\"samples\":[");
+  Sample sample;
+  size_t count = 0;
+  uint32_t skipped = 0;
+  /** Samples sent at the epoch of the last one */
+  uint32_t lastEpoch = 0;
+  uint32_t sameEpoch = 0;
+  bool more = false;
+  while (range->nextSample(sample))
+  {
+    if (sample.epoch == from && skipped < skip)
+    {
+      skipped++;
+      continue;
+    }
+    char temperature[TEMPERATURE_STRING_SIZE];
+    formatTemperature(temperature, sample.raw);
+    char row[WS_HISTORY_ROW_SIZE];
+    int rowLength = snprintf(row, sizeof(row), "%s[%u,%u,\"%s\"]", count ? "," : "", sample.readingID,
+                             sample.epoch, temperature);
+    if (count == WS_HISTORY_MAX_SAMPLES || rowLength < 0 || rowLength >= (int)sizeof(row) ||
+        length + rowLength + WS_HISTORY_END_SIZE > size)
+    {
+      more = true;
+      break;
+    }
+    memcpy(out + length, row, rowLength);
+    length += rowLength;
+    sameEpoch = count && sample.epoch == lastEpoch ? sameEpoch + 1 : 1;
+    lastEpoch = sample.epoch;
+    count++;
+  }
+  if (more)
+  {
+    uint32_t nextSkip = (count && lastEpoch == sample.epoch ? sameEpoch : 0) + (sample.epoch == from ? skipped : 0);
+    length += snprintf(out + length, size - length, "],\"next\":%u,\"skip\":%u}", sample.epoch, nextSkip);
+  }
+  else
+  {
+    length += snprintf(out + length, size - length, "]}");
+  }
+  delete range;
+  ws.text(request.clientId, out, length);
+  free(out);
+}
+
+/**
+ * @brief Handle one command from a websocket client.
+ *
+ * Commands are text messages, possibly fragmented, reassembled by the server
+ * before this is called. Replies go to the sending client only:
+ *
+ *     sub temp,sample,ota  subscribe to live channels, replacing the current set
+ *     unsub                stop live pushes
+ *     hist <from> <to> [skip]
+ *                          samples of an epoch range, see sendWebSocketHistory(),
+ *                          queued for the storage task; refused with a "busy"
+ *                          error while WS_HISTORY_QUEUE are waiting
+ *     rate <ms>            push at most once per <ms>, 0 for every sample
+ *     ping [n]             answered with {"type":"pong","n":n}
+ *     latest               the latest reading, see formatLatestReading()
+ *     ota                  firmware update progress, see formatOtaProgress()
+ *
+ * Each client has a token bucket of WS_COMMAND_BURST commands refilled at
+ * WS_COMMANDS_PER_S, commands past it are dropped without a reply.
+ *
+ * @param client Sending client.
+ * @param opcode WS_TEXT or WS_BINARY.
+ * @param data Whole message, NUL-terminated and owned by the server until return.
+ * @param len Length of the message.
  */
-void handleWebSocketMessage(void *arg, uint8_t *data, size_t len) {
-  AwsFrameInfo *info = (AwsFrameInfo*)arg;
-  if (info->final && info->index == 0 && info->len == len && info->opcode == WS_TEXT) {
-    data[len] = 0;
-    notifyClients();
+void handleWebSocketMessage(AsyncWebSocketClient *client, uint8_t opcode, uint8_t *data, size_t len) {
+  if (opcode != WS_TEXT) {
+    return;
+  }
+  if (!takeCommandToken(client->id()))
+  {
+    wsCommandsLimited.add();
+    return;
+  }
+  wsCommands.add();
+
+  if (len > WS_COMMAND_MAX)
+  {
+    wsCommandErrors.add();
+    client->text("{\"type\":\"error\",\"reason\":\"command too long\"}");
+    return;
+  }
+  char *save;
+  const char *command = strtok_r((char *)data, " ", &save);
+  char *arg1 = strtok_r(NULL, " ", &save);
+  char *arg2 = strtok_r(NULL, " ", &save);
+  char *arg3 = strtok_r(NULL, " ", &save);
+  char reply[64];
+  if (!command)
+  {
+    command = "";
+  }
+  uint8_t channels = 0;
+  if (!strcmp(command, "sub") && arg1 && (channels = parseChannels(arg1)))
+  {
+    portENTER_CRITICAL(&wsSessionMux);
+    WsSession *session = findSession(client->id());
+    if (session)
+    {
+      session->channels = channels;
+    }
+    portEXIT_CRITICAL(&wsSessionMux);
+    client->text("{\"type\":\"ok\",\"cmd\":\"sub\"}");
+  }
+  else if (!strcmp(command, "unsub"))
+  {
+    portENTER_CRITICAL(&wsSessionMux);
+    WsSession *session = findSession(client->id());
+    if (session)
+    {
+      session->channels = 0;
+    }
+    portEXIT_CRITICAL(&wsSessionMux);
+    client->text("{\"type\":\"ok\",\"cmd\":\"unsub\"}");
   }
+  else if (!strcmp(command, "hist") && arg1 && arg2)
+  {
+    /** Reading the card would hold up every other connection on this task */
+    HistoryRequest request;
+    request.clientId = client->id();
+    request.from = strtoul(arg1, NULL, 10);
+    request.to = strtoul(arg2, NULL, 10);
+    request.skip = arg3 ? strtoul(arg3, NULL, 10) : 0;
+    if (xQueueSend(historyRequests, &request, 0) == pdTRUE)
+    {
+      xTaskNotifyGive(tasks[TASK_STORAGE].handle);
+    }
+    else
+    {
+      client->text("{\"type\":\"error\",\"cmd\":\"hist\",\"reason\":\"busy\"}");
+    }
+  }
+  else if (!strcmp(command, "rate") && arg1 && strtoul(arg1, NULL, 10) <= WS_RATE_MAX_MS)
+  {
+    uint32_t interval = strtoul(arg1, NULL, 10);
+    portENTER_CRITICAL(&wsSessionMux);
+    WsSession *session = findSession(client->id());
+    if (session)
+    {
+      session->intervalMs = interval;
+    }
+    portEXIT_CRITICAL(&wsSessionMux);
+    client->text("{\"type\":\"ok\",\"cmd\":\"rate\"}");
+  }
+  else if (!strcmp(command, "latest"))
+  {
+    char json[LATEST_READING_JSON_SIZE];
+    client->text(json, formatLatestReading(json));
+  }
+  else if (!strcmp(command, "ota"))
+  {
+    char json[OTA_PROGRESS_JSON_SIZE];
+    client->text(json, formatOtaProgress(json, AsyncElegantOTA.progress()));
+  }
+  else if (!strcmp(command, "ping"))
+  {
+    snprintf(reply, sizeof(reply), "{\"type\":\"pong\",\"n\":%lu}",
+             arg1 ? strtoul(arg1, NULL, 10) : 0UL);
+    client->text(reply);
+  }
+  else
+  {
+    wsCommandErrors.add();
+    client->text("{\"type\":\"error\",\"reason\":\"unknown or malformed command\"}");
+  }
+}
+
+/**
+ * @brief Give a newly connected client a session, subscribed to `temp`.
+ *
+ * The session of a client still closing is taken over: the server evicts one
+ * to make room for a new client before it is gone.
+ *
+ * @return false if all sessions are taken.
+ */
+bool openSession(AsyncWebSocketClient *client)
+{
+  /** Sessions are only written from the async_tcp task, so they can be looked through unlocked */
+  size_t slot = 0;
+  while (slot < DEFAULT_MAX_WS_CLIENTS && wsSessions[slot].used && ws.hasClient(wsSessions[slot].clientId))
+  {
+    slot++;
+  }
+  if (slot == DEFAULT_MAX_WS_CLIENTS)
+  {
+    return false;
+  }
+  portENTER_CRITICAL(&wsSessionMux);
+  WsSession &session = wsSessions[slot];
+  session.used = true;
+  session.clientId = client->id();
+  session.channels = WS_CHANNEL_TEMP;
+  session.intervalMs = 0;
+  session.lastPushMs = millis();
+  session.tokens = WS_COMMAND_BURST * 1000;
+  session.refillMs = millis();
+  portEXIT_CRITICAL(&wsSessionMux);
+  return true;
+}
+
+/** @brief Free the session of a disconnected client. */
+void closeSession(AsyncWebSocketClient *client)
+{
+  portENTER_CRITICAL(&wsSessionMux);
+  WsSession *session = findSession(client->id());
+  if (session)
+  {
+    session->used = false;
+  }
+  portEXIT_CRITICAL(&wsSessionMux);
+}
+
+/**
+ * @brief Send a new reading to all Server-Sent Events clients.
+ *
+ * @param sample Reading to send.
+ */
+void notifyEvents(const Sample &sample)
+{
+  char temperature[TEMPERATURE_STRING_SIZE];
+  formatTemperature(temperature, sample.raw);
+  events.send(temperature, "temperature", sample.readingID);
 }
 
 /**
@@ -261,14 +1724,24 @@ void onEvent(AsyncWebSocket *server, AsyncWebSocketClient *client, AwsEventType
              void *arg, uint8_t *data, size_t len) {
   switch (type) {
     case WS_EVT_CONNECT:
-      Serial.printf("WebSocket client #%u connected from %s\n", client->id(), client->remoteIP().toString().c_str());
+      LOG_INFO("WebSocket client #%u connected from %s", client->id(), client->remoteIP().toString().c_str());
+      if (!openSession(client))
+      {
+        client->close(1013, "Too many clients");
+        break;
+      }
+      {
+        /** The deadband may hold pushes back for a while, start from the latest reading */
+        char temperature[TEMPERATURE_STRING_SIZE];
+        formatLatestTemperature(temperature);
+        client->text(temperature);
+      }
       break;
     case WS_EVT_DISCONNECT:
-      Serial.printf("WebSocket client #%u disconnected\n", client->id());
+      LOG_INFO("WebSocket client #%u disconnected", client->id());
+      closeSession(client);
       break;
     case WS_EVT_DATA:
-      handleWebSocketMessage(arg, data, len);
-      break;
     case WS_EVT_PONG:
     case WS_EVT_ERROR:
       break;
@@ -280,54 +1753,164 @@ void onEvent(AsyncWebSocket *server, AsyncWebSocketClient *client, AwsEventType
  */
 void initWebSocket() {
   ws.onEvent(onEvent);
+  ws.onMessage(handleWebSocketMessage);
+  ws.setDeflate(WS_DEFLATE_WINDOW_BITS, WS_DEFLATE_THRESHOLD);
+  ws.setMaxClients(DEFAULT_MAX_WS_CLIENTS);
+  ws.setKeepAlive(WS_PING_INTERVAL_S, WS_PONG_TIMEOUT_S);
   server.addHandler(&ws);
 }
 
+/**
+ * @brief Initialize Server-Sent Events on /events.
+ */
+void initEventSource() {
+  /** As for websocket clients, start from the latest reading rather than wait for the next push */
+  events.onConnect([](AsyncEventSourceClient *client) {
+    char temperature[TEMPERATURE_STRING_SIZE];
+    uint32_t id = formatLatestTemperature(temperature);
+    client->send(temperature, "temperature", id);
+  });
+  server.addHandler(&events);
+}
+
+/**
+ * @brief Mount the SD card and open the sample log, recovering its tail.
+ *
+ * @return false if no usable card was found.
+ */
+bool initSDCard()
+{
+  SD.begin(SD_CS);
+  if (!SD.begin(SD_CS)){
+    LOG_ERROR("Card Mount Failed");
+    return false;
+  }
+  uint8_t cardType = SD.cardType();
+  if (cardType == CARD_NONE){
+    LOG_ERROR("No SD card attached");
+    return false;
+  }
+  LOG_INFO("Initializing SD card...");
+  if (!SD.begin(SD_CS)){
+    LOG_ERROR("ERROR - SD card initialization failed!");
+    return false; /**< init failed */
+  }
+
+  /** Cut off whatever a power cut left after the last complete record */
+  int64_t start = esp_timer_get_time();
+  sampleLogReady = sampleLog.begin(SD, SD_MOUNT_POINT, SAMPLE_LOG_DIR);
+  sdRecoveryMicros = esp_timer_get_time() - start;
+  if (!sampleLogReady)
+  {
+    LOG_ERROR("Failed to open %s", SAMPLE_LOG_DIR);
+    return false;
+  }
+  sampleLog.setRetention(SD_RETENTION_FILL, sdFill);
+  return true;
+}
+
 void setup()
 {
   /** Start serial communication for debugging purposes */
   Serial.begin(115200);
+  logBegin(Serial);
 
   /** Initialize SPIFFS */
   if(!SPIFFS.begin(true)){
-    Serial.println("An Error has occurred while mounting SPIFFS");
+    LOG_ERROR("An Error has occurred while mounting SPIFFS");
     return;
   }
 
   /** Connect to Wi-Fi network with SSID and password */
-  Serial.print("Connecting to ");
-  Serial.println(ssid);
+  LOG_INFO("Connecting to %s", ssid);
   WiFi.begin(ssid, password);
   while (WiFi.status() != WL_CONNECTED)
   {
     delay(500);
-    Serial.print(".");
   }
-  Serial.println("");
-  Serial.println("WiFi connected.");
+  LOG_INFO("WiFi connected.");
 
   /** Print ESP32 Local IP Address */
-  Serial.println(WiFi.localIP());
+  LOG_INFO("%s", WiFi.localIP().toString().c_str());
 
   /** Route for root / web page */
-  server.on("/", HTTP_GET, [](AsyncWebServerRequest *request){
+  server.on("/", HTTP_GET, instrumentRoute("/", [](AsyncWebServerRequest *request){
     request->send(SPIFFS, "/index.html", String(), false);
-  });
+  }));
   
   /** Route to load style.css file */
-  server.on("/style.css", HTTP_GET, [](AsyncWebServerRequest *request){
+  server.on("/style.css", HTTP_GET, instrumentRoute("/style.css", [](AsyncWebServerRequest *request){
     request->send(SPIFFS, "/style.css", "text/css");
-  });
+  }));
 
   /** Route to load script.js file */
-  server.on("/script.js", HTTP_GET, [](AsyncWebServerRequest *request){
+  server.on("/script.js", HTTP_GET, instrumentRoute("/script.js", [](AsyncWebServerRequest *request){
     request->send(SPIFFS, "/script.js");
-  });
+  }));
 
   /** Route to load favicon.png file -- gives the browser window an icon */
-  server.on("/favicon.ico", HTTP_GET, [](AsyncWebServerRequest *request){
+  server.on("/favicon.ico", HTTP_GET, instrumentRoute("/favicon.ico", [](AsyncWebServerRequest *request){
     request->send(SPIFFS, "/favicon.png");
-  });
+  }));
+
+  /** Route for the latest reading, see formatLatestReading() */
+  server.on("/latest", HTTP_GET, instrumentRoute("/latest", [](AsyncWebServerRequest *request){
+    char json[LATEST_READING_JSON_SIZE];
+    formatLatestReading(json);
+    request->send(200, "application/json", json);
+  }));
+
+  /** Route for task stack and CPU statistics */
+  server.on("/tasks", HTTP_GET, instrumentRoute("/tasks", [](AsyncWebServerRequest *request){
+    AsyncResponseStream *response = request->beginResponseStream("application/json");
+    printTaskStats(*response);
+    request->send(response);
+  }));
+
+  /** Route for sampling jitter statistics, ?reset=1 starts a new measurement */
+  server.on("/jitter", HTTP_GET, instrumentRoute("/jitter", [](AsyncWebServerRequest *request){
+    AsyncResponseStream *response = request->beginResponseStream("application/json");
+    printJitterStats(*response);
+    request->send(response);
+    if (request->hasParam("reset"))
+    {
+      jitterResetRequested = true;
+    }
+  }));
+
+  /** Route to download samples as CSV, ?from= and ?to= select an epoch range */
+  server.on("/history", HTTP_GET, instrumentRoute("/history", sendHistory));
+  server.on("/data.csv", HTTP_GET, instrumentRoute("/data.csv", sendHistory));
+
+  /** Route for the sample log manifest */
+  server.on("/segments", HTTP_GET, instrumentRoute("/segments", [](AsyncWebServerRequest *request){
+    AsyncResponseStream *response = request->beginResponseStream("application/json");
+    printSegments(*response);
+    request->send(response);
+  }));
+
+  /** Route for the sensor resolution and sampling policy, POST to change them */
+  server.on("/config", HTTP_GET | HTTP_POST, instrumentRoute("/config", handleSamplerConfig));
+
+  /** Route for the deadbands of the live channels, POST to change them */
+  server.on("/publish", HTTP_GET | HTTP_POST, instrumentRoute("/publish", handlePublishConfig));
+
+  /** Route for Prometheus metrics */
+  server.on("/metrics", HTTP_GET, instrumentRoute("/metrics", [](AsyncWebServerRequest *request){
+    AsyncResponseStream *response = request->beginResponseStream("text/plain; version=0.0.4");
+    printMetrics(*response);
+    request->send(response);
+  }));
+
+  /** Route for firmware updates, progress on /update/identity and the `ota` channel */
+#ifdef OTA_USERNAME
+  static_assert(sizeof(OTA_USERNAME) > 1 && sizeof(OTA_PASSWORD) > 1,
+                "OTA_USERNAME and OTA_PASSWORD must not be empty");
+  AsyncElegantOTA.onProgress(notifyOtaProgress);
+  AsyncElegantOTA.begin(&server, OTA_USERNAME, OTA_PASSWORD);
+#else
+  LOG_INFO("Firmware updates disabled, OTA_USERNAME and OTA_PASSWORD not defined");
+#endif
 
   /** Start server */
   server.begin();
@@ -336,48 +1919,45 @@ void setup()
   timeClient.begin();
   timeClient.setTimeOffset(7200); /**< GMT +1 (+summertime) = 7200 */
 
-  /** Initialize SD card */
-  SD.begin(SD_CS);
-  if (!SD.begin(SD_CS)){
-    Serial.println("Card Mount Failed");
-    return;
-  }
-  uint8_t cardType = SD.cardType();
-  if (cardType == CARD_NONE){
-    Serial.println("No SD card attached");
-    return;
-  }
-  Serial.println("Initializing SD card...");
-  if (!SD.begin(SD_CS)){
-    Serial.println("ERROR - SD card initialization failed!");
-    return; /**< init failed */
+  /** Get the first sync before any reading is timestamped */
+  while (!syncTime())
+  {
+    LOG_WARN("NTP sync failed, retrying");
   }
 
-  /** If the data.txt file doesn't exist
-   * Create a file on the SD card and write the data labels */
-  File file = SD.open("/data.txt");
-  if (!file){
-    Serial.println("File doesn't exist");
-    Serial.println("Creating file...");
-    writeFile(SD, "/data.txt", "Reading ID, Date, Hour, Temperature \r\n");
-  } else{
-    Serial.println("File already exists");
-  }
-  file.close();
+  /** Initialize SD card, keep sampling to the web clients without one */
+  initSDCard();
 
   /** Start the DallasTemperature library */
   sensors.begin();
+  if (!sensors.getAddress(sensorAddress, 0))
+  {
+    LOG_WARN("No DS18B20 found, readings will be invalid");
+  }
+  for (uint8_t i = 0; i < sizeof(DeviceAddress); i++)
+  {
+    sensorId = sensorId << 8 | sensorAddress[i];
+  }
+  loadSamplerConfig();
+  loadPublishConfig();
 
   initWebSocket();
+  initEventSource();
 
   /** Increment readingID on every new reading */
   readingID++;
+
+  /** Start the sensing, storage and network tasks */
+  startTasks();
 }
 
 void loop()
 {
-  getReadings();
-  delay(10000); /**< Update every 10 seconds */
-  // delay(1000 * 60); /**< Update every minute */
-  // delay(1000 * 60 * 60); /**< Update every hour */
+  /** All work happens in the application tasks, only report on them here */
+  if (logEnabled(LOG_LEVEL_INFO))
+  {
+    printTaskStats(Serial);
+    printJitterStats(Serial);
+  }
+  delay(60000);
 }
\ No newline at end of file